@@ -0,0 +1,612 @@
+/* Benchmarks of parsing, printing and lookups over generated corpora
+ *
+ *   ./bench [-s scale] [-t seconds] [-n] [corpus ...]
+ *
+ * The corpora are made by a seeded generator, so every run and every
+ * version sees the same bytes. They are shaped after the usual JSON
+ * benchmark files: a twitter like feed, canada like arrays of
+ * coordinates, citm like wide objects, deep nesting, long strings and
+ * NDJSON logs. Each result is printed as a JSON object on a line of its
+ * own, e.g.
+ *
+ *   {"corpus":"twitter","op":"parse","bytes":378384,"docs":1,
+ *    "iterations":14,"ns_per_op":14572539,"mb_per_s":25.97,
+ *    "allocs_per_op":65861.00}
+ *
+ * an op is a pass over all documents of the corpus, or a single lookup
+ * for "lookup". "memory" reports what the parsed corpus takes in its
+ * state, as counted by state::stats.
+ *
+ * On Linux the cycles, instructions, branch misses, L1 data and last
+ * level cache misses and page faults of each op are counted as well,
+ * and reported per op, per byte and per node, the nodes being the
+ * objects the parsed corpus is made of. -n leaves the counters out.
+ */
+#include "json.hpp"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace cee;
+
+/*
+ * xorshift64*, the corpora only depend on the seed
+ */
+static uint64_t rnd_state;
+
+static void rnd_seed (uint64_t seed)
+{
+  rnd_state = seed ? seed : 1;
+}
+
+static uint64_t rnd (void)
+{
+  rnd_state ^= rnd_state >> 12;
+  rnd_state ^= rnd_state << 25;
+  rnd_state ^= rnd_state >> 27;
+  return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t rnd_below (uint64_t n)
+{
+  return rnd() % n;
+}
+
+static double rnd_double (double lo, double hi)
+{
+  return lo + (hi - lo) * (double)(rnd() >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * a growing text
+ */
+struct text {
+  char * buf;
+  size_t size;
+  size_t capacity;
+};
+
+static void put (struct text * t, const char * fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(t->buf + t->size, t->capacity - t->size, fmt, ap);
+  va_end(ap);
+  if (t->size + n >= t->capacity) {
+    t->capacity = (t->size + n + 1) * 2;
+    t->buf = (char *)realloc(t->buf, t->capacity);
+    va_start(ap, fmt);
+    vsnprintf(t->buf + t->size, t->capacity - t->size, fmt, ap);
+    va_end(ap);
+  }
+  t->size += n;
+}
+
+static const char * words[] = {
+  "the", "json", "parser", "state", "value", "quick", "brown", "fox",
+  "jumps", "over", "lazy", "dog", "caf\xc3\xa9", "na\xc3\xafve",
+  "\xe6\x97\xa5\xe6\x9c\xac", "\xd0\xbc\xd0\xb8\xd1\x80", "tab\\there",
+  "quote\\\"d", "line\\nbreak", "\\u00e9t\\u00e9", "\xf0\x9f\x98\x80",
+  "release", "memory", "cache"
+};
+
+static void put_words (struct text * t, uintptr_t n)
+{
+  uintptr_t i;
+  for (i = 0; i < n; i++)
+    put(t, "%s%s", i ? " " : "",
+        words[rnd_below(sizeof(words) / sizeof(words[0]))]);
+}
+
+static void put_string (struct text * t, uintptr_t n_words)
+{
+  put(t, "\"");
+  put_words(t, n_words);
+  put(t, "\"");
+}
+
+/*
+ * the corpora, scale 1 makes each of them 0.4 to 1 MB
+ */
+static void gen_twitter (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, j, n = 400 * scale;
+  put(t, "{\"statuses\":[");
+  for (i = 0; i < n; i++) {
+    uint64_t id = 505874924095815681ULL + i * 7919;
+    put(t, "%s{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"ja\"},",
+        i ? "," : "");
+    put(t, "\"created_at\":\"Sun Aug 31 00:29:%02u +0000 2014\",", (unsigned)(i % 60));
+    put(t, "\"id\":%llu,\"id_str\":\"%llu\",\"text\":",
+        (unsigned long long)id, (unsigned long long)id);
+    put_string(t, 8 + rnd_below(16));
+    put(t, ",\"truncated\":false,\"in_reply_to_status_id\":null,");
+    put(t, "\"user\":{\"id\":%llu,\"name\":", (unsigned long long)rnd_below(3000000000ULL));
+    put_string(t, 2);
+    put(t, ",\"screen_name\":\"user_%u\",\"location\":", (unsigned)i);
+    put_string(t, 1 + rnd_below(3));
+    put(t, ",\"description\":");
+    put_string(t, rnd_below(20));
+    put(t, ",\"protected\":false,\"followers_count\":%u,\"friends_count\":%u,"
+        "\"verified\":%s,\"profile_background_color\":\"C0DEED\","
+        "\"profile_image_url\":\"http://pbs.twimg.com/profile_images/%u/normal.jpeg\"},",
+        (unsigned)rnd_below(100000), (unsigned)rnd_below(5000),
+        rnd_below(10) ? "false" : "true", (unsigned)rnd_below(1000000000));
+    put(t, "\"geo\":null,\"coordinates\":null,\"place\":null,");
+    put(t, "\"retweet_count\":%u,\"favorite_count\":%u,\"entities\":{\"hashtags\":[",
+        (unsigned)rnd_below(1000), (unsigned)rnd_below(1000));
+    for (j = rnd_below(4); j > 0; j--)
+      put(t, "{\"text\":\"tag%u\",\"indices\":[%u,%u]}%s", (unsigned)rnd_below(100),
+          (unsigned)j * 10, (unsigned)j * 10 + 6, j > 1 ? "," : "");
+    put(t, "],\"symbols\":[],\"urls\":[],\"user_mentions\":[]},");
+    put(t, "\"favorited\":false,\"retweeted\":false,\"lang\":\"ja\"}");
+  }
+  put(t, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,"
+      "\"count\":%u}}", (unsigned)n);
+}
+
+static void gen_canada (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, j, n = 24 * scale;
+  put(t, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\","
+      "\"properties\":{\"name\":\"Canada\"},\"geometry\":{\"type\":\"Polygon\","
+      "\"coordinates\":[");
+  for (i = 0; i < n; i++) {
+    put(t, "%s[", i ? "," : "");
+    for (j = 0; j < 1000; j++)
+      put(t, "%s[%.15g,%.15g]", j ? "," : "",
+          rnd_double(-141.0, -52.6), rnd_double(41.6, 83.1));
+    put(t, "]");
+  }
+  put(t, "]}}]}");
+}
+
+static void gen_citm (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, j, n = 2000 * scale;
+  put(t, "{\"areaNames\":{");
+  for (i = 0; i < 200; i++)
+    put(t, "%s\"%u\":\"area %u\"", i ? "," : "", (unsigned)(205705993 + i), (unsigned)i);
+  put(t, "},\"events\":{");
+  for (i = 0; i < n; i++) {
+    unsigned id = 138586341 + i;
+    put(t, "%s\"%u\":{\"description\":null,\"id\":%u,\"logo\":\"/images/UE0AAAAACEKo%uQAAAAVDSVRN\","
+        "\"name\":", i ? "," : "", id, id, (unsigned)i);
+    put_string(t, 3);
+    put(t, ",\"subTopicIds\":[");
+    for (j = 0; j < 4; j++)
+      put(t, "%s%u", j ? "," : "", (unsigned)(337184262 + rnd_below(100)));
+    put(t, "],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[%u,%u]}",
+        (unsigned)(324846099 + rnd_below(10)), (unsigned)(107888604 + rnd_below(10)));
+  }
+  put(t, "},\"seatCategoryNames\":{");
+  for (i = 0; i < 500; i++)
+    put(t, "%s\"%u\":\"category %u\"", i ? "," : "", (unsigned)(338937235 + i), (unsigned)i);
+  put(t, "}}");
+}
+
+static void gen_deep (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, j, n = 600 * scale, depth = 400;
+  put(t, "[");
+  for (i = 0; i < n; i++) {
+    put(t, "%s", i ? "," : "");
+    for (j = 0; j < depth; j++)
+      put(t, j % 2 ? "{\"a\":" : "[");
+    put(t, "%u", (unsigned)i);
+    for (j = depth; j-- > 0; )
+      put(t, j % 2 ? "}" : "]");
+  }
+  put(t, "]");
+}
+
+static void gen_strings (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, n = 32 * scale;
+  put(t, "[");
+  for (i = 0; i < n; i++) {
+    put(t, "%s", i ? "," : "");
+    put_string(t, 4000);
+  }
+  put(t, "]");
+}
+
+static const char * methods[] = { "GET", "GET", "GET", "POST", "PUT", "DELETE" };
+
+static void gen_ndjson (struct text * t, uintptr_t scale)
+{
+  uintptr_t i, n = 4000 * scale;
+  for (i = 0; i < n; i++) {
+    put(t, "{\"ts\":\"2024-01-%02uT%02u:%02u:%02u.%03uZ\",\"level\":\"%s\",",
+        (unsigned)(1 + i / 86400 % 28), (unsigned)(i / 3600 % 24),
+        (unsigned)(i / 60 % 60), (unsigned)(i % 60), (unsigned)rnd_below(1000),
+        rnd_below(20) ? "info" : "error");
+    put(t, "\"request\":{\"method\":\"%s\",\"path\":\"/api/v1/items/%u\",\"status\":%u,"
+        "\"latency_ms\":%.3f},\"msg\":", methods[rnd_below(6)],
+        (unsigned)rnd_below(100000), rnd_below(50) ? 200 : 500, rnd_double(0.1, 250.0));
+    put_string(t, 4 + rnd_below(8));
+    put(t, ",\"tags\":[\"web\",\"shard-%u\"]}\n", (unsigned)rnd_below(16));
+  }
+}
+
+struct corpus {
+  const char * name;
+  void (*gen)(struct text *, uintptr_t scale);
+  bool ndjson;          // one document per line
+  char * pointers[4];   // looked up in every document
+};
+
+static struct corpus corpora[] = {
+  { "twitter", gen_twitter, false,
+    { "/statuses/57/user/screen_name", "/statuses/0/id",
+      "/statuses/199/entities/hashtags", "/search_metadata/count" } },
+  { "canada", gen_canada, false,
+    { "/features/0/geometry/coordinates/3/999/1", "/features/0/type",
+      "/features/0/properties/name", "/features/0/geometry/coordinates/0/0/0" } },
+  { "citm", gen_citm, false,
+    { "/events/138586341/name", "/events/138587341/topicIds/1",
+      "/areaNames/205705999", "/seatCategoryNames/338937400" } },
+  { "deep", gen_deep, false,
+    { "/0/0/a/0/a/0/a/0/a/0/a/0/a/0/a/0/a/0/a/0/a", "/599",
+      "/300/0/a/0/a", "/1/0" } },
+  { "strings", gen_strings, false,
+    { "/0", "/7", "/31", "/16" } },
+  { "ndjson", gen_ndjson, true,
+    { "/request/path", "/level", "/tags/1", "/request/latency_ms" } },
+};
+
+/*
+ * the documents of a corpus, NDJSON is split at its newlines
+ */
+struct docs {
+  struct text text;
+  uintptr_t n;
+  char ** buf;
+  uintptr_t * len;
+};
+
+static void split (struct docs * d, bool ndjson)
+{
+  char * p = d->text.buf, * end = d->text.buf + d->text.size, * nl;
+  uintptr_t capacity = 16;
+  d->n = 0;
+  d->buf = (char **)malloc(capacity * sizeof(char *));
+  d->len = (uintptr_t *)malloc(capacity * sizeof(uintptr_t));
+  while (p < end) {
+    nl = ndjson ? (char *)memchr(p, '\n', end - p) : NULL;
+    if (nl == NULL)
+      nl = end;
+    if (d->n == capacity) {
+      capacity *= 2;
+      d->buf = (char **)realloc(d->buf, capacity * sizeof(char *));
+      d->len = (uintptr_t *)realloc(d->len, capacity * sizeof(uintptr_t));
+    }
+    d->buf[d->n] = p;
+    d->len[d->n] = nl - p;
+    d->n++;
+    p = nl + 1;
+  }
+}
+
+static double now (void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * hardware and software counters read around the measured regions with
+ * perf_event_open. The counters the kernel refuses, e.g. for
+ * perf_event_paranoid or in a VM without a PMU, are left out of the
+ * results.
+ */
+enum event {
+  ev_cycles = 0,
+  ev_instructions,
+  ev_branch_misses,
+  ev_l1d_misses,
+  ev_llc_misses,
+  ev_page_faults,
+  n_events
+};
+
+static const char * event_names[n_events] = {
+  "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses",
+  "page_faults"
+};
+
+static int event_fds[n_events];
+static bool use_events = true;
+
+#ifdef __linux__
+static int open_event (uint32_t type, uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = type == PERF_TYPE_SOFTWARE ? 0 : 1;
+  attr.exclude_hv = 1;
+  // the kernel time shares counters when there are more events than counters
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void open_events (void)
+{
+  int i;
+  for (i = 0; i < n_events; i++)
+    event_fds[i] = -1;
+#ifdef __linux__
+  if (!use_events)
+    return;
+  event_fds[ev_cycles] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  event_fds[ev_instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  event_fds[ev_branch_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  event_fds[ev_l1d_misses] = open_event(PERF_TYPE_HW_CACHE,
+                                        PERF_COUNT_HW_CACHE_L1D
+                                        | PERF_COUNT_HW_CACHE_OP_READ << 8
+                                        | PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  event_fds[ev_llc_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  event_fds[ev_page_faults] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+  for (i = 0; i < n_events; i++)
+    if (event_fds[i] < 0)
+      fprintf(stderr, "bench: %s cannot be counted: %s\n", event_names[i],
+              strerror(errno));
+#endif
+}
+
+/*
+ * what the passes over a measured region took
+ */
+struct measure {
+  uintptr_t iterations;
+  double seconds;
+  uintptr_t n_allocs;
+  double counts[n_events];
+  double started;
+};
+
+static void start (struct measure * m)
+{
+#ifdef __linux__
+  int i;
+  for (i = 0; i < n_events; i++)
+    if (event_fds[i] >= 0) {
+      ioctl(event_fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(event_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  m->started = now();
+}
+
+static void stop (struct measure * m)
+{
+  m->seconds += now() - m->started;
+#ifdef __linux__
+  int i;
+  for (i = 0; i < n_events; i++)
+    if (event_fds[i] >= 0) {
+      uint64_t v[3];   // value, time enabled, time running
+      ioctl(event_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(event_fds[i], v, sizeof(v)) == sizeof(v) && v[2])
+        m->counts[i] += (double)v[0] * v[1] / v[2];
+    }
+#endif
+}
+
+static uintptr_t allocs (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_allocs;
+}
+
+static double min_seconds = 0.5;
+
+/*
+ * an op is a pass over the corpus, bytes and nodes are what a pass
+ * goes through, 0 if that does not apply to the op
+ */
+static void report (const char * corpus, const char * op, uintptr_t bytes,
+                    uintptr_t n_docs, uintptr_t n_nodes, struct measure * m)
+{
+  double ns = m->seconds * 1e9 / m->iterations;
+  int i;
+  printf("{\"corpus\":\"%s\",\"op\":\"%s\",\"bytes\":%lu,\"docs\":%lu,"
+         "\"nodes\":%lu,\"iterations\":%lu,\"ns_per_op\":%.0f,\"mb_per_s\":%.2f,"
+         "\"allocs_per_op\":%.2f", corpus, op, (unsigned long)bytes,
+         (unsigned long)n_docs, (unsigned long)n_nodes,
+         (unsigned long)m->iterations, ns,
+         bytes ? bytes / (ns * 1e-9) / 1e6 : 0.0,
+         (double)m->n_allocs / m->iterations);
+  for (i = 0; i < n_events; i++) {
+    double per_op = m->counts[i] / m->iterations;
+    if (event_fds[i] < 0)
+      continue;
+    printf(",\"%s_per_op\":%.2f", event_names[i], per_op);
+    if (bytes)
+      printf(",\"%s_per_byte\":%.6g", event_names[i], per_op / bytes);
+    if (n_nodes)
+      printf(",\"%s_per_node\":%.6g", event_names[i], per_op / n_nodes);
+  }
+  if (event_fds[ev_cycles] >= 0 && event_fds[ev_instructions] >= 0
+      && m->counts[ev_cycles] > 0)
+    printf(",\"ipc\":%.3f", m->counts[ev_instructions] / m->counts[ev_cycles]);
+  printf("}\n");
+  fflush(stdout);
+}
+
+static json::data ** parse_all (state::data * st, struct docs * d)
+{
+  json::data ** out = (json::data **)malloc(d->n * sizeof(json::data *));
+  uintptr_t i;
+  int line;
+  for (i = 0; i < d->n; i++)
+    if (!json::parse(st, d->buf[i], d->len[i], out + i, true, &line)) {
+      fprintf(stderr, "bench: document %lu does not parse at line %d\n",
+              (unsigned long)i, line);
+      exit(1);
+    }
+  return out;
+}
+
+static void bench_parse (struct corpus * c, struct docs * d, uintptr_t n_nodes)
+{
+  struct measure m;
+  memset(&m, 0, sizeof(m));
+  /*
+   * each pass gets a fresh state, freeing it is not measured
+   */
+  while (m.seconds < min_seconds || m.iterations < 3) {
+    state::data * st = state::mk(10);
+    uintptr_t a = allocs(st);
+    start(&m);
+    json::data ** out = parse_all(st, d);
+    stop(&m);
+    m.n_allocs += allocs(st) - a;
+    m.iterations++;
+    free(out);
+    del(st);
+  }
+  report(c->name, "parse", d->text.size, d->n, n_nodes, &m);
+}
+
+static void bench_print (struct corpus * c, struct docs * d, state::data * st,
+                         json::data ** docs, uintptr_t n_nodes,
+                         enum json::format how)
+{
+  uintptr_t i, bytes = 0, capacity = 0, a;
+  struct measure m;
+  char * buf;
+  memset(&m, 0, sizeof(m));
+  for (i = 0; i < d->n; i++) {
+    size_t n = json::snprint(st, NULL, 0, docs[i], how);
+    bytes += n;
+    if (n + 1 > capacity)
+      capacity = n + 1;
+  }
+  buf = (char *)malloc(capacity);
+  a = allocs(st);
+  do {
+    start(&m);
+    for (i = 0; i < d->n; i++)
+      json::snprint(st, buf, capacity, docs[i], how);
+    stop(&m);
+    m.iterations++;
+  } while (m.seconds < min_seconds || m.iterations < 3);
+  m.n_allocs = allocs(st) - a;
+  report(c->name, how == json::compact ? "print_compact" : "print_readable",
+         bytes, d->n, n_nodes, &m);
+  free(buf);
+}
+
+static void bench_lookup (struct corpus * c, struct docs * d, state::data * st,
+                          json::data ** docs)
+{
+  uintptr_t i, j, a;
+  struct measure m;
+  memset(&m, 0, sizeof(m));
+  for (j = 0; j < 4; j++)
+    for (i = 0; i < d->n; i++)
+      if (json::find(st, docs[i], c->pointers[j]) == NULL) {
+        fprintf(stderr, "bench: %s does not resolve in %s\n",
+                c->pointers[j], c->name);
+        exit(1);
+      }
+  a = allocs(st);
+  do {
+    start(&m);
+    for (j = 0; j < 4; j++)
+      for (i = 0; i < d->n; i++)
+        json::find(st, docs[i], c->pointers[j]);
+    stop(&m);
+    m.iterations += 4 * d->n;
+  } while (m.seconds < min_seconds);
+  m.n_allocs = allocs(st) - a;
+  report(c->name, "lookup", 0, d->n, 0, &m);
+}
+
+static void bench_corpus (struct corpus * c, uintptr_t scale)
+{
+  struct docs d;
+  struct state::stats before, after;
+  uintptr_t n_nodes;
+  memset(&d, 0, sizeof(d));
+  rnd_seed(0x6a736f6e);
+  c->gen(&d.text, scale);
+  split(&d, c->ndjson);
+
+  // the nodes of the corpus are the objects its documents are made of
+  state::data * st = state::mk(10);
+  state::stats(st, &before);
+  json::data ** docs = parse_all(st, &d);
+  state::stats(st, &after);
+  n_nodes = after.n_live - before.n_live;
+  printf("{\"corpus\":\"%s\",\"op\":\"memory\",\"bytes\":%lu,\"docs\":%lu,"
+         "\"live_bytes\":%lu,\"objects\":%lu,\"bytes_per_doc\":%.0f,"
+         "\"expansion\":%.2f}\n", c->name, (unsigned long)d.text.size,
+         (unsigned long)d.n, (unsigned long)(after.live_bytes - before.live_bytes),
+         (unsigned long)n_nodes,
+         (double)(after.live_bytes - before.live_bytes) / d.n,
+         (double)(after.live_bytes - before.live_bytes) / d.text.size);
+
+  bench_parse(c, &d, n_nodes);
+  bench_print(c, &d, st, docs, n_nodes, json::compact);
+  bench_print(c, &d, st, docs, n_nodes, json::readable);
+  bench_lookup(c, &d, st, docs);
+
+  free(docs);
+  del(st);
+  free(d.buf);
+  free(d.len);
+  free(d.text.buf);
+}
+
+int main (int argc, char ** argv)
+{
+  uintptr_t scale = 1, i;
+  int opt, k;
+  while ((opt = getopt(argc, argv, "s:t:n")) != -1) {
+    switch (opt) {
+      case 's':
+        scale = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        min_seconds = strtod(optarg, NULL);
+        break;
+      case 'n':
+        use_events = false;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s scale] [-t seconds] [-n] [corpus ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (scale == 0)
+    scale = 1;
+  open_events();
+  for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+    bool selected = optind == argc;
+    for (k = optind; k < argc; k++)
+      if (strcmp(argv[k], corpora[i].name) == 0)
+        selected = true;
+    if (selected)
+      bench_corpus(corpora + i, scale);
+  }
+  return 0;
+}
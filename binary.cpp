@@ -0,0 +1,462 @@
+/* A random access binary document format
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "buffer.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace binary {
+
+/*
+ * A document is a header followed by records, all of them start at a
+ * multiple of 8 and every number is stored little endian.
+ *
+ *   header:  "CEEJSONB" | root slot
+ *   string:  length | bytes | '\0' | padding
+ *   array:   count | count slots
+ *   object:  count | count offsets of key strings | count slots
+ *
+ * The keys of an object are sorted by strcmp. A slot is 8 bytes, its low
+ * 3 bits are the kind, the rest is an inline value or, as records are
+ * aligned, the slot with the kind bits cleared is the offset of a record.
+ */
+enum kind {
+  kind_simple = 0,    // null, false, true and undefined
+  kind_int,           // a signed 61 bit integer held in the slot
+  kind_double,        // offset of 8 bytes
+  kind_i64,           // offset of 8 bytes
+  kind_u64,           // offset of 8 bytes
+  kind_string,
+  kind_array,
+  kind_object
+};
+
+enum simple {
+  simple_null = 0,
+  simple_false,
+  simple_true,
+  simple_undefined
+};
+
+static const char magic[8] = { 'C', 'E', 'E', 'J', 'S', 'O', 'N', 'B' };
+
+#define HEADER_SIZE 16
+#define INLINE_MAX  (((int64_t)1 << 60) - 1)
+#define INLINE_MIN  (-((int64_t)1 << 60))
+
+static uint64_t load(char * p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static void store(char * p, uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  memcpy(p, &v, 8);
+}
+
+/*
+ * reserve an aligned record of n bytes and return its offset
+ */
+static uint64_t reserve(struct buffer * b, uintptr_t n)
+{
+  uint64_t offset = b->size;
+  memset(buffer_reserve(b, (n + 7) & ~(uintptr_t)7), 0, (n + 7) & ~(uintptr_t)7);
+  return offset;
+}
+
+static uint64_t encode_word(struct buffer * b, enum kind k, uint64_t v)
+{
+  uint64_t offset = reserve(b, 8);
+  store(b->_ + offset, v);
+  return offset | k;
+}
+
+static uint64_t encode_int(struct buffer * b, int64_t v)
+{
+  if (INLINE_MIN <= v && v <= INLINE_MAX)
+    return ((uint64_t)v << 3) | kind_int;
+  return encode_word(b, kind_i64, v);
+}
+
+static uint64_t encode_number(struct buffer * b, boxed::data * x)
+{
+  double d;
+  uint64_t u64;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+    case boxed::primitive_f32:
+      d = boxed::type(x) == boxed::primitive_f64 ? x->_.f64 : x->_.f32;
+      memcpy(&u64, &d, 8);
+      return encode_word(b, kind_double, u64);
+    case boxed::primitive_u64:
+      if (x->_.u64 > (uint64_t)INLINE_MAX)
+        return encode_word(b, kind_u64, x->_.u64);
+      return encode_int(b, x->_.u64);
+    case boxed::primitive_u32: return encode_int(b, x->_.u32);
+    case boxed::primitive_u16: return encode_int(b, x->_.u16);
+    case boxed::primitive_u8:  return encode_int(b, x->_.u8);
+    case boxed::primitive_i64: return encode_int(b, x->_.i64);
+    case boxed::primitive_i32: return encode_int(b, x->_.i32);
+    case boxed::primitive_i16: return encode_int(b, x->_.i16);
+    case boxed::primitive_i8:  return encode_int(b, x->_.i8);
+  }
+  return kind_simple | (simple_undefined << 3);
+}
+
+static uint64_t encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  uint64_t offset = reserve(b, 8 + n + 1);
+  store(b->_ + offset, n);
+  memcpy(b->_ + offset + 8, s, n);
+  return offset | kind_string;
+}
+
+static uint64_t encode(struct buffer * b, json::data * j);
+
+/*
+ * the state of writing the members of an object
+ */
+struct members {
+  struct buffer * b;
+  uint64_t offset;
+  uint64_t count;
+  uint64_t i;
+};
+
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  uint64_t k = encode_string(m->b, (char *)key);
+  uint64_t v = encode(m->b, (json::data *)value);
+  store(m->b->_ + m->offset + 8 + 8 * m->i, k & ~(uint64_t)7);
+  store(m->b->_ + m->offset + 8 + 8 * (m->count + m->i), v);
+  m->i++;
+}
+
+static uint64_t encode(struct buffer * b, json::data * j)
+{
+  uint64_t i, n, offset;
+  switch (j->t) {
+    case type_is_null:
+      return kind_simple | (simple_null << 3);
+    case type_is_boolean:
+      return kind_simple | ((to_bool(j) ? simple_true : simple_false) << 3);
+    case type_is_number:
+      return encode_number(b, j->value.number);
+    case type_is_string:
+      return encode_string(b, (char *)j->value.string);
+    case type_is_array:
+      /*
+       * the record is reserved first and its slots are filled in as the
+       * elements are written after it, the buffer may move meanwhile
+       */
+      n = list::size(j->value.array);
+      offset = reserve(b, 8 + 8 * n);
+      store(b->_ + offset, n);
+      for (i = 0; i < n; i++) {
+        uint64_t v = encode(b, (json::data *)j->value.array->_[i]);
+        store(b->_ + offset + 8 + 8 * i, v);
+      }
+      return offset | kind_array;
+    case type_is_object:
+      {
+        struct members m;
+        m.b = b;
+        m.count = map::size(j->value.object);
+        m.offset = reserve(b, 8 + 16 * m.count);
+        m.i = 0;
+        store(b->_ + m.offset, m.count);
+        map::walk(j->value.object, &m, encode_member);
+        return m.offset | kind_object;
+      }
+    default:
+      return kind_simple | (simple_undefined << 3);
+  }
+}
+
+/*
+ * a record of n bytes at offset lies inside the document
+ */
+static bool inside(struct value v, uint64_t offset, uint64_t n)
+{
+  return offset <= v.len && n <= v.len - offset;
+}
+
+static uint64_t count(struct value v)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7;
+  if (!inside(v, offset, 8))
+    return 0;
+  uint64_t n = load(v.base + offset);
+  uint64_t per = (v.slot & 7) == kind_object ? 16 : 8;
+  if (n > v.len / per || !inside(v, offset + 8, n * per))
+    return 0;
+  return n;
+}
+
+static struct value child(struct value v, uint64_t offset)
+{
+  struct value c = { v.base, v.len, load(v.base + offset) };
+  return c;
+}
+
+bool open(char * buf, uintptr_t len, struct value * root)
+{
+  if (len < HEADER_SIZE || memcmp(buf, magic, 8))
+    return false;
+  root->base = buf;
+  root->len = len;
+  root->slot = load(buf + 8);
+  return true;
+}
+
+enum type type_of(struct value v)
+{
+  switch (v.slot & 7) {
+    case kind_simple:
+      switch (v.slot >> 3) {
+        case simple_null:
+          return type_is_null;
+        case simple_false:
+        case simple_true:
+          return type_is_boolean;
+        default:
+          return type_is_undefined;
+      }
+    case kind_int:
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      return type_is_number;
+    case kind_string:
+      return type_is_string;
+    case kind_array:
+      return type_is_array;
+    default:
+      return type_is_object;
+  }
+}
+
+bool get_bool(struct value v, bool * b)
+{
+  if ((v.slot & 7) != kind_simple
+      || ((v.slot >> 3) != simple_false && (v.slot >> 3) != simple_true))
+    return false;
+  *b = (v.slot >> 3) == simple_true;
+  return true;
+}
+
+bool get_number(struct value v, double * d)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7, u64;
+  switch (v.slot & 7) {
+    case kind_int:
+      *d = (double)((int64_t)v.slot >> 3);
+      return true;
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      if (!inside(v, offset, 8))
+        return false;
+      u64 = load(v.base + offset);
+      if ((v.slot & 7) == kind_double)
+        memcpy(d, &u64, 8);
+      else if ((v.slot & 7) == kind_i64)
+        *d = (double)(int64_t)u64;
+      else
+        *d = (double)u64;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool get_string(struct value v, char ** s, uintptr_t * len)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7;
+  if ((v.slot & 7) != kind_string || !inside(v, offset, 8))
+    return false;
+  uint64_t n = load(v.base + offset);
+  if (n >= v.len || !inside(v, offset + 8, n + 1) || v.base[offset + 8 + n] != '\0')
+    return false;
+  *s = v.base + offset + 8;
+  if (len)
+    *len = n;
+  return true;
+}
+
+uintptr_t size(struct value v)
+{
+  if ((v.slot & 7) != kind_array && (v.slot & 7) != kind_object)
+    return 0;
+  return count(v);
+}
+
+bool at(struct value array, uintptr_t i, struct value * out)
+{
+  if ((array.slot & 7) != kind_array || i >= count(array))
+    return false;
+  *out = child(array, (array.slot & ~(uint64_t)7) + 8 + 8 * i);
+  return true;
+}
+
+bool member(struct value object, uintptr_t i, char ** key, struct value * out)
+{
+  uint64_t n, offset = object.slot & ~(uint64_t)7;
+  if ((object.slot & 7) != kind_object || i >= (n = count(object)))
+    return false;
+  struct value k = child(object, offset + 8 + 8 * i);
+  k.slot |= kind_string;
+  if (!get_string(k, key, NULL))
+    return false;
+  *out = child(object, offset + 8 + 8 * (n + i));
+  return true;
+}
+
+bool find(struct value object, char * key, struct value * out)
+{
+  uint64_t n, offset = object.slot & ~(uint64_t)7;
+  if ((object.slot & 7) != kind_object)
+    return false;
+  n = count(object);
+  uint64_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    char * k;
+    struct value kv = child(object, offset + 8 + 8 * mid);
+    kv.slot |= kind_string;
+    if (!get_string(kv, &k, NULL))
+      return false;
+    int c = strcmp(key, k);
+    if (c == 0) {
+      *out = child(object, offset + 8 + 8 * (n + mid));
+      return true;
+    }
+    if (c < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return false;
+}
+
+static json::data * mk_boxed(state::data * st, boxed::data * x)
+{
+  return (json::data *)tagged::mk(st, type_is_number, x);
+}
+
+static bool materialize(state::data * st, struct value v, json::data ** out,
+                        int depth)
+{
+  uint64_t i, n, u64;
+  char * s;
+  bool b;
+  json::data * j, * c;
+  if (depth > MAX_JSON_DEPTH)
+    return false;
+  switch (v.slot & 7) {
+    case kind_simple:
+      switch (v.slot >> 3) {
+        case simple_null:
+          *out = mk_null(st);
+          return true;
+        case simple_undefined:
+          *out = mk_undefined(st);
+          return true;
+        default:
+          get_bool(v, &b);
+          *out = mk_bool(st, b);
+          return true;
+      }
+    case kind_int:
+      *out = mk_boxed(st, boxed::from_i64(st, (int64_t)v.slot >> 3));
+      return true;
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      if (!inside(v, v.slot & ~(uint64_t)7, 8))
+        return false;
+      u64 = load(v.base + (v.slot & ~(uint64_t)7));
+      if ((v.slot & 7) == kind_i64)
+        *out = mk_boxed(st, boxed::from_i64(st, (int64_t)u64));
+      else if ((v.slot & 7) == kind_u64)
+        *out = mk_boxed(st, boxed::from_u64(st, u64));
+      else {
+        double d;
+        memcpy(&d, &u64, 8);
+        *out = mk_number(st, d);
+      }
+      return true;
+    case kind_string:
+      if (!get_string(v, &s, &n))
+        return false;
+      {
+        str::data * str = str::mk_e(st, n + 1, NULL);
+        memcpy(str->_, s, n + 1);
+        *out = mk_string(st, str);
+      }
+      return true;
+    case kind_array:
+      n = count(v);
+      j = mk_array(st, n);
+      for (i = 0; i < n; i++) {
+        struct value e;
+        if (!at(v, i, &e) || !materialize(st, e, &c, depth + 1)) {
+          del(j);
+          return false;
+        }
+        list::append(&j->value.array, c);
+      }
+      *out = j;
+      return true;
+    default:
+      n = count(v);
+      j = mk_object(st);
+      for (i = 0; i < n; i++) {
+        struct value e;
+        if (!member(v, i, &s, &e) || !materialize(st, e, &c, depth + 1)) {
+          del(j);
+          return false;
+        }
+        map::add(j->value.object, str::mk(st, "%s", s), c);
+      }
+      *out = j;
+      return true;
+  }
+}
+
+bool to_json(state::data * st, struct value v, json::data ** out)
+{
+  return materialize(st, v, out, 0);
+}
+
+    }
+
+block::data * to_binary(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 4096);
+  buffer_put(&b, (void *)binary::magic, 8);
+  buffer_reserve(&b, 8);
+  uint64_t root = binary::encode(&b, j);
+  binary::store(b._ + 8, root);
+  *size = b.size;
+  return (block::data *)b._;
+}
+
+  }
+}
@@ -0,0 +1,61 @@
+/* A growable output buffer
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "cee.hpp"
+#include "buffer.hpp"
+#include <string.h>
+#endif
+
+namespace cee {
+  namespace json {
+
+void buffer_init(struct buffer * b, state::data * st, uintptr_t capacity)
+{
+  b->st = st;
+  b->_ = (char *)block::mk(st, capacity);
+  b->size = 0;
+  b->capacity = capacity;
+}
+
+char * buffer_reserve(struct buffer * b, uintptr_t n)
+{
+  if (b->size + n > b->capacity) {
+    uintptr_t capacity = b->capacity * 2;
+    if (capacity < b->size + n)
+      capacity = b->size + n;
+    char * p = (char *)block::mk(b->st, capacity);
+    memcpy(p, b->_, b->size);
+    del(b->_);
+    b->_ = p;
+    b->capacity = capacity;
+  }
+  char * p = b->_ + b->size;
+  b->size += n;
+  return p;
+}
+
+void buffer_put(struct buffer * b, void * p, uintptr_t n)
+{
+  memcpy(buffer_reserve(b, n), p, n);
+}
+
+void buffer_put_byte(struct buffer * b, uint8_t c)
+{
+  if (b->size < b->capacity)
+    b->_[b->size++] = c;
+  else
+    *buffer_reserve(b, 1) = c;
+}
+
+void buffer_put_be(struct buffer * b, uint64_t v, int n)
+{
+  char * p = buffer_reserve(b, n);
+  int i;
+  for (i = n - 1; i >= 0; i--) {
+    p[i] = (char)v;
+    v >>= 8;
+  }
+}
+
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef CEE_JSON_BUFFER_H
+#define CEE_JSON_BUFFER_H
+#include "cee.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * a growable output buffer for the binary encoders, the bytes live in a
+ * block of the state that is handed to the caller when encoding is done
+ */
+struct buffer {
+  state::data * st;
+  char * _;
+  uintptr_t size;
+  uintptr_t capacity;
+};
+
+extern void buffer_init(struct buffer * b, state::data * st, uintptr_t capacity);
+
+/*
+ * make room for n more bytes and return where they go, size is moved
+ * past them
+ */
+extern char * buffer_reserve(struct buffer * b, uintptr_t n);
+
+extern void buffer_put(struct buffer * b, void * p, uintptr_t n);
+extern void buffer_put_byte(struct buffer * b, uint8_t c);
+
+/*
+ * store v with the most significant byte first
+ */
+extern void buffer_put_be(struct buffer * b, uint64_t v, int n);
+
+  }
+}
+#endif // CEE_JSON_BUFFER_H
@@ -0,0 +1,55 @@
+/* Tree construction shared by the decoders
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "builder.hpp"
+#endif
+
+namespace cee {
+  namespace json {
+
+void builder_init(struct builder * b)
+{
+  b->root = NULL;
+  b->key = NULL;
+  b->depth = 0;
+}
+
+void builder_add(struct builder * b, json::data * v)
+{
+  if (b->depth == 0) {
+    b->root = v;
+    return;
+  }
+  json::data * top = b->containers[b->depth-1];
+  if (top->t == type_is_object) {
+    map::add(top->value.object, b->key, v);
+    b->key = NULL;
+  }
+  else
+    list::append(&top->value.array, v);
+}
+
+bool builder_open(struct builder * b, json::data * container)
+{
+  if (b->depth == MAX_JSON_DEPTH) {
+    del(container);
+    return false;
+  }
+  builder_add(b, container);
+  b->containers[b->depth++] = container;
+  return true;
+}
+
+void builder_abort(struct builder * b)
+{
+  if (b->key)
+    del(b->key);
+  if (b->root)
+    del(b->root);
+  builder_init(b);
+}
+
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef CEE_JSON_BUILDER_H
+#define CEE_JSON_BUILDER_H
+#include "cee.hpp"
+#include "json.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * builds a tree from values that arrive in document order, the decoders
+ * share it. The open containers are kept in a fixed array, nesting does
+ * not allocate any bookkeeping objects.
+ */
+struct builder {
+  json::data * root;
+  str::data * key;     // the key of the next member of an object
+  int depth;
+  json::data * containers[MAX_JSON_DEPTH];
+};
+
+extern void builder_init(struct builder * b);
+
+/*
+ * add v to the innermost open container, under key if it is an object,
+ * or make it the root if there is no open container
+ */
+extern void builder_add(struct builder * b, json::data * v);
+
+/*
+ * add a container and make it the innermost open one, false if it
+ * would be nested more than MAX_JSON_DEPTH deep
+ */
+extern bool builder_open(struct builder * b, json::data * container);
+
+/*
+ * the innermost open container, NULL if there is none
+ */
+static inline json::data * builder_top(struct builder * b)
+{
+  return b->depth ? b->containers[b->depth-1] : NULL;
+}
+
+static inline void builder_close(struct builder * b)
+{
+  b->depth--;
+}
+
+/*
+ * free what has been built so far
+ */
+extern void builder_abort(struct builder * b);
+
+  }
+}
+#endif // CEE_JSON_BUILDER_H
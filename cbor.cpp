@@ -0,0 +1,554 @@
+/* CBOR (RFC 8949) encoding
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "buffer.hpp"
+#include "builder.hpp"
+#include "utf8.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace cbor {
+
+enum cbor_major {
+  major_uint = 0,
+  major_negint,
+  major_bytes,
+  major_text,
+  major_array,
+  major_map,
+  major_tag,
+  major_simple
+};
+
+/*
+ * the tags of positive and negative bignums, the only tags that change
+ * how the tagged item is read
+ */
+#define CBOR_TAG_BIGNUM     2
+#define CBOR_TAG_NEG_BIGNUM 3
+
+static void encode_head(struct buffer * b, int major, uint64_t v)
+{
+  uint8_t m = major << 5;
+  if (v < 24)
+    buffer_put_byte(b, m | v);
+  else if (v <= 0xFF) {
+    buffer_put_byte(b, m | 24);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v <= 0xFFFF) {
+    buffer_put_byte(b, m | 25);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v <= 0xFFFFFFFF) {
+    buffer_put_byte(b, m | 26);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, m | 27);
+    buffer_put_be(b, v, 8);
+  }
+}
+
+static void encode_int(struct buffer * b, int64_t v)
+{
+  if (v >= 0)
+    encode_head(b, major_uint, v);
+  else
+    encode_head(b, major_negint, (uint64_t)-(v + 1));
+}
+
+static void encode_number(struct buffer * b, boxed::data * x)
+{
+  uint64_t u64;
+  uint32_t u32;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+      memcpy(&u64, &x->_.f64, 8);
+      buffer_put_byte(b, 0xfb);
+      buffer_put_be(b, u64, 8);
+      break;
+    case boxed::primitive_f32:
+      memcpy(&u32, &x->_.f32, 4);
+      buffer_put_byte(b, 0xfa);
+      buffer_put_be(b, u32, 4);
+      break;
+    case boxed::primitive_u64: encode_head(b, major_uint, x->_.u64); break;
+    case boxed::primitive_u32: encode_head(b, major_uint, x->_.u32); break;
+    case boxed::primitive_u16: encode_head(b, major_uint, x->_.u16); break;
+    case boxed::primitive_u8:  encode_head(b, major_uint, x->_.u8);  break;
+    case boxed::primitive_i64: encode_int(b, x->_.i64); break;
+    case boxed::primitive_i32: encode_int(b, x->_.i32); break;
+    case boxed::primitive_i16: encode_int(b, x->_.i16); break;
+    case boxed::primitive_i8:  encode_int(b, x->_.i8);  break;
+  }
+}
+
+static void encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  encode_head(b, major_text, n);
+  buffer_put(b, s, n);
+}
+
+static void encode(struct buffer * b, json::data * j);
+
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct buffer * b = (struct buffer *)cxt;
+  encode_string(b, (char *)key);
+  encode(b, (json::data *)value);
+}
+
+static void encode(struct buffer * b, json::data * j)
+{
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+      buffer_put_byte(b, 0xf7);
+      break;
+    case type_is_null:
+      buffer_put_byte(b, 0xf6);
+      break;
+    case type_is_boolean:
+      buffer_put_byte(b, to_bool(j) ? 0xf5 : 0xf4);
+      break;
+    case type_is_number:
+      encode_number(b, j->value.number);
+      break;
+    case type_is_string:
+      encode_string(b, (char *)j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      encode_head(b, major_array, n);
+      for (i = 0; i < n; i++)
+        encode(b, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      encode_head(b, major_map, map::size(j->value.object));
+      map::walk(j->value.object, b, encode_member);
+      break;
+  }
+}
+
+struct decoder {
+  state::data * st;
+  struct builder b;
+  /*
+   * the items an open container still expects, the pairs of a map,
+   * -1 if it has an indefinite length
+   */
+  int64_t remaining[MAX_JSON_DEPTH];
+  struct buffer carry;   // an item that is split between chunks
+  struct buffer text;    // the chunks of an indefinite length string
+  int in_string;         // the major type of that string, 0 if there is none
+  uint64_t tag;
+  bool done;
+  bool error;
+  uintptr_t offset;      // of the next item in the stream
+};
+
+decoder * mk_decoder(state::data * st)
+{
+  decoder * d = (decoder *)block::mk(st, sizeof(decoder));
+  d->st = st;
+  builder_init(&d->b);
+  buffer_init(&d->carry, st, 64);
+  buffer_init(&d->text, st, 64);
+  d->in_string = 0;
+  d->tag = 0;
+  d->done = false;
+  d->error = false;
+  d->offset = 0;
+  return d;
+}
+
+static int argument_size(uint8_t ib)
+{
+  switch (ib & 31) {
+    case 24: return 1;
+    case 25: return 2;
+    case 26: return 4;
+    case 27: return 8;
+    case 28: case 29: case 30:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+static uint64_t argument(unsigned char * p)
+{
+  int i, n = argument_size(p[0]);
+  uint64_t v = 0;
+  if (n == 0)
+    return p[0] & 31;
+  for (i = 1; i <= n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+/*
+ * the number of bytes the item at p takes, as far as the n bytes there
+ * tell, the head and the content of a definite length string.
+ * -1 if it is malformed.
+ */
+static intptr_t item_size(unsigned char * p, uintptr_t n)
+{
+  if (n == 0)
+    return 1;
+  int a = argument_size(p[0]);
+  if (a < 0)
+    return -1;
+  if (n < (uintptr_t)a + 1)
+    return a + 1;
+  int major = p[0] >> 5;
+  if ((major == major_bytes || major == major_text) && (p[0] & 31) != 31) {
+    uint64_t len = argument(p);
+    if (len > (uint64_t)INTPTR_MAX - 9)
+      return -1;
+    return a + 1 + len;
+  }
+  return a + 1;
+}
+
+/*
+ * a value is complete, close the containers that it completes
+ */
+static void completed(decoder * d)
+{
+  while (d->b.depth) {
+    int64_t * r = d->remaining + d->b.depth - 1;
+    if (*r < 0 || --*r > 0)
+      return;
+    builder_close(&d->b);
+  }
+  d->done = true;
+}
+
+static bool expects_key(decoder * d)
+{
+  json::data * top = builder_top(&d->b);
+  return top && top->t == type_is_object && d->b.key == NULL;
+}
+
+static bool emit(decoder * d, json::data * v)
+{
+  if (expects_key(d)) {
+    del(v);
+    return false;
+  }
+  builder_add(&d->b, v);
+  completed(d);
+  return true;
+}
+
+static bool emit_key_or_string(decoder * d, str::data * s)
+{
+  if (expects_key(d)) {
+    d->b.key = s;
+    return true;
+  }
+  return emit(d, mk_string(d->st, s));
+}
+
+static bool emit_int(decoder * d, int64_t v)
+{
+  if (expects_key(d))
+    return emit_key_or_string(d, str::mk(d->st, "%lld", (long long)v));
+  return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                           boxed::from_i64(d->st, v)));
+}
+
+/*
+ * a text string is valid UTF-8 without '\0', which would cut it short
+ */
+static bool emit_text(decoder * d, char * p, uintptr_t n)
+{
+  if (utf8_scan(p, p + n) != p + n || memchr(p, '\0', n))
+    return false;
+  str::data * s = str::mk_e(d->st, n + 1, NULL);
+  memcpy(s->_, p, n);
+  s->_[n] = '\0';
+  return emit_key_or_string(d, s);
+}
+
+/*
+ * a byte string has no JSON type, it becomes its base64url form as
+ * RFC 8949 suggests, or a number if it is tagged as a bignum
+ */
+static bool emit_bytes(decoder * d, unsigned char * p, uintptr_t n)
+{
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uintptr_t i;
+  if (d->tag == CBOR_TAG_BIGNUM || d->tag == CBOR_TAG_NEG_BIGNUM) {
+    double v = 0;
+    for (i = 0; i < n; i++)
+      v = v * 256 + p[i];
+    if (d->tag == CBOR_TAG_NEG_BIGNUM)
+      v = -1 - v;
+    d->tag = 0;
+    return emit(d, mk_number(d->st, v));
+  }
+  str::data * s = str::mk_e(d->st, (n + 2) / 3 * 4 + 1, NULL);
+  char * out = s->_;
+  for (i = 0; i + 2 < n; i += 3) {
+    uint32_t v = (p[i] << 16) | (p[i+1] << 8) | p[i+2];
+    *out++ = digits[v >> 18];
+    *out++ = digits[(v >> 12) & 63];
+    *out++ = digits[(v >> 6) & 63];
+    *out++ = digits[v & 63];
+  }
+  if (i < n) {
+    uint32_t v = p[i] << 16 | (i + 1 < n ? p[i+1] << 8 : 0);
+    *out++ = digits[v >> 18];
+    *out++ = digits[(v >> 12) & 63];
+    if (i + 1 < n)
+      *out++ = digits[(v >> 6) & 63];
+  }
+  *out = '\0';
+  return emit_key_or_string(d, s);
+}
+
+static double half_to_double(uint16_t h)
+{
+  int e = (h >> 10) & 0x1f, m = h & 0x3ff;
+  double v;
+  if (e == 0)
+    v = ldexp(m, -24);
+  else if (e == 31)
+    v = m ? NAN : INFINITY;
+  else
+    v = ldexp(m + 1024, e - 25);
+  return (h & 0x8000) ? -v : v;
+}
+
+static bool open_container(decoder * d, json::data * c, unsigned char * p)
+{
+  uint64_t n = argument(p);
+  if (expects_key(d) || n > INT64_MAX) {
+    del(c);
+    return false;
+  }
+  if (!builder_open(&d->b, c))
+    return false;
+  int64_t * r = d->remaining + d->b.depth - 1;
+  *r = ((p[0] & 31) == 31) ? -1 : (int64_t)n;
+  if (*r == 0) {
+    builder_close(&d->b);
+    completed(d);
+  }
+  return true;
+}
+
+/*
+ * the end of an indefinite length container or string
+ */
+static bool brk(decoder * d)
+{
+  if (d->in_string) {
+    bool ok;
+    if (d->in_string == major_text)
+      ok = emit_text(d, d->text._, d->text.size);
+    else
+      ok = emit_bytes(d, (unsigned char *)d->text._, d->text.size);
+    d->in_string = 0;
+    d->text.size = 0;
+    return ok;
+  }
+  if (d->b.depth == 0 || d->remaining[d->b.depth-1] >= 0 || d->b.key)
+    return false;
+  builder_close(&d->b);
+  completed(d);
+  return true;
+}
+
+/*
+ * decode the complete item at p, item_size has checked its length
+ */
+static bool item(decoder * d, unsigned char * p)
+{
+  int major = p[0] >> 5, ai = p[0] & 31;
+  int a = argument_size(p[0]);
+  uint64_t v = argument(p);
+  uint64_t u64;
+  uint32_t u32;
+  double f;
+
+  if (d->done)
+    return false;
+  if (d->in_string) {
+    if (p[0] == 0xff)
+      return brk(d);
+    if (major != d->in_string || ai == 31)
+      return false;
+    buffer_put(&d->text, p + 1 + a, v);
+    return true;
+  }
+  // only strings, containers and the break have an indefinite length
+  if (ai == 31 && (major == major_uint || major == major_negint || major == major_tag))
+    return false;
+  if (d->tag && major != major_bytes && major != major_tag)
+    d->tag = 0;
+
+  switch (major) {
+    case major_uint:
+      if (v > INT64_MAX) {
+        if (expects_key(d))
+          return emit_key_or_string(d, str::mk(d->st, "%llu", (unsigned long long)v));
+        return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                                 boxed::from_u64(d->st, v)));
+      }
+      return emit_int(d, (int64_t)v);
+    case major_negint:
+      if (v > INT64_MAX)
+        return emit(d, mk_number(d->st, -1.0 - (double)v));
+      return emit_int(d, -1 - (int64_t)v);
+    case major_bytes:
+    case major_text:
+      if (ai == 31) {
+        d->in_string = major;
+        return true;
+      }
+      if (major == major_text)
+        return emit_text(d, (char *)p + 1 + a, v);
+      return emit_bytes(d, p + 1 + a, v);
+    case major_array:
+      return open_container(d, mk_array(d->st, ai == 31 || v > 1024 ? 8 : v), p);
+    case major_map:
+      return open_container(d, mk_object(d->st), p);
+    case major_tag:
+      /*
+       * other tags are dropped and the tagged item is read as it is
+       */
+      d->tag = v;
+      return true;
+    default:
+      switch (ai) {
+        case 20:
+          return emit(d, mk_false(d->st));
+        case 21:
+          return emit(d, mk_true(d->st));
+        case 22:
+          return emit(d, mk_null(d->st));
+        case 23:
+          return emit(d, mk_undefined(d->st));
+        case 25:
+          return emit(d, mk_number(d->st, half_to_double(v)));
+        case 26:
+          {
+            float f32;
+            u32 = v;
+            memcpy(&f32, &u32, 4);
+            return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                                     boxed::from_float(d->st, f32)));
+          }
+        case 27:
+          u64 = v;
+          memcpy(&f, &u64, 8);
+          return emit(d, mk_number(d->st, f));
+        case 31:
+          return brk(d);
+        default:
+          return false;
+      }
+  }
+}
+
+static bool fail(decoder * d)
+{
+  d->error = true;
+  return false;
+}
+
+bool feed(decoder * d, char * chunk, uintptr_t len)
+{
+  unsigned char * p = (unsigned char *)chunk;
+  intptr_t need;
+  if (d->error)
+    return false;
+
+  /*
+   * complete the item that the previous chunk ended in
+   */
+  while (d->carry.size && len) {
+    need = item_size((unsigned char *)d->carry._, d->carry.size);
+    if (need < 0)
+      return fail(d);
+    uintptr_t take = need - d->carry.size;
+    if (take > len)
+      take = len;
+    buffer_put(&d->carry, p, take);
+    p += take;
+    len -= take;
+    if (d->carry.size == (uintptr_t)need
+        && item_size((unsigned char *)d->carry._, d->carry.size) == need) {
+      if (!item(d, (unsigned char *)d->carry._))
+        return fail(d);
+      d->offset += need;
+      d->carry.size = 0;
+    }
+  }
+
+  while (len) {
+    need = item_size(p, len);
+    if (need < 0)
+      return fail(d);
+    if ((uintptr_t)need > len) {
+      buffer_put(&d->carry, p, len);
+      break;
+    }
+    if (!item(d, p))
+      return fail(d);
+    d->offset += need;
+    p += need;
+    len -= need;
+  }
+  return true;
+}
+
+bool finish(decoder * d, json::data ** out, uintptr_t * error_at)
+{
+  bool ok = !d->error && d->done && d->carry.size == 0;
+  *out = NULL;
+  if (ok)
+    *out = d->b.root;
+  else {
+    builder_abort(&d->b);
+    *error_at = d->offset;
+  }
+  del(d->carry._);
+  del(d->text._);
+  del(d);
+  return ok;
+}
+
+    }
+
+block::data * to_cbor(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 256);
+  cbor::encode(&b, j);
+  *size = b.size;
+  return (block::data *)b._;
+}
+
+bool from_cbor(state::data * st, char * buf, uintptr_t len,
+               json::data ** out, uintptr_t * error_at)
+{
+  cbor::decoder * d = cbor::mk_decoder(st);
+  cbor::feed(d, buf, len);
+  return cbor::finish(d, out, error_at);
+}
+
+  }
+}
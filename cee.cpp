@@ -6,6 +6,8 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #ifndef CEE_H
 #define CEE_H
 #include <stdint.h>
@@ -14,13 +16,15 @@
 
 namespace cee {
   namespace state { struct data; };
+  struct slabs;
+  struct tombs;
   
 typedef uintptr_t tag_t;
 typedef int (*cmp_fun) (const void *, const void *);
 
 enum resize_method {
   resize_with_identity = 0, // resize with identity function
-  resize_with_malloc = 1,   // resize with malloc  (safe, but leak)
+  resize_with_malloc = 1,   // resize with malloc, see use_malloc
   resize_with_realloc = 2   // resize with realloc (probably unsafe)
 };
 
@@ -72,25 +76,34 @@ enum del_policy {
  * if an object is owned by multiple del_rc containers, in_degree is the 
  * number of containers.
  *
+ * sect precedes every object and takes 40 bytes with 64 bit pointers.
+ * There is no compact header: the collectors find objects by the trace
+ * chain and keep cursors into it, and objects that are not in slabs
+ * have nothing else to be found by, so state, the chain links and
+ * mem_block_size are kept in every object.
+ *
  */
 struct sect {
+  // the bits the collectors write, a byte of their own
+  uint8_t  gc_mark:2;             // used for mark & sweep gc
+  uint8_t  gc_grey:1;             // waiting to be traced by state::gc_step
+  uint8_t  gc_old:1;              // survived a collection, see state::gc_minor
+  uint8_t  gc_remembered:1;       // old, and may point to young objects
+  uint8_t  :0;
+  // the bits threads that share the object read
   uint8_t  cmp_stop_at_null:1;    // 0: compare all bytes, otherwise stop at '\0'
   uint8_t  resize_method:2;       // three values: identity, malloc, realloc
   uint8_t  retained:1;            // if it is retained, in_degree is ignored
-  uint8_t  gc_mark:2;             // used for mark & sweep gc
+  uint8_t  shared:1;              // in_degree is changed atomically, see share
   uint8_t  n_product;             // n-ary (no more than 256) product type
-  uint16_t in_degree;             // the number of cee objects points to this object
+  uint8_t  type;                  // the descriptor of the type, see trace
+  uint32_t in_degree;             // the number of cee objects points to this object
   // begin of gc fields
   state::data * state;            // the gc state under which this block is allocated
   struct sect * trace_next;       // used for chaining cee::_::data to be traced
   struct sect * trace_prev;       // used for chaining cee::_::data to be traced
   // end of gc fields
   uintptr_t mem_block_size;       // the size of a memory block enclosing this struct
-  void *cmp;                      // compare two memory blocks
-  
-  // the object specific generic scan function
-  // it does memory deallocation, reference count decreasing, or liveness marking
-  void (*trace)(void *, enum trace_action);
 };
 
 
@@ -353,9 +366,21 @@ namespace map {
   extern uintptr_t size(map::data *);
   extern void add(map::data * m, void * key, void * value);
   extern void * find(map::data * m, void * key);
+  /*
+   * the pair of key is removed, the key and the value are released by the
+   * del policies of the map. The value is returned, it is only valid if
+   * something else still holds it.
+   */
   extern void * remove(map::data *m, void * key);
   extern list::data * keys(map::data *m);
   extern list::data * values(map::data *m);
+
+  /*
+   * call f with every key and value in the order of the keys,
+   * nothing is allocated
+   */
+  extern void walk(map::data *m, void * cxt,
+                   void (*f)(void * cxt, void * key, void * value));
 };
 
 
@@ -484,6 +509,11 @@ namespace boxed {
   extern boxed::data * from_i16(state::data *, int16_t);
   extern boxed::data * from_i8(state::data *, int8_t);
 
+  /*
+   * the primitive type the value is boxed with
+   */
+  extern enum primitive_type type(boxed::data * x);
+
   extern double   to_double(boxed::data * x);
   extern float    to_float(boxed::data * x);
   
@@ -539,6 +569,24 @@ namespace tagged {
    */
   extern tagged::data * mk (state::data *, uintptr_t tag, void * v);
   extern tagged::data * mk_e (state::data *, enum del_policy o, uintptr_t tag, void *v);
+
+  /*
+   * a value derived from what a tagged value points to, e.g. a hash, can
+   * be cached with it until the list or the map it points to changes,
+   * strings and boxed values are taken as not changing. Nothing is kept,
+   * and false is returned, if that list or map has other owners or the
+   * tagged value points to another kind of container.
+   */
+  extern bool memoize (tagged::data *, uint64_t value);
+  extern bool recall (tagged::data *, uint64_t * value);
+
+  /*
+   * link child under parent, the value cached with parent is dropped
+   * with the one of child from then on. It fails if child has other
+   * owners than the container of parent, parent should then not cache
+   * anything derived from child.
+   */
+  extern bool link (tagged::data * child, tagged::data * parent);
 }
 
 namespace env {
@@ -561,6 +609,12 @@ namespace closure {
 };
 
 extern void use_realloc(void *);
+/*
+ * the default: a resized object is a copy in a new block. The old block
+ * stays valid for what still counts a reference to it and is freed at
+ * once otherwise, a pointer that is not counted must be replaced by the
+ * one the resize returns.
+ */
 extern void use_malloc(void *);
   
   /*
@@ -574,16 +628,38 @@ extern void del (void *);
 extern void del_ref(void *);
 extern void del_e (enum del_policy o, void * p);
 
+/*
+ * run the scan function of the type of p, it does memory deallocation,
+ * reference count decreasing, or liveness marking. The scan functions
+ * are kept in one table of type descriptors rather than in every object.
+ */
 extern void trace (void *p, enum trace_action ta);
 extern int cmp (void *, void *);
 
 extern void incr_indegree (enum del_policy o, void * p);
 extern void decr_indegree (enum del_policy o, void * p);
 
+/*
+ * record that p has been stored into container, it is only needed when
+ * the container is changed by other means than its own functions. What
+ * is cached from the container is dropped, see tagged::memoize.
+ */
+extern void write_barrier (void * container, void * p);
+
 /* 
  * return the reference count of an object
  */
-extern uint16_t get_rc (void *);
+extern uint32_t get_rc (void *);
+
+/*
+ * the reference count of p is changed with atomic operations from now
+ * on, so that threads can take and drop references to it. Objects that
+ * stay in one thread keep the cheaper plain counts. It marks p alone,
+ * not what p points to. The object that is released last is freed
+ * under the lock of its state, and from then on the state takes its
+ * lock to allocate, to free and to collect.
+ */
+extern void share (void * p);
 
 /*
  * call this to cause segfault for non-recoverable errors
@@ -591,6 +667,29 @@ extern uint16_t get_rc (void *);
 extern void segfault() __attribute__((noreturn));
 
 namespace state {
+  enum gc_phase {
+    gc_idle = 0,
+    gc_marking,
+    gc_sweeping,
+    gc_minor_marking,
+    gc_parallel_marking
+  };
+
+  /*
+   * what the objects of a state take, the counters are updated as objects
+   * are allocated and freed. A resized object is counted as freed and
+   * allocated again.
+   */
+  enum { max_types = 32 };
+  struct stats {
+    uintptr_t live_bytes;   // the block sizes of the live objects added up
+    uintptr_t peak_bytes;   // the largest live_bytes has been
+    uintptr_t n_allocs;     // the objects allocated so far
+    uintptr_t n_live;       // the live objects
+    // the live objects of each type, see type_name
+    uintptr_t n_live_by_type[max_types];
+  };
+
   struct data {
     // arbitrary number of contexts
     map::data * contexts;
@@ -601,6 +700,30 @@ namespace state {
     set::data   * roots; 
     // the mark value for the next iteration
     int           next_mark;
+    // the number of objects chained to trace_tail
+    uintptr_t     n_objects;
+    // held while a shared object is freed
+    int           lock;
+    // some objects are shared, see share
+    bool          shared;
+    // the collection in progress by gc_step
+    enum gc_phase gc_phase;
+    struct sect * gc_sweep;     // the next object to sweep
+    void       ** gc_grey;      // marked objects that are still to be traced
+    uintptr_t     gc_grey_size;
+    uintptr_t     gc_grey_capacity;
+    struct tombs * gc_grey_freed;  // freed objects still on the grey list
+    // the objects chained after gc_old_tail are young
+    struct sect * gc_old_tail;
+    void       ** gc_remembered; // old objects young ones were stored into
+    uintptr_t     gc_remembered_size;
+    uintptr_t     gc_remembered_capacity;
+    struct tombs * gc_remembered_freed;  // freed objects still in the remembered set
+    // tuples, tagged values, boxed values, map and set nodes, and other
+    // objects of a fixed small size are allocated from slabs of the state
+    struct slabs * slabs;
+    // n_live is n_objects
+    struct stats  usage;
   };
   /*
    * the size of stack
@@ -609,6 +732,45 @@ namespace state {
   extern void add_gc_root(state::data *, void *);
   extern void remove_gc_root(state::data *, void *);
   extern void gc(state::data *);
+
+  /*
+   * do at most max_objects units of an incremental collection, tracing
+   * or sweeping one object is a unit. While a collection is in progress
+   * objects stored into containers are marked by a write barrier in
+   * incr_indegree, and new objects are allocated marked, so that the
+   * mutator can run between steps. true is returned when a collection
+   * has just been completed. gc completes a collection in progress.
+   */
+  extern bool gc_step(state::data *, uintptr_t max_objects);
+
+  /*
+   * collect the young objects only, those allocated since the previous
+   * collection. They are reachable from the roots of the state or from
+   * old objects they were stored into, the survivors become old. The
+   * old objects are left to gc and gc_step, which make all survivors
+   * old. Nothing is done while gc_step has a collection in progress.
+   */
+  extern void gc_minor(state::data *);
+
+  /*
+   * gc with n_threads threads. The objects to be traced are kept in a
+   * work-stealing deque per thread, and a thread marks an object with an
+   * atomic update before it puts it into its deque, so that the per-type
+   * trace functions run once per object. The unmarked objects are then
+   * taken out of the chain and split among the threads to be freed. The
+   * mutator must not run during the collection.
+   */
+  extern void gc_parallel(state::data *, unsigned n_threads);
+
+  /*
+   * a snapshot of the counters of the state, it takes no lock
+   */
+  extern void stats(state::data *, struct stats *);
+  /*
+   * the name of a type counted by n_live_by_type, such as "str", "list",
+   * "map", "tagged" or "boxed", NULL for an index no type has
+   */
+  extern const char * type_name(unsigned type);
   extern void add_context(state::data *, char * key, void * val);
   extern void remove_context(state::data *, char * key);
   extern void * get_context(state::data *, char * key);
@@ -624,6 +786,213 @@ namespace state {
 #endif 
 
 #endif // CEE_INTERNAL_H
+/*
+ * what all objects of a type share, the type field of sect indexes
+ * _cee_types
+ */
+enum _cee_type_id {
+  _cee_type_unknown = 0,
+  _cee_type_boxed,
+  _cee_type_str,
+  _cee_type_str_empty,
+  _cee_type_dict,
+  _cee_type_map,
+  _cee_type_set,
+  _cee_type_stack,
+  _cee_type_tuple,
+  _cee_type_triple,
+  _cee_type_quadruple,
+  _cee_type_list,
+  _cee_type_tagged,
+  _cee_type_singleton,
+  _cee_type_closure,
+  _cee_type_block,
+  _cee_type_n_tuple,
+  _cee_type_env,
+  _cee_type_state,
+  _cee_type_max
+};
+struct _cee_type {
+  const char * name;
+  // the object specific generic scan function
+  // it does memory deallocation, reference count decreasing, or liveness marking
+  void (*trace)(void *, enum cee::trace_action);
+};
+extern const struct _cee_type _cee_types[_cee_type_max];
+static_assert(sizeof(void *) != 8 || sizeof(struct cee::sect) == 40,
+              "the size of sect is documented with it");
+static_assert((int)_cee_type_max <= (int)cee::state::max_types,
+              "state::stats has no counter for some types");
+/*
+ * the state whose lock this thread holds, releasing a shared object
+ * releases what it points to under the same lock
+ */
+static __thread cee::state::data * _cee_locked_state;
+struct _cee_lock {
+  cee::state::data * st;      // NULL if nothing was locked
+  cee::state::data * outer;   // the state locked before
+};
+/*
+ * once a state has shared objects another thread may free the last
+ * reference to one of them, the chain, the counters and the slabs of
+ * the state are then changed under its lock. The lock is taken once by
+ * a thread, what runs under it does not take it again.
+ */
+static struct _cee_lock _cee_state_lock (cee::state::data * st) {
+  struct _cee_lock l = { NULL, _cee_locked_state };
+  if (st == NULL || !st->shared || st == _cee_locked_state)
+    return l;
+  while (__atomic_exchange_n(&st->lock, 1, __ATOMIC_ACQUIRE))
+    ;
+  _cee_locked_state = st;
+  l.st = st;
+  return l;
+}
+static void _cee_state_unlock (struct _cee_lock l) {
+  if (l.st == NULL)
+    return;
+  _cee_locked_state = l.outer;
+  __atomic_store_n(&l.st->lock, 0, __ATOMIC_RELEASE);
+}
+/*
+ * the slabs of a state. A slab is an aligned block of objects of one
+ * size class with a bitmap of its free objects, so an object finds its
+ * slab from its address. Objects are allocated from the current slab
+ * of their class until it is full, then from a slab that has had
+ * objects freed, or from a new one. Frees may come from the threads of
+ * gc_parallel and update the slab atomically, allocations may not run
+ * at the same time as frees. The slabs left empty are freed when a
+ * collection is over.
+ */
+#define CEE_SLAB_SIZE     (64 * 1024)
+#define CEE_SLAB_MAX      256       // larger objects are allocated by malloc
+#define CEE_SLAB_CLASSES  (CEE_SLAB_MAX / 16)
+#define CEE_SLAB_WORDS    (CEE_SLAB_SIZE / 16 / 64)
+struct _cee_slab_class;
+struct _cee_slab {
+  struct _cee_slab * next;          // in the partial list of its class
+  struct _cee_slab * all;           // every slab of the state
+  struct _cee_slab_class * cls;
+  uint32_t size;
+  uint32_t capacity;                // the number of objects it holds
+  uint32_t n_free;
+  uint32_t hint;                    // where the search for a free object starts
+  uint64_t free[CEE_SLAB_WORDS];    // a set bit is a free object
+  char _[1] __attribute__((aligned(16)));
+};
+struct _cee_slab_class {
+  struct _cee_slab * current;       // never full
+  struct _cee_slab * partial;       // slabs that have had objects freed
+};
+struct cee::slabs {
+  struct _cee_slab_class classes[CEE_SLAB_CLASSES];
+  struct _cee_slab * all;
+};
+static struct _cee_slab * _cee_slab_mk (struct cee::slabs * a, struct _cee_slab_class * c,
+                                        uint32_t size) {
+  struct _cee_slab * s = (struct _cee_slab *)aligned_alloc(CEE_SLAB_SIZE, CEE_SLAB_SIZE);
+  uint32_t n = (CEE_SLAB_SIZE - __builtin_offsetof(struct _cee_slab, _)) / size, i;
+  s->next = NULL;
+  s->all = a->all;
+  a->all = s;
+  s->cls = c;
+  s->size = size;
+  s->capacity = n;
+  s->n_free = n;
+  s->hint = 0;
+  for (i = 0; i < CEE_SLAB_WORDS; i++)
+    s->free[i] = i < n / 64 ? ~(uint64_t)0 : i == n / 64 ? ((uint64_t)1 << n % 64) - 1 : 0;
+  return s;
+}
+static void * _cee_slab_alloc (cee::state::data * st, size_t size) {
+  if (size > CEE_SLAB_MAX)
+    return malloc(size);
+  struct _cee_lock l = _cee_state_lock(st);
+  struct _cee_slab_class * c = st->slabs->classes + (size - 1) / 16;
+  struct _cee_slab * s = c->current;
+  if (s == NULL) {
+    s = __atomic_load_n(&c->partial, __ATOMIC_ACQUIRE);
+    while (s && !__atomic_compare_exchange_n(&c->partial, &s, s->next, false,
+                                             __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      ;
+    if (s == NULL)
+      s = _cee_slab_mk(st->slabs, c, ((size - 1) / 16 + 1) * 16);
+    c->current = s;
+  }
+  uint32_t i = s->hint;
+  while (s->free[i] == 0)
+    i = (i + 1) % CEE_SLAB_WORDS;
+  s->hint = i;
+  int b = __builtin_ctzll(s->free[i]);
+  s->free[i] &= ~((uint64_t)1 << b);
+  /*
+   * a full slab is dropped, the free that makes room in it puts it on
+   * the partial list
+   */
+  if (--s->n_free == 0)
+    c->current = NULL;
+  _cee_state_unlock(l);
+  return s->_ + (i * 64 + b) * s->size;
+}
+static void _cee_slab_free (void * p, size_t size) {
+  if (size > CEE_SLAB_MAX) {
+    free(p);
+    return;
+  }
+  struct _cee_slab * s = (struct _cee_slab *)((uintptr_t)p & ~(uintptr_t)(CEE_SLAB_SIZE - 1));
+  uintptr_t k = ((char *)p - s->_) / s->size;
+  __atomic_fetch_or(&s->free[k / 64], (uint64_t)1 << k % 64, __ATOMIC_RELAXED);
+  uint32_t n_free = __atomic_fetch_add(&s->n_free, 1, __ATOMIC_ACQ_REL);
+  if (s->cls == NULL) {
+    // the state is gone, see _cee_slab_orphan
+    if (n_free + 1 == s->capacity)
+      free(s);
+  }
+  else if (n_free == 0) {
+    struct _cee_slab_class * c = s->cls;
+    struct _cee_slab * head = __atomic_load_n(&c->partial, __ATOMIC_RELAXED);
+    do
+      s->next = head;
+    while (!__atomic_compare_exchange_n(&c->partial, &head, s, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+}
+/*
+ * free the slabs that have no objects left but the current ones, it is
+ * called when a collection is over as no frees run at the same time
+ */
+static void _cee_slab_trim (struct cee::slabs * a) {
+  struct _cee_slab ** pp, * s;
+  int i;
+  for (i = 0; i < CEE_SLAB_CLASSES; i++)
+    for (pp = &a->classes[i].partial; (s = *pp) != NULL; )
+      if (s->n_free == s->capacity)
+        *pp = s->next;
+      else
+        pp = &s->next;
+  for (pp = &a->all; (s = *pp) != NULL; )
+    if (s->n_free == s->capacity && s != s->cls->current) {
+      *pp = s->all;
+      free(s);
+    }
+    else
+      pp = &s->all;
+}
+/*
+ * the state is freed but not the objects in its slabs, the empty slabs
+ * are freed and the others are left to be freed with their last object
+ */
+static void _cee_slab_orphan (struct cee::slabs * a) {
+  while (a->all) {
+    struct _cee_slab * s = a->all;
+    a->all = s->all;
+    if (s->n_free == s->capacity)
+      free(s);
+    else
+      s->cls = NULL;
+  }
+  free(a);
+}
 typedef enum { FIND, ENTER } ACTION;
 typedef enum { preorder, postorder, endorder, leaf } VISIT;
 typedef struct musl_entry {
@@ -649,7 +1018,7 @@ void *musl_lfind(const void *, const void *, size_t *, size_t,
  int (*)(const void *, const void *));
 void *musl_tdelete(void * cxt, const void *__restrict, void **__restrict, int(*)(void *, const void *, const void *));
 void *musl_tfind(void * cxt, const void *, void *const *, int(*)(void *, const void *, const void *));
-void *musl_tsearch(void * cxt, const void *, void **, int (*)(void *, const void *, const void *));
+void *musl_tsearch(void * cxt, cee::state::data *, const void *, void **, int (*)(void *, const void *, const void *));
 void musl_twalk(void * cxt, const void *, void (*)(void *, const void *, VISIT, int));
 struct musl_qelem {
  struct qelem *q_forw, *q_back;
@@ -893,7 +1262,7 @@ static int __tsearch_balance(void **p)
   }
   return rot(p, n, h0<h1);
 }
-void *musl_tsearch(void *cxt, const void *key, void **rootp,
+void *musl_tsearch(void *cxt, cee::state::data * st, const void *key, void **rootp,
   int (*cmp)(void *, const void *, const void *))
 {
   if (!rootp)
@@ -912,7 +1281,7 @@ void *musl_tsearch(void *cxt, const void *key, void **rootp,
     a[i++] = &n->a[c>0];
     n = (struct _cee_tsearch_node *)n->a[c>0];
   }
-  r = (struct _cee_tsearch_node *)malloc(sizeof *r);
+  r = (struct _cee_tsearch_node *)_cee_slab_alloc(st, sizeof *r);
   if (!r)
     return 0;
   r->key = key;
@@ -931,7 +1300,7 @@ void musl_tdestroy(void * cxt, void *root, void (*freekey)(void *, void *))
   musl_tdestroy(cxt, r->a[0], freekey);
   musl_tdestroy(cxt, r->a[1], freekey);
   if (freekey) freekey(cxt, (void *)r->key);
-  free(r);
+  _cee_slab_free(r, sizeof *r);
 }
 void *musl_tfind(void * cxt, const void *key, void *const *rootp,
   int(*cmp)(void * cxt, const void *, const void *))
@@ -1010,16 +1379,321 @@ void *musl_tdelete(void * cxt, const void * key, void ** rootp,
   /* freed node has at most one child, move it up and rebalance.  */
   if (parent == n)
     parent = NULL;
-  free(n);
+  _cee_slab_free(n, sizeof *n);
   *a[--i] = child;
   while (--i && __tsearch_balance(a[i]));
   return parent;
 }
 using namespace cee;
+/*
+ * the objects freed while they are on the grey list or in the remembered
+ * set, their entries are dropped when they are reached instead of being
+ * searched for. An address is counted once for each time it is freed, a
+ * new object at the same address may be put on the list again and its
+ * entry is then as good as the stale one.
+ */
+struct _cee_tomb {
+  void * p;
+  uintptr_t n;
+};
+struct cee::tombs {
+  uintptr_t n_dead;                 // the sum of the counts
+  uintptr_t size;                   // the addresses in the table
+  uintptr_t capacity;               // a power of two
+  struct _cee_tomb * at;
+};
+static struct _cee_tomb * _cee_tombs_slot (struct cee::tombs * t, void * p) {
+  uintptr_t i = (uintptr_t)p >> 4;
+  i ^= i >> 16;
+  for (i &= t->capacity - 1; t->at[i].p && t->at[i].p != p; i = (i + 1) & (t->capacity - 1))
+    ;
+  return t->at + i;
+}
+static void _cee_tombs_add (struct cee::tombs ** tp, void * p) {
+  struct cee::tombs * t = *tp;
+  if (t == NULL)
+    t = *tp = (struct cee::tombs *)calloc(1, sizeof(struct cee::tombs));
+  if (2 * (t->size + 1) > t->capacity) {
+    struct _cee_tomb * old = t->at;
+    uintptr_t i, n = t->capacity;
+    t->capacity = n ? n * 2 : 64;
+    t->at = (struct _cee_tomb *)calloc(t->capacity, sizeof(struct _cee_tomb));
+    for (i = 0; i < n; i++)
+      if (old[i].p)
+        *_cee_tombs_slot(t, old[i].p) = old[i];
+    free(old);
+  }
+  struct _cee_tomb * e = _cee_tombs_slot(t, p);
+  if (e->p == NULL) {
+    e->p = p;
+    t->size++;
+  }
+  e->n++;
+  t->n_dead++;
+}
+/*
+ * true if the entry of p is stale, it is counted off
+ */
+static bool _cee_tombs_take (struct cee::tombs * t, void * p) {
+  if (t == NULL || t->n_dead == 0)
+    return false;
+  struct _cee_tomb * e = _cee_tombs_slot(t, p);
+  if (e->n == 0)
+    return false;
+  e->n--;
+  t->n_dead--;
+  return true;
+}
+static void _cee_tombs_clear (struct cee::tombs * t) {
+  if (t == NULL || t->size == 0)
+    return;
+  memset(t->at, 0, t->capacity * sizeof(struct _cee_tomb));
+  t->size = 0;
+  t->n_dead = 0;
+}
+static void _cee_tombs_del (struct cee::tombs * t) {
+  if (t == NULL)
+    return;
+  free(t->at);
+  free(t);
+}
+/*
+ * put an unmarked object on the grey list of an incremental collection
+ */
+static void _cee_common_shade (struct sect * cs, state::data * st) {
+  if (cs->gc_mark == st->next_mark || cs->gc_grey)
+    return;
+  if (st->gc_grey_size == st->gc_grey_capacity) {
+    st->gc_grey_capacity = st->gc_grey_capacity ? st->gc_grey_capacity * 2 : 256;
+    st->gc_grey = (void **)realloc(st->gc_grey, st->gc_grey_capacity * sizeof(void *));
+  }
+  cs->gc_grey = 1;
+  st->gc_grey[st->gc_grey_size++] = cs + 1;
+}
+/*
+ * put an old object on the remembered set, gc_minor traces it as a root
+ */
+static void _cee_common_remember (struct sect * cs, state::data * st) {
+  if (st->gc_remembered_size == st->gc_remembered_capacity) {
+    st->gc_remembered_capacity = st->gc_remembered_capacity ? st->gc_remembered_capacity * 2 : 64;
+    st->gc_remembered = (void **)realloc(st->gc_remembered, st->gc_remembered_capacity * sizeof(void *));
+  }
+  cs->gc_remembered = 1;
+  st->gc_remembered[st->gc_remembered_size++] = cs + 1;
+}
+/*
+ * the generational write barrier: an old container that gets a young
+ * object is remembered until the next collection
+ */
+static void _cee_common_write_barrier (struct sect * c, void * p) {
+  if (!c->gc_old || c->gc_remembered || p == NULL)
+    return;
+  struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+  if (cs->state && !cs->gc_old)
+    _cee_common_remember(c, c->state);
+}
+/*
+ * an object chained while marking is traced before the marking ends, it
+ * may be a resized copy of an object that has not been traced yet. One
+ * chained while sweeping is marked so that it is not swept.
+ */
+static void _cee_common_chain (struct sect * cs, state::data * st) {
+  struct _cee_lock l = _cee_state_lock(st);
+  cs->state = st;
+  cs->trace_prev = st->trace_tail;
+  cs->trace_next = NULL;
+  st->trace_tail->trace_next = cs;
+  st->trace_tail = cs;
+  st->n_objects++;
+  st->usage.live_bytes += cs->mem_block_size;
+  if (st->usage.live_bytes > st->usage.peak_bytes)
+    st->usage.peak_bytes = st->usage.live_bytes;
+  st->usage.n_allocs++;
+  st->usage.n_live_by_type[cs->type]++;
+  cs->gc_grey = 0;
+  /*
+   * a resized copy keeps the generation of the original, what pointed
+   * to the original points to it without a write barrier
+   */
+  if (cs->gc_remembered)
+    _cee_common_remember(cs, st);
+  if (st->gc_phase == state::gc_sweeping)
+    cs->gc_mark = st->next_mark;
+  else {
+    cs->gc_mark = !st->next_mark;
+    if (st->gc_phase == state::gc_marking)
+      _cee_common_shade(cs, st);
+  }
+  _cee_state_unlock(l);
+}
+static void _cee_common_de_chain (struct sect * cs) {
+  state::data * st = cs->state;
+  struct _cee_lock l = _cee_state_lock(st);
+  struct sect * prev = cs->trace_prev;
+  struct sect * next = cs->trace_next;
+  if (st->trace_tail == cs) {
+    prev->trace_next = NULL;
+    st->trace_tail = prev;
+  }
+  else {
+    prev->trace_next = next;
+    if (next)
+      next->trace_prev = prev;
+  }
+  st->n_objects--;
+  st->usage.live_bytes -= cs->mem_block_size;
+  st->usage.n_live_by_type[cs->type]--;
+  if (st->gc_sweep == cs)
+    st->gc_sweep = next;
+  if (st->gc_old_tail == cs)
+    st->gc_old_tail = prev;
+  // the entries of the object are left where they are, see tombs
+  if (cs->gc_grey)
+    _cee_tombs_add(&st->gc_grey_freed, cs + 1);
+  if (cs->gc_remembered)
+    _cee_tombs_add(&st->gc_remembered_freed, cs + 1);
+  _cee_state_unlock(l);
+}
+/*
+ * a resize with malloc leaves the old block to what still points to it,
+ * it is freed at once when nothing counts a reference to it
+ */
+static void _cee_common_drop_resized (struct sect * cs, void * block) {
+  state::data * st = cs->state;
+  if (cs->in_degree || cs->retained || cs->shared || set::find(st->roots, cs + 1))
+    return;
+  _cee_common_de_chain(cs);
+  free(block);
+}
+/*
+ * the work-stealing deque of a thread of gc_parallel (Chase and Lev).
+ * The owner pushes and takes at the bottom, other threads steal from
+ * the top. The arrays it outgrows are kept until the collection ends,
+ * a thief may still read them.
+ */
+struct _cee_gc_array {
+  struct _cee_gc_array * retired;
+  int64_t size;                   // a power of 2
+  void * _[1];
+};
+struct _cee_gc_deque {
+  int64_t top;
+  int64_t bottom;
+  struct _cee_gc_array * array;
+  char pad[64 - 2 * sizeof(int64_t) - sizeof(void *)];
+};
+static struct _cee_gc_array * _cee_gc_array_mk (int64_t size) {
+  struct _cee_gc_array * a = (struct _cee_gc_array *)malloc(
+    sizeof(struct _cee_gc_array) + (size - 1) * sizeof(void *));
+  a->retired = NULL;
+  a->size = size;
+  return a;
+}
+static void _cee_gc_push (struct _cee_gc_deque * q, void * p) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+  struct _cee_gc_array * a = __atomic_load_n(&q->array, __ATOMIC_RELAXED);
+  if (b - t > a->size - 1) {
+    struct _cee_gc_array * g = _cee_gc_array_mk(a->size * 2);
+    int64_t i;
+    for (i = t; i < b; i++)
+      g->_[i & (g->size - 1)] = __atomic_load_n(&a->_[i & (a->size - 1)], __ATOMIC_RELAXED);
+    g->retired = a;
+    __atomic_store_n(&q->array, g, __ATOMIC_RELEASE);
+    a = g;
+  }
+  __atomic_store_n(&a->_[b & (a->size - 1)], p, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+}
+static void * _cee_gc_take (struct _cee_gc_deque * q) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+  struct _cee_gc_array * a = __atomic_load_n(&q->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+  void * p = NULL;
+  if (t <= b) {
+    p = __atomic_load_n(&a->_[b & (a->size - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+      // the last one, a thief may be taking it too
+      if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        p = NULL;
+      __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  }
+  else
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+  return p;
+}
+static void * _cee_gc_steal (struct _cee_gc_deque * q) {
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return NULL;
+  struct _cee_gc_array * a = __atomic_load_n(&q->array, __ATOMIC_ACQUIRE);
+  void * p = __atomic_load_n(&a->_[t & (a->size - 1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return p;
+}
+/*
+ * the deque of the thread, while it runs gc_parallel
+ */
+static __thread struct _cee_gc_deque * _cee_gc_self;
+/*
+ * set the mark of cs, false if it was already set. The bit-fields of
+ * the collectors take the first byte of sect, which no other thread
+ * writes while the marking runs.
+ */
+static bool _cee_common_claim (struct sect * cs, int mark) {
+  uint8_t * bits = (uint8_t *)cs, old = __atomic_load_n(bits, __ATOMIC_RELAXED), want;
+  struct sect probe;
+  do {
+    memcpy(&probe, &old, 1);
+    if (probe.gc_mark == mark)
+      return false;
+    probe.gc_mark = mark;
+    memcpy(&want, &probe, 1);
+  } while (!__atomic_compare_exchange_n(bits, &old, want, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return true;
+}
+/*
+ * the mark of an object that is traced, gc_parallel has set it already
+ * and other threads may be reading it
+ */
+static void _cee_common_mark (struct sect * cs, enum trace_action ta) {
+  if (cs->gc_mark != ta - trace_mark)
+    cs->gc_mark = ta - trace_mark;
+}
 void cee::trace (void *p, enum trace_action ta) {
   if (!p) cee::segfault();
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
-  cs->trace(p, ta);
+  if (ta >= trace_mark && cs->state) {
+    switch (cs->state->gc_phase) {
+      case state::gc_marking:
+        // an incremental collection traces what an object points to later
+        _cee_common_shade(cs, cs->state);
+        return;
+      case state::gc_minor_marking:
+        // a minor collection stops at old objects, and at young ones it
+        // has already marked
+        if (cs->gc_old || cs->gc_mark == ta - trace_mark)
+          return;
+        break;
+      case state::gc_parallel_marking:
+        // the thread that marks an object traces it
+        if (_cee_common_claim(cs, ta - trace_mark))
+          _cee_gc_push(_cee_gc_self, p);
+        return;
+      default:
+        break;
+    }
+  }
+  _cee_types[cs->type].trace(p, ta);
 }
 /*
  * a generic resource delete function for all cee_* pointers
@@ -1027,17 +1701,33 @@ void cee::trace (void *p, enum trace_action ta) {
 void cee::del(void *p) {
   if (!p) cee::segfault();
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
-  cs->trace(p, trace_del_follow);
+  _cee_types[cs->type].trace(p, trace_del_follow);
+}
+static void _cee_shared_del_ref (struct sect * cs, void * p) {
+  if (cs->retained) return;
+  /*
+   * a count that is already zero is not held by anyone else
+   */
+  if (__atomic_load_n(&cs->in_degree, __ATOMIC_ACQUIRE)
+      && __atomic_sub_fetch(&cs->in_degree, 1, __ATOMIC_ACQ_REL))
+    return;
+  struct _cee_lock l = _cee_state_lock(cs->state);
+  _cee_types[cs->type].trace(p, trace_del_follow);
+  _cee_state_unlock(l);
 }
 void cee::del_ref(void *p) {
   if (!p) cee::segfault();
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+  if (cs->shared) {
+    _cee_shared_del_ref(cs, p);
+    return;
+  }
   if (cs->in_degree) cs->in_degree --;
   /* if it's retained by an owner,
      it should be freed by cee_del
   */
   if (cs->retained) return;
-  if (!cs->in_degree) cs->trace(p, trace_del_follow);
+  if (!cs->in_degree) _cee_types[cs->type].trace(p, trace_del_follow);
 }
 void cee::use_realloc(void * p) {
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
@@ -1057,20 +1747,47 @@ void cee::segfault() {
 static void _cee_common_incr_rc (void * p) {
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
   if (cs->retained) return;
-  cs->in_degree ++;
+  if (cs->shared)
+    __atomic_add_fetch(&cs->in_degree, 1, __ATOMIC_RELAXED);
+  else
+    cs->in_degree ++;
 }
 static void _cee_common_decr_rc (void * p) {
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
   if (cs->retained) return;
-  if (cs->in_degree)
+  if (cs->shared) {
+    uint32_t n = __atomic_load_n(&cs->in_degree, __ATOMIC_RELAXED);
+    while (n && !__atomic_compare_exchange_n(&cs->in_degree, &n, n - 1, true,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      ;
+  }
+  else if (cs->in_degree)
     cs->in_degree --;
   else {
     // report warnings
   }
 }
-uint16_t get_in_degree (void * p) {
+uint32_t cee::get_rc (void * p) {
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
-  return cs->in_degree;
+  return __atomic_load_n(&cs->in_degree, __ATOMIC_RELAXED);
+}
+/*
+ * the links of tagged::memoize and tagged::link. A list, a map or a
+ * tagged value is linked while it has a single owner that counts, a new
+ * owner drops the memo that depends on it. One that gains an owner that
+ * does not count is never linked again.
+ */
+static tagged::data * const _cee_many_owners = (tagged::data *)1;
+static tagged::data ** _cee_common_link_of (struct sect * cs);
+static void _cee_common_changed (struct sect * cs);
+static void _cee_common_owned (struct sect * cs, enum del_policy o);
+void cee::share (void * p) {
+  struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+  // the owners taken by other threads are not seen
+  _cee_common_owned(cs, dp_noop);
+  cs->shared = 1;
+  if (cs->state)
+    cs->state->shared = true;
 }
 static void _cee_common_retain (void *p) {
   struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
@@ -1086,6 +1803,21 @@ static void _cee_common_release (void * p) {
   }
 }
 void cee::incr_indegree (enum del_policy o, void * p) {
+  struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+  if (!cs->shared)
+    _cee_common_owned(cs, o);
+  /*
+   * the write barrier: an object stored while marking may be the last
+   * reference to it, it would otherwise be missed if the container has
+   * already been traced. Threads that take references to a shared object
+   * shade it under the lock of the state, as gc_step runs under it.
+   */
+  if (cs->state) {
+    struct _cee_lock l = _cee_state_lock(cs->shared ? cs->state : NULL);
+    if (cs->state->gc_phase == state::gc_marking)
+      _cee_common_shade(cs, cs->state);
+    _cee_state_unlock(l);
+  }
   switch(o) {
     case dp_del_rc:
       _cee_common_incr_rc(p);
@@ -1097,6 +1829,11 @@ void cee::incr_indegree (enum del_policy o, void * p) {
       break;
   }
 }
+void cee::write_barrier (void * container, void * p) {
+  struct sect * c = (struct sect *)((void *)((char *)container - sizeof(struct cee::sect)));
+  _cee_common_changed(c);
+  _cee_common_write_barrier(c, p);
+}
 void cee::decr_indegree (enum del_policy o, void * p) {
   switch(o) {
     case dp_del_rc:
@@ -1129,24 +1866,10 @@ struct _cee_boxed_header {
   union primitive_value _[1];
 };
 static void _cee_boxed_chain (struct _cee_boxed_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_boxed_de_chain (struct _cee_boxed_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_boxed_header * _cee_boxed_resize(struct _cee_boxed_header * h, size_t n)
 {
@@ -1178,31 +1901,30 @@ static void _cee_boxed_trace (void * v, enum trace_action ta) {
     case trace_del_follow:
     case trace_del_no_follow:
       _cee_boxed_de_chain(m);
-      free(m);
+      _cee_slab_free(m, sizeof(struct _cee_boxed_header));
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       break;
   }
 }
 static int _cee_boxed_cmp (void * v1, void * v2) {
   struct _cee_boxed_header * h1 = (struct _cee_boxed_header *)((void *)((char *)(v1) - (__builtin_offsetof(struct _cee_boxed_header, _))));
   struct _cee_boxed_header * h2 = (struct _cee_boxed_header *)((void *)((char *)(v2) - (__builtin_offsetof(struct _cee_boxed_header, _))));
-  if (h1->cs.trace == h2->cs.trace)
+  if (h1->cs.type == h2->cs.type)
     segfault();
   else
     segfault();
 }
 static struct _cee_boxed_header * _cee_boxed_mk_header(state::data * s, enum primitive_type t) {
   size_t mem_block_size = sizeof(struct _cee_boxed_header);
-  struct _cee_boxed_header * b = (struct _cee_boxed_header *)malloc(mem_block_size);
+  struct _cee_boxed_header * b = (struct _cee_boxed_header *)_cee_slab_alloc(s, mem_block_size);
   do{ memset(&b->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_boxed_chain(b, s);
-  b->cs.trace = _cee_boxed_trace;
+  b->cs.type = _cee_type_boxed;
   b->cs.resize_method = resize_with_identity;
   b->cs.mem_block_size = mem_block_size;
-  b->cs.cmp = NULL;
   b->cs.n_product = 0;
+  _cee_boxed_chain(b, s);
   b->type = t;
   b->_[0].u64 = 0;
   return b;
@@ -1218,7 +1940,6 @@ static int _cee_boxed_cmp_double(double v1, double v2) {
 boxed::data * from_double (state::data * s, double d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_f64);
-  b->cs.cmp = (void *)_cee_boxed_cmp_double;
   b->_[0].f64 = d;
   return (boxed::data *)b->_;
 }
@@ -1233,7 +1954,6 @@ static int _cee_boxed_cmp_float(float v1, float v2) {
 boxed::data * from_float (state::data * s, float d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_f32);
-  b->cs.cmp = (void *)_cee_boxed_cmp_float;
   b->_[0].f32 = d;
   return (boxed::data *)b->_;
 }
@@ -1262,7 +1982,6 @@ static int _cee_boxed_cmp_u32(uint32_t v1, uint32_t v2) {
 boxed::data * from_u32 (state::data * s, uint32_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_u32);
-  b->cs.cmp = (void *)_cee_boxed_cmp_u32;
   b->_[0].u32 = d;
   return (boxed::data *)b->_;
 }
@@ -1277,7 +1996,6 @@ static int _cee_boxed_cmp_u16(uint16_t v1, uint16_t v2) {
 boxed::data * from_u16 (state::data * s, uint16_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_u16);
-  b->cs.cmp = (void *) _cee_boxed_cmp_u16;
   b->_[0].u16 = d;
   return (boxed::data *)b->_;
 }
@@ -1292,7 +2010,6 @@ static int _cee_boxed_cmp_u8(uint8_t v1, uint8_t v2) {
 boxed::data * from_u8 (state::data * s, uint8_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_u8);
-  b->cs.cmp = (void *)_cee_boxed_cmp_u8;
   b->_[0].u8 = d;
   return (boxed::data *)b->_;
 }
@@ -1307,7 +2024,6 @@ static int _cee_boxed_cmp_i64(int64_t v1, int64_t v2) {
 boxed::data * from_i64 (state::data *s, int64_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_i64);
-  b->cs.cmp = (void *)_cee_boxed_cmp_i64;
   b->_[0].i64 = d;
   return (boxed::data *)b->_;
 }
@@ -1322,7 +2038,6 @@ static int _cee_boxed_cmp_i32(int32_t v1, int32_t v2) {
 boxed::data * from_i32 (state::data * s, int32_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_i32);
-  b->cs.cmp = (void *)_cee_boxed_cmp_i32;
   b->_[0].i32 = d;
   return (boxed::data *)b->_;
 }
@@ -1337,7 +2052,6 @@ static int _cee_boxed_cmp_i16(int16_t v1, int16_t v2) {
 boxed::data * from_i16 (state::data * s, int16_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_i16);
-  b->cs.cmp = (void *)_cee_boxed_cmp_i16;
   b->_[0].i16 = d;
   return (boxed::data *)b->_;
 }
@@ -1352,7 +2066,6 @@ static int _cee_boxed_cmp_i8(int8_t v1, int8_t v2) {
 boxed::data * from_i8 (state::data *s, int8_t d) {
   size_t mem_block_size = sizeof(boxed::data);
   struct _cee_boxed_header * b = _cee_boxed_mk_header(s, primitive_i8);
-  b->cs.cmp = (void *)_cee_boxed_cmp_i8;
   b->_[0].i8 = d;
   return (boxed::data *)b->_;
 }
@@ -1392,6 +2105,10 @@ size_t snprint (char * buf, size_t size, boxed::data * x) {
   else
     segfault();
 }
+enum primitive_type type (boxed::data * x) {
+  struct _cee_boxed_header * h = (struct _cee_boxed_header *)((void *)((char *)(x) - (__builtin_offsetof(struct _cee_boxed_header, _))));
+  return h->type;
+}
 double to_double (boxed::data * x) {
   struct _cee_boxed_header * h = (struct _cee_boxed_header *)((void *)((char *)(x) - (__builtin_offsetof(struct _cee_boxed_header, _))));
   if (h->type == primitive_f64)
@@ -1472,24 +2189,10 @@ struct _cee_str_header {
   char _[1];
 };
 static void _cee_str_chain (struct _cee_str_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_str_de_chain (struct _cee_str_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_str_header * _cee_str_resize(struct _cee_str_header * h, size_t n)
 {
@@ -1508,6 +2211,7 @@ static struct _cee_str_header * _cee_str_resize(struct _cee_str_header * h, size
      memcpy(ret, h, h->cs.mem_block_size);
       ret->cs.mem_block_size = n;
       _cee_str_chain(ret, state);
+      _cee_common_drop_resized(&h->cs, h);
       break;
     case resize_with_identity:
       ret = h;
@@ -1524,7 +2228,7 @@ static void _cee_str_trace (void * p, enum trace_action ta) {
       free(m);
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       break;
   }
 }
@@ -1544,13 +2248,12 @@ str::data * mk (state::data * st, const char * fmt, ...) {
   size_t mem_block_size = s;
   struct _cee_str_header * h = (struct _cee_str_header *)malloc(mem_block_size);
   do{ memset(&h->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_str_chain(h, st);
-  h->cs.trace = _cee_str_trace;
+  h->cs.type = _cee_type_str;
   h->cs.resize_method = resize_with_malloc;
   h->cs.mem_block_size = mem_block_size;
-  h->cs.cmp = (void *)strcmp;
   h->cs.cmp_stop_at_null = 1;
   h->cs.n_product = 0;
+  _cee_str_chain(h, st);
   h->capacity = s - sizeof(struct _cee_str_header);
   va_start(ap, fmt);
   vsnprintf(h->_, s, fmt, ap);
@@ -1570,10 +2273,9 @@ str::data * mk_e (state::data * st, size_t n, const char * fmt, ...) {
   size_t mem_block_size = (s / 64 + 1) * 64;
   struct _cee_str_header * m = (struct _cee_str_header *) malloc(mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  m->cs.trace = _cee_str_trace;
+  m->cs.type = _cee_type_str;
   m->cs.resize_method = resize_with_malloc;
   m->cs.mem_block_size = mem_block_size;
-  m->cs.cmp = (void *)strcmp;
   m->cs.cmp_stop_at_null = 1;
   _cee_str_chain(m, st);
   m->capacity = mem_block_size - sizeof(struct _cee_str_header);
@@ -1589,7 +2291,7 @@ str::data * mk_e (state::data * st, size_t n, const char * fmt, ...) {
 static void _cee_str_noop(void * v, enum trace_action ta) {}
 struct cee_block * cee_block_empty () {
   static struct _cee_str_header singleton;
-  singleton.cs.trace = _cee_str_noop;
+  singleton.cs.type = _cee_type_str_empty;
   singleton.cs.resize_method = resize_with_malloc;
   singleton.cs.mem_block_size = sizeof(struct _cee_str_header);
   singleton.capacity = 1;
@@ -1624,10 +2326,11 @@ str::data * add(str::data * str, char c) {
     return (str::data *)(b->_);
   }
   else {
+    uintptr_t capacity = b->capacity;
     struct _cee_str_header * b1 = _cee_str_resize(b, b->cs.mem_block_size + 64);
-    b1->capacity = b->capacity + 64;
-    b1->_[b->capacity] = c;
-    b1->_[b->capacity+1] = '\0';
+    b1->capacity = capacity + 64;
+    b1->_[capacity] = c;
+    b1->_[capacity+1] = '\0';
     return (str::data *)(b1->_);
   }
 }
@@ -1646,7 +2349,9 @@ str::data * catf(str::data * str, const char * fmt, ...) {
     return str;
   }
   else {
-    struct _cee_str_header * b1 = _cee_str_resize(b, slen + s);
+    size_t n = ((sizeof(struct _cee_str_header) + slen + s) / 64 + 1) * 64;
+    struct _cee_str_header * b1 = _cee_str_resize(b, n);
+    b1->capacity = n - sizeof(struct _cee_str_header);
     vsnprintf(b1->_ + slen, s, fmt, ap);
     return (str::data *)(b1->_);
   }
@@ -1667,24 +2372,10 @@ struct _cee_dict_header {
   struct musl_hsearch_data _[1];
 };
 static void _cee_dict_chain (struct _cee_dict_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_dict_de_chain (struct _cee_dict_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_dict_header * _cee_dict_resize(struct _cee_dict_header * h, size_t n)
 {
@@ -1726,7 +2417,7 @@ static void _cee_dict_trace(void *d, enum trace_action ta) {
       free(m);
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       trace(m->keys, ta);
       trace(m->vals, ta);
       break;
@@ -1742,11 +2433,11 @@ dict::data * mk_e (state::data * s, enum del_policy o, size_t size) {
   use_realloc(m->vals);
   m->size = size;
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_dict_chain(m, s);
-  m->cs.trace = _cee_dict_trace;
+  m->cs.type = _cee_type_dict;
   m->cs.mem_block_size = mem_block_size;
   m->cs.resize_method = resize_with_identity;
   m->cs.n_product = 2; // key:str, value
+  _cee_dict_chain(m, s);
   size_t hsize = (size_t)((float)size * 1.25);
   memset(m->_, 0, sizeof(struct musl_hsearch_data));
   if (musl_hcreate_r(hsize, m->_)) {
@@ -1788,6 +2479,7 @@ namespace cee {
   namespace map {
 struct _cee_map_header {
   void * context;
+  tagged::data * owner;   // caches what it derives from the map, see tagged::memoize
   int (*cmp)(const void *l, const void *r);
   uintptr_t size;
   enum del_policy key_del_policy;
@@ -1797,24 +2489,10 @@ struct _cee_map_header {
   void * _[1];
 };
 static void _cee_map_chain (struct _cee_map_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_map_de_chain (struct _cee_map_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_map_header * _cee_map_resize(struct _cee_map_header * h, size_t n)
 {
@@ -1863,15 +2541,15 @@ static void _cee_map_trace(void * p, enum trace_action ta) {
     case trace_del_no_follow:
       musl_tdestroy(NULL, h->_[0], NULL);
       _cee_map_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_map_header));
       break;
     case trace_del_follow:
       musl_tdestroy((void *)&ta, h->_[0], _cee_map_free_pair_follow);
       _cee_map_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_map_header));
       break;
     default:
-      h->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&h->cs, ta);
       h->ta = ta;
       musl_twalk(&ta, h->_[0], _cee_map_trace_pair);
       break;
@@ -1886,18 +2564,18 @@ static int _cee_map_cmp (void * cxt, const void * v1, const void * v2) {
 map::data * mk_e (state::data * st, enum del_policy o[2],
                   int (*cmp)(const void *, const void *)) {
   size_t mem_block_size = sizeof(struct _cee_map_header);
-  struct _cee_map_header * m = (struct _cee_map_header *)malloc(mem_block_size);
+  struct _cee_map_header * m = (struct _cee_map_header *)_cee_slab_alloc(st, mem_block_size);
   m->context = NULL;
+  m->owner = NULL;
   m->cmp = cmp;
   m->size = 0;
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_map_chain(m, st);
-  m->cs.trace = _cee_map_trace;
+  m->cs.type = _cee_type_map;
   m->cs.resize_method = resize_with_identity;
   m->cs.mem_block_size = mem_block_size;
-  m->cs.cmp = 0;
   m->cs.cmp_stop_at_null = 0;
   m->cs.n_product = 2; // key, value
+  _cee_map_chain(m, st);
   m->key_del_policy = o[0];
   m->val_del_policy = o[1];
   m->_[0] = 0;
@@ -1917,13 +2595,16 @@ void add(map::data * m, void * key, void * value) {
   d[0] = b->key_del_policy;
   d[1] = b->val_del_policy;
   tuple::data * t = tuple::mk_e(b->cs.state, d, key, value);
-  tuple::data ** oldp = (tuple::data **)musl_tsearch(b, t, b->_, _cee_map_cmp);
+  tuple::data ** oldp = (tuple::data **)musl_tsearch(b, b->cs.state, t, b->_, _cee_map_cmp);
   if (oldp == NULL)
     segfault(); // run out of memory
   else if (*oldp != t)
     del(t);
-  else
+  else {
+    _cee_common_changed(&b->cs);
     b->size ++;
+    _cee_common_write_barrier(&b->cs, t);
+  }
   return;
 }
 void * find(map::data * m, void * key) {
@@ -1939,17 +2620,18 @@ void * find(map::data * m, void * key) {
 }
 void * remove(map::data * m, void * key) {
   struct _cee_map_header * b = (struct _cee_map_header *)((void *)((char *)(m) - (__builtin_offsetof(struct _cee_map_header, _))));
-  void ** oldp = (void **)musl_tdelete(b, key, b->_, _cee_map_cmp);
-  if (oldp == NULL)
+  tuple::data t = { key, 0 };
+  tuple::data ** pp = (tuple::data **)musl_tfind(b, &t, b->_, _cee_map_cmp);
+  if (pp == NULL)
     return NULL;
-  else {
-    b->size --;
-    tuple::data * ret = (tuple::data *)*oldp;
-    del(ret);
-    decr_indegree(b->key_del_policy, ret->_[0]);
-    decr_indegree(b->val_del_policy, ret->_[1]);
-    return ret->_[1];
-  }
+  tuple::data * ret = *pp;
+  void * value = ret->_[1];
+  musl_tdelete(b, &t, b->_, _cee_map_cmp);
+  _cee_common_changed(&b->cs);
+  b->size --;
+  // the pair releases the key and the value by their del policies
+  del(ret);
+  return value;
 }
 static void _cee_map_get_key (void * cxt, const void *nodep, const VISIT which, const int depth) {
   tuple::data * p;
@@ -1992,6 +2674,29 @@ list::data * values(map::data * m) {
   b->context = values;
   musl_twalk(&values, b->_[0], _cee_map_get_value);
   return values;
+}
+struct _cee_map_walk_cxt {
+  void * cxt;
+  void (*f)(void *, void *, void *);
+};
+static void _cee_map_walk (void * cxt, const void *nodep, const VISIT which, const int depth) {
+  struct _cee_map_walk_cxt * w = (struct _cee_map_walk_cxt *)cxt;
+  tuple::data * p;
+  switch (which)
+  {
+    case postorder:
+    case leaf:
+      p = (tuple::data *)*(void **)nodep;
+      w->f(w->cxt, p->_[0], p->_[1]);
+      break;
+    default:
+      break;
+  }
+}
+void walk(map::data * m, void * cxt, void (*f)(void *, void *, void *)) {
+  struct _cee_map_header * b = (struct _cee_map_header *)((void *)((char *)(m) - (__builtin_offsetof(struct _cee_map_header, _))));
+  struct _cee_map_walk_cxt w = { cxt, f };
+  musl_twalk(&w, b->_[0], _cee_map_walk);
 }
   }
 }
@@ -2007,24 +2712,10 @@ struct _cee_set_header {
   void * _[1];
 };
 static void _cee_set_chain (struct _cee_set_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_set_de_chain (struct _cee_set_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_set_header * _cee_set_resize(struct _cee_set_header * h, size_t n)
 {
@@ -2074,15 +2765,15 @@ static void _cee_set_trace(void * p, enum trace_action ta) {
     case trace_del_no_follow:
       musl_tdestroy(NULL, h->_[0], NULL);
       _cee_set_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_set_header));
       break;
     case trace_del_follow:
       musl_tdestroy(NULL, h->_[0], _cee_set_free_pair_follow);
       _cee_set_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_set_header));
       break;
     default:
-      h->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&h->cs, ta);
       h->ta = ta;
       musl_twalk(&ta, h->_[0], _cee_set_trace_pair);
       break;
@@ -2100,14 +2791,15 @@ int _cee_set_cmp (void * cxt, const void * v1, const void *v2) {
 set::data * mk_e (state::data * st, enum del_policy o,
                   int (*cmp)(const void *, const void *))
 {
-  struct _cee_set_header * m = (struct _cee_set_header *)malloc(sizeof(struct _cee_set_header));
+  struct _cee_set_header * m = (struct _cee_set_header *)_cee_slab_alloc(st, sizeof(struct _cee_set_header));
   m->cmp = cmp;
   m->size = 0;
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_set_chain(m, st);
-  m->cs.trace = _cee_set_trace;
+  m->cs.type = _cee_type_set;
+  m->cs.mem_block_size = sizeof(struct _cee_set_header);
   m->cs.resize_method = resize_with_identity;
   m->cs.n_product = 1;
+  _cee_set_chain(m, st);
   m->context = NULL;
   m->_[0] = NULL;
   m->del_policy = o;
@@ -2130,13 +2822,14 @@ bool empty (set::data * s) {
  */
 void add(set::data *m, void * val) {
   struct _cee_set_header * h = (struct _cee_set_header *)((void *)((char *)(m) - (__builtin_offsetof(struct _cee_set_header, _))));
-  void ** oldp = (void **) musl_tsearch(h, val, h->_, _cee_set_cmp);
+  void ** oldp = (void **) musl_tsearch(h, h->cs.state, val, h->_, _cee_set_cmp);
   if (oldp == NULL)
     segfault();
   else if (*oldp != (void *)val)
     return;
   else {
     h->size ++;
+    _cee_common_write_barrier(&h->cs, val);
     incr_indegree(h->del_policy, val);
   }
   return;
@@ -2233,24 +2926,10 @@ struct _cee_stack_header {
   void * _[];
 };
 static void _cee_stack_chain (struct _cee_stack_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_stack_de_chain (struct _cee_stack_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_stack_header * _cee_stack_resize(struct _cee_stack_header * h, size_t n)
 {
@@ -2291,7 +2970,7 @@ static void _cee_stack_trace (void * v, enum trace_action ta) {
       free(m);
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       for (i = 0; i < m->used; i++)
         trace(m->_[i], ta);
       break;
@@ -2305,9 +2984,9 @@ stack::data * mk_e (state::data * st, enum del_policy o, size_t size) {
   m->top = (0-1);
   m->del_policy = o;
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_stack_chain(m, st);
-  m->cs.trace = _cee_stack_trace;
+  m->cs.type = _cee_type_stack;
   m->cs.mem_block_size = mem_block_size;
+  _cee_stack_chain(m, st);
   return (stack::data *)(m->_);
 }
 stack::data * mk (state::data * st, size_t size) {
@@ -2320,6 +2999,7 @@ int push (stack::data * v, void *e) {
   m->top ++;
   m->used ++;
   m->_[m->top] = e;
+  _cee_common_write_barrier(&m->cs, e);
   incr_indegree(m->del_policy, e);
   return 1;
 }
@@ -2375,24 +3055,10 @@ struct _cee_tuple_header {
   void * _[2];
 };
 static void _cee_tuple_chain (struct _cee_tuple_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_tuple_de_chain (struct _cee_tuple_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_tuple_header * _cee_tuple_resize(struct _cee_tuple_header * h, size_t n)
 {
@@ -2424,16 +3090,16 @@ static void _cee_tuple_trace(void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_tuple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_tuple_header));
       break;
     case trace_del_follow:
       for (i = 0; i < 2; i++)
         del_e(b->del_policies[i], b->_[i]);
       _cee_tuple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_tuple_header));
       break;
     default:
-      b->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&b->cs, ta);
       for (i = 0; i < 2; i++)
         trace(b->_[i], ta);
       break;
@@ -2441,13 +3107,13 @@ static void _cee_tuple_trace(void * v, enum trace_action ta) {
 }
 tuple::data * mk_e (state::data * st, enum del_policy o[2], void * v1, void * v2) {
   size_t mem_block_size = sizeof(struct _cee_tuple_header);
-  struct _cee_tuple_header * m = (struct _cee_tuple_header *) malloc(mem_block_size);
+  struct _cee_tuple_header * m = (struct _cee_tuple_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_tuple_chain(m, st);
-  m->cs.trace = _cee_tuple_trace;
+  m->cs.type = _cee_type_tuple;
   m->cs.resize_method = resize_with_identity;
   m->cs.mem_block_size = mem_block_size;
   m->cs.state = st;
+  _cee_tuple_chain(m, st);
   m->_[0] = v1;
   m->_[1] = v2;
   int i;
@@ -2471,24 +3137,10 @@ struct _cee_triple_header {
   void * _[3];
 };
 static void _cee_triple_chain (struct _cee_triple_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_triple_de_chain (struct _cee_triple_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_triple_header * _cee_triple_resize(struct _cee_triple_header * h, size_t n)
 {
@@ -2520,16 +3172,16 @@ static void _cee_triple_trace(void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_triple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_triple_header));
       break;
     case trace_del_follow:
       for (i = 0; i < 3; i++)
         del_e(b->del_policies[i], b->_[i]);
       _cee_triple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_triple_header));
       break;
     default:
-      b->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&b->cs, ta);
       for (i = 0; i < 3; i++)
         trace(b->_[i], ta);
       break;
@@ -2537,13 +3189,13 @@ static void _cee_triple_trace(void * v, enum trace_action ta) {
 }
 triple::data * mk_e (state::data * st, enum del_policy o[3], void * v1, void * v2, void * v3) {
   size_t mem_block_size = sizeof(struct _cee_triple_header);
-  struct _cee_triple_header * m = (struct _cee_triple_header *)malloc(mem_block_size);
+  struct _cee_triple_header * m = (struct _cee_triple_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_triple_chain(m, st);
-  m->cs.trace = _cee_triple_trace;
+  m->cs.type = _cee_type_triple;
   m->cs.resize_method = resize_with_identity;
   m->cs.mem_block_size = mem_block_size;
   m->cs.state = st;
+  _cee_triple_chain(m, st);
   m->_[0] = v1;
   m->_[1] = v2;
   m->_[2] = v3;
@@ -2570,24 +3222,10 @@ struct _cee_quadruple_header {
   void * _[4];
 };
 static void _cee_quadruple_chain (struct _cee_quadruple_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_quadruple_de_chain (struct _cee_quadruple_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_quadruple_header * _cee_quadruple_resize(struct _cee_quadruple_header * h, size_t n)
 {
@@ -2619,16 +3257,16 @@ static void _cee_quadruple_trace(void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_quadruple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_quadruple_header));
       break;
     case trace_del_follow:
       for (i = 0; i < 4; i++)
         del_e(b->del_policies[i], b->_[i]);
       _cee_quadruple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_quadruple_header));
       break;
     default:
-      b->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&b->cs, ta);
       for (i = 0; i < 4; i++)
         trace(b->_[i], ta);
       break;
@@ -2637,14 +3275,14 @@ static void _cee_quadruple_trace(void * v, enum trace_action ta) {
 quadruple::data * mk_e (state::data * st, enum del_policy o[4],
                         void * v1, void * v2, void * v3, void * v4) {
   size_t mem_block_size = sizeof(struct _cee_quadruple_header);
-  struct _cee_quadruple_header * m = (struct _cee_quadruple_header *) malloc(mem_block_size);
+  struct _cee_quadruple_header * m = (struct _cee_quadruple_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_quadruple_chain(m, st);
-  m->cs.trace = _cee_quadruple_trace;
+  m->cs.type = _cee_type_quadruple;
   m->cs.resize_method = resize_with_identity;
   m->cs.mem_block_size = mem_block_size;
   m->cs.n_product = 4;
   m->cs.state = st;
+  _cee_quadruple_chain(m, st);
   m->_[0] = v1;
   m->_[1] = v2;
   m->_[2] = v3;
@@ -2664,28 +3302,15 @@ struct _cee_list_header {
   uintptr_t size;
   uintptr_t capacity;
   enum del_policy del_policy;
+  tagged::data * owner;   // caches what it derives from the list, see tagged::memoize
   struct sect cs;
   void * _[];
 };
 static void _cee_list_chain (struct _cee_list_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_list_de_chain (struct _cee_list_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_list_header * _cee_list_resize(struct _cee_list_header * h, size_t n)
 {
@@ -2704,6 +3329,7 @@ static struct _cee_list_header * _cee_list_resize(struct _cee_list_header * h, s
      memcpy(ret, h, h->cs.mem_block_size);
       ret->cs.mem_block_size = n;
       _cee_list_chain(ret, state);
+      _cee_common_drop_resized(&h->cs, h);
       break;
     case resize_with_identity:
       ret = h;
@@ -2726,7 +3352,7 @@ static void _cee_list_trace (void * v, enum trace_action ta) {
       free(m);
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       for (i = 0; i < m->size; i++)
         trace(m->_[i], ta);
       break;
@@ -2738,11 +3364,12 @@ list::data * mk_e (state::data * st, enum del_policy o, size_t cap) {
   m->capacity = cap;
   m->size = 0;
   m->del_policy = o;
+  m->owner = NULL;
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_list_chain(m, st);
-  m->cs.trace = _cee_list_trace;
+  m->cs.type = _cee_type_list;
   m->cs.resize_method = resize_with_malloc;
   m->cs.mem_block_size = mem_block_size;
+  _cee_list_chain(m, st);
   return (list::data *)(m->_);
 }
 list::data * mk (state::data * s, size_t cap) {
@@ -2762,15 +3389,13 @@ list::data * append (list::data ** l, void *e) {
   }
   m->_[m->size] = e;
   m->size ++;
+  _cee_common_changed(&m->cs);
+  _cee_common_write_barrier(&m->cs, e);
   incr_indegree(m->del_policy, e);
   return *l;
 }
-list::data * insert(state::data * s, list::data ** l, size_t index, void *e) {
+list::data * insert(list::data ** l, size_t index, void *e) {
   list::data * v = *l;
-  if (v == NULL) {
-    v = mk(s, 10);
-    use_realloc(v);
-  }
   struct _cee_list_header * m = (struct _cee_list_header *)((void *)((char *)(v) - (__builtin_offsetof(struct _cee_list_header, _))));
   size_t capacity = m->capacity;
   size_t extra_cap = capacity ? capacity : 1;
@@ -2786,6 +3411,8 @@ list::data * insert(state::data * s, list::data ** l, size_t index, void *e) {
     m->_[i] = m->_[i-1];
   m->_[index] = e;
   m->size ++;
+  _cee_common_changed(&m->cs);
+  _cee_common_write_barrier(&m->cs, e);
   incr_indegree(m->del_policy, e);
   return *l;
 }
@@ -2798,6 +3425,7 @@ bool remove(list::data * v, size_t index) {
   for (i = index; i < (m->size - 1); i++)
     m->_[i] = m->_[i+1];
   m->size --;
+  _cee_common_changed(&m->cs);
   decr_indegree(m->del_policy, e);
   return true;
 }
@@ -2815,28 +3443,17 @@ namespace cee {
   namespace tagged {
 struct _cee_tagged_header {
   enum del_policy del_policy;
+  bool memo_valid;        // memo is derived from what ptr points to now
+  uint64_t memo;
+  tagged::data * parent;  // the memo of parent is derived from this one, see link
   struct sect cs;
   struct tagged::data _;
 };
 static void _cee_tagged_chain (struct _cee_tagged_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_tagged_de_chain (struct _cee_tagged_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_tagged_header * _cee_tagged_resize(struct _cee_tagged_header * h, size_t n)
 {
@@ -2867,38 +3484,119 @@ static void _cee_tagged_trace (void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_tagged_de_chain(m);
-      free(m);
+      _cee_slab_free(m, sizeof(struct _cee_tagged_header));
       break;
     case trace_del_follow:
       del_e(m->del_policy, m->_.ptr._);
       _cee_tagged_de_chain(m);
-      free(m);
+      _cee_slab_free(m, sizeof(struct _cee_tagged_header));
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       trace(m->_.ptr._, ta);
       break;
   }
 }
 tagged::data * mk_e (state::data * st, enum del_policy o, uintptr_t tag, void *p) {
   size_t mem_block_size = sizeof(struct _cee_tagged_header);
-  struct _cee_tagged_header * b = (struct _cee_tagged_header *)malloc(mem_block_size);
+  struct _cee_tagged_header * b = (struct _cee_tagged_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&b->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_tagged_chain(b, st);
-  b->cs.trace = _cee_tagged_trace;
+  b->cs.type = _cee_type_tagged;
   b->cs.resize_method = resize_with_identity;
   b->cs.mem_block_size = mem_block_size;
+  _cee_tagged_chain(b, st);
   b->_.tag = tag;
   b->_.ptr._ = p;
   b->del_policy = o;
+  b->memo_valid = false;
+  b->memo = 0;
+  b->parent = NULL;
   incr_indegree(o, p);
   return &b->_;
 }
 tagged::data * mk (state::data * st, uintptr_t tag, void *p) {
   return mk_e(st, CEE_DEFAULT_DEL_POLICY, tag, p);
+}
+bool memoize (tagged::data * t, uint64_t value) {
+  struct _cee_tagged_header * b = (struct _cee_tagged_header *)((void *)((char *)(t) - (__builtin_offsetof(struct _cee_tagged_header, _))));
+  if (t->ptr._) {
+    struct sect * cs = (struct sect *)((void *)((char *)t->ptr._ - sizeof(struct cee::sect)));
+    tagged::data ** owner = _cee_common_link_of(cs);
+    if (owner == NULL) {
+      if (cs->type != _cee_type_str && cs->type != _cee_type_str_empty
+          && cs->type != _cee_type_boxed)
+        return false;
+    }
+    else if (*owner != t) {
+      if (*owner || cs->in_degree != 1 || cs->retained || cs->shared)
+        return false;
+      *owner = t;
+    }
+  }
+  b->memo = value;
+  b->memo_valid = true;
+  return true;
+}
+bool recall (tagged::data * t, uint64_t * value) {
+  struct _cee_tagged_header * b = (struct _cee_tagged_header *)((void *)((char *)(t) - (__builtin_offsetof(struct _cee_tagged_header, _))));
+  if (!b->memo_valid)
+    return false;
+  *value = b->memo;
+  return true;
+}
+bool link (tagged::data * child, tagged::data * parent) {
+  struct _cee_tagged_header * b = (struct _cee_tagged_header *)((void *)((char *)(child) - (__builtin_offsetof(struct _cee_tagged_header, _))));
+  if (b->parent == parent)
+    return true;
+  if (b->parent || b->cs.in_degree != 1 || b->cs.retained || b->cs.shared)
+    return false;
+  b->parent = parent;
+  return true;
 }
   }
 }
+/*
+ * drop the memo of t and of the tagged values it is linked under. An
+ * ancestor of a tagged value without a memo has none either, the walk
+ * stops there.
+ */
+static void _cee_tagged_forget (tagged::data * t) {
+  while (t && t != _cee_many_owners) {
+    struct tagged::_cee_tagged_header * b = (struct tagged::_cee_tagged_header *)((void *)((char *)(t) - (__builtin_offsetof(struct tagged::_cee_tagged_header, _))));
+    if (!b->memo_valid)
+      return;
+    b->memo_valid = false;
+    t = b->parent;
+  }
+}
+static tagged::data ** _cee_common_link_of (struct sect * cs) {
+  switch (cs->type) {
+    case _cee_type_list:
+      return &((struct list::_cee_list_header *)((void *)((char *)cs - __builtin_offsetof(struct list::_cee_list_header, cs))))->owner;
+    case _cee_type_map:
+      return &((struct map::_cee_map_header *)((void *)((char *)cs - __builtin_offsetof(struct map::_cee_map_header, cs))))->owner;
+    case _cee_type_tagged:
+      return &((struct tagged::_cee_tagged_header *)((void *)((char *)cs - __builtin_offsetof(struct tagged::_cee_tagged_header, cs))))->parent;
+    default:
+      return NULL;
+  }
+}
+static void _cee_common_changed (struct sect * cs) {
+  tagged::data ** link = _cee_common_link_of(cs);
+  if (link == NULL)
+    return;
+  if (cs->type == _cee_type_tagged)
+    _cee_tagged_forget((tagged::data *)(cs + 1));
+  else
+    _cee_tagged_forget(*link);
+}
+static void _cee_common_owned (struct sect * cs, enum del_policy o) {
+  tagged::data ** link = _cee_common_link_of(cs);
+  if (link == NULL || *link == _cee_many_owners)
+    return;
+  _cee_tagged_forget(*link);
+  *link = o == dp_del_rc ? NULL : _cee_many_owners;
+}
 namespace cee {
   namespace singleton {
 struct _cee_singleton_header {
@@ -2917,7 +3615,7 @@ static void _cee_singleton_noop(void *p, enum trace_action ta) {}
 singleton::data * init(void *s, uintptr_t tag, uintptr_t val) {
   struct _cee_singleton_header * b = (struct _cee_singleton_header *)s;
   do{ memset(&b->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  b->cs.trace = _cee_singleton_noop;
+  b->cs.type = _cee_type_singleton;
   b->cs.resize_method = resize_with_identity;
   b->cs.mem_block_size = 0;
   b->cs.n_product = 0;
@@ -2934,24 +3632,10 @@ struct _cee_closure_header {
   struct data _;
 };
 static void _cee_closure_chain (struct _cee_closure_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_closure_de_chain (struct _cee_closure_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_closure_header * _cee_closure_resize(struct _cee_closure_header * h, size_t n)
 {
@@ -2983,7 +3667,7 @@ static void _cee_closure_trace (void * v, enum trace_action sa) {
     case trace_del_no_follow:
     case trace_del_follow:
       _cee_closure_de_chain(m);
-      free(m);
+      _cee_slab_free(m, sizeof(struct _cee_closure_header));
       break;
     default:
       break;
@@ -2991,12 +3675,12 @@ static void _cee_closure_trace (void * v, enum trace_action sa) {
 }
 struct data * mk (state::data * s, env::data * env, void * fun) {
   size_t mem_block_size = sizeof(struct _cee_closure_header);
-  struct _cee_closure_header * b = (struct _cee_closure_header *)malloc(mem_block_size);
+  struct _cee_closure_header * b = (struct _cee_closure_header *)_cee_slab_alloc(s, mem_block_size);
   do{ memset(&b->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_closure_chain(b, s);
-  b->cs.trace = _cee_closure_trace;
+  b->cs.type = _cee_type_closure;
   b->cs.resize_method = resize_with_identity;
   b->cs.mem_block_size = mem_block_size;
+  _cee_closure_chain(b, s);
   b->_.env = NULL;
   b->_.fun = NULL;
   return &(b->_);
@@ -3012,24 +3696,10 @@ struct _cee_block_header {
   char _[1]; // actual data
 };
 static void _cee_block_chain (struct _cee_block_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_block_de_chain (struct _cee_block_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_block_header * _cee_block_resize(struct _cee_block_header * h, size_t n)
 {
@@ -3064,7 +3734,7 @@ static void _cee_block_trace (void * p, enum trace_action ta) {
       free(m);
       break;
     default:
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       break;
   }
 }
@@ -3077,11 +3747,10 @@ void * mk (state::data * s, size_t n) {
   struct _cee_block_header * m = (struct _cee_block_header *)malloc(mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
   m->del_policy = dp_del_rc;
-  _cee_block_chain(m, s);
-  m->cs.trace = _cee_block_trace;
+  m->cs.type = _cee_type_block;
   m->cs.resize_method = resize_with_malloc;
   m->cs.mem_block_size = mem_block_size;
-  m->cs.cmp = (void *)memcmp;
+  _cee_block_chain(m, s);
   m->capacity = n;
   return (block::data *)(m->_);
 }
@@ -3095,24 +3764,10 @@ struct _cee_n_tuple_header {
   void * _[16];
 };
 static void _cee_n_tuple_chain (struct _cee_n_tuple_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_n_tuple_de_chain (struct _cee_n_tuple_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_n_tuple_header * _cee_n_tuple_resize(struct _cee_n_tuple_header * h, size_t n)
 {
@@ -3144,16 +3799,16 @@ static void _cee_n_tuple_trace(void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_n_tuple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_n_tuple_header));
       break;
     case trace_del_follow:
       for (i = 0; i < b->cs.n_product; i++)
         del_e(b->del_policies[i], b->_[i]);
       _cee_n_tuple_de_chain(b);
-      free(b);
+      _cee_slab_free(b, sizeof(struct _cee_n_tuple_header));
       break;
     default:
-      b->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&b->cs, ta);
       for (i = 0; i < b->cs.n_product; i++)
         trace(b->_[i], ta);
       break;
@@ -3164,13 +3819,13 @@ static struct _cee_n_tuple_header * cee_n_tuple_v (state::data * st, size_t ntup
   if (ntuple > 16)
     segfault();
   size_t mem_block_size = sizeof(struct _cee_n_tuple_header);
-  struct _cee_n_tuple_header * m = (struct _cee_n_tuple_header *) malloc(mem_block_size);
+  struct _cee_n_tuple_header * m = (struct _cee_n_tuple_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&m->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_n_tuple_chain(m, st);
-  m->cs.trace = _cee_n_tuple_trace;
+  m->cs.type = _cee_type_n_tuple;
   m->cs.resize_method = resize_with_identity;
   m->cs.mem_block_size = mem_block_size;
   m->cs.n_product = ntuple;
+  _cee_n_tuple_chain(m, st);
   int i;
   for(i = 0; i < ntuple; i++) {
     m->_[i] = va_arg(ap, void *);
@@ -3201,24 +3856,10 @@ struct _cee_env_header {
   struct data _;
 };
 static void _cee_env_chain (struct _cee_env_header * h, state::data * st) {
-  h->cs.state = st;
-  h->cs.trace_prev = st->trace_tail;
-  st->trace_tail->trace_next = &h->cs;
-  st->trace_tail = &h->cs;
+  _cee_common_chain(&h->cs, st);
 }
 static void _cee_env_de_chain (struct _cee_env_header * h) {
-  state::data * st = h->cs.state;
-  struct sect * prev = h->cs.trace_prev;
-  struct sect * next = h->cs.trace_next;
-  if (st->trace_tail == &h->cs) {
-    prev->trace_next = NULL;
-    st->trace_tail = prev;
-  }
-  else {
-    prev->trace_next = next;
-    if (next)
-      next->trace_prev = prev;
-  }
+  _cee_common_de_chain(&h->cs);
 }
 static struct _cee_env_header * _cee_env_resize(struct _cee_env_header * h, size_t n)
 {
@@ -3249,16 +3890,16 @@ static void _cee_env_trace (void * v, enum trace_action ta) {
   switch (ta) {
     case trace_del_no_follow:
       _cee_env_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_env_header));
       break;
     case trace_del_follow:
       del_e(h->env_dp, h->_.outer);
       del_e(h->vars_dp, h->_.vars);
       _cee_env_de_chain(h);
-      free(h);
+      _cee_slab_free(h, sizeof(struct _cee_env_header));
       break;
     default:
-      h->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&h->cs, ta);
       trace(h->_.outer, ta);
       trace(h->_.vars, ta);
       break;
@@ -3266,14 +3907,13 @@ static void _cee_env_trace (void * v, enum trace_action ta) {
 }
 env::data * mk_e(state::data * st, enum del_policy dp[2], env::data * outer, map::data * vars) {
   size_t mem_block_size = sizeof(struct _cee_env_header);
-  struct _cee_env_header * h = (struct _cee_env_header *)malloc(mem_block_size);
+  struct _cee_env_header * h = (struct _cee_env_header *)_cee_slab_alloc(st, mem_block_size);
   do{ memset(&h->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  _cee_env_chain(h, st);
-  h->cs.trace = _cee_env_trace;
+  h->cs.type = _cee_type_env;
   h->cs.resize_method = resize_with_identity;
   h->cs.mem_block_size = mem_block_size;
-  h->cs.cmp = NULL;
   h->cs.n_product = 0;
+  _cee_env_chain(h, st);
   h->env_dp = dp[0];
   h->vars_dp = dp[1];
   h->_.outer = outer;
@@ -3303,18 +3943,34 @@ static void _cee_state_trace (void * v, enum trace_action ta) {
         trace(tail + 1, trace_del_no_follow);
         tail = m->_.trace_tail;
       }
+      while (m->_.slabs->all) {
+        struct _cee_slab * s = m->_.slabs->all;
+        m->_.slabs->all = s->all;
+        free(s);
+      }
+      free(m->_.slabs);
+      free(m->_.gc_grey);
+      free(m->_.gc_remembered);
+      _cee_tombs_del(m->_.gc_grey_freed);
+      _cee_tombs_del(m->_.gc_remembered_freed);
       free(m);
       break;
     }
     case trace_del_no_follow:
     {
       // TODO detach the this state from all memory blocks
+      // the slabs are left to the objects in them
+      _cee_slab_orphan(m->_.slabs);
+      free(m->_.gc_grey);
+      free(m->_.gc_remembered);
+      _cee_tombs_del(m->_.gc_grey_freed);
+      _cee_tombs_del(m->_.gc_remembered_freed);
       free(m);
       break;
     }
     default:
     {
-      m->cs.gc_mark = ta - trace_mark;
+      _cee_common_mark(&m->cs, ta);
       trace(m->_.roots, ta);
       trace(m->_.stack, ta);
       trace(m->_.contexts, ta);
@@ -3329,9 +3985,36 @@ static void _cee_state_sweep (void * v, enum trace_action ta) {
     struct sect * next = head->trace_next;
     if (head->gc_mark != ta - trace_mark)
       trace(head + 1, trace_del_no_follow);
+    else
+      head->gc_old = 1;
     head = next;
   }
 }
+/*
+ * drop the entries of the freed objects from the remembered set
+ */
+static void _cee_state_prune (state::data * s) {
+  uintptr_t i, n = 0;
+  if (s->gc_remembered_freed == NULL || s->gc_remembered_freed->n_dead == 0)
+    return;
+  for (i = 0; i < s->gc_remembered_size; i++)
+    if (!_cee_tombs_take(s->gc_remembered_freed, s->gc_remembered[i]))
+      s->gc_remembered[n++] = s->gc_remembered[i];
+  s->gc_remembered_size = n;
+  _cee_tombs_clear(s->gc_remembered_freed);
+}
+/*
+ * empty the remembered set
+ */
+static void _cee_state_forget (state::data * s) {
+  uintptr_t i;
+  _cee_state_prune(s);
+  for (i = 0; i < s->gc_remembered_size; i++) {
+    struct sect * cs = (struct sect *)((void *)((char *)s->gc_remembered[i] - sizeof(struct cee::sect)));
+    cs->gc_remembered = 0;
+  }
+  s->gc_remembered_size = 0;
+}
 static int _cee_state_cmp (const void * v1, const void * v2) {
   if (v1 < v2)
     return -1;
@@ -3344,15 +4027,40 @@ state::data * mk(size_t n) {
   size_t memblock_size = sizeof(struct _cee_state_header);
   struct _cee_state_header * h = (struct _cee_state_header *)malloc(memblock_size);
   do{ memset(&h->cs, 0, sizeof(struct cee::sect)); } while(0);;
-  h->cs.trace = _cee_state_trace;
+  h->cs.type = _cee_type_state;
   h->_.trace_tail = &h->cs; // points to self;
+  h->_.next_mark = 1;
+  h->_.n_objects = 0;
+  memset(&h->_.usage, 0, sizeof(struct stats));
+  h->_.lock = 0;
+  h->_.shared = false;
+  h->_.gc_phase = gc_idle;
+  h->_.gc_sweep = NULL;
+  h->_.gc_grey = NULL;
+  h->_.gc_grey_size = 0;
+  h->_.gc_grey_capacity = 0;
+  h->_.gc_grey_freed = NULL;
+  h->_.gc_old_tail = &h->cs;
+  h->_.gc_remembered = NULL;
+  h->_.gc_remembered_size = 0;
+  h->_.gc_remembered_capacity = 0;
+  h->_.gc_remembered_freed = NULL;
+  h->_.slabs = (struct slabs *)calloc(1, sizeof(struct slabs));
   set::data * roots = set::mk_e(&h->_, dp_noop, _cee_state_cmp);
   h->_.roots = roots;
-  h->_.next_mark = 1;
   h->_.stack = stack::mk(&h->_, n);
   h->_.contexts = map::mk(&h->_, (cmp_fun)strcmp);
   return &h->_;
 }
+void stats (state::data * s, struct stats * out) {
+  *out = s->usage;
+  out->n_live = s->n_objects;
+}
+const char * type_name (unsigned type) {
+  if (type == 0 || type >= _cee_type_max)
+    return NULL;
+  return _cee_types[type].name;
+}
 void add_gc_root(state::data * s, void * key) {
   set::add(s->roots, key);
 }
@@ -3368,16 +4076,308 @@ void remove_context (state::data * s, char * key) {
 void * get_context (state::data * s, char * key) {
   return map::find(s->contexts, key);
 }
+static bool _cee_state_step (state::data * s, uintptr_t max_objects) {
+  struct _cee_state_header * h = (struct _cee_state_header *)((void *)((char *)(s) - (__builtin_offsetof(struct _cee_state_header, _))));
+  enum trace_action mark = (enum trace_action)(trace_mark + s->next_mark);
+  if (s->gc_phase == gc_idle) {
+    // the state is traced at once, what it holds is shaded grey
+    s->gc_phase = gc_marking;
+    _cee_types[h->cs.type].trace(s, mark);
+  }
+  while (s->gc_phase == gc_marking && max_objects) {
+    if (s->gc_grey_size == 0) {
+      s->gc_phase = gc_sweeping;
+      s->gc_sweep = h->cs.trace_next;
+      _cee_tombs_clear(s->gc_grey_freed);
+      break;
+    }
+    void * p = s->gc_grey[--s->gc_grey_size];
+    if (_cee_tombs_take(s->gc_grey_freed, p))
+      continue;
+    struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+    cs->gc_grey = 0;
+    _cee_types[cs->type].trace(p, mark);
+    max_objects--;
+  }
+  while (s->gc_phase == gc_sweeping && max_objects) {
+    struct sect * cs = s->gc_sweep;
+    if (cs == NULL) {
+      s->gc_phase = gc_idle;
+      // every object left is old now
+      _cee_state_forget(s);
+      s->gc_old_tail = s->trace_tail;
+      s->next_mark = !s->next_mark;
+      _cee_slab_trim(s->slabs);
+      return true;
+    }
+    s->gc_sweep = cs->trace_next;
+    if (cs->gc_mark != s->next_mark)
+      _cee_types[cs->type].trace(cs + 1, trace_del_no_follow);
+    else
+      cs->gc_old = 1;
+    max_objects--;
+  }
+  return false;
+}
+bool gc_step (state::data * s, uintptr_t max_objects) {
+  struct _cee_lock l = _cee_state_lock(s);
+  bool done = _cee_state_step(s, max_objects);
+  _cee_state_unlock(l);
+  return done;
+}
+void gc_minor (state::data * s) {
+  struct _cee_state_header * h = (struct _cee_state_header *)((void *)((char *)(s) - (__builtin_offsetof(struct _cee_state_header, _))));
+  enum trace_action mark = (enum trace_action)(trace_mark + s->next_mark);
+  struct sect * cs, * next;
+  uintptr_t i;
+  if (s->gc_phase != gc_idle)
+    return;
+  struct _cee_lock l = _cee_state_lock(s);
+  /*
+   * the roots are the state and the remembered objects, cee::trace does
+   * not go into old objects
+   */
+  s->gc_phase = gc_minor_marking;
+  _cee_types[h->cs.type].trace(s, mark);
+  _cee_state_prune(s);
+  for (i = 0; i < s->gc_remembered_size; i++) {
+    cs = (struct sect *)((void *)((char *)s->gc_remembered[i] - sizeof(struct cee::sect)));
+    _cee_types[cs->type].trace(cs + 1, mark);
+  }
+  s->gc_phase = gc_idle;
+  for (cs = s->gc_old_tail->trace_next; cs != NULL; cs = next) {
+    next = cs->trace_next;
+    if (cs->gc_old)
+      continue;
+    if (cs->gc_mark != s->next_mark)
+      _cee_types[cs->type].trace(cs + 1, trace_del_no_follow);
+    else {
+      cs->gc_mark = !s->next_mark;
+      cs->gc_old = 1;
+    }
+  }
+  // the sweep above may have freed objects that were in the set
+  _cee_state_prune(s);
+  for (i = 0; i < s->gc_remembered_size; i++) {
+    cs = (struct sect *)((void *)((char *)s->gc_remembered[i] - sizeof(struct cee::sect)));
+    cs->gc_mark = !s->next_mark;
+  }
+  _cee_state_forget(s);
+  h->cs.gc_mark = !s->next_mark;
+  s->gc_old_tail = s->trace_tail;
+  _cee_slab_trim(s->slabs);
+  _cee_state_unlock(l);
+}
 void gc (state::data * s) {
   struct _cee_state_header * h = (struct _cee_state_header *)((void *)((char *)(s) - (__builtin_offsetof(struct _cee_state_header, _))));
+  if (s->gc_phase != gc_idle) {
+    while (!gc_step(s, UINTPTR_MAX))
+      ;
+    return;
+  }
+  struct _cee_lock l = _cee_state_lock(s);
   int mark = trace_mark + s->next_mark;
   trace(s, (enum trace_action)mark);
   _cee_state_sweep(s, (enum trace_action) mark);
+  _cee_state_forget(s);
+  s->gc_old_tail = s->trace_tail;
   if (s->next_mark == 0) {
     s->next_mark = 1;
   } else {
     s->next_mark = 0;
   }
+  _cee_slab_trim(s->slabs);
+  _cee_state_unlock(l);
+}
+/*
+ * a thread of gc_parallel
+ */
+struct _cee_gc_worker {
+  struct _cee_gc_deque deque;
+  struct _cee_gc_worker * all;
+  unsigned index;
+  unsigned n_threads;
+  uintptr_t * active;             // the number of threads that may have work
+  enum trace_action mark;
+  struct sect * dead;             // the objects to free, linked by trace_next
+};
+static void * _cee_gc_steal_any (struct _cee_gc_worker * w) {
+  unsigned i;
+  void * p;
+  for (i = 1; i < w->n_threads; i++)
+    if ((p = _cee_gc_steal(&w->all[(w->index + i) % w->n_threads].deque)))
+      return p;
+  return NULL;
 }
+static bool _cee_gc_has_work (struct _cee_gc_worker * w) {
+  unsigned i;
+  for (i = 0; i < w->n_threads; i++) {
+    struct _cee_gc_deque * q = &w->all[i].deque;
+    if (__atomic_load_n(&q->top, __ATOMIC_ACQUIRE)
+        < __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE))
+      return true;
   }
+  return false;
 }
+/*
+ * a thread only becomes idle with an empty deque and nobody pushes to
+ * it after, so the marking is done when all threads are idle
+ */
+static void * _cee_gc_mark_worker (void * cxt) {
+  struct _cee_gc_worker * w = (struct _cee_gc_worker *)cxt;
+  void * p;
+  _cee_gc_self = &w->deque;
+  for (;;) {
+    while ((p = _cee_gc_take(&w->deque)) || (p = _cee_gc_steal_any(w))) {
+      struct sect * cs = (struct sect *)((void *)((char *)p - sizeof(struct cee::sect)));
+      _cee_types[cs->type].trace(p, w->mark);
+    }
+    __atomic_sub_fetch(w->active, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      if (__atomic_load_n(w->active, __ATOMIC_SEQ_CST) == 0)
+        return NULL;
+      if (_cee_gc_has_work(w)) {
+        __atomic_add_fetch(w->active, 1, __ATOMIC_SEQ_CST);
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+/*
+ * free the objects of a part of the sweep, they are already out of the
+ * chain. Each is put on a chain of its own that is local to the thread,
+ * for the per-type trace functions to take it off.
+ */
+static void * _cee_gc_sweep_worker (void * cxt) {
+  struct _cee_gc_worker * w = (struct _cee_gc_worker *)cxt;
+  struct _cee_state_header local;
+  struct sect * cs, * next;
+  memset(&local, 0, sizeof(local));
+  for (cs = w->dead; cs != NULL; cs = next) {
+    next = cs->trace_next;
+    cs->state = &local._;
+    cs->trace_prev = &local.cs;
+    cs->trace_next = NULL;
+    _cee_types[cs->type].trace(cs + 1, trace_del_no_follow);
+  }
+  return NULL;
+}
+void gc_parallel (state::data * s, unsigned n_threads) {
+  struct _cee_state_header * h = (struct _cee_state_header *)((void *)((char *)(s) - (__builtin_offsetof(struct _cee_state_header, _))));
+  enum trace_action mark = (enum trace_action)(trace_mark + s->next_mark);
+  struct _cee_gc_worker * w;
+  pthread_t * threads;
+  bool * started;
+  uintptr_t active = n_threads, i, n = 0;
+  struct sect * cs, * next, * prev;
+  if (n_threads < 2 || s->gc_phase != gc_idle) {
+    gc(s);
+    return;
+  }
+  struct _cee_lock l = _cee_state_lock(s);
+  w = (struct _cee_gc_worker *)calloc(n_threads, sizeof(struct _cee_gc_worker));
+  threads = (pthread_t *)malloc(n_threads * sizeof(pthread_t));
+  started = (bool *)calloc(n_threads, sizeof(bool));
+  for (i = 0; i < n_threads; i++) {
+    w[i].deque.array = _cee_gc_array_mk(1024);
+    w[i].all = w;
+    w[i].index = i;
+    w[i].n_threads = n_threads;
+    w[i].active = &active;
+    w[i].mark = mark;
+  }
+
+  // the state is traced here, what it holds goes to the first deque
+  s->gc_phase = gc_parallel_marking;
+  _cee_gc_self = &w[0].deque;
+  _cee_types[h->cs.type].trace(s, mark);
+  for (i = 1; i < n_threads; i++) {
+    started[i] = !pthread_create(threads + i, NULL, _cee_gc_mark_worker, w + i);
+    if (!started[i])
+      // its deque stays empty
+      __atomic_sub_fetch(&active, 1, __ATOMIC_SEQ_CST);
+  }
+  _cee_gc_mark_worker(w);
+  for (i = 1; i < n_threads; i++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  _cee_gc_self = NULL;
+  s->gc_phase = gc_idle;
+  _cee_state_forget(s);
+
+  /*
+   * the unmarked objects are taken out of the chain in runs of 1024 per
+   * thread, runs keep the threads off each other's cache lines
+   */
+  prev = &h->cs;
+  for (cs = h->cs.trace_next; cs != NULL; cs = next) {
+    next = cs->trace_next;
+    if (cs->gc_mark == s->next_mark) {
+      cs->gc_old = 1;
+      cs->trace_prev = prev;
+      prev->trace_next = cs;
+      prev = cs;
+    }
+    else {
+      struct _cee_gc_worker * v = w + (n++ / 1024) % n_threads;
+      // the threads take them off chains of their own
+      s->usage.live_bytes -= cs->mem_block_size;
+      s->usage.n_live_by_type[cs->type]--;
+      cs->trace_next = v->dead;
+      v->dead = cs;
+    }
+  }
+  prev->trace_next = NULL;
+  s->trace_tail = prev;
+  s->gc_old_tail = prev;
+  s->n_objects -= n;
+  for (i = 1; i < n_threads; i++)
+    started[i] = !pthread_create(threads + i, NULL, _cee_gc_sweep_worker, w + i);
+  _cee_gc_sweep_worker(w);
+  for (i = 1; i < n_threads; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      _cee_gc_sweep_worker(w + i);
+  }
+  for (i = 0; i < n_threads; i++)
+    while (w[i].deque.array) {
+      struct _cee_gc_array * a = w[i].deque.array;
+      w[i].deque.array = a->retired;
+      free(a);
+    }
+  h->cs.gc_mark = mark - trace_mark;
+  s->next_mark = !s->next_mark;
+  _cee_slab_trim(s->slabs);
+  _cee_state_unlock(l);
+  free(w);
+  free(threads);
+  free(started);
+}
+  }
+}
+static void _cee_unknown_trace (void * p, enum cee::trace_action ta) {
+  cee::segfault();
+}
+const struct _cee_type _cee_types[_cee_type_max] = {
+  { "unknown", _cee_unknown_trace },
+  { "boxed", cee::boxed::_cee_boxed_trace },
+  { "str", cee::str::_cee_str_trace },
+  { "str_empty", cee::str::_cee_str_noop },
+  { "dict", cee::dict::_cee_dict_trace },
+  { "map", cee::map::_cee_map_trace },
+  { "set", cee::set::_cee_set_trace },
+  { "stack", cee::stack::_cee_stack_trace },
+  { "tuple", cee::tuple::_cee_tuple_trace },
+  { "triple", cee::triple::_cee_triple_trace },
+  { "quadruple", cee::quadruple::_cee_quadruple_trace },
+  { "list", cee::list::_cee_list_trace },
+  { "tagged", cee::tagged::_cee_tagged_trace },
+  { "singleton", cee::singleton::_cee_singleton_noop },
+  { "closure", cee::closure::_cee_closure_trace },
+  { "block", cee::block::_cee_block_trace },
+  { "n_tuple", cee::n_tuple::_cee_n_tuple_trace },
+  { "env", cee::env::_cee_env_trace },
+  { "state", cee::state::_cee_state_trace },
+};
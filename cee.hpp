@@ -6,13 +6,15 @@
 
 namespace cee {
   namespace state { struct data; };
+  struct slabs;
+  struct tombs;
   
 typedef uintptr_t tag_t;
 typedef int (*cmp_fun) (const void *, const void *);
 
 enum resize_method {
   resize_with_identity = 0, // resize with identity function
-  resize_with_malloc = 1,   // resize with malloc  (safe, but leak)
+  resize_with_malloc = 1,   // resize with malloc, see use_malloc
   resize_with_realloc = 2   // resize with realloc (probably unsafe)
 };
 
@@ -64,25 +66,34 @@ enum del_policy {
  * if an object is owned by multiple del_rc containers, in_degree is the 
  * number of containers.
  *
+ * sect precedes every object and takes 40 bytes with 64 bit pointers.
+ * There is no compact header: the collectors find objects by the trace
+ * chain and keep cursors into it, and objects that are not in slabs
+ * have nothing else to be found by, so state, the chain links and
+ * mem_block_size are kept in every object.
+ *
  */
 struct sect {
+  // the bits the collectors write, a byte of their own
+  uint8_t  gc_mark:2;             // used for mark & sweep gc
+  uint8_t  gc_grey:1;             // waiting to be traced by state::gc_step
+  uint8_t  gc_old:1;              // survived a collection, see state::gc_minor
+  uint8_t  gc_remembered:1;       // old, and may point to young objects
+  uint8_t  :0;
+  // the bits threads that share the object read
   uint8_t  cmp_stop_at_null:1;    // 0: compare all bytes, otherwise stop at '\0'
   uint8_t  resize_method:2;       // three values: identity, malloc, realloc
   uint8_t  retained:1;            // if it is retained, in_degree is ignored
-  uint8_t  gc_mark:2;             // used for mark & sweep gc
+  uint8_t  shared:1;              // in_degree is changed atomically, see share
   uint8_t  n_product;             // n-ary (no more than 256) product type
-  uint16_t in_degree;             // the number of cee objects points to this object
+  uint8_t  type;                  // the descriptor of the type, see trace
+  uint32_t in_degree;             // the number of cee objects points to this object
   // begin of gc fields
   state::data * state;            // the gc state under which this block is allocated
   struct sect * trace_next;       // used for chaining cee::_::data to be traced
   struct sect * trace_prev;       // used for chaining cee::_::data to be traced
   // end of gc fields
   uintptr_t mem_block_size;       // the size of a memory block enclosing this struct
-  void *cmp;                      // compare two memory blocks
-  
-  // the object specific generic scan function
-  // it does memory deallocation, reference count decreasing, or liveness marking
-  void (*trace)(void *, enum trace_action);
 };
 
 
@@ -345,9 +356,21 @@ namespace map {
   extern uintptr_t size(map::data *);
   extern void add(map::data * m, void * key, void * value);
   extern void * find(map::data * m, void * key);
+  /*
+   * the pair of key is removed, the key and the value are released by the
+   * del policies of the map. The value is returned, it is only valid if
+   * something else still holds it.
+   */
   extern void * remove(map::data *m, void * key);
   extern list::data * keys(map::data *m);
   extern list::data * values(map::data *m);
+
+  /*
+   * call f with every key and value in the order of the keys,
+   * nothing is allocated
+   */
+  extern void walk(map::data *m, void * cxt,
+                   void (*f)(void * cxt, void * key, void * value));
 };
 
 
@@ -476,6 +499,11 @@ namespace boxed {
   extern boxed::data * from_i16(state::data *, int16_t);
   extern boxed::data * from_i8(state::data *, int8_t);
 
+  /*
+   * the primitive type the value is boxed with
+   */
+  extern enum primitive_type type(boxed::data * x);
+
   extern double   to_double(boxed::data * x);
   extern float    to_float(boxed::data * x);
   
@@ -531,6 +559,24 @@ namespace tagged {
    */
   extern tagged::data * mk (state::data *, uintptr_t tag, void * v);
   extern tagged::data * mk_e (state::data *, enum del_policy o, uintptr_t tag, void *v);
+
+  /*
+   * a value derived from what a tagged value points to, e.g. a hash, can
+   * be cached with it until the list or the map it points to changes,
+   * strings and boxed values are taken as not changing. Nothing is kept,
+   * and false is returned, if that list or map has other owners or the
+   * tagged value points to another kind of container.
+   */
+  extern bool memoize (tagged::data *, uint64_t value);
+  extern bool recall (tagged::data *, uint64_t * value);
+
+  /*
+   * link child under parent, the value cached with parent is dropped
+   * with the one of child from then on. It fails if child has other
+   * owners than the container of parent, parent should then not cache
+   * anything derived from child.
+   */
+  extern bool link (tagged::data * child, tagged::data * parent);
 }
 
 namespace env {
@@ -553,6 +599,12 @@ namespace closure {
 };
 
 extern void use_realloc(void *);
+/*
+ * the default: a resized object is a copy in a new block. The old block
+ * stays valid for what still counts a reference to it and is freed at
+ * once otherwise, a pointer that is not counted must be replaced by the
+ * one the resize returns.
+ */
 extern void use_malloc(void *);
   
   /*
@@ -566,16 +618,38 @@ extern void del (void *);
 extern void del_ref(void *);
 extern void del_e (enum del_policy o, void * p);
 
+/*
+ * run the scan function of the type of p, it does memory deallocation,
+ * reference count decreasing, or liveness marking. The scan functions
+ * are kept in one table of type descriptors rather than in every object.
+ */
 extern void trace (void *p, enum trace_action ta);
 extern int cmp (void *, void *);
 
 extern void incr_indegree (enum del_policy o, void * p);
 extern void decr_indegree (enum del_policy o, void * p);
 
+/*
+ * record that p has been stored into container, it is only needed when
+ * the container is changed by other means than its own functions. What
+ * is cached from the container is dropped, see tagged::memoize.
+ */
+extern void write_barrier (void * container, void * p);
+
 /* 
  * return the reference count of an object
  */
-extern uint16_t get_rc (void *);
+extern uint32_t get_rc (void *);
+
+/*
+ * the reference count of p is changed with atomic operations from now
+ * on, so that threads can take and drop references to it. Objects that
+ * stay in one thread keep the cheaper plain counts. It marks p alone,
+ * not what p points to. The object that is released last is freed
+ * under the lock of its state, and from then on the state takes its
+ * lock to allocate, to free and to collect.
+ */
+extern void share (void * p);
 
 /*
  * call this to cause segfault for non-recoverable errors
@@ -583,6 +657,29 @@ extern uint16_t get_rc (void *);
 extern void segfault() __attribute__((noreturn));
 
 namespace state {
+  enum gc_phase {
+    gc_idle = 0,
+    gc_marking,
+    gc_sweeping,
+    gc_minor_marking,
+    gc_parallel_marking
+  };
+
+  /*
+   * what the objects of a state take, the counters are updated as objects
+   * are allocated and freed. A resized object is counted as freed and
+   * allocated again.
+   */
+  enum { max_types = 32 };
+  struct stats {
+    uintptr_t live_bytes;   // the block sizes of the live objects added up
+    uintptr_t peak_bytes;   // the largest live_bytes has been
+    uintptr_t n_allocs;     // the objects allocated so far
+    uintptr_t n_live;       // the live objects
+    // the live objects of each type, see type_name
+    uintptr_t n_live_by_type[max_types];
+  };
+
   struct data {
     // arbitrary number of contexts
     map::data * contexts;
@@ -593,6 +690,30 @@ namespace state {
     set::data   * roots; 
     // the mark value for the next iteration
     int           next_mark;
+    // the number of objects chained to trace_tail
+    uintptr_t     n_objects;
+    // held while a shared object is freed
+    int           lock;
+    // some objects are shared, see share
+    bool          shared;
+    // the collection in progress by gc_step
+    enum gc_phase gc_phase;
+    struct sect * gc_sweep;     // the next object to sweep
+    void       ** gc_grey;      // marked objects that are still to be traced
+    uintptr_t     gc_grey_size;
+    uintptr_t     gc_grey_capacity;
+    struct tombs * gc_grey_freed;  // freed objects still on the grey list
+    // the objects chained after gc_old_tail are young
+    struct sect * gc_old_tail;
+    void       ** gc_remembered; // old objects young ones were stored into
+    uintptr_t     gc_remembered_size;
+    uintptr_t     gc_remembered_capacity;
+    struct tombs * gc_remembered_freed;  // freed objects still in the remembered set
+    // tuples, tagged values, boxed values, map and set nodes, and other
+    // objects of a fixed small size are allocated from slabs of the state
+    struct slabs * slabs;
+    // n_live is n_objects
+    struct stats  usage;
   };
   /*
    * the size of stack
@@ -601,6 +722,45 @@ namespace state {
   extern void add_gc_root(state::data *, void *);
   extern void remove_gc_root(state::data *, void *);
   extern void gc(state::data *);
+
+  /*
+   * do at most max_objects units of an incremental collection, tracing
+   * or sweeping one object is a unit. While a collection is in progress
+   * objects stored into containers are marked by a write barrier in
+   * incr_indegree, and new objects are allocated marked, so that the
+   * mutator can run between steps. true is returned when a collection
+   * has just been completed. gc completes a collection in progress.
+   */
+  extern bool gc_step(state::data *, uintptr_t max_objects);
+
+  /*
+   * collect the young objects only, those allocated since the previous
+   * collection. They are reachable from the roots of the state or from
+   * old objects they were stored into, the survivors become old. The
+   * old objects are left to gc and gc_step, which make all survivors
+   * old. Nothing is done while gc_step has a collection in progress.
+   */
+  extern void gc_minor(state::data *);
+
+  /*
+   * gc with n_threads threads. The objects to be traced are kept in a
+   * work-stealing deque per thread, and a thread marks an object with an
+   * atomic update before it puts it into its deque, so that the per-type
+   * trace functions run once per object. The unmarked objects are then
+   * taken out of the chain and split among the threads to be freed. The
+   * mutator must not run during the collection.
+   */
+  extern void gc_parallel(state::data *, unsigned n_threads);
+
+  /*
+   * a snapshot of the counters of the state, it takes no lock
+   */
+  extern void stats(state::data *, struct stats *);
+  /*
+   * the name of a type counted by n_live_by_type, such as "str", "list",
+   * "map", "tagged" or "boxed", NULL for an index no type has
+   */
+  extern const char * type_name(unsigned type);
   extern void add_context(state::data *, char * key, void * val);
   extern void remove_context(state::data *, char * key);
   extern void * get_context(state::data *, char * key);
@@ -0,0 +1,239 @@
+/* structural comparison and hashing
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace structural {
+
+#define HASH_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+static uint64_t fmix (uint64_t v)
+{
+  v ^= v >> 33;
+  v *= 0xff51afd7ed558ccdULL;
+  v ^= v >> 33;
+  v *= 0xc4ceb9fe1a85ec53ULL;
+  v ^= v >> 33;
+  return v;
+}
+
+static uint64_t combine (uint64_t h, uint64_t v)
+{
+  h = (h << 5 | h >> 59) ^ fmix(v);
+  return h * HASH_MULTIPLIER;
+}
+
+static uint64_t hash_string (char * s)
+{
+  uintptr_t n = strlen(s), i;
+  uint64_t h = n, w;
+  for (i = 0; i + 8 <= n; i += 8) {
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * HASH_MULTIPLIER;
+    h ^= h >> 32;
+  }
+  if (i < n) {
+    w = 0;
+    memcpy(&w, s + i, n - i);
+    h = (h ^ w) * HASH_MULTIPLIER;
+    h ^= h >> 32;
+  }
+  return fmix(h);
+}
+
+/*
+ * the hash of a container being computed
+ */
+struct hasher {
+  uint64_t h;
+  json::data * parent;
+  bool stable;    // the containers in parent are linked under it
+};
+
+static uint64_t hash_e (json::data * j, bool * stable);
+
+/*
+ * a container in h->parent is linked under it, so that a change to the
+ * container drops the hash cached with the parent
+ */
+static void hash_child (struct hasher * h, json::data * c)
+{
+  bool stable = true;
+  h->h = combine(h->h, hash_e(c, &stable));
+  if ((c->t == type_is_array || c->t == type_is_object)
+      && !(stable && tagged::link((tagged::data *)c, (tagged::data *)h->parent)))
+    h->stable = false;
+}
+
+static void hash_member (void * cxt, void * key, void * value)
+{
+  struct hasher * h = (struct hasher *)cxt;
+  h->h = combine(h->h, hash_string((char *)key));
+  hash_child(h, (json::data *)value);
+}
+
+/*
+ * *stable is cleared if the hash of j cannot be cached because j, or a
+ * container in it, has other owners
+ */
+static uint64_t hash_e (json::data * j, bool * stable)
+{
+  struct hasher h = { 0, j, true };
+  uintptr_t i, n;
+  uint64_t v;
+  double d;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+      return fmix(j->t + 1);
+    case type_is_boolean:
+      return fmix((j->t << 1 | to_bool(j)) + 1);
+    case type_is_number:
+      d = to_double(j);
+      if (d == 0)
+        d = 0; // -0 and 0 are equal
+      memcpy(&v, &d, 8);
+      return combine(j->t, v);
+    case type_is_string:
+      return combine(j->t, hash_string((char *)j->value.string));
+    case type_is_array:
+      if (tagged::recall((tagged::data *)j, &v))
+        return v;
+      n = list::size(j->value.array);
+      h.h = combine(j->t, n);
+      for (i = 0; i < n; i++)
+        hash_child(&h, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      if (tagged::recall((tagged::data *)j, &v))
+        return v;
+      h.h = combine(j->t, map::size(j->value.object));
+      map::walk(j->value.object, &h, hash_member);
+      break;
+  }
+  *stable = h.stable && tagged::memoize((tagged::data *)j, h.h);
+  return h.h;
+}
+
+/*
+ * the members of an object in the order of their keys, key and value
+ * interleaved
+ */
+struct members {
+  uintptr_t size;
+  void ** _;
+};
+
+static void collect_member (void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  m->_[m->size++] = key;
+  m->_[m->size++] = value;
+}
+
+struct merge {
+  struct members * a;
+  uintptr_t i;
+  int result;
+};
+
+static void merge_member (void * cxt, void * key, void * value)
+{
+  struct merge * m = (struct merge *)cxt;
+  if (m->result)
+    return;
+  m->result = strcmp((char *)m->a->_[m->i], (char *)key);
+  if (m->result == 0)
+    m->result = json::cmp((json::data *)m->a->_[m->i + 1],
+                          (json::data *)value);
+  m->i += 2;
+}
+
+static int cmp_objects (map::data * a, map::data * b, uintptr_t n)
+{
+  void * small[32];
+  struct members ma = { 0, small };
+  struct merge m = { &ma, 0, 0 };
+  if (2 * n > sizeof(small)/sizeof(small[0]))
+    ma._ = (void **)malloc(2 * n * sizeof(void *));
+  map::walk(a, &ma, collect_member);
+  map::walk(b, &m, merge_member);
+  if (ma._ != small)
+    free(ma._);
+  return m.result;
+}
+
+static int sign (int c)
+{
+  return c < 0 ? -1 : c > 0;
+}
+
+    }
+
+uint64_t hash (json::data * j)
+{
+  bool stable;
+  return structural::hash_e(j, &stable);
+}
+
+int cmp (json::data * a, json::data * b)
+{
+  uintptr_t i, n, m;
+  uint64_t ha, hb;
+  double x, y;
+  int c;
+  if (a == b)
+    return 0;
+  if (a->t != b->t)
+    return a->t < b->t ? -1 : 1;
+  switch (a->t) {
+    case type_is_undefined:
+    case type_is_null:
+      return 0;
+    case type_is_boolean:
+      return (int)to_bool(a) - (int)to_bool(b);
+    case type_is_number:
+      x = to_double(a);
+      y = to_double(b);
+      return x < y ? -1 : x > y;
+    case type_is_string:
+      return structural::sign(strcmp((char *)a->value.string,
+                                     (char *)b->value.string));
+    case type_is_array:
+    case type_is_object:
+      if (a->t == type_is_array) {
+        n = list::size(a->value.array);
+        m = list::size(b->value.array);
+      }
+      else {
+        n = map::size(a->value.object);
+        m = map::size(b->value.object);
+      }
+      if (n != m)
+        return n < m ? -1 : 1;
+      ha = hash(a);
+      hb = hash(b);
+      if (ha != hb)
+        return ha < hb ? -1 : 1;
+      if (a->t == type_is_object)
+        return structural::sign(structural::cmp_objects(a->value.object,
+                                                        b->value.object, n));
+      for (i = 0; i < n; i++) {
+        c = cmp((json::data *)a->value.array->_[i],
+                (json::data *)b->value.array->_[i]);
+        if (c)
+          return c;
+      }
+      return 0;
+  }
+  return 0;
+}
+
+  }
+}
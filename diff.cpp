@@ -0,0 +1,280 @@
+/* RFC 6902 JSON Patch from the difference of two documents
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "buffer.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace differ {
+
+/*
+ * the dynamic programming table of an LCS of two array middles is
+ * limited to this many cells, larger middles are paired up by position
+ */
+#define MAX_JSON_DIFF_LCS (1 << 22)
+
+struct context {
+  state::data * st;
+  struct buffer path;   // the pointer of the values being compared
+  json::data * patch;
+};
+
+/*
+ * subtrees that are the same node, or that are equal scalars or
+ * containers with equal hashes are taken as unchanged
+ */
+static bool same (json::data * a, json::data * b)
+{
+  if (a == b)
+    return true;
+  if (a->t != b->t)
+    return false;
+  if (a->t == type_is_array || a->t == type_is_object)
+    return hash(a) == hash(b);
+  return cmp(a, b) == 0;
+}
+
+static void emit (struct context * d, char * op, json::data * value)
+{
+  json::data * o = mk_object(d->st);
+  object_set_string(d->st, o, "op", op);
+  buffer_put_byte(&d->path, 0);
+  object_set_string(d->st, o, "path", d->path._);
+  d->path.size--;
+  if (value)
+    object_set(d->st, o, "value", value);
+  list::append(&d->patch->value.array, o);
+}
+
+static void push_key (struct context * d, char * key)
+{
+  buffer_put_byte(&d->path, '/');
+  for (; *key; key++) {
+    if (*key == '~')
+      buffer_put(&d->path, (void *)"~0", 2);
+    else if (*key == '/')
+      buffer_put(&d->path, (void *)"~1", 2);
+    else
+      buffer_put_byte(&d->path, *key);
+  }
+}
+
+static void push_index (struct context * d, uintptr_t i)
+{
+  char s[24];
+  int n = snprintf(s, sizeof(s), "/%lu", (unsigned long)i);
+  buffer_put(&d->path, s, n);
+}
+
+static void diff (struct context * d, json::data * a, json::data * b);
+
+/*
+ * the members of an object in the order of their keys, key and value
+ * interleaved
+ */
+struct members {
+  uintptr_t size;
+  void ** _;
+};
+
+static void collect_member (void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  m->_[m->size++] = key;
+  m->_[m->size++] = value;
+}
+
+static void diff_objects (struct context * d, map::data * a, map::data * b)
+{
+  struct members ma, mb;
+  uintptr_t i = 0, j = 0, top = d->path.size;
+  int c;
+  ma.size = mb.size = 0;
+  ma._ = (void **)malloc((map::size(a) + map::size(b)) * 2 * sizeof(void *) + 1);
+  mb._ = ma._ + map::size(a) * 2;
+  map::walk(a, &ma, collect_member);
+  map::walk(b, &mb, collect_member);
+  while (i < ma.size || j < mb.size) {
+    if (i == ma.size)
+      c = 1;
+    else if (j == mb.size)
+      c = -1;
+    else
+      c = strcmp((char *)ma._[i], (char *)mb._[j]);
+    if (c < 0) {
+      push_key(d, (char *)ma._[i]);
+      emit(d, "remove", NULL);
+      i += 2;
+    }
+    else if (c > 0) {
+      push_key(d, (char *)mb._[j]);
+      emit(d, "add", (json::data *)mb._[j + 1]);
+      j += 2;
+    }
+    else {
+      push_key(d, (char *)ma._[i]);
+      diff(d, (json::data *)ma._[i + 1], (json::data *)mb._[j + 1]);
+      i += 2;
+      j += 2;
+    }
+    d->path.size = top;
+  }
+  free(ma._);
+}
+
+/*
+ * edit the middle a[0..n) into b[0..m), index is where a[0] is in the
+ * array being patched. A removal that is followed by an addition
+ * becomes a diff of the two elements.
+ */
+static void edit (struct context * d, uintptr_t index,
+                  json::data ** a, uintptr_t n, json::data ** b, uintptr_t m,
+                  char * dir)
+{
+  uintptr_t i = 0, j = 0, top = d->path.size;
+  while (i < n || j < m) {
+    if (i < n && j < m && dir[i * (m + 1) + j] == 0) {
+      i++;
+      j++;
+      index++;
+      continue;
+    }
+    push_index(d, index);
+    if (i < n && j < m && dir[i * (m + 1) + j] == 3) {
+      diff(d, a[i++], b[j++]);
+      index++;
+    }
+    else if (i < n && (j == m || dir[i * (m + 1) + j] == 1)) {
+      emit(d, "remove", NULL);
+      i++;
+    }
+    else {
+      emit(d, "add", b[j++]);
+      index++;
+    }
+    d->path.size = top;
+  }
+}
+
+static void diff_arrays (struct context * d, list::data * la, list::data * lb)
+{
+  json::data ** a = (json::data **)la->_, ** b = (json::data **)lb->_;
+  uintptr_t n = list::size(la), m = list::size(lb), p = 0, i, j;
+  while (p < n && p < m && same(a[p], b[p]))
+    p++;
+  while (n > p && m > p && same(a[n - 1], b[m - 1])) {
+    n--;
+    m--;
+  }
+  a += p;
+  b += p;
+  n -= p;
+  m -= p;
+  if (n == 0 && m == 0)
+    return;
+
+  if ((uint64_t)(n + 1) * (m + 1) > MAX_JSON_DIFF_LCS) {
+    uintptr_t top = d->path.size;
+    for (i = 0; i < n && i < m; i++) {
+      push_index(d, p + i);
+      diff(d, a[i], b[i]);
+      d->path.size = top;
+    }
+    for (; i < m; i++) {
+      push_index(d, p + i);
+      emit(d, "add", b[i]);
+      d->path.size = top;
+    }
+    push_index(d, p + m);
+    for (; i < n; i++)
+      emit(d, "remove", NULL);
+    d->path.size = top;
+    return;
+  }
+
+  /*
+   * dir[i][j] is the first step of an edit of a[i..n) into b[j..m):
+   * 0 keeps both, 1 removes a[i], 2 adds b[j], 3 diffs a[i] with b[j]
+   */
+  char * dir = (char *)malloc((n + 1) * (m + 1));
+  uint32_t * len = (uint32_t *)malloc((m + 1) * 2 * sizeof(uint32_t));
+  uint32_t * next = len, * cur = len + m + 1, * t;
+  for (j = 0; j <= m; j++)
+    next[j] = 0;
+  for (i = n + 1; i-- > 0; ) {
+    for (j = m + 1; j-- > 0; ) {
+      char * s = &dir[i * (m + 1) + j];
+      if (i == n || j == m) {
+        *s = i == n ? 2 : 1;
+        cur[j] = 0;
+      }
+      else if (same(a[i], b[j])) {
+        *s = 0;
+        cur[j] = next[j + 1] + 1;
+      }
+      else if (next[j] >= cur[j + 1]) {
+        *s = 1;
+        cur[j] = next[j];
+      }
+      else {
+        *s = 2;
+        cur[j] = cur[j + 1];
+      }
+    }
+    t = next;
+    next = cur;
+    cur = t;
+  }
+  free(len);
+  /*
+   * a removal right before an addition is one element changed
+   */
+  for (i = 0, j = 0; i < n || j < m; ) {
+    char * s = &dir[i * (m + 1) + j];
+    if (i < n && j < m && *s == 1 && dir[(i + 1) * (m + 1) + j] == 2)
+      *s = 3;
+    if (*s == 0 || *s == 3) {
+      i++;
+      j++;
+    }
+    else if (*s == 1)
+      i++;
+    else
+      j++;
+  }
+  edit(d, p, a, n, b, m, dir);
+  free(dir);
+}
+
+static void diff (struct context * d, json::data * a, json::data * b)
+{
+  if (same(a, b))
+    return;
+  if (a->t == type_is_object && b->t == type_is_object)
+    diff_objects(d, a->value.object, b->value.object);
+  else if (a->t == type_is_array && b->t == type_is_array)
+    diff_arrays(d, a->value.array, b->value.array);
+  else
+    emit(d, "replace", b);
+}
+
+    }
+
+json::data * diff (state::data * st, json::data * a, json::data * b)
+{
+  struct differ::context d;
+  d.st = st;
+  d.patch = mk_array(st, 8);
+  buffer_init(&d.path, st, 256);
+  differ::diff(&d, a, b);
+  del(d.path._);
+  return d.patch;
+}
+
+  }
+}
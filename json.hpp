@@ -38,6 +38,184 @@ struct data {
   } value;
 };
 
+namespace pointer {
+  struct token {
+    char * key;       // the unescaped reference token
+    intptr_t index;   // the token as an array index, -1 if it is not one
+  };
+
+  struct data {
+    uintptr_t size;
+    struct token _[1];
+  };
+
+  /*
+   * return the compiled form of path, compiling it only the first time
+   * the state sees it. The result is owned by the state's cache of
+   * pointers, which drops those nothing else holds when it has 1024 of
+   * them: it stays valid until another path is compiled, incr_indegree
+   * keeps it in the cache for longer and del_ref then lets it go.
+   */
+  extern pointer::data * compile (state::data *, char * path);
+
+  /*
+   * resolve a compiled pointer against j, it does not allocate
+   */
+  extern json::data * eval (pointer::data *, json::data * j);
+
+  /*
+   * resolve only the first n tokens, e.g. n = size - 1 for the parent
+   */
+  extern json::data * eval_e (pointer::data *, json::data * j, uintptr_t n);
+}
+
+/*
+ * JSONPath queries such as "$.store.book[*].author", "$..price",
+ * "$.items[-1]", "$.items[0:10:2]" or "$.items[?(@.price > 10 && !@.sold)].id".
+ * Filters compare paths from @ or $ made of names and indices with numbers,
+ * strings, true, false and null, a path alone tests that it exists. Members
+ * of objects are visited in the order of their keys.
+ */
+namespace jsonpath {
+  enum selector {
+    sel_name,
+    sel_wildcard,
+    sel_index,
+    sel_slice,
+    sel_filter
+  };
+
+  struct expr;
+
+  struct step {
+    enum selector kind;
+    bool descendant;        // the step is applied to all descendants, ..
+    bool has_start;
+    bool has_end;
+    char * name;
+    intptr_t start;         // the index of sel_index
+    intptr_t end;
+    intptr_t step;
+    struct expr * filter;
+  };
+
+  struct data {
+    uintptr_t size;
+    struct step * steps;
+  };
+
+  /*
+   * NULL is returned if the query is malformed. A plan is never changed
+   * by eval, it can be shared by threads and used for any document.
+   */
+  extern jsonpath::data * compile (state::data *, char * query);
+
+  /*
+   * the nodes of j selected by the plan, parents before their
+   * descendants and elements in index order. The list is
+   * allocated in st, it borrows the nodes and does not own them.
+   */
+  extern list::data * eval (state::data * st, jsonpath::data *, json::data * j);
+}
+
+/*
+ * a field mask for parse_e, made of paths such as "id", "user.name" or
+ * "items[*].price". Only the subtrees selected by a path, and the
+ * containers leading to them, are built, the rest is skipped. A scalar
+ * that stands where a path expects a container is skipped as well.
+ * Skipped parts are only checked for balanced brackets and well formed
+ * strings.
+ */
+#define MAX_JSON_PROJECTION 63
+
+namespace projection {
+  struct step {
+    char * key;       // the field name, NULL for an array step
+    intptr_t index;   // the element an array step selects, -1 for [*]
+  };
+
+  struct path {
+    uintptr_t size;
+    struct step * steps;
+  };
+
+  struct data {
+    uintptr_t size;
+    struct path _[1];
+  };
+
+  /*
+   * NULL is returned if a path is malformed or there are more than
+   * MAX_JSON_PROJECTION paths
+   */
+  extern projection::data * mk (state::data *, size_t n, char ** paths);
+}
+
+/*
+ * forward only, on demand access to a JSON text. Nothing is built for the
+ * parts of the input that are not asked for, they are skipped by matching
+ * brackets. Values have to be visited in document order: stepping to a
+ * field or an element skips whatever is left of the previous one, and a
+ * value that has been skipped can no longer be read. Containers nest up to
+ * MAX_JSON_DEPTH, as in parse.
+ */
+namespace ondemand {
+  struct document {
+    char * buf;
+    char * buf_end;
+    int line;
+    int depth;      // the number of containers entered so far
+    bool at_value;  // positioned at a value that has not been consumed
+    bool error;
+    char open[MAX_JSON_DEPTH];  // '[' or '{' for each container entered
+  };
+
+  struct value {
+    struct document * doc;
+    int depth;
+  };
+
+  struct object {
+    struct document * doc;
+    int depth;
+    bool first;
+  };
+
+  struct array {
+    struct document * doc;
+    int depth;
+    bool first;
+  };
+
+  extern struct value init (struct document *, char * buf, uintptr_t len);
+
+  /*
+   * the type of a value, decided by its first character, 
+   * type_is_undefined is returned if the value is no longer readable
+   */
+  extern enum type type_of (struct value);
+
+  extern bool get_object (struct value, struct object *);
+  extern bool get_array (struct value, struct array *);
+
+  /*
+   * search the fields after the current position of the object, the
+   * object is left at its end if key is not found
+   */
+  extern bool find_field (struct object *, char * key, struct value *);
+  extern bool next_element (struct array *, struct value *);
+
+  extern bool get_string (state::data *, struct value, str::data **);
+  extern bool get_number (struct value, double *);
+  extern bool get_bool (struct value, bool *);
+  extern bool is_null (struct value);
+
+  /*
+   * build the DOM of a single value
+   */
+  extern bool materialize (state::data *, struct value, json::data **);
+}
+
 enum format {
   compact = 0,
   readable = 1
@@ -48,17 +226,73 @@ extern bool is_undefined (json::data *);
 extern bool is_null (json::data *);
 extern bool to_bool (json::data *);
 
-extern json::data * find (json::data *, char *);
-extern json::data * get(json::data *, char *, json::data * def);
+/*
+ * look up an RFC 6901 JSON pointer such as "/a/b/3/c", the pointer is
+ * compiled once and cached in the state, NULL is returned if the
+ * pointer is malformed or does not resolve
+ */
+extern json::data * find (state::data *, json::data *, char * pointer);
+extern json::data * get(state::data *, json::data *, char * pointer,
+                        json::data * def);
 
 extern bool save (json::data *, FILE *, int how);
 extern json::data * load_from_file (FILE *, bool force_eof, int * error_at_line);
 extern json::data * load_from_buffer (int size, char *, int line);
+
+/*
+ * a 64 bit hash of the structure and the values of j, the hash of
+ * an array or an object is cached with it until it or a container in it
+ * changes, see tagged::memoize. A container that has other owners than
+ * its parent, e.g. one shared by versions of a persistent document, is
+ * hashed again each time and so are the containers above it, though not
+ * the ones below. Equal documents have equal hashes.
+ */
+extern uint64_t hash (json::data * j);
+
+/*
+ * a total order of documents, 0 if they are equal. Values of different
+ * types are ordered by their types, containers by their sizes and then
+ * by their hashes before their contents are compared, so the order is
+ * only meant for telling documents apart and for sorting them.
+ */
 extern int cmp (json::data *, json::data *);
 
+/*
+ * apply an RFC 6902 JSON Patch to *doc in place, the containers of the
+ * document are changed rather than copied and paths are compiled once
+ * per state, see pointer::compile. Values taken from the patch are copied. If an operation
+ * fails every change made so far is taken back, false is returned and
+ * error_at is the index of the operation. *doc is set to the new root
+ * when the whole document is replaced, the old root is then released.
+ */
+extern bool apply_patch (state::data *, json::data ** doc, json::data * patch,
+                         uintptr_t * error_at);
+
+/*
+ * apply an RFC 7386 JSON Merge Patch to *doc in place, it cannot fail.
+ * *doc is set to the new root when the patch is not an object or the
+ * document is not one, the old root is then released as apply_patch
+ * does: it is freed unless something else holds a reference to it.
+ */
+extern void merge_patch (state::data *, json::data ** doc, json::data * patch);
+
+/*
+ * an RFC 6902 JSON Patch that turns a into b, an array of operations
+ * allocated in st. The values of add and replace operations are the
+ * nodes of b, not copies. Subtrees with equal hashes are taken as
+ * unchanged and are not visited, so once the hashes are cached the
+ * time taken is proportional to the changed regions. Array elements are
+ * matched by a longest common subsequence of their hashes.
+ */
+extern json::data * diff (state::data *, json::data * a, json::data * b);
+
 extern list::data  * to_array (json::data *);
 extern map::data   * to_object (json::data *);
 extern boxed::data * to_number (json::data *);
+/*
+ * the value of a number whatever primitive type it is boxed with
+ */
+extern double to_double (json::data *);
 extern str::data   * to_string (json::data *);
 
 extern json::data * mk_true(state::data *);
@@ -70,6 +304,26 @@ extern json::data * mk_number (state::data *, double d);
 extern json::data * mk_string(state::data *, str::data * s);
 extern json::data * mk_array(state::data *, int s);
 
+/*
+ * the counters of state::stats as an object allocated in st, with the
+ * live objects of each type under "live_by_type". s is best taken
+ * before the object is made, it changes the counters of st.
+ */
+extern json::data * mk_stats (state::data * st, struct state::stats * s);
+
+/*
+ * a deep copy of j, the singletons are shared
+ */
+extern json::data * clone (state::data *, json::data * j);
+
+/*
+ * mark j and everything it holds as shared between threads, see
+ * cee::share. Threads take references with incr_indegree(dp_del_rc, j)
+ * and drop them with del_ref(j). The document must not be changed once
+ * it is shared, persistent updates can still make new versions of it.
+ */
+extern void share (json::data * j);
+
 extern void object_set (state::data *, json::data *, char *, json::data *);
 extern void object_set_bool (state::data *, json::data *, char *, bool);
 extern void object_set_string (state::data *, json::data *, char *, char *);
@@ -80,12 +334,249 @@ extern void array_append_bool (state::data *, json::data *, bool);
 extern void array_append_string (state::data *, json::data *, char *);
 extern void array_append_number (state::data *, json::data *, double);
 
+/*
+ * what parse and snprint went through, counted only if the library is
+ * built with CEE_JSON_STATS (make JSON_FLAGS=-DCEE_JSON_STATS), which
+ * slows them down. Tokens are counted by stats_token, the tokens the
+ * field mask of a projection skips are not.
+ */
+enum stats_token {
+  stats_open_object = 0,
+  stats_close_object,
+  stats_open_array,
+  stats_close_array,
+  stats_colon,
+  stats_comma,
+  stats_string,       // keys included
+  stats_number,
+  stats_true,
+  stats_false,
+  stats_null,
+  stats_n_tokens
+};
+
+struct stats {
+  uintptr_t n_parses;
+  uintptr_t n_parse_failures;   // the parses that returned false
+  uintptr_t n_tokens[stats_n_tokens];
+  uintptr_t n_strings;          // the strings decoded, keys included
+  uintptr_t n_escaped_strings;  // the strings with escape sequences
+  uintptr_t bytes_copied;       // the bytes decoded into the strings
+  uintptr_t n_parse_allocs;     // the objects allocated by parse
+  // the objects parse left in the state by type, see state::type_name
+  uintptr_t n_parse_allocs_by_type[state::max_types];
+  uintptr_t max_depth;
+  uint64_t  tokenizer_ns;       // the time taken by the tokenizer
+  uint64_t  build_ns;           // the rest, taken by building the tree
+  uintptr_t n_prints;
+  uintptr_t bytes_printed;
+  uintptr_t n_print_allocs;     // the objects allocated by snprint
+  uint64_t  print_ns;
+};
+
+/*
+ * the counters of every parse and snprint in st, NULL if the library is
+ * built without CEE_JSON_STATS
+ */
+extern struct stats * get_stats (state::data * st);
+
+/*
+ * print j to buf, or only count the bytes needed if buf is NULL. The
+ * nesting parse accepts is printed in full, a document built deeper than
+ * MAX_JSON_DEPTH is cut at that depth.
+ */
 extern size_t snprint (state::data *, char * buf, size_t size, json::data *, 
                        enum format);
 
 extern bool parse(state::data *, char * buf, uintptr_t len, json::data **out, 
                   bool force_eof, int *error_at_line);
 
+struct parse_options {
+  projection::data * projection;  // NULL builds the whole document
+  struct stats * stats;           // if not NULL the call is counted into it too
+};
+
+extern bool parse_e(state::data *, char * buf, uintptr_t len, json::data **out,
+                    bool force_eof, int *error_at_line,
+                    struct parse_options * options);
+
+/*
+ * check that buf holds exactly one well formed JSON text without building
+ * it: the structure, string escapes, UTF-8 and the number grammar. It
+ * neither allocates nor needs a state. On failure the offset and the line
+ * of the offending byte are returned. A text that validates is accepted
+ * by parse with force_eof.
+ */
+extern bool validate(char * buf, uintptr_t len, uintptr_t * error_at,
+                     int * error_at_line);
+
+/*
+ * MessagePack encoding. Numbers keep the primitive type they are boxed
+ * with: integers are written as MessagePack integers and read back as i64
+ * (u64 above INT64_MAX), f32 and f64 as float 32 and float 64. undefined
+ * is written as a fixext 1 of type 0. The encoded bytes are a block of
+ * the state.
+ */
+extern block::data * to_msgpack(state::data *, json::data *, uintptr_t * size);
+extern bool from_msgpack(state::data *, char * buf, uintptr_t len,
+                         json::data ** out, uintptr_t * error_at);
+
+/*
+ * CBOR (RFC 8949) encoding, numbers are mapped as in MessagePack and
+ * undefined is the CBOR undefined. Decoding takes definite and indefinite
+ * length items, byte strings become base64url strings, bignums become
+ * numbers and other tags are dropped. Integer map keys become strings.
+ */
+extern block::data * to_cbor(state::data *, json::data *, uintptr_t * size);
+extern bool from_cbor(state::data *, char * buf, uintptr_t len,
+                      json::data ** out, uintptr_t * error_at);
+
+/*
+ * a binary form of a document that is read in place, without being
+ * parsed, e.g. from a file mapped with mmap. Objects keep their keys
+ * sorted and are searched in O(log n), arrays are indexed in O(1). The
+ * layout is described in binary.cpp. Offsets are 64 bit, a document can
+ * be larger than 4 GB.
+ */
+extern block::data * to_binary(state::data *, json::data *, uintptr_t * size);
+
+namespace binary {
+  /*
+   * a value inside a binary document, a few words that are passed by
+   * value. Every access is checked against the bounds of the document.
+   */
+  struct value {
+    char * base;
+    uintptr_t len;
+    uint64_t slot;
+  };
+
+  /*
+   * false if buf does not hold a binary document
+   */
+  extern bool open(char * buf, uintptr_t len, struct value * root);
+
+  extern enum type type_of(struct value);
+  extern bool get_bool(struct value, bool *);
+  extern bool get_number(struct value, double *);
+
+  /*
+   * s points into the document, it is terminated by '\0'
+   */
+  extern bool get_string(struct value, char ** s, uintptr_t * len);
+
+  /*
+   * the number of elements of an array or members of an object
+   */
+  extern uintptr_t size(struct value);
+  extern bool at(struct value array, uintptr_t i, struct value * out);
+  extern bool find(struct value object, char * key, struct value * out);
+
+  /*
+   * the i-th member in the order of the keys
+   */
+  extern bool member(struct value object, uintptr_t i, char ** key,
+                     struct value * out);
+
+  /*
+   * build a json::data tree of the value
+   */
+  extern bool to_json(state::data *, struct value, json::data ** out);
+}
+
+/*
+ * updates of documents that are never changed in place. An update
+ * returns a new root, only the objects and arrays on the path to the
+ * changed value are copied, every other subtree is shared with the old
+ * version and holds one more reference. Old versions stay valid and
+ * readable while newer ones are made, and a version is released with
+ * del(root), which frees only what no other version shares. Nodes
+ * reachable from a version must not be changed in place, e.g. by
+ * apply_patch. An update takes time in the sum of the sizes of the
+ * containers on its path.
+ */
+namespace persistent {
+  /*
+   * v is stored at pointer, which replaces a member or an element, adds
+   * a member, or appends with "-". v is shared, not copied. NULL is
+   * returned if the parent of pointer does not resolve.
+   */
+  extern json::data * set (state::data *, json::data * root, char * pointer,
+                           json::data * v);
+  extern json::data * remove (state::data *, json::data * root, char * pointer);
+}
+
+/*
+ * publication of a document root to threads that read it while writers
+ * replace it, e.g. with a reloaded config or a new persistent version.
+ * Readers never block and never touch reference counts, they should
+ * not call hash or cmp, which cache hashes in the nodes. A replaced root
+ * is retired and freed with del once every reader that may have seen it
+ * has left read_lock, which frees only what later versions do not
+ * share. Retired roots are freed by the writers in publish and reclaim,
+ * so writers should run in the thread that owns the state. The roots
+ * of a domain are gc roots of the state until they are freed, so that
+ * state::gc keeps what readers may see.
+ */
+namespace rcu {
+  struct domain;
+  struct reader;
+
+  extern domain * mk_domain (state::data *, json::data * root,
+                             uintptr_t max_readers);
+
+  /*
+   * free the domain and its retired roots, every reader must have left.
+   * The current root is returned, it is no longer a gc root.
+   */
+  extern json::data * del_domain (domain *);
+
+  /*
+   * a reader slot for the calling thread, NULL if all are taken
+   */
+  extern reader * join (domain *);
+  extern void leave (reader *);
+
+  /*
+   * the current root, it stays valid until read_unlock
+   */
+  extern json::data * read_lock (reader *);
+  extern void read_unlock (reader *);
+
+  /*
+   * swap in a new root, the old one is retired
+   */
+  extern void publish (domain *, json::data * root);
+
+  /*
+   * free the retired roots no reader can see, the number of roots
+   * still waiting is returned
+   */
+  extern uintptr_t reclaim (domain *);
+}
+
+namespace cbor {
+  /*
+   * a decoder that takes its input in chunks of any size, an item that
+   * is split between chunks is carried over
+   */
+  struct decoder;
+
+  extern decoder * mk_decoder(state::data *);
+
+  /*
+   * false once the input is known to be malformed
+   */
+  extern bool feed(decoder *, char * chunk, uintptr_t len);
+
+  /*
+   * the input has ended, out is set if it was exactly one complete item,
+   * otherwise error_at is the offset of the item that failed. The
+   * decoder is freed.
+   */
+  extern bool finish(decoder *, json::data ** out, uintptr_t * error_at);
+}
+
   }
 }
 
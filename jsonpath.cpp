@@ -0,0 +1,679 @@
+/* JSONPath queries
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace jsonpath {
+
+enum expr_op {
+  op_or,
+  op_and,
+  op_not,
+  op_eq,
+  op_ne,
+  op_lt,
+  op_le,
+  op_gt,
+  op_ge,
+  op_path,      // a path from @ or $, true if it selects a value
+  op_literal
+};
+
+struct expr {
+  enum expr_op op;
+  struct expr * left;
+  struct expr * right;
+  /*
+   * op_path
+   */
+  bool absolute;
+  uintptr_t size;
+  struct pointer::token * path;
+  /*
+   * op_literal
+   */
+  enum type t;
+  double number;
+  char * string;
+};
+
+/*
+ * the parts of a plan are carved out of one block, a query never
+ * needs more of them than it has characters
+ */
+struct compiler {
+  char * p;
+  struct step * steps;
+  struct expr * exprs;
+  struct pointer::token * tokens;
+  char * chars;
+};
+
+static void skip_blank(struct compiler * c)
+{
+  while (*c->p == ' ' || *c->p == '\t')
+    c->p++;
+}
+
+static bool is_name_char(char ch)
+{
+  return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z')
+    || ('0' <= ch && ch <= '9') || ch == '_' || ch == '-'
+    || (unsigned char)ch >= 0x80;
+}
+
+static char * read_name(struct compiler * c)
+{
+  char * out = c->chars;
+  if (!is_name_char(*c->p))
+    return NULL;
+  while (is_name_char(*c->p))
+    *c->chars++ = *c->p++;
+  *c->chars++ = '\0';
+  return out;
+}
+
+/*
+ * a name in single or double quotes, \ escapes the next character
+ */
+static char * read_quoted(struct compiler * c)
+{
+  char quote = *c->p++;
+  char * out = c->chars;
+  while (*c->p != quote) {
+    if (*c->p == '\0')
+      return NULL;
+    if (*c->p == '\\' && c->p[1])
+      c->p++;
+    *c->chars++ = *c->p++;
+  }
+  c->p++;
+  *c->chars++ = '\0';
+  return out;
+}
+
+static bool read_int(struct compiler * c, intptr_t * v)
+{
+  char * end;
+  skip_blank(c);
+  if (!(*c->p == '-' || ('0' <= *c->p && *c->p <= '9')))
+    return false;
+  *v = strtol(c->p, &end, 10);
+  if (end == c->p || (*c->p == '-' && end == c->p + 1))
+    return false;
+  c->p = end;
+  skip_blank(c);
+  return true;
+}
+
+static struct expr * parse_or(struct compiler * c);
+
+/*
+ * the steps after @ or $ in a filter, only names and indices
+ */
+static struct expr * parse_path(struct compiler * c)
+{
+  struct expr * e = c->exprs++;
+  e->op = op_path;
+  e->absolute = (*c->p++ == '$');
+  e->path = c->tokens;
+  e->size = 0;
+  for (;;) {
+    struct pointer::token * tok = c->tokens;
+    if (*c->p == '.') {
+      c->p++;
+      if (!(tok->key = read_name(c)))
+        return NULL;
+      tok->index = -1;
+    }
+    else if (*c->p == '[') {
+      c->p++;
+      skip_blank(c);
+      if (*c->p == '\'' || *c->p == '"') {
+        if (!(tok->key = read_quoted(c)))
+          return NULL;
+        tok->index = -1;
+        skip_blank(c);
+      }
+      else {
+        tok->key = NULL;
+        if (!read_int(c, &tok->index))
+          return NULL;
+      }
+      if (*c->p++ != ']')
+        return NULL;
+    }
+    else
+      return e;
+    c->tokens++;
+    e->size++;
+  }
+}
+
+static struct expr * parse_operand(struct compiler * c)
+{
+  struct expr * e;
+  char * end;
+  skip_blank(c);
+  switch (*c->p) {
+    case '@':
+    case '$':
+      e = parse_path(c);
+      break;
+    case '\'':
+    case '"':
+      e = c->exprs++;
+      e->op = op_literal;
+      e->t = type_is_string;
+      if (!(e->string = read_quoted(c)))
+        return NULL;
+      break;
+    default:
+      e = c->exprs++;
+      e->op = op_literal;
+      if (!strncmp(c->p, "true", 4) || !strncmp(c->p, "false", 5)) {
+        e->t = type_is_boolean;
+        e->number = (*c->p == 't');
+        c->p += (*c->p == 't') ? 4 : 5;
+      }
+      else if (!strncmp(c->p, "null", 4)) {
+        e->t = type_is_null;
+        c->p += 4;
+      }
+      else {
+        e->t = type_is_number;
+        e->number = strtod(c->p, &end);
+        if (end == c->p)
+          return NULL;
+        c->p = end;
+      }
+      break;
+  }
+  skip_blank(c);
+  return e;
+}
+
+static struct expr * parse_comparison(struct compiler * c)
+{
+  struct expr * left = parse_operand(c), * e;
+  enum expr_op op;
+  if (left == NULL)
+    return NULL;
+  char * p = c->p;
+  if (p[0] == '=' && p[1] == '=')
+    op = op_eq;
+  else if (p[0] == '!' && p[1] == '=')
+    op = op_ne;
+  else if (p[0] == '<')
+    op = p[1] == '=' ? op_le : op_lt;
+  else if (p[0] == '>')
+    op = p[1] == '=' ? op_ge : op_gt;
+  else
+    return left;
+  c->p += (op == op_lt || op == op_gt) ? 1 : 2;
+  e = c->exprs++;
+  e->op = op;
+  e->left = left;
+  if (!(e->right = parse_operand(c)))
+    return NULL;
+  return e;
+}
+
+static struct expr * parse_unary(struct compiler * c)
+{
+  struct expr * e;
+  skip_blank(c);
+  if (*c->p == '!') {
+    c->p++;
+    e = c->exprs++;
+    e->op = op_not;
+    if (!(e->left = parse_unary(c)))
+      return NULL;
+    return e;
+  }
+  if (*c->p == '(') {
+    c->p++;
+    e = parse_or(c);
+    if (e == NULL || *c->p++ != ')')
+      return NULL;
+    skip_blank(c);
+    return e;
+  }
+  return parse_comparison(c);
+}
+
+static struct expr * parse_and(struct compiler * c)
+{
+  struct expr * left = parse_unary(c), * e;
+  while (left && c->p[0] == '&' && c->p[1] == '&') {
+    c->p += 2;
+    e = c->exprs++;
+    e->op = op_and;
+    e->left = left;
+    if (!(e->right = parse_unary(c)))
+      return NULL;
+    left = e;
+  }
+  return left;
+}
+
+static struct expr * parse_or(struct compiler * c)
+{
+  struct expr * left = parse_and(c), * e;
+  while (left && c->p[0] == '|' && c->p[1] == '|') {
+    c->p += 2;
+    e = c->exprs++;
+    e->op = op_or;
+    e->left = left;
+    if (!(e->right = parse_and(c)))
+      return NULL;
+    left = e;
+  }
+  return left;
+}
+
+/*
+ * the inside of [ ]: a quoted name, *, an index, a slice or a filter
+ */
+static bool parse_bracket(struct compiler * c, struct step * s)
+{
+  skip_blank(c);
+  if (*c->p == '\'' || *c->p == '"') {
+    s->kind = sel_name;
+    if (!(s->name = read_quoted(c)))
+      return false;
+  }
+  else if (*c->p == '*') {
+    s->kind = sel_wildcard;
+    c->p++;
+  }
+  else if (*c->p == '?') {
+    c->p++;
+    skip_blank(c);
+    if (*c->p++ != '(')
+      return false;
+    s->kind = sel_filter;
+    if (!(s->filter = parse_or(c)) || *c->p++ != ')')
+      return false;
+  }
+  else {
+    intptr_t * bounds[3] = { &s->start, &s->end, &s->step };
+    bool given[3] = { false, false, false };
+    int i;
+    for (i = 0; i < 3; i++) {
+      given[i] = read_int(c, bounds[i]);
+      if (*c->p != ':')
+        break;
+      c->p++;
+    }
+    if (i == 3)
+      return false;
+    if (i == 0) {
+      s->kind = sel_index;
+      if (!given[0])
+        return false;
+    }
+    else {
+      s->kind = sel_slice;
+      s->has_start = given[0];
+      s->has_end = given[1];
+      if (!given[2])
+        s->step = 1;
+    }
+  }
+  skip_blank(c);
+  return *c->p++ == ']';
+}
+
+jsonpath::data * compile(state::data * st, char * query)
+{
+  size_t n = strlen(query) + 1;
+  size_t head = sizeof(jsonpath::data);
+  size_t steps_size = n * sizeof(struct step);
+  size_t exprs_size = n * sizeof(struct expr);
+  size_t tokens_size = n * sizeof(struct pointer::token);
+  jsonpath::data * plan =
+    (jsonpath::data *)block::mk(st, head + steps_size + exprs_size
+                                     + tokens_size + 2 * n);
+  struct compiler c;
+  char * mem = (char *)plan;
+  memset(mem, 0, head + steps_size + exprs_size + tokens_size);
+  c.p = query;
+  c.steps = plan->steps = (struct step *)(mem + head);
+  c.exprs = (struct expr *)(mem + head + steps_size);
+  c.tokens = (struct pointer::token *)(mem + head + steps_size + exprs_size);
+  c.chars = mem + head + steps_size + exprs_size + tokens_size;
+  plan->size = 0;
+
+  skip_blank(&c);
+  if (*c.p++ != '$')
+    goto error;
+  for (;;) {
+    skip_blank(&c);
+    if (*c.p == '\0')
+      return plan;
+    struct step * s = c.steps++;
+    plan->size++;
+    if (c.p[0] == '.' && c.p[1] == '.') {
+      s->descendant = true;
+      c.p += 2;
+      if (*c.p == '[') {
+        c.p++;
+        if (!parse_bracket(&c, s))
+          goto error;
+        continue;
+      }
+    }
+    else if (*c.p == '.')
+      c.p++;
+    else if (*c.p == '[') {
+      c.p++;
+      if (!parse_bracket(&c, s))
+        goto error;
+      continue;
+    }
+    else
+      goto error;
+    if (*c.p == '*') {
+      s->kind = sel_wildcard;
+      c.p++;
+    }
+    else {
+      s->kind = sel_name;
+      if (!(s->name = read_name(&c)))
+        goto error;
+    }
+  }
+
+error:
+  del(plan);
+  return NULL;
+}
+
+/*
+ * the state of one evaluation, the plan itself is never written
+ */
+struct run {
+  jsonpath::data * plan;
+  json::data * root;
+  list::data * results;
+};
+
+struct visit {
+  struct run * r;
+  uintptr_t i;
+};
+
+static void apply(struct run * r, uintptr_t i, json::data * j);
+static void descend(struct run * r, uintptr_t i, json::data * j);
+
+static json::data * resolve(struct expr * e, json::data * root, json::data * j)
+{
+  uintptr_t i;
+  if (e->absolute)
+    j = root;
+  for (i = 0; j && i < e->size; i++) {
+    struct pointer::token * tok = e->path + i;
+    if (tok->key) {
+      if (j->t != type_is_object)
+        return NULL;
+      j = (json::data *)map::find(j->value.object, tok->key);
+    }
+    else {
+      intptr_t n, k = tok->index;
+      if (j->t != type_is_array)
+        return NULL;
+      n = list::size(j->value.array);
+      if (k < 0)
+        k += n;
+      if (k < 0 || k >= n)
+        return NULL;
+      j = (json::data *)j->value.array->_[k];
+    }
+  }
+  return j;
+}
+
+/*
+ * a scalar value of a comparison
+ */
+struct scalar {
+  enum type t;
+  double number;
+  char * string;
+};
+
+static bool operand(struct expr * e, json::data * root, json::data * j,
+                    struct scalar * v)
+{
+  if (e->op == op_literal) {
+    v->t = e->t;
+    v->number = e->number;
+    v->string = e->string;
+    return true;
+  }
+  j = resolve(e, root, j);
+  if (j == NULL)
+    return false;
+  v->t = j->t;
+  switch (j->t) {
+    case type_is_number:
+      v->number = to_double(j);
+      break;
+    case type_is_boolean:
+      v->number = to_bool(j);
+      break;
+    case type_is_string:
+      v->string = (char *)j->value.string;
+      break;
+    case type_is_null:
+      break;
+    default:
+      /*
+       * containers are compared by identity
+       */
+      v->string = (char *)j;
+      break;
+  }
+  return true;
+}
+
+static bool compare(struct expr * e, json::data * root, json::data * j)
+{
+  struct scalar a, b;
+  int c;
+  if (!operand(e->left, root, j, &a) || !operand(e->right, root, j, &b))
+    return e->op == op_ne;
+  if (a.t != b.t)
+    return e->op == op_ne;
+  switch (a.t) {
+    case type_is_number:
+    case type_is_boolean:
+      c = (a.number > b.number) - (a.number < b.number);
+      break;
+    case type_is_string:
+      c = strcmp(a.string, b.string);
+      break;
+    case type_is_null:
+      c = 0;
+      break;
+    default:
+      if (e->op != op_eq && e->op != op_ne)
+        return false;
+      c = (a.string != b.string);
+      break;
+  }
+  if (a.t == type_is_boolean || a.t == type_is_null)
+    if (e->op != op_eq && e->op != op_ne)
+      return false;
+  switch (e->op) {
+    case op_eq: return c == 0;
+    case op_ne: return c != 0;
+    case op_lt: return c < 0;
+    case op_le: return c <= 0;
+    case op_gt: return c > 0;
+    default:    return c >= 0;
+  }
+}
+
+static bool matches(struct expr * e, json::data * root, json::data * j)
+{
+  switch (e->op) {
+    case op_or:
+      return matches(e->left, root, j) || matches(e->right, root, j);
+    case op_and:
+      return matches(e->left, root, j) && matches(e->right, root, j);
+    case op_not:
+      return !matches(e->left, root, j);
+    case op_path:
+      return resolve(e, root, j) != NULL;
+    case op_literal:
+      return e->t == type_is_boolean ? e->number != 0 : e->t != type_is_null;
+    default:
+      return compare(e, root, j);
+  }
+}
+
+/*
+ * member callbacks of map::walk
+ */
+static void apply_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  apply(v->r, v->i + 1, (json::data *)value);
+}
+
+static void filter_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  struct step * s = v->r->plan->steps + v->i;
+  if (matches(s->filter, v->r->root, (json::data *)value))
+    apply(v->r, v->i + 1, (json::data *)value);
+}
+
+static void descend_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  descend(v->r, v->i, (json::data *)value);
+}
+
+/*
+ * python like slice bounds
+ */
+static intptr_t clamp(intptr_t k, intptr_t n, intptr_t lo, intptr_t hi)
+{
+  if (k < 0)
+    k += n;
+  return k < lo ? lo : (k > hi ? hi : k);
+}
+
+/*
+ * apply the selector of step i to j and go on with the selected nodes
+ */
+static void select_step(struct run * r, uintptr_t i, json::data * j)
+{
+  struct step * s = r->plan->steps + i;
+  struct visit v = { r, i };
+  json::data * child;
+  intptr_t n, k, start, end;
+
+  if (j->t == type_is_object) {
+    switch (s->kind) {
+      case sel_name:
+        child = (json::data *)map::find(j->value.object, s->name);
+        if (child)
+          apply(r, i + 1, child);
+        break;
+      case sel_wildcard:
+        map::walk(j->value.object, &v, apply_member);
+        break;
+      case sel_filter:
+        map::walk(j->value.object, &v, filter_member);
+        break;
+      default:
+        break;
+    }
+    return;
+  }
+  if (j->t != type_is_array)
+    return;
+  n = list::size(j->value.array);
+  switch (s->kind) {
+    case sel_wildcard:
+      for (k = 0; k < n; k++)
+        apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      break;
+    case sel_filter:
+      for (k = 0; k < n; k++) {
+        child = (json::data *)j->value.array->_[k];
+        if (matches(s->filter, r->root, child))
+          apply(r, i + 1, child);
+      }
+      break;
+    case sel_index:
+      k = s->start < 0 ? s->start + n : s->start;
+      if (0 <= k && k < n)
+        apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      break;
+    case sel_slice:
+      if (s->step > 0) {
+        start = s->has_start ? clamp(s->start, n, 0, n) : 0;
+        end = s->has_end ? clamp(s->end, n, 0, n) : n;
+        for (k = start; k < end; k += s->step)
+          apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      }
+      else if (s->step < 0) {
+        start = s->has_start ? clamp(s->start, n, -1, n - 1) : n - 1;
+        end = s->has_end ? clamp(s->end, n, -1, n - 1) : -1;
+        for (k = start; k > end; k += s->step)
+          apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * apply the selector of step i to j and all of its descendants
+ */
+static void descend(struct run * r, uintptr_t i, json::data * j)
+{
+  struct visit v = { r, i };
+  intptr_t k, n;
+  select_step(r, i, j);
+  if (j->t == type_is_object)
+    map::walk(j->value.object, &v, descend_member);
+  else if (j->t == type_is_array) {
+    n = list::size(j->value.array);
+    for (k = 0; k < n; k++)
+      descend(r, i, (json::data *)j->value.array->_[k]);
+  }
+}
+
+static void apply(struct run * r, uintptr_t i, json::data * j)
+{
+  if (i == r->plan->size)
+    list::append(&r->results, j);
+  else if (r->plan->steps[i].descendant)
+    descend(r, i, j);
+  else
+    select_step(r, i, j);
+}
+
+list::data * eval(state::data * st, jsonpath::data * plan, json::data * j)
+{
+  struct run r = { plan, j, list::mk_e(st, dp_noop, 8) };
+  apply(&r, 0, j);
+  return r.results;
+}
+
+    }
+  }
+}
@@ -0,0 +1,413 @@
+/* MessagePack encoding
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "buffer.hpp"
+#include "utf8.h"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace msgpack {
+
+/*
+ * undefined has no MessagePack type, it is written as a fixext 1 of
+ * the application type 0
+ */
+#define MSGPACK_UNDEFINED_EXT 0
+
+static void encode_uint(struct buffer * b, uint64_t v)
+{
+  if (v < 0x80)
+    buffer_put_byte(b, v);
+  else if (v <= 0xFF) {
+    buffer_put_byte(b, 0xcc);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v <= 0xFFFF) {
+    buffer_put_byte(b, 0xcd);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v <= 0xFFFFFFFF) {
+    buffer_put_byte(b, 0xce);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, 0xcf);
+    buffer_put_be(b, v, 8);
+  }
+}
+
+static void encode_int(struct buffer * b, int64_t v)
+{
+  if (v >= 0)
+    encode_uint(b, v);
+  else if (v >= -32)
+    buffer_put_byte(b, (uint8_t)v);
+  else if (v >= INT8_MIN) {
+    buffer_put_byte(b, 0xd0);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v >= INT16_MIN) {
+    buffer_put_byte(b, 0xd1);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v >= INT32_MIN) {
+    buffer_put_byte(b, 0xd2);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, 0xd3);
+    buffer_put_be(b, v, 8);
+  }
+}
+
+static void encode_number(struct buffer * b, boxed::data * x)
+{
+  uint64_t u64;
+  uint32_t u32;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+      memcpy(&u64, &x->_.f64, 8);
+      buffer_put_byte(b, 0xcb);
+      buffer_put_be(b, u64, 8);
+      break;
+    case boxed::primitive_f32:
+      memcpy(&u32, &x->_.f32, 4);
+      buffer_put_byte(b, 0xca);
+      buffer_put_be(b, u32, 4);
+      break;
+    case boxed::primitive_u64: encode_uint(b, x->_.u64); break;
+    case boxed::primitive_u32: encode_uint(b, x->_.u32); break;
+    case boxed::primitive_u16: encode_uint(b, x->_.u16); break;
+    case boxed::primitive_u8:  encode_uint(b, x->_.u8);  break;
+    case boxed::primitive_i64: encode_int(b, x->_.i64);  break;
+    case boxed::primitive_i32: encode_int(b, x->_.i32);  break;
+    case boxed::primitive_i16: encode_int(b, x->_.i16);  break;
+    case boxed::primitive_i8:  encode_int(b, x->_.i8);   break;
+  }
+}
+
+/*
+ * the header of a str, array or map: the fix form, then 8 (str only),
+ * 16 and 32 bit lengths
+ */
+static void encode_header(struct buffer * b, uint8_t fix, uintptr_t fix_max,
+                          uint8_t first, uintptr_t n)
+{
+  if (n <= fix_max)
+    buffer_put_byte(b, fix | n);
+  else if (first == 0xd9 && n <= 0xFF) {
+    buffer_put_byte(b, 0xd9);
+    buffer_put_be(b, n, 1);
+  }
+  else if (n <= 0xFFFF) {
+    buffer_put_byte(b, first == 0xd9 ? 0xda : first);
+    buffer_put_be(b, n, 2);
+  }
+  else {
+    buffer_put_byte(b, (first == 0xd9 ? 0xda : first) + 1);
+    buffer_put_be(b, n, 4);
+  }
+}
+
+static void encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  encode_header(b, 0xa0, 31, 0xd9, n);
+  buffer_put(b, s, n);
+}
+
+static void encode(struct buffer * b, json::data * j);
+
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct buffer * b = (struct buffer *)cxt;
+  encode_string(b, (char *)key);
+  encode(b, (json::data *)value);
+}
+
+static void encode(struct buffer * b, json::data * j)
+{
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+      buffer_put_byte(b, 0xd4);
+      buffer_put_byte(b, MSGPACK_UNDEFINED_EXT);
+      buffer_put_byte(b, 0);
+      break;
+    case type_is_null:
+      buffer_put_byte(b, 0xc0);
+      break;
+    case type_is_boolean:
+      buffer_put_byte(b, to_bool(j) ? 0xc3 : 0xc2);
+      break;
+    case type_is_number:
+      encode_number(b, j->value.number);
+      break;
+    case type_is_string:
+      encode_string(b, (char *)j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      encode_header(b, 0x90, 15, 0xdc, n);
+      for (i = 0; i < n; i++)
+        encode(b, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      encode_header(b, 0x80, 15, 0xde, map::size(j->value.object));
+      map::walk(j->value.object, b, encode_member);
+      break;
+  }
+}
+
+struct reader {
+  state::data * st;
+  unsigned char * p;
+  unsigned char * end;
+  int depth;
+};
+
+static bool read_be(struct reader * r, int n, uint64_t * v)
+{
+  int i;
+  if (r->end - r->p < n)
+    return false;
+  *v = 0;
+  for (i = 0; i < n; i++)
+    *v = (*v << 8) | *r->p++;
+  return true;
+}
+
+static json::data * mk_boxed(state::data * st, boxed::data * x)
+{
+  return (json::data *)tagged::mk(st, type_is_number, x);
+}
+
+static json::data * mk_int(state::data * st, int64_t v)
+{
+  return mk_boxed(st, boxed::from_i64(st, v));
+}
+
+/*
+ * a string is valid UTF-8 without '\0', which would cut it short
+ */
+static str::data * read_string(struct reader * r, uint64_t n)
+{
+  char * p = (char *)r->p;
+  if ((uint64_t)(r->end - r->p) < n || utf8_scan(p, p + n) != p + n || memchr(p, '\0', n))
+    return NULL;
+  str::data * s = str::mk_e(r->st, n + 1, NULL);
+  memcpy(s->_, r->p, n);
+  s->_[n] = '\0';
+  r->p += n;
+  return s;
+}
+
+static bool decode(struct reader * r, json::data ** out);
+
+static bool decode_array(struct reader * r, uint64_t n, json::data ** out)
+{
+  uint64_t i;
+  json::data * v;
+  /*
+   * every element takes at least a byte, a bogus count cannot make
+   * the list allocate more than the input is long
+   */
+  if (n > (uint64_t)(r->end - r->p) || r->depth == MAX_JSON_DEPTH)
+    return false;
+  json::data * a = mk_array(r->st, n);
+  r->depth++;
+  for (i = 0; i < n; i++) {
+    if (!decode(r, &v)) {
+      del(a);
+      return false;
+    }
+    list::append(&a->value.array, v);
+  }
+  r->depth--;
+  *out = a;
+  return true;
+}
+
+static bool decode_map(struct reader * r, uint64_t n, json::data ** out)
+{
+  uint64_t i, len;
+  json::data * v;
+  str::data * key;
+  if (n > (uint64_t)(r->end - r->p) / 2 || r->depth == MAX_JSON_DEPTH)
+    return false;
+  json::data * o = mk_object(r->st);
+  r->depth++;
+  for (i = 0; i < n; i++) {
+    unsigned char c = r->p < r->end ? *r->p++ : 0xc1;
+    if ((c & 0xe0) == 0xa0)
+      len = c & 0x1f;
+    else if (c < 0xd9 || c > 0xdb || !read_be(r, 1 << (c - 0xd9), &len)) {
+      del(o);
+      return false;
+    }
+    if (!(key = read_string(r, len))) {
+      del(o);
+      return false;
+    }
+    if (!decode(r, &v)) {
+      del(key);
+      del(o);
+      return false;
+    }
+    map::add(o->value.object, key, v);
+  }
+  r->depth--;
+  *out = o;
+  return true;
+}
+
+static bool decode(struct reader * r, json::data ** out)
+{
+  uint64_t v;
+  str::data * s;
+  if (r->p == r->end)
+    return false;
+  unsigned char c = *r->p++;
+
+  if (c < 0x80) {
+    *out = mk_int(r->st, c);
+    return true;
+  }
+  if (c >= 0xe0) {
+    *out = mk_int(r->st, (int8_t)c);
+    return true;
+  }
+  switch (c & 0xf0) {
+    case 0x80:
+      return decode_map(r, c & 0x0f, out);
+    case 0x90:
+      return decode_array(r, c & 0x0f, out);
+    case 0xa0:
+    case 0xb0:
+      if (!(s = read_string(r, c & 0x1f)))
+        return false;
+      *out = mk_string(r->st, s);
+      return true;
+  }
+  switch (c) {
+    case 0xc0:
+      *out = mk_null(r->st);
+      return true;
+    case 0xc2:
+      *out = mk_false(r->st);
+      return true;
+    case 0xc3:
+      *out = mk_true(r->st);
+      return true;
+    case 0xca:
+      {
+        uint32_t u32;
+        float f;
+        if (!read_be(r, 4, &v))
+          return false;
+        u32 = v;
+        memcpy(&f, &u32, 4);
+        *out = mk_boxed(r->st, boxed::from_float(r->st, f));
+        return true;
+      }
+    case 0xcb:
+      {
+        double d;
+        if (!read_be(r, 8, &v))
+          return false;
+        memcpy(&d, &v, 8);
+        *out = mk_boxed(r->st, boxed::from_double(r->st, d));
+        return true;
+      }
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+      if (!read_be(r, 1 << (c - 0xcc), &v))
+        return false;
+      if (v > INT64_MAX)
+        *out = mk_boxed(r->st, boxed::from_u64(r->st, v));
+      else
+        *out = mk_int(r->st, v);
+      return true;
+    case 0xd0:
+      if (!read_be(r, 1, &v))
+        return false;
+      *out = mk_int(r->st, (int8_t)v);
+      return true;
+    case 0xd1:
+      if (!read_be(r, 2, &v))
+        return false;
+      *out = mk_int(r->st, (int16_t)v);
+      return true;
+    case 0xd2:
+      if (!read_be(r, 4, &v))
+        return false;
+      *out = mk_int(r->st, (int32_t)v);
+      return true;
+    case 0xd3:
+      if (!read_be(r, 8, &v))
+        return false;
+      *out = mk_int(r->st, (int64_t)v);
+      return true;
+    case 0xd4:
+      if (r->end - r->p < 2 || r->p[0] != MSGPACK_UNDEFINED_EXT)
+        return false;
+      r->p += 2;
+      *out = mk_undefined(r->st);
+      return true;
+    case 0xd9: case 0xda: case 0xdb:
+      if (!read_be(r, 1 << (c - 0xd9), &v) || !(s = read_string(r, v)))
+        return false;
+      *out = mk_string(r->st, s);
+      return true;
+    case 0xdc: case 0xdd:
+      if (!read_be(r, c == 0xdc ? 2 : 4, &v))
+        return false;
+      return decode_array(r, v, out);
+    case 0xde: case 0xdf:
+      if (!read_be(r, c == 0xde ? 2 : 4, &v))
+        return false;
+      return decode_map(r, v, out);
+    default:
+      /*
+       * bin and the other ext types have no JSON counterpart
+       */
+      return false;
+  }
+}
+
+    }
+
+block::data * to_msgpack(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 256);
+  msgpack::encode(&b, j);
+  *size = b.size;
+  return (block::data *)b._;
+}
+
+bool from_msgpack(state::data * st, char * buf, uintptr_t len,
+                  json::data ** out, uintptr_t * error_at)
+{
+  struct msgpack::reader r;
+  r.st = st;
+  r.p = (unsigned char *)buf;
+  r.end = r.p + len;
+  r.depth = 0;
+  *out = NULL;
+  if (msgpack::decode(&r, out) && r.p == r.end)
+    return true;
+  if (*out) {
+    del(*out);
+    *out = NULL;
+  }
+  *error_at = (char *)r.p - buf;
+  return false;
+}
+
+  }
+}
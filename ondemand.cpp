@@ -0,0 +1,305 @@
+/* On demand JSON access
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "tokenizer.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace ondemand {
+
+static void load(struct document * d, struct tokenizer * t)
+{
+  t->buf = d->buf;
+  t->buf_end = d->buf_end;
+  t->line = d->line;
+  t->str = NULL;
+  t->utf8_checked = false;
+  t->stats = NULL;
+}
+
+static void store(struct tokenizer * t, struct document * d)
+{
+  d->buf = t->buf;
+  d->line = t->line;
+}
+
+static bool fail(struct document * d)
+{
+  d->error = true;
+  return false;
+}
+
+/*
+ * bring the document to the given container depth with no value pending,
+ * whatever is left of deeper containers is skipped
+ */
+static bool seek(struct document * d, int depth)
+{
+  struct tokenizer t;
+  load(d, &t);
+  while (!d->error && (d->depth > depth || (d->depth == depth && d->at_value))) {
+    if (d->at_value) {
+      if (!skip_value(&t))
+        d->error = true;
+      d->at_value = false;
+    }
+    else {
+      if (!skip_container(&t, d->open[d->depth - 1]))
+        d->error = true;
+      d->depth--;
+    }
+  }
+  store(&t, d);
+  return !d->error && d->depth == depth;
+}
+
+/*
+ * true if v is the value the document is positioned at
+ */
+static bool current(struct value v)
+{
+  struct document * d = v.doc;
+  return !d->error && d->at_value && d->depth == v.depth;
+}
+
+/*
+ * consume the current value as a single token, st is only used for
+ * strings
+ */
+static int scalar(state::data * st, struct value v, struct tokenizer * t)
+{
+  struct document * d = v.doc;
+  if (!current(v))
+    return tock_err;
+  load(d, t);
+  int c = next_token(st, t);
+  if (c == tock_err || c == tock_eof || c < tock_eof)
+    fail(d);
+  else {
+    store(t, d);
+    d->at_value = false;
+  }
+  return c;
+}
+
+struct value init(struct document * d, char * buf, uintptr_t len)
+{
+  d->buf = buf;
+  d->buf_end = buf + len;
+  d->line = 0;
+  d->depth = 0;
+  d->at_value = true;
+  d->error = false;
+  struct value v = { d, 0 };
+  return v;
+}
+
+enum type type_of(struct value v)
+{
+  struct tokenizer t;
+  if (!current(v))
+    return type_is_undefined;
+  load(v.doc, &t);
+  int c = skip_space(&t);
+  store(&t, v.doc);
+  switch (c) {
+    case '{':
+      return type_is_object;
+    case '[':
+      return type_is_array;
+    case '"':
+      return type_is_string;
+    case 't':
+    case 'f':
+      return type_is_boolean;
+    case 'n':
+      return type_is_null;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return type_is_number;
+    default:
+      return type_is_undefined;
+  }
+}
+
+static bool enter(struct value v, char open)
+{
+  struct tokenizer t;
+  struct document * d = v.doc;
+  if (!current(v))
+    return false;
+  load(d, &t);
+  if (skip_space(&t) != open || d->depth == MAX_JSON_DEPTH)
+    return fail(d);
+  t.buf++;
+  store(&t, d);
+  d->at_value = false;
+  d->open[d->depth++] = open;
+  return true;
+}
+
+bool get_object(struct value v, struct object * o)
+{
+  if (!enter(v, '{'))
+    return false;
+  o->doc = v.doc;
+  o->depth = v.doc->depth;
+  o->first = true;
+  return true;
+}
+
+bool get_array(struct value v, struct array * a)
+{
+  if (!enter(v, '['))
+    return false;
+  a->doc = v.doc;
+  a->depth = v.doc->depth;
+  a->first = true;
+  return true;
+}
+
+bool find_field(struct object * o, char * key, struct value * out)
+{
+  struct document * d = o->doc;
+  struct tokenizer t;
+  char * begin, * end;
+  if (!seek(d, o->depth))
+    return false;
+  load(d, &t);
+  for (;;) {
+    int c = skip_space(&t);
+    if (c == '}') {
+      t.buf++;
+      store(&t, d);
+      d->depth--;
+      return false;
+    }
+    if (!o->first) {
+      if (c != ',')
+        break;
+      t.buf++;
+      c = skip_space(&t);
+    }
+    o->first = false;
+    if (c != '"' || !scan_string(&t, &begin, &end) || skip_space(&t) != ':')
+      break;
+    t.buf++;
+    if (string_equals(begin, end, key)) {
+      store(&t, d);
+      d->at_value = true;
+      out->doc = d;
+      out->depth = o->depth;
+      return true;
+    }
+    if (!skip_value(&t))
+      break;
+  }
+  store(&t, d);
+  return fail(d);
+}
+
+bool next_element(struct array * a, struct value * out)
+{
+  struct document * d = a->doc;
+  struct tokenizer t;
+  if (!seek(d, a->depth))
+    return false;
+  load(d, &t);
+  int c = skip_space(&t);
+  if (c == ']') {
+    t.buf++;
+    store(&t, d);
+    d->depth--;
+    return false;
+  }
+  if (!a->first) {
+    if (c != ',') {
+      store(&t, d);
+      return fail(d);
+    }
+    t.buf++;
+  }
+  a->first = false;
+  store(&t, d);
+  d->at_value = true;
+  out->doc = d;
+  out->depth = a->depth;
+  return true;
+}
+
+bool get_string(state::data * st, struct value v, str::data ** s)
+{
+  struct tokenizer t;
+  t.str = NULL; // scalar does not load t for a value already consumed
+  int c = scalar(st, v, &t);
+  if (c != tock_str) {
+    if (t.str)
+      del(t.str);
+    return fail(v.doc);
+  }
+  *s = t.str;
+  return true;
+}
+
+bool get_number(struct value v, double * d)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_number || scalar(NULL, v, &t) != tock_number)
+    return fail(v.doc);
+  *d = t.real;
+  return true;
+}
+
+bool get_bool(struct value v, bool * b)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_boolean)
+    return fail(v.doc);
+  switch (scalar(NULL, v, &t)) {
+    case tock_true:
+      *b = true;
+      return true;
+    case tock_false:
+      *b = false;
+      return true;
+    default:
+      return fail(v.doc);
+  }
+}
+
+bool is_null(struct value v)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_null)
+    return false;
+  return scalar(NULL, v, &t) == tock_null;
+}
+
+bool materialize(state::data * st, struct value v, json::data ** out)
+{
+  struct tokenizer t;
+  struct document * d = v.doc;
+  int line;
+  if (!current(v))
+    return false;
+  load(d, &t);
+  skip_space(&t);
+  char * begin = t.buf;
+  if (!skip_value(&t))
+    return fail(d);
+  if (!parse(st, begin, t.buf - begin, out, true, &line))
+    return fail(d);
+  store(&t, d);
+  d->at_value = false;
+  return true;
+}
+
+    }
+  }
+}
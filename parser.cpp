@@ -1,11 +1,14 @@
 /* JSON parser
-   C reimplementation of 
+   C reimplementation of
      Artyom Beilis (Tonkikh) <artyomtnk@yahoo.com>'s orca_json.cpp
 */
 #ifndef CEE_JSON_AMALGAMATION
 #include "json.hpp"
 #include "cee.hpp"
 #include "tokenizer.hpp"
+#include "builder.hpp"
+#include "stats.hpp"
+#include "utf8.h"
 #include <string.h>
 #include <stdlib.h>
 #endif
@@ -13,240 +16,285 @@
 namespace cee {
   namespace json {
 
-enum state_type {
-  st_init = 0,
-  st_object_or_array_or_value_expected = 0 ,
-  st_object_key_or_close_expected,
-  st_object_colon_expected,
-  st_object_value_expected,
-  st_object_close_or_comma_expected,
-  st_array_value_or_close_expected,
-  st_array_close_or_comma_expected,
-  st_error,
-  st_done
-} state_type;
-
-static const uintptr_t json_max_depth = 512;
-
-bool parse(state::data * st, char * buf, uintptr_t len, json::data **out, 
+/*
+ * the mask of a subtree that is built completely
+ */
+#define MASK_ALL (~(uint64_t)0)
+
+/*
+ * what the parser keeps for each open container of the builder
+ */
+struct frame {
+  uint64_t mask;      // the projection paths that can still match inside
+  uintptr_t index;    // the index of the next element of an array
+};
+
+static enum stats_token stats_token_of(int c)
+{
+  switch (c) {
+    case '{': return stats_open_object;
+    case '}': return stats_close_object;
+    case '[': return stats_open_array;
+    case ']': return stats_close_array;
+    case ':': return stats_colon;
+    case ',': return stats_comma;
+    case tock_str: return stats_string;
+    case tock_number: return stats_number;
+    case tock_true: return stats_true;
+    case tock_false: return stats_false;
+    case tock_null: return stats_null;
+    default: return stats_n_tokens;
+  }
+}
+
+static int get_token(state::data * st, struct tokenizer * t)
+{
+  uint64_t started = 0;
+  enum stats_token k;
+  JSON_STATS(t->stats, started = stats_clock());
+  int c = next_token(st, t);
+  JSON_STATS(t->stats, t->stats->tokenizer_ns += stats_clock() - started;
+                       if ((k = stats_token_of(c)) != stats_n_tokens)
+                         t->stats->n_tokens[k]++);
+#ifdef DEBUG_PARSER
+  printf ("token %c\n", c);
+#endif
+  return c;
+}
+
+/*
+ * return the paths of mask that select the member named by the raw
+ * string [begin, end), or the element index if begin is NULL.
+ * MASK_ALL is returned if a path ends at the member.
+ */
+static uint64_t select_paths(projection::data * proj, uint64_t mask, int level,
+                             char * begin, char * end, uintptr_t index)
+{
+  uint64_t selected = 0;
+  uintptr_t i;
+  for (i = 0; i < proj->size; i++) {
+    if (!(mask & ((uint64_t)1 << i)))
+      continue;
+    struct projection::path * p = proj->_ + i;
+    struct projection::step * s = p->steps + level;
+    bool match;
+    if (begin)
+      match = s->key && string_equals(begin, end, s->key);
+    else
+      match = !s->key && (s->index < 0 || (uintptr_t)s->index == index);
+    if (match) {
+      if (p->size == (uintptr_t)level + 1)
+        return MASK_ALL;
+      selected |= (uint64_t)1 << i;
+    }
+  }
+  return selected;
+}
+
+static uint64_t root_mask(projection::data * proj)
+{
+  uintptr_t i;
+  if (proj == NULL)
+    return MASK_ALL;
+  for (i = 0; i < proj->size; i++)
+    if (proj->_[i].size == 0)
+      return MASK_ALL;
+  return ((uint64_t)1 << proj->size) - 1;
+}
+
+bool parse(state::data * st, char * buf, uintptr_t len, json::data **out,
            bool force_eof, int *error_at_line)
 {
-  struct tokenizer tock = {0};
+  return parse_e(st, buf, len, out, force_eof, error_at_line, NULL);
+}
+
+/*
+ * the states of the old table driven parser are kept as labels, each
+ * state jumps to its successor directly so the dispatch on a state
+ * variable is gone. The builder keeps the open containers in a fixed
+ * array on the C stack, nesting does not allocate any bookkeeping
+ * objects.
+ *
+ * With a projection every container carries the set of paths that can
+ * still match inside it. Members and elements no path selects are
+ * skipped with the scanning functions of the tokenizer, which neither
+ * decode nor allocate anything.
+ */
+bool parse_e(state::data * st, char * buf, uintptr_t len, json::data **out,
+             bool force_eof, int *error_at_line, struct parse_options * options)
+{
+  struct tokenizer tock = {};
   tock.buf = buf;
   tock.buf_end = buf + len;
   *out = NULL;
-  
-  enum state_type state = st_init;
-  str::data * key = NULL;
-  
-  stack::data * sp = stack::mk_e (st, dp_noop, json_max_depth);
-  tuple::data * top = NULL;
-  tuple::data * result = NULL;
-  static enum del_policy del_noops[2] = { dp_noop, dp_noop };
-
-#define SPI(s, j)    tuple::mk_e(st, del_noops, (void *)s, j)
-#define TOPS         (static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])))
-#define POP(sp)      { result = (struct tuple::data *)stack::pop(sp); }
-  
-  stack::push(sp, SPI(st_done, NULL));
-
-  while(!stack::empty(sp) && !stack::full(sp) &&
-        state != st_error && state != st_done) {
-
-    if (result) {
-      del(result);
-      result = NULL;
+
+  /*
+   * a complete input is checked as a whole, which is faster than
+   * validating every string after it is decoded
+   */
+  if (force_eof) {
+    char * bad = utf8_scan(buf, tock.buf_end);
+    if (bad != tock.buf_end) {
+      *error_at_line = count_lines(buf, bad);
+      return false;
     }
+    tock.utf8_checked = true;
+  }
 
-    int c = next_token(st, &tock);
-#ifdef DEBUG_PARSER
-    printf ("token %c\n", c);
-#endif
-    
-    top = (tuple::data *)stack::top(sp, 0);
-    switch(state) {
-    case st_object_or_array_or_value_expected:
-      if(c=='[')  {
-        top->_[1]= mk_array(st, 10);
-        state=st_array_value_or_close_expected;
-      }
-      else if(c=='{') {
-        top->_[1]= mk_object(st);
-        state=st_object_key_or_close_expected;
-      }
-      else if(c==tock_str)  {
-        top->_[1]= mk_string(st, tock.str);
-        tock.str = NULL;
-        state=TOPS;
-        POP(sp);
-      }
-      else if(c==tock_true) {
-        top->_[1]= mk_true(st);
-        state=TOPS;
-        POP(sp);
-      }
-      else if(c==tock_false) {
-        top->_[1] = mk_false(st);
-        state=TOPS;
-        POP(sp);
-      }
-      else if(c==tock_null) {
-        top->_[1] = mk_null(st);
-        state=TOPS;
-        POP(sp);
-      }
-      else if(c==tock_number) {
-        top->_[1] = mk_number (st, tock.real);
-        state=TOPS;
-        POP(sp);
-      }
-      else
-        state = st_error;
-      break;
+  projection::data * proj = options ? options->projection : NULL;
+  struct stats_call call;
+  if (JSON_STATS_ON) {
+    stats_begin(st, &call);
+    tock.stats = &call.counted;
+  }
+  struct frame frames[MAX_JSON_DEPTH];
+  struct builder b;
+  json::data * v = NULL;
+  uint64_t mask = root_mask(proj);
+  char * begin, * end, * key_at;
+  int c;
+  builder_init(&b);
 
-    case st_object_key_or_close_expected:
-      if(c=='}') {
-        state=TOPS;
-        POP(sp);
-      } 
-      else if (c==tock_str) {
-        key = tock.str;
-        tock.str = NULL;
-        state = st_object_colon_expected;
+st_object_or_array_or_value_expected:
+  if (mask != MASK_ALL && b.depth > 0) {
+    c = skip_space(&tock);
+    if (c != '[' && c != '{') {
+      /*
+       * a path goes on below this value but it is not a container
+       */
+      if (!skip_value(&tock))
+        goto st_error;
+      if (b.key) {
+        del(b.key);
+        b.key = NULL;
       }
-      else
-        state = st_error;
+      goto st_close_or_comma_expected;
+    }
+  }
+  c = get_token(st, &tock);
+st_value:
+  switch(c) {
+    case '[':
+    case '{':
+      if (b.depth == MAX_JSON_DEPTH)
+        goto st_error;
+      builder_open(&b, (c == '[') ? mk_array(st, 10) : mk_object(st));
+      JSON_STATS(tock.stats, if ((uintptr_t)b.depth > tock.stats->max_depth)
+                               tock.stats->max_depth = b.depth);
+      frames[b.depth-1].mask = mask;
+      frames[b.depth-1].index = 0;
+      if (c == '[')
+        goto st_array_value_or_close_expected;
+      goto st_object_key_or_close_expected;
+    case tock_str:
+      v = mk_string(st, tock.str);
+      tock.str = NULL;
       break;
-    case st_object_colon_expected:
-      if(c!=':')
-        state=st_error;
-      else
-        state=st_object_value_expected;
+    case tock_true:
+      v = mk_true(st);
       break;
-    case st_object_value_expected:
-      {
-        map::data * obj = json::to_object((json::data *)top->_[1]);
-        if(c==tock_str) {
-          map::add(obj, key, mk_string(st, tock.str));
-          tock.str = NULL;
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_true) {
-          map::add(obj, key, mk_true(st));
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_false) {
-          map::add(obj, key, mk_false(st));
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_null) {
-          map::add(obj, key, mk_null(st));
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_number) {
-          map::add(obj, key, mk_number(st, tock.real));
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c=='[') {
-          json::data * a = mk_array(st, 10);
-          map::add(obj, key, a);
-          state=st_array_value_or_close_expected;
-          stack::push(sp, SPI(st_object_close_or_comma_expected, a));
-        }
-        else if(c=='{') {
-          json::data * o = mk_object(st);
-          map::add(obj, key, o);
-          state=st_object_key_or_close_expected;
-          stack::push(sp, SPI(st_object_close_or_comma_expected, o));
-        }
-        else 
-          state=st_error;
-      }
+    case tock_false:
+      v = mk_false(st);
       break;
-    case st_object_close_or_comma_expected:
-      if(c==',')
-        state=st_object_key_or_close_expected;
-      else if(c=='}') {
-        state=TOPS;
-        POP(sp);
-      }
-      else
-        state=st_error;
-      break;
-    case st_array_value_or_close_expected:
-      {
-        if(c==']') {
-          state=TOPS;
-          POP(sp);
-          break;
-        }
-        list::data * ar = json::to_array((json::data *)top->_[1]);
-        
-        if(c==tock_str)  {
-          list::append(&ar, mk_string(st, tock.str));
-          state=st_array_close_or_comma_expected;
-        } 
-        else if(c==tock_true) {
-          list::append(&ar, mk_true(st));
-          state=st_array_close_or_comma_expected;
-        } 
-        else if(c==tock_false) {
-          list::append(&ar, mk_false(st));
-          state=st_array_close_or_comma_expected;
-        } 
-        else if(c==tock_null) {
-          list::append(&ar, mk_null(st));
-          state=st_array_close_or_comma_expected;
-        } 
-        else if(c==tock_number) {
-          list::append(&ar, mk_number(st, tock.real));
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c=='[') {
-          json::data * a = mk_array(st, 10);
-          state=st_array_value_or_close_expected;
-          stack::push(sp, SPI(st_array_close_or_comma_expected,a));
-        }
-        else if(c=='{') {
-          json::data * o = mk_object(st);
-          state=st_object_key_or_close_expected;
-          stack::push(sp, SPI(st_array_close_or_comma_expected,o));
-        }
-        else 
-          state=st_error;
-        break;
-      }
-    case st_array_close_or_comma_expected:
-      if(c==']') {
-        state=TOPS;
-        POP(sp);
-      }
-      else if(c==',')
-        state=st_array_value_or_close_expected;
-      else
-        state=st_error;
+    case tock_null:
+      v = mk_null(st);
       break;
-    case st_done:
-    case st_error:
+    case tock_number:
+      v = mk_number(st, tock.real);
       break;
-    };
+    default:
+      goto st_error;
   }
-  
-  del(sp);
-  if(state==st_done) { 
-    if(force_eof) {
-      if(next_token(st, &tock)!=tock_eof) {
-        *error_at_line=tock.line;
-        return false;
-      }
+  builder_add(&b, v);
+  goto st_close_or_comma_expected;
+
+st_object_key_or_close_expected:
+  mask = frames[b.depth-1].mask;
+  if (mask != MASK_ALL) {
+    c = skip_space(&tock);
+    if (c == '}') {
+      tock.buf++;
+      goto st_close;
+    }
+    key_at = tock.buf;
+    if (c != '"' || !scan_string(&tock, &begin, &end))
+      goto st_error;
+    mask = select_paths(proj, mask, b.depth - 1, begin, end, 0);
+    if (mask == 0) {
+      if (skip_space(&tock) != ':')
+        goto st_error;
+      tock.buf++;
+      if (!skip_value(&tock))
+        goto st_error;
+      goto st_close_or_comma_expected;
+    }
+    tock.buf = key_at;
+  }
+  c = get_token(st, &tock);
+  if (c == '}')
+    goto st_close;
+  if (c != tock_str)
+    goto st_error;
+  b.key = tock.str;
+  tock.str = NULL;
+  if (get_token(st, &tock) != ':')
+    goto st_error;
+  goto st_object_or_array_or_value_expected;
+
+st_array_value_or_close_expected:
+  mask = frames[b.depth-1].mask;
+  if (mask != MASK_ALL) {
+    c = skip_space(&tock);
+    if (c == ']') {
+      tock.buf++;
+      goto st_close;
+    }
+    mask = select_paths(proj, mask, b.depth - 1, NULL, NULL, frames[b.depth-1].index++);
+    if (mask == 0) {
+      if (!skip_value(&tock))
+        goto st_error;
+      goto st_close_or_comma_expected;
     }
-    *out = (json::data *)(result->_[1]);
-    del(result);
-    return true;
+    goto st_object_or_array_or_value_expected;
   }
-  *error_at_line=tock.line;
+  c = get_token(st, &tock);
+  if (c == ']')
+    goto st_close;
+  goto st_value;
+
+st_close:
+  builder_close(&b);
+st_close_or_comma_expected:
+  if (b.depth == 0)
+    goto st_done;
+  c = get_token(st, &tock);
+  if (builder_top(&b)->t == type_is_object) {
+    if (c == ',')
+      goto st_object_key_or_close_expected;
+    if (c == '}')
+      goto st_close;
+  }
+  else {
+    if (c == ',')
+      goto st_array_value_or_close_expected;
+    if (c == ']')
+      goto st_close;
+  }
+  goto st_error;
+
+st_done:
+  if (force_eof && get_token(st, &tock) != tock_eof)
+    goto st_error;
+  *out = b.root;
+  JSON_STATS(tock.stats, stats_end_parse(st, &call, options ? options->stats : NULL, true));
+  return true;
+
+st_error:
+  builder_abort(&b);
+  *error_at_line = tock.line;
+  JSON_STATS(tock.stats, stats_end_parse(st, &call, options ? options->stats : NULL, false));
   return false;
 }
-    
+
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,396 @@
+/* JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7386) applied in place
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace patching {
+
+/*
+ * what has to be done to take back one change of the document, the
+ * undo log holds a reference to old so that it outlives the change
+ */
+enum undo_kind {
+  undo_root,      // *doc was old
+  undo_member,    // key of container was old, or absent if old is NULL
+  undo_insert,    // an element was inserted at index
+  undo_remove,    // old was removed from index
+  undo_element    // the element at index was old
+};
+
+struct undo {
+  enum undo_kind kind;
+  json::data * container;
+  char * key;
+  uintptr_t index;
+  json::data * old;
+};
+
+struct patcher {
+  state::data * st;
+  json::data ** doc;
+  struct undo * log;
+  uintptr_t size;
+  uintptr_t capacity;
+  // the compiled paths the log refers to, kept from the cache emptying
+  list::data * paths;
+};
+
+static void record (struct patcher * p, enum undo_kind kind,
+                    json::data * container, char * key, uintptr_t index,
+                    json::data * old)
+{
+  if (p->size == p->capacity) {
+    p->capacity = p->capacity ? p->capacity * 2 : 16;
+    p->log = (struct undo *)realloc(p->log, p->capacity * sizeof(struct undo));
+  }
+  struct undo * u = p->log + p->size++;
+  u->kind = kind;
+  u->container = container;
+  u->key = key;
+  u->index = index;
+  u->old = old;
+  if (old)
+    incr_indegree(CEE_DEFAULT_DEL_POLICY, old);
+}
+
+/*
+ * the element at i is replaced by v without shifting the rest
+ */
+static void set_element (json::data * a, uintptr_t i, json::data * v)
+{
+  json::data * old = (json::data *)a->value.array->_[i];
+  incr_indegree(CEE_DEFAULT_DEL_POLICY, v);
+  write_barrier(a->value.array, v);
+  a->value.array->_[i] = v;
+  decr_indegree(CEE_DEFAULT_DEL_POLICY, old);
+}
+
+static void set_member (state::data * st, json::data * o, char * key,
+                        json::data * v)
+{
+  map::remove(o->value.object, key);
+  map::add(o->value.object, str::mk(st, "%s", key), v);
+}
+
+/*
+ * take back the changes in reverse order and drop the references of
+ * the log, or only drop them when the patch succeeded
+ */
+static void finish (struct patcher * p, bool rollback)
+{
+  uintptr_t i = p->size;
+  while (i-- > 0) {
+    struct undo * u = p->log + i;
+    if (rollback) {
+      switch (u->kind) {
+        case undo_root:
+          {
+            /*
+             * the reference of the log goes back to being the one of the
+             * root, the reference add took on the new root is dropped
+             */
+            json::data * v = *p->doc;
+            *p->doc = u->old;
+            decr_indegree(CEE_DEFAULT_DEL_POLICY, u->old);
+            del_e(CEE_DEFAULT_DEL_POLICY, v);
+            continue;
+          }
+        case undo_member:
+          if (u->old)
+            set_member(p->st, u->container, u->key, u->old);
+          else
+            map::remove(u->container->value.object, u->key);
+          break;
+        case undo_insert:
+          list::remove(u->container->value.array, u->index);
+          break;
+        case undo_remove:
+          list::insert(&u->container->value.array, u->index, u->old);
+          break;
+        case undo_element:
+          set_element(u->container, u->index, u->old);
+          break;
+      }
+    }
+    if (u->old)
+      del_e(CEE_DEFAULT_DEL_POLICY, u->old);
+  }
+  free(p->log);
+  if (p->paths)
+    del(p->paths);
+}
+
+static pointer::data * compile (struct patcher * p, char * path)
+{
+  pointer::data * ptr = pointer::compile(p->st, path);
+  if (ptr) {
+    if (p->paths == NULL)
+      p->paths = list::mk(p->st, 8);
+    list::append(&p->paths, ptr);
+  }
+  return ptr;
+}
+
+static json::data * member (json::data * o, char * key)
+{
+  return (json::data *)map::find(o->value.object, key);
+}
+
+static char * string_member (json::data * o, char * key)
+{
+  json::data * v = member(o, key);
+  return v && v->t == type_is_string ? (char *)v->value.string : NULL;
+}
+
+/*
+ * the index an array token refers to, size for "-" when it is allowed
+ */
+static bool element_index (json::data * a, struct pointer::token * tok,
+                           bool end_ok, uintptr_t * index)
+{
+  uintptr_t n = list::size(a->value.array);
+  if (end_ok && strcmp(tok->key, "-") == 0) {
+    *index = n;
+    return true;
+  }
+  if (tok->index < 0 || (uintptr_t)tok->index >= n + end_ok)
+    return false;
+  *index = tok->index;
+  return true;
+}
+
+static bool add (struct patcher * p, pointer::data * path, json::data * v)
+{
+  uintptr_t i;
+  if (path->size == 0) {
+    record(p, undo_root, NULL, NULL, 0, *p->doc);
+    /*
+     * the root is held as if it were in a container, a value moved to
+     * the root outlives the references of the log
+     */
+    incr_indegree(CEE_DEFAULT_DEL_POLICY, v);
+    *p->doc = v;
+    return true;
+  }
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      record(p, undo_member, parent, tok->key, 0, member(parent, tok->key));
+      set_member(p->st, parent, tok->key, v);
+      return true;
+    case type_is_array:
+      if (!element_index(parent, tok, true, &i))
+        return false;
+      record(p, undo_insert, parent, NULL, i, NULL);
+      list::insert(&parent->value.array, i, v);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool remove (struct patcher * p, pointer::data * path)
+{
+  uintptr_t i;
+  if (path->size == 0)
+    return false;
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      {
+        json::data * old = member(parent, tok->key);
+        if (old == NULL)
+          return false;
+        record(p, undo_member, parent, tok->key, 0, old);
+        map::remove(parent->value.object, tok->key);
+        return true;
+      }
+    case type_is_array:
+      if (!element_index(parent, tok, false, &i))
+        return false;
+      record(p, undo_remove, parent, NULL, i,
+             (json::data *)parent->value.array->_[i]);
+      list::remove(parent->value.array, i);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool replace (struct patcher * p, pointer::data * path, json::data * v)
+{
+  uintptr_t i;
+  if (path->size == 0)
+    return add(p, path, v);
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      if (member(parent, tok->key) == NULL)
+        return false;
+      return add(p, path, v);
+    case type_is_array:
+      if (!element_index(parent, tok, false, &i))
+        return false;
+      record(p, undo_element, parent, NULL, i,
+             (json::data *)parent->value.array->_[i]);
+      set_element(parent, i, v);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * a value cannot be moved into one of its own descendants
+ */
+static bool is_proper_prefix (pointer::data * from, pointer::data * path)
+{
+  uintptr_t i;
+  if (from->size >= path->size)
+    return false;
+  for (i = 0; i < from->size; i++)
+    if (strcmp(from->_[i].key, path->_[i].key))
+      return false;
+  return true;
+}
+
+/*
+ * op with a copy of v, the copy is dropped when op fails as it is then
+ * in no document
+ */
+static bool with_copy (bool (*op)(struct patcher *, pointer::data *, json::data *),
+                       struct patcher * p, pointer::data * path, json::data * v)
+{
+  json::data * copy = clone(p->st, v);
+  if (op(p, path, copy))
+    return true;
+  del(copy);
+  return false;
+}
+
+static bool apply (struct patcher * p, json::data * op)
+{
+  if (op->t != type_is_object)
+    return false;
+  char * name = string_member(op, "op"), * to, * s;
+  json::data * value = member(op, "value"), * v;
+  pointer::data * path, * from = NULL;
+  if (name == NULL || (to = string_member(op, "path")) == NULL
+      || (path = compile(p, to)) == NULL)
+    return false;
+  if (strcmp(name, "move") == 0 || strcmp(name, "copy") == 0) {
+    if ((s = string_member(op, "from")) == NULL
+        || (from = compile(p, s)) == NULL
+        || (v = pointer::eval(from, *p->doc)) == NULL)
+      return false;
+  }
+  if (strcmp(name, "add") == 0)
+    return value && with_copy(add, p, path, value);
+  if (strcmp(name, "remove") == 0)
+    return remove(p, path);
+  if (strcmp(name, "replace") == 0)
+    return value && with_copy(replace, p, path, value);
+  if (strcmp(name, "copy") == 0)
+    return with_copy(add, p, path, v);
+  if (strcmp(name, "move") == 0) {
+    if (strcmp(s, to) == 0)
+      return true;
+    if (is_proper_prefix(from, path))
+      return false;
+    /*
+     * the log keeps v alive between its removal and its addition
+     */
+    return remove(p, from) && add(p, path, v);
+  }
+  if (strcmp(name, "test") == 0)
+    return value && (v = pointer::eval(path, *p->doc)) && cmp(v, value) == 0;
+  return false;
+}
+
+static json::data * merge (state::data * st, json::data * target,
+                           json::data * patch);
+
+struct merger {
+  state::data * st;
+  json::data * target;
+};
+
+static void merge_member (void * cxt, void * key, void * value)
+{
+  struct merger * m = (struct merger *)cxt;
+  json::data * patch = (json::data *)value;
+  json::data * old = member(m->target, (char *)key);
+  if (patch->t == type_is_null) {
+    if (old)
+      map::remove(m->target->value.object, key);
+  }
+  else if (old && old->t == type_is_object && patch->t == type_is_object)
+    merge(m->st, old, patch);
+  else
+    set_member(m->st, m->target, (char *)key, merge(m->st, NULL, patch));
+}
+
+/*
+ * the result of merging patch into target, target is changed in place
+ * when both are objects
+ */
+static json::data * merge (state::data * st, json::data * target,
+                           json::data * patch)
+{
+  if (patch->t != type_is_object)
+    return clone(st, patch);
+  if (target == NULL || target->t != type_is_object)
+    target = mk_object(st);
+  struct merger m = { st, target };
+  map::walk(patch->value.object, &m, merge_member);
+  return target;
+}
+
+    }
+
+bool apply_patch (state::data * st, json::data ** doc, json::data * patch,
+                  uintptr_t * error_at)
+{
+  struct patching::patcher p = { st, doc, NULL, 0, 0, NULL };
+  uintptr_t i, n;
+  if (patch->t != type_is_array) {
+    *error_at = 0;
+    return false;
+  }
+  n = list::size(patch->value.array);
+  for (i = 0; i < n; i++) {
+    if (!patching::apply(&p, (json::data *)patch->value.array->_[i])) {
+      patching::finish(&p, true);
+      *error_at = i;
+      return false;
+    }
+  }
+  patching::finish(&p, false);
+  return true;
+}
+
+void merge_patch (state::data * st, json::data ** doc, json::data * patch)
+{
+  json::data * old = *doc;
+  *doc = patching::merge(st, old, patch);
+  if (old && *doc != old && get_rc(old) == 0)
+    del(old);
+}
+
+  }
+}
@@ -0,0 +1,118 @@
+/* Persistent documents, updates that leave the old version intact
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace persistent {
+
+/*
+ * the copy of an object or array on the path, its other members are
+ * shared with the original and gain a reference each
+ */
+struct copier {
+  json::data * copy;
+  char * skip;        // the member left out, it is about to be replaced
+};
+
+static void copy_member (void * cxt, void * key, void * value)
+{
+  struct copier * c = (struct copier *)cxt;
+  if (c->skip == NULL || strcmp((char *)key, c->skip))
+    map::add(c->copy->value.object, key, value);
+}
+
+static json::data * copy_object (state::data * st, json::data * o, char * skip)
+{
+  struct copier c = { mk_object(st), skip };
+  map::walk(o->value.object, &c, copy_member);
+  return c.copy;
+}
+
+static json::data * copy_array (state::data * st, json::data * a,
+                                uintptr_t skip, json::data * v)
+{
+  uintptr_t i, n = list::size(a->value.array);
+  json::data * c = mk_array(st, n + 1);
+  for (i = 0; i < n; i++) {
+    if (i != skip)
+      list::append(&c->value.array, a->value.array->_[i]);
+    else if (v)
+      list::append(&c->value.array, v);
+  }
+  if (skip == n && v)
+    list::append(&c->value.array, v);
+  return c;
+}
+
+/*
+ * the new version of node with the value at ptr from the token at depth
+ * on replaced by v, or removed if v is NULL. NULL if ptr does not
+ * resolve.
+ */
+static json::data * update (state::data * st, json::data * node,
+                            pointer::data * ptr, uintptr_t depth, json::data * v)
+{
+  struct pointer::token * tok = ptr->_ + depth;
+  bool last = depth + 1 == ptr->size;
+  json::data * child, * c;
+  uintptr_t n, i;
+  switch (node->t) {
+    case type_is_object:
+      child = (json::data *)map::find(node->value.object, tok->key);
+      if (!last) {
+        if (child == NULL || (v = update(st, child, ptr, depth + 1, v)) == NULL)
+          return NULL;
+      }
+      else if (v == NULL && child == NULL)
+        return NULL;
+      c = copy_object(st, node, tok->key);
+      if (v)
+        map::add(c->value.object, str::mk(st, "%s", tok->key), v);
+      return c;
+    case type_is_array:
+      n = list::size(node->value.array);
+      if (last && v && strcmp(tok->key, "-") == 0)
+        i = n;
+      else if (tok->index >= 0 && (uintptr_t)tok->index < n)
+        i = tok->index;
+      else
+        return NULL;
+      if (!last) {
+        child = (json::data *)node->value.array->_[i];
+        if ((v = update(st, child, ptr, depth + 1, v)) == NULL)
+          return NULL;
+      }
+      return copy_array(st, node, i, v);
+    default:
+      return NULL;
+  }
+}
+
+json::data * set (state::data * st, json::data * root, char * pointer,
+                  json::data * value)
+{
+  pointer::data * ptr = pointer::compile(st, pointer);
+  if (ptr == NULL)
+    return NULL;
+  if (ptr->size == 0)
+    return value;
+  return update(st, root, ptr, 0, value);
+}
+
+json::data * remove (state::data * st, json::data * root, char * pointer)
+{
+  pointer::data * ptr = pointer::compile(st, pointer);
+  if (ptr == NULL || ptr->size == 0)
+    return NULL;
+  return update(st, root, ptr, 0, NULL);
+}
+
+    }
+  }
+}
@@ -0,0 +1,160 @@
+/* JSON Pointer (RFC 6901)
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace pointer {
+
+/*
+ * the key under which the compiled pointers are cached in a state
+ */
+static char * cache_key = "cee.json.pointers";
+
+/*
+ * the cache drops the pointers nothing else holds when it has this
+ * many, so that a program looking up ever new paths does not keep them
+ * all
+ */
+enum { max_cached = 1024 };
+
+static void keep_held(void * cxt, void * key, void * value)
+{
+  if (get_rc(value) > 1)
+    map::add((map::data *)cxt, key, value);
+}
+
+/*
+ * "0" or a decimal number without leading zeros, -1 otherwise
+ */
+static intptr_t to_index(char * s)
+{
+  if (s[0] == '0')
+    return s[1] == '\0' ? 0 : -1;
+  intptr_t v = 0;
+  char * p;
+  for (p = s; *p; p++) {
+    if (*p < '0' || '9' < *p)
+      return -1;
+    int d = *p - '0';
+    if (v > (INTPTR_MAX - d) / 10)
+      return -1;
+    v = v * 10 + d;
+  }
+  return p == s ? -1 : v;
+}
+
+static pointer::data * mk(state::data * st, char * path)
+{
+  uintptr_t n = 0;
+  char * p;
+  if (path[0] != '\0' && path[0] != '/')
+    return NULL;
+  for (p = path; *p; p++)
+    if (*p == '/')
+      n++;
+
+  /*
+   * one block holds the tokens followed by their unescaped keys,
+   * unescaping never makes a key longer than it is in the path
+   */
+  size_t head = sizeof(pointer::data) + n * sizeof(struct token);
+  pointer::data * ptr = (pointer::data *)block::mk(st, head + strlen(path) + 1);
+  char * out = (char *)ptr + head;
+  ptr->size = n;
+
+  uintptr_t i = 0;
+  for (p = path; *p; ) {
+    struct token * tok = ptr->_ + i++;
+    tok->key = out;
+    for (p++; *p && *p != '/'; p++) {
+      if (*p == '~') {
+        p++;
+        if (*p == '0')
+          *out++ = '~';
+        else if (*p == '1')
+          *out++ = '/';
+        else {
+          del(ptr);
+          return NULL;
+        }
+      }
+      else
+        *out++ = *p;
+    }
+    *out++ = '\0';
+    tok->index = to_index(tok->key);
+  }
+  return ptr;
+}
+
+pointer::data * compile(state::data * st, char * path)
+{
+  map::data * cache = (map::data *)state::get_context(st, cache_key);
+  if (cache == NULL || (map::size(cache) >= max_cached && map::find(cache, path) == NULL)) {
+    map::data * held = map::mk(st, (cmp_fun)strcmp);
+    if (cache) {
+      map::walk(cache, held, keep_held);
+      state::remove_context(st, cache_key);
+    }
+    cache = held;
+    state::add_context(st, (char *)str::mk(st, "%s", cache_key), cache);
+  }
+  pointer::data * ptr = (pointer::data *)map::find(cache, path);
+  if (ptr)
+    return ptr;
+  ptr = mk(st, path);
+  if (ptr)
+    map::add(cache, str::mk(st, "%s", path), ptr);
+  return ptr;
+}
+
+json::data * eval(pointer::data * ptr, json::data * j)
+{
+  return eval_e(ptr, j, ptr->size);
+}
+
+json::data * eval_e(pointer::data * ptr, json::data * j, uintptr_t n)
+{
+  uintptr_t i;
+  for (i = 0; j && i < n; i++) {
+    struct token * tok = ptr->_ + i;
+    switch (j->t) {
+      case type_is_object:
+        j = (json::data *)map::find(j->value.object, tok->key);
+        break;
+      case type_is_array:
+        if (tok->index < 0 || (uintptr_t)tok->index >= list::size(j->value.array))
+          return NULL;
+        j = (json::data *)j->value.array->_[tok->index];
+        break;
+      default:
+        return NULL;
+    }
+  }
+  return j;
+}
+
+    }
+
+json::data * find(state::data * st, json::data * j, char * path)
+{
+  pointer::data * ptr = pointer::compile(st, path);
+  if (ptr == NULL)
+    return NULL;
+  return pointer::eval(ptr, j);
+}
+
+json::data * get(state::data * st, json::data * j, char * path, json::data * def)
+{
+  json::data * v = find(st, j, path);
+  return v ? v : def;
+}
+
+  }
+}
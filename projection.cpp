@@ -0,0 +1,114 @@
+/* Field masks for projection parsing
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace projection {
+
+/*
+ * count the steps of a path, -1 if it is malformed
+ */
+static intptr_t count_steps(char * p)
+{
+  intptr_t n = 0;
+  if (*p == '\0')
+    return 0;
+  for (;;) {
+    if (*p == '[') {
+      if (n == 0)
+        return -1;
+      p++;
+      if (*p == '*')
+        p++;
+      else if ('0' <= *p && *p <= '9')
+        while ('0' <= *p && *p <= '9')
+          p++;
+      else
+        return -1;
+      if (*p++ != ']')
+        return -1;
+    }
+    else {
+      char * begin = p;
+      while (*p && *p != '.' && *p != '[')
+        p++;
+      if (p == begin)
+        return -1;
+    }
+    n++;
+    if (*p == '\0')
+      return n;
+    if (*p == '.') {
+      p++;
+      if (*p == '\0' || *p == '.' || *p == '[')
+        return -1;
+    }
+    else if (*p != '[')
+      return -1;
+  }
+}
+
+projection::data * mk(state::data * st, size_t n, char ** paths)
+{
+  size_t i, steps = 0, chars = 0;
+  if (n == 0 || n > MAX_JSON_PROJECTION)
+    return NULL;
+  for (i = 0; i < n; i++) {
+    intptr_t k = count_steps(paths[i]);
+    if (k < 0)
+      return NULL;
+    steps += k;
+    chars += strlen(paths[i]) + k;
+  }
+
+  /*
+   * one block holds the paths, their steps and the field names
+   */
+  size_t paths_size = sizeof(projection::data) + n * sizeof(struct path);
+  size_t steps_size = steps * sizeof(struct step);
+  projection::data * proj =
+    (projection::data *)block::mk(st, paths_size + steps_size + chars);
+  struct step * step = (struct step *)((char *)proj + paths_size);
+  char * out = (char *)proj + paths_size + steps_size;
+  proj->size = n;
+
+  for (i = 0; i < n; i++) {
+    char * p = paths[i];
+    proj->_[i].steps = step;
+    proj->_[i].size = count_steps(p);
+    while (*p) {
+      if (*p == '[') {
+        step->key = NULL;
+        if (p[1] == '*') {
+          step->index = -1;
+          p += 3;
+        }
+        else {
+          step->index = strtol(p + 1, &p, 10);
+          p++;
+        }
+      }
+      else {
+        step->key = out;
+        step->index = -1;
+        while (*p && *p != '.' && *p != '[')
+          *out++ = *p++;
+        *out++ = '\0';
+      }
+      step++;
+      if (*p == '.')
+        p++;
+    }
+  }
+  return proj;
+}
+
+    }
+  }
+}
@@ -0,0 +1,200 @@
+/* Publication of document roots to concurrent readers with epoch based
+ * reclamation
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+    namespace rcu {
+
+/*
+ * a reader slot takes a cache line of its own, readers only ever write
+ * to their own slot
+ */
+struct alignas(64) reader {
+  struct domain * domain;
+  uintptr_t epoch;      // the epoch seen by read_lock, 0 outside of it
+  int in_use;
+};
+
+/*
+ * a root replaced at epoch, it can be freed once every reader has moved
+ * past that epoch
+ */
+struct retired {
+  json::data * root;
+  uintptr_t epoch;
+};
+
+/*
+ * the roots of a domain, the current one and the retired ones, are gc
+ * roots of its state until they are freed
+ */
+struct domain {
+  state::data * st;
+  json::data * root;
+  uintptr_t epoch;
+  int lock;             // serializes writers
+  struct retired * retired;
+  uintptr_t size;
+  uintptr_t capacity;
+  uintptr_t max_readers;
+  struct reader readers[1];
+};
+
+static void lock (struct domain * d)
+{
+  while (__atomic_exchange_n(&d->lock, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock (struct domain * d)
+{
+  __atomic_store_n(&d->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * the oldest epoch a reader may still be in, or the current epoch if no
+ * reader is inside read_lock
+ */
+static uintptr_t oldest_epoch (struct domain * d)
+{
+  uintptr_t i, e, min = __atomic_load_n(&d->epoch, __ATOMIC_SEQ_CST);
+  for (i = 0; i < d->max_readers; i++) {
+    e = __atomic_load_n(&d->readers[i].epoch, __ATOMIC_SEQ_CST);
+    if (e && e < min)
+      min = e;
+  }
+  return min;
+}
+
+static uintptr_t reclaim_locked (struct domain * d)
+{
+  uintptr_t i, n = 0, oldest = oldest_epoch(d);
+  for (i = 0; i < d->size; i++) {
+    if (d->retired[i].epoch < oldest) {
+      state::remove_gc_root(d->st, d->retired[i].root);
+      del(d->retired[i].root);
+    }
+    else
+      d->retired[n++] = d->retired[i];
+  }
+  d->size = n;
+  return n;
+}
+
+domain * mk_domain (state::data * st, json::data * root, uintptr_t max_readers)
+{
+  uintptr_t i, size = sizeof(domain) + max_readers * sizeof(struct reader);
+  // the readers are aligned as the domain is
+  domain * d = (domain *)aligned_alloc(alignof(domain), size);
+  d->st = st;
+  d->root = root;
+  d->epoch = 1;
+  d->lock = 0;
+  d->retired = NULL;
+  d->size = 0;
+  d->capacity = 0;
+  d->max_readers = max_readers;
+  for (i = 0; i < max_readers; i++) {
+    d->readers[i].domain = d;
+    d->readers[i].epoch = 0;
+    d->readers[i].in_use = 0;
+  }
+  if (root)
+    state::add_gc_root(st, root);
+  return d;
+}
+
+json::data * del_domain (domain * d)
+{
+  uintptr_t i;
+  json::data * root = d->root;
+  for (i = 0; i < d->size; i++) {
+    state::remove_gc_root(d->st, d->retired[i].root);
+    del(d->retired[i].root);
+  }
+  if (root)
+    state::remove_gc_root(d->st, root);
+  free(d->retired);
+  free(d);
+  return root;
+}
+
+reader * join (domain * d)
+{
+  uintptr_t i;
+  for (i = 0; i < d->max_readers; i++) {
+    int idle = 0;
+    if (__atomic_compare_exchange_n(&d->readers[i].in_use, &idle, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return d->readers + i;
+  }
+  return NULL;
+}
+
+void leave (reader * r)
+{
+  __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+json::data * read_lock (reader * r)
+{
+  domain * d = r->domain;
+  /*
+   * the epoch is announced before the root is loaded, a writer that
+   * swaps the root afterwards sees the announcement and keeps the
+   * root this reader may get
+   */
+  __atomic_store_n(&r->epoch, __atomic_load_n(&d->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&d->root, __ATOMIC_SEQ_CST);
+}
+
+void read_unlock (reader * r)
+{
+  __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void publish (domain * d, json::data * root)
+{
+  lock(d);
+  if (root == d->root) {
+    unlock(d);
+    return;
+  }
+  if (root)
+    state::add_gc_root(d->st, root);
+  json::data * old = __atomic_exchange_n(&d->root, root, __ATOMIC_SEQ_CST);
+  uintptr_t e = __atomic_fetch_add(&d->epoch, 1, __ATOMIC_SEQ_CST);
+  if (old) {
+    if (d->size == d->capacity) {
+      d->capacity = d->capacity ? d->capacity * 2 : 8;
+      d->retired = (struct retired *)realloc(d->retired,
+                                             d->capacity * sizeof(struct retired));
+    }
+    d->retired[d->size].root = old;
+    d->retired[d->size].epoch = e;
+    d->size++;
+  }
+  reclaim_locked(d);
+  unlock(d);
+}
+
+uintptr_t reclaim (domain * d)
+{
+  lock(d);
+  uintptr_t n = reclaim_locked(d);
+  unlock(d);
+  return n;
+}
+
+    }
+  }
+}
@@ -3,11 +3,13 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 #include "cee.hpp"
  
 #ifndef CEE_JSON_H
@@ -45,11 +47,189 @@ struct data {
     singleton::data * boolean;
     boxed::data     * number;
     str::data       * string;
-    vect::data      * array;
+    list::data      * array;
     map::data       * object;
   } value;
 };
 
+namespace pointer {
+  struct token {
+    char * key;       // the unescaped reference token
+    intptr_t index;   // the token as an array index, -1 if it is not one
+  };
+
+  struct data {
+    uintptr_t size;
+    struct token _[1];
+  };
+
+  /*
+   * return the compiled form of path, compiling it only the first time
+   * the state sees it. The result is owned by the state's cache of
+   * pointers, which drops those nothing else holds when it has 1024 of
+   * them: it stays valid until another path is compiled, incr_indegree
+   * keeps it in the cache for longer and del_ref then lets it go.
+   */
+  extern pointer::data * compile (state::data *, char * path);
+
+  /*
+   * resolve a compiled pointer against j, it does not allocate
+   */
+  extern json::data * eval (pointer::data *, json::data * j);
+
+  /*
+   * resolve only the first n tokens, e.g. n = size - 1 for the parent
+   */
+  extern json::data * eval_e (pointer::data *, json::data * j, uintptr_t n);
+}
+
+/*
+ * JSONPath queries such as "$.store.book[*].author", "$..price",
+ * "$.items[-1]", "$.items[0:10:2]" or "$.items[?(@.price > 10 && !@.sold)].id".
+ * Filters compare paths from @ or $ made of names and indices with numbers,
+ * strings, true, false and null, a path alone tests that it exists. Members
+ * of objects are visited in the order of their keys.
+ */
+namespace jsonpath {
+  enum selector {
+    sel_name,
+    sel_wildcard,
+    sel_index,
+    sel_slice,
+    sel_filter
+  };
+
+  struct expr;
+
+  struct step {
+    enum selector kind;
+    bool descendant;        // the step is applied to all descendants, ..
+    bool has_start;
+    bool has_end;
+    char * name;
+    intptr_t start;         // the index of sel_index
+    intptr_t end;
+    intptr_t step;
+    struct expr * filter;
+  };
+
+  struct data {
+    uintptr_t size;
+    struct step * steps;
+  };
+
+  /*
+   * NULL is returned if the query is malformed. A plan is never changed
+   * by eval, it can be shared by threads and used for any document.
+   */
+  extern jsonpath::data * compile (state::data *, char * query);
+
+  /*
+   * the nodes of j selected by the plan, parents before their
+   * descendants and elements in index order. The list is
+   * allocated in st, it borrows the nodes and does not own them.
+   */
+  extern list::data * eval (state::data * st, jsonpath::data *, json::data * j);
+}
+
+/*
+ * a field mask for parse_e, made of paths such as "id", "user.name" or
+ * "items[*].price". Only the subtrees selected by a path, and the
+ * containers leading to them, are built, the rest is skipped. A scalar
+ * that stands where a path expects a container is skipped as well.
+ * Skipped parts are only checked for balanced brackets and well formed
+ * strings.
+ */
+#define MAX_JSON_PROJECTION 63
+
+namespace projection {
+  struct step {
+    char * key;       // the field name, NULL for an array step
+    intptr_t index;   // the element an array step selects, -1 for [*]
+  };
+
+  struct path {
+    uintptr_t size;
+    struct step * steps;
+  };
+
+  struct data {
+    uintptr_t size;
+    struct path _[1];
+  };
+
+  /*
+   * NULL is returned if a path is malformed or there are more than
+   * MAX_JSON_PROJECTION paths
+   */
+  extern projection::data * mk (state::data *, size_t n, char ** paths);
+}
+
+/*
+ * forward only, on demand access to a JSON text. Nothing is built for the
+ * parts of the input that are not asked for, they are skipped by matching
+ * brackets. Values have to be visited in document order: stepping to a
+ * field or an element skips whatever is left of the previous one, and a
+ * value that has been skipped can no longer be read. Containers nest up to
+ * MAX_JSON_DEPTH, as in parse.
+ */
+namespace ondemand {
+  struct document {
+    char * buf;
+    char * buf_end;
+    int line;
+    int depth;      // the number of containers entered so far
+    bool at_value;  // positioned at a value that has not been consumed
+    bool error;
+    char open[MAX_JSON_DEPTH];  // '[' or '{' for each container entered
+  };
+
+  struct value {
+    struct document * doc;
+    int depth;
+  };
+
+  struct object {
+    struct document * doc;
+    int depth;
+    bool first;
+  };
+
+  struct array {
+    struct document * doc;
+    int depth;
+    bool first;
+  };
+
+  extern struct value init (struct document *, char * buf, uintptr_t len);
+
+  /*
+   * the type of a value, decided by its first character, 
+   * type_is_undefined is returned if the value is no longer readable
+   */
+  extern enum type type_of (struct value);
+
+  extern bool get_object (struct value, struct object *);
+  extern bool get_array (struct value, struct array *);
+
+  /*
+   * search the fields after the current position of the object, the
+   * object is left at its end if key is not found
+   */
+  extern bool find_field (struct object *, char * key, struct value *);
+  extern bool next_element (struct array *, struct value *);
+
+  extern bool get_string (state::data *, struct value, str::data **);
+  extern bool get_number (struct value, double *);
+  extern bool get_bool (struct value, bool *);
+  extern bool is_null (struct value);
+
+  /*
+   * build the DOM of a single value
+   */
+  extern bool materialize (state::data *, struct value, json::data **);
+}
+
 enum format {
   compact = 0,
   readable = 1
@@ -60,42 +240,356 @@ extern bool is_undefined (json::data *);
 extern bool is_null (json::data *);
 extern bool to_bool (json::data *);
 
-extern json::data * find (json::data *, char *);
-extern json::data * get(json::data *, char *, json::data * def);
+/*
+ * look up an RFC 6901 JSON pointer such as "/a/b/3/c", the pointer is
+ * compiled once and cached in the state, NULL is returned if the
+ * pointer is malformed or does not resolve
+ */
+extern json::data * find (state::data *, json::data *, char * pointer);
+extern json::data * get(state::data *, json::data *, char * pointer,
+                        json::data * def);
 
 extern bool save (json::data *, FILE *, int how);
 extern json::data * load_from_file (FILE *, bool force_eof, int * error_at_line);
 extern json::data * load_from_buffer (int size, char *, int line);
+
+/*
+ * a 64 bit hash of the structure and the values of j, the hash of
+ * an array or an object is cached with it until it or a container in it
+ * changes, see tagged::memoize. A container that has other owners than
+ * its parent, e.g. one shared by versions of a persistent document, is
+ * hashed again each time and so are the containers above it, though not
+ * the ones below. Equal documents have equal hashes.
+ */
+extern uint64_t hash (json::data * j);
+
+/*
+ * a total order of documents, 0 if they are equal. Values of different
+ * types are ordered by their types, containers by their sizes and then
+ * by their hashes before their contents are compared, so the order is
+ * only meant for telling documents apart and for sorting them.
+ */
 extern int cmp (json::data *, json::data *);
 
-extern vect::data  * to_array (json::data *);
+/*
+ * apply an RFC 6902 JSON Patch to *doc in place, the containers of the
+ * document are changed rather than copied and paths are compiled once
+ * per state, see pointer::compile. Values taken from the patch are copied. If an operation
+ * fails every change made so far is taken back, false is returned and
+ * error_at is the index of the operation. *doc is set to the new root
+ * when the whole document is replaced, the old root is then released.
+ */
+extern bool apply_patch (state::data *, json::data ** doc, json::data * patch,
+                         uintptr_t * error_at);
+
+/*
+ * apply an RFC 7386 JSON Merge Patch to *doc in place, it cannot fail.
+ * *doc is set to the new root when the patch is not an object or the
+ * document is not one, the old root is then released as apply_patch
+ * does: it is freed unless something else holds a reference to it.
+ */
+extern void merge_patch (state::data *, json::data ** doc, json::data * patch);
+
+/*
+ * an RFC 6902 JSON Patch that turns a into b, an array of operations
+ * allocated in st. The values of add and replace operations are the
+ * nodes of b, not copies. Subtrees with equal hashes are taken as
+ * unchanged and are not visited, so once the hashes are cached the
+ * time taken is proportional to the changed regions. Array elements are
+ * matched by a longest common subsequence of their hashes.
+ */
+extern json::data * diff (state::data *, json::data * a, json::data * b);
+
+extern list::data  * to_array (json::data *);
 extern map::data   * to_object (json::data *);
 extern boxed::data * to_number (json::data *);
+/*
+ * the value of a number whatever primitive type it is boxed with
+ */
+extern double to_double (json::data *);
 extern str::data   * to_string (json::data *);
 
-extern json::data * mk_true();
-extern json::data * mk_false();
-extern json::data * mk_undefined ();
-extern json::data * mk_null ();
-extern json::data * mk_object();
-extern json::data * mk_number (double d);
-extern json::data * mk_string(str::data * s);
-extern json::data * mk_array(int s);
+extern json::data * mk_true(state::data *);
+extern json::data * mk_false(state::data *);
+extern json::data * mk_undefined (state::data *);
+extern json::data * mk_null (state::data *);
+extern json::data * mk_object(state::data *);
+extern json::data * mk_number (state::data *, double d);
+extern json::data * mk_string(state::data *, str::data * s);
+extern json::data * mk_array(state::data *, int s);
+
+/*
+ * the counters of state::stats as an object allocated in st, with the
+ * live objects of each type under "live_by_type". s is best taken
+ * before the object is made, it changes the counters of st.
+ */
+extern json::data * mk_stats (state::data * st, struct state::stats * s);
+
+/*
+ * a deep copy of j, the singletons are shared
+ */
+extern json::data * clone (state::data *, json::data * j);
+
+/*
+ * mark j and everything it holds as shared between threads, see
+ * cee::share. Threads take references with incr_indegree(dp_del_rc, j)
+ * and drop them with del_ref(j). The document must not be changed once
+ * it is shared, persistent updates can still make new versions of it.
+ */
+extern void share (json::data * j);
+
+extern void object_set (state::data *, json::data *, char *, json::data *);
+extern void object_set_bool (state::data *, json::data *, char *, bool);
+extern void object_set_string (state::data *, json::data *, char *, char *);
+extern void object_set_number (state::data *, json::data *, char *, double);
+
+extern void array_append (state::data *, json::data *, json::data *);
+extern void array_append_bool (state::data *, json::data *, bool);
+extern void array_append_string (state::data *, json::data *, char *);
+extern void array_append_number (state::data *, json::data *, double);
+
+/*
+ * what parse and snprint went through, counted only if the library is
+ * built with CEE_JSON_STATS (make JSON_FLAGS=-DCEE_JSON_STATS), which
+ * slows them down. Tokens are counted by stats_token, the tokens the
+ * field mask of a projection skips are not.
+ */
+enum stats_token {
+  stats_open_object = 0,
+  stats_close_object,
+  stats_open_array,
+  stats_close_array,
+  stats_colon,
+  stats_comma,
+  stats_string,       // keys included
+  stats_number,
+  stats_true,
+  stats_false,
+  stats_null,
+  stats_n_tokens
+};
+
+struct stats {
+  uintptr_t n_parses;
+  uintptr_t n_parse_failures;   // the parses that returned false
+  uintptr_t n_tokens[stats_n_tokens];
+  uintptr_t n_strings;          // the strings decoded, keys included
+  uintptr_t n_escaped_strings;  // the strings with escape sequences
+  uintptr_t bytes_copied;       // the bytes decoded into the strings
+  uintptr_t n_parse_allocs;     // the objects allocated by parse
+  // the objects parse left in the state by type, see state::type_name
+  uintptr_t n_parse_allocs_by_type[state::max_types];
+  uintptr_t max_depth;
+  uint64_t  tokenizer_ns;       // the time taken by the tokenizer
+  uint64_t  build_ns;           // the rest, taken by building the tree
+  uintptr_t n_prints;
+  uintptr_t bytes_printed;
+  uintptr_t n_print_allocs;     // the objects allocated by snprint
+  uint64_t  print_ns;
+};
+
+/*
+ * the counters of every parse and snprint in st, NULL if the library is
+ * built without CEE_JSON_STATS
+ */
+extern struct stats * get_stats (state::data * st);
+
+/*
+ * print j to buf, or only count the bytes needed if buf is NULL. The
+ * nesting parse accepts is printed in full, a document built deeper than
+ * MAX_JSON_DEPTH is cut at that depth.
+ */
+extern size_t snprint (state::data *, char * buf, size_t size, json::data *, 
+                       enum format);
+
+extern bool parse(state::data *, char * buf, uintptr_t len, json::data **out, 
+                  bool force_eof, int *error_at_line);
+
+struct parse_options {
+  projection::data * projection;  // NULL builds the whole document
+  struct stats * stats;           // if not NULL the call is counted into it too
+};
+
+extern bool parse_e(state::data *, char * buf, uintptr_t len, json::data **out,
+                    bool force_eof, int *error_at_line,
+                    struct parse_options * options);
+
+/*
+ * check that buf holds exactly one well formed JSON text without building
+ * it: the structure, string escapes, UTF-8 and the number grammar. It
+ * neither allocates nor needs a state. On failure the offset and the line
+ * of the offending byte are returned. A text that validates is accepted
+ * by parse with force_eof.
+ */
+extern bool validate(char * buf, uintptr_t len, uintptr_t * error_at,
+                     int * error_at_line);
+
+/*
+ * MessagePack encoding. Numbers keep the primitive type they are boxed
+ * with: integers are written as MessagePack integers and read back as i64
+ * (u64 above INT64_MAX), f32 and f64 as float 32 and float 64. undefined
+ * is written as a fixext 1 of type 0. The encoded bytes are a block of
+ * the state.
+ */
+extern block::data * to_msgpack(state::data *, json::data *, uintptr_t * size);
+extern bool from_msgpack(state::data *, char * buf, uintptr_t len,
+                         json::data ** out, uintptr_t * error_at);
+
+/*
+ * CBOR (RFC 8949) encoding, numbers are mapped as in MessagePack and
+ * undefined is the CBOR undefined. Decoding takes definite and indefinite
+ * length items, byte strings become base64url strings, bignums become
+ * numbers and other tags are dropped. Integer map keys become strings.
+ */
+extern block::data * to_cbor(state::data *, json::data *, uintptr_t * size);
+extern bool from_cbor(state::data *, char * buf, uintptr_t len,
+                      json::data ** out, uintptr_t * error_at);
+
+/*
+ * a binary form of a document that is read in place, without being
+ * parsed, e.g. from a file mapped with mmap. Objects keep their keys
+ * sorted and are searched in O(log n), arrays are indexed in O(1). The
+ * layout is described in binary.cpp. Offsets are 64 bit, a document can
+ * be larger than 4 GB.
+ */
+extern block::data * to_binary(state::data *, json::data *, uintptr_t * size);
+
+namespace binary {
+  /*
+   * a value inside a binary document, a few words that are passed by
+   * value. Every access is checked against the bounds of the document.
+   */
+  struct value {
+    char * base;
+    uintptr_t len;
+    uint64_t slot;
+  };
+
+  /*
+   * false if buf does not hold a binary document
+   */
+  extern bool open(char * buf, uintptr_t len, struct value * root);
 
-extern void object_set (json::data *, char *, json::data *);
-extern void object_set_bool (json::data *, char *, bool);
-extern void object_set_string (json::data *, char *, char *);
-extern void object_set_number (json::data *, char *, double);
+  extern enum type type_of(struct value);
+  extern bool get_bool(struct value, bool *);
+  extern bool get_number(struct value, double *);
 
-extern void array_append (json::data *, json::data *);
-extern void array_append_bool (json::data *, bool);
-extern void array_append_string (json::data *, char *);
-extern void array_append_number (json::data *, double);
+  /*
+   * s points into the document, it is terminated by '\0'
+   */
+  extern bool get_string(struct value, char ** s, uintptr_t * len);
 
-extern size_t snprint (char * buf, size_t size, json::data *, enum format);
+  /*
+   * the number of elements of an array or members of an object
+   */
+  extern uintptr_t size(struct value);
+  extern bool at(struct value array, uintptr_t i, struct value * out);
+  extern bool find(struct value object, char * key, struct value * out);
 
-extern bool parse(char * buf, uintptr_t len, json::data **out, bool force_eof,
-                  int *error_at_line);
+  /*
+   * the i-th member in the order of the keys
+   */
+  extern bool member(struct value object, uintptr_t i, char ** key,
+                     struct value * out);
+
+  /*
+   * build a json::data tree of the value
+   */
+  extern bool to_json(state::data *, struct value, json::data ** out);
+}
+
+/*
+ * updates of documents that are never changed in place. An update
+ * returns a new root, only the objects and arrays on the path to the
+ * changed value are copied, every other subtree is shared with the old
+ * version and holds one more reference. Old versions stay valid and
+ * readable while newer ones are made, and a version is released with
+ * del(root), which frees only what no other version shares. Nodes
+ * reachable from a version must not be changed in place, e.g. by
+ * apply_patch. An update takes time in the sum of the sizes of the
+ * containers on its path.
+ */
+namespace persistent {
+  /*
+   * v is stored at pointer, which replaces a member or an element, adds
+   * a member, or appends with "-". v is shared, not copied. NULL is
+   * returned if the parent of pointer does not resolve.
+   */
+  extern json::data * set (state::data *, json::data * root, char * pointer,
+                           json::data * v);
+  extern json::data * remove (state::data *, json::data * root, char * pointer);
+}
+
+/*
+ * publication of a document root to threads that read it while writers
+ * replace it, e.g. with a reloaded config or a new persistent version.
+ * Readers never block and never touch reference counts, they should
+ * not call hash or cmp, which cache hashes in the nodes. A replaced root
+ * is retired and freed with del once every reader that may have seen it
+ * has left read_lock, which frees only what later versions do not
+ * share. Retired roots are freed by the writers in publish and reclaim,
+ * so writers should run in the thread that owns the state. The roots
+ * of a domain are gc roots of the state until they are freed, so that
+ * state::gc keeps what readers may see.
+ */
+namespace rcu {
+  struct domain;
+  struct reader;
+
+  extern domain * mk_domain (state::data *, json::data * root,
+                             uintptr_t max_readers);
+
+  /*
+   * free the domain and its retired roots, every reader must have left.
+   * The current root is returned, it is no longer a gc root.
+   */
+  extern json::data * del_domain (domain *);
+
+  /*
+   * a reader slot for the calling thread, NULL if all are taken
+   */
+  extern reader * join (domain *);
+  extern void leave (reader *);
+
+  /*
+   * the current root, it stays valid until read_unlock
+   */
+  extern json::data * read_lock (reader *);
+  extern void read_unlock (reader *);
+
+  /*
+   * swap in a new root, the old one is retired
+   */
+  extern void publish (domain *, json::data * root);
+
+  /*
+   * free the retired roots no reader can see, the number of roots
+   * still waiting is returned
+   */
+  extern uintptr_t reclaim (domain *);
+}
+
+namespace cbor {
+  /*
+   * a decoder that takes its input in chunks of any size, an item that
+   * is split between chunks is carried over
+   */
+  struct decoder;
+
+  extern decoder * mk_decoder(state::data *);
+
+  /*
+   * false once the input is known to be malformed
+   */
+  extern bool feed(decoder *, char * chunk, uintptr_t len);
+
+  /*
+   * the input has ended, out is set if it was exactly one complete item,
+   * otherwise error_at is the offset of the item that failed. The
+   * decoder is freed.
+   */
+  extern bool finish(decoder *, json::data ** out, uintptr_t * error_at);
+}
 
   }
 }
@@ -124,14 +618,198 @@ struct tokenizer {
   char * buf_end;
   str::data * str;
   double real;
+  bool utf8_checked;  // the whole input is known to be valid UTF-8
+  struct stats * stats; // the counters of parse, see stats.hpp
 };
 
-extern enum token next_token(struct tokenizer * t);
+extern enum token next_token(state::data *, struct tokenizer * t);
+
+/*
+ * the scanning functions below move t->buf over the input without
+ * allocating anything, they keep t->line up to date
+ */
+
+/*
+ * skip whitespace and comments, return the next character without
+ * consuming it, or tock_eof at the end of the input
+ */
+extern int skip_space(struct tokenizer * t);
+
+/*
+ * t->buf points to the opening quote of a string, on success *begin and
+ * *end delimit its raw (still escaped) content and t->buf is moved past
+ * the closing quote. Escape sequences and control characters are
+ * checked, UTF-8 is not.
+ */
+extern bool scan_string(struct tokenizer * t, char ** begin, char ** end);
+
+/*
+ * the line number of end, counted from begin
+ */
+extern int count_lines(char * begin, char * end);
+
+/*
+ * move over a number that follows the JSON number grammar
+ */
+extern bool scan_number(struct tokenizer * t);
+
+/*
+ * compare the raw content of a string with a '\0' terminated key,
+ * escape sequences in the raw content are decoded on the fly
+ */
+extern bool string_equals(char * begin, char * end, char * key);
+
+/*
+ * skip one value, containers are skipped by matching brackets of the
+ * same kind, the literals in them are checked
+ */
+extern bool skip_value(struct tokenizer * t);
+
+/*
+ * skip the rest of the innermost open container, which was opened by
+ * open ('[' or '{'), up to and including its closing bracket
+ */
+extern bool skip_container(struct tokenizer * t, char open);
     
   }
 }
 #endif // ORCA_JSON_TOK_H
  
+#ifndef CEE_JSON_BUFFER_H
+#define CEE_JSON_BUFFER_H
+#include "cee.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * a growable output buffer for the binary encoders, the bytes live in a
+ * block of the state that is handed to the caller when encoding is done
+ */
+struct buffer {
+  state::data * st;
+  char * _;
+  uintptr_t size;
+  uintptr_t capacity;
+};
+
+extern void buffer_init(struct buffer * b, state::data * st, uintptr_t capacity);
+
+/*
+ * make room for n more bytes and return where they go, size is moved
+ * past them
+ */
+extern char * buffer_reserve(struct buffer * b, uintptr_t n);
+
+extern void buffer_put(struct buffer * b, void * p, uintptr_t n);
+extern void buffer_put_byte(struct buffer * b, uint8_t c);
+
+/*
+ * store v with the most significant byte first
+ */
+extern void buffer_put_be(struct buffer * b, uint64_t v, int n);
+
+  }
+}
+#endif // CEE_JSON_BUFFER_H
+ 
+#ifndef CEE_JSON_BUILDER_H
+#define CEE_JSON_BUILDER_H
+#include "cee.hpp"
+#include "json.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * builds a tree from values that arrive in document order, the decoders
+ * share it. The open containers are kept in a fixed array, nesting does
+ * not allocate any bookkeeping objects.
+ */
+struct builder {
+  json::data * root;
+  str::data * key;     // the key of the next member of an object
+  int depth;
+  json::data * containers[MAX_JSON_DEPTH];
+};
+
+extern void builder_init(struct builder * b);
+
+/*
+ * add v to the innermost open container, under key if it is an object,
+ * or make it the root if there is no open container
+ */
+extern void builder_add(struct builder * b, json::data * v);
+
+/*
+ * add a container and make it the innermost open one, false if it
+ * would be nested more than MAX_JSON_DEPTH deep
+ */
+extern bool builder_open(struct builder * b, json::data * container);
+
+/*
+ * the innermost open container, NULL if there is none
+ */
+static inline json::data * builder_top(struct builder * b)
+{
+  return b->depth ? b->containers[b->depth-1] : NULL;
+}
+
+static inline void builder_close(struct builder * b)
+{
+  b->depth--;
+}
+
+/*
+ * free what has been built so far
+ */
+extern void builder_abort(struct builder * b);
+
+  }
+}
+#endif // CEE_JSON_BUILDER_H
+ 
+#ifndef CEE_JSON_STATS_H
+#define CEE_JSON_STATS_H
+#include "cee.hpp"
+#include "json.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * the counting of parse and snprint is compiled in with CEE_JSON_STATS.
+ * JSON_STATS(s, x) runs x if it is and s is not NULL, the compiler drops
+ * x otherwise.
+ */
+#ifdef CEE_JSON_STATS
+#define JSON_STATS_ON 1
+#else
+#define JSON_STATS_ON 0
+#endif
+#define JSON_STATS(s, x) do { if (JSON_STATS_ON && (s)) { x; } } while (0)
+
+/*
+ * a call counts into a struct stats of its own, stats_end_parse and
+ * stats_end_print add it to the stats of the state, and stats_end_parse
+ * to more as well if that is not NULL
+ */
+struct stats_call {
+  struct stats counted;
+  struct state::stats before;
+  uint64_t started;
+};
+
+extern uint64_t stats_clock(void);
+extern void stats_begin(state::data *, struct stats_call *);
+extern void stats_end_parse(state::data *, struct stats_call *,
+                            struct stats * more, bool ok);
+extern void stats_end_print(state::data *, struct stats_call *);
+
+  }
+}
+#endif // CEE_JSON_STATS_H
+ 
 /* convert to C */
 ///////////////////////////////////////////////////////////////////////////////
 //                                                                             
@@ -145,6 +823,13 @@ extern enum token next_token(struct tokenizer * t);
 #ifndef CEE_JSON_AMALGAMATION
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CEE_JSON_UTF8_SSSE3
+#ifndef CEE_JSON_AMALGAMATION
+#include <tmmintrin.h>
+#endif
 #endif
 
 static const uint32_t utf_illegal = 0xFFFFFFFFu;
@@ -288,159 +973,487 @@ static bool utf8_validate(char * p, char * e)
   return true;
 }
 
-
-struct utf8_seq {
-  char c[4];
-  unsigned len;
-};
-
-static void utf8_encode(uint32_t value, struct utf8_seq *out) {
-  //struct utf8_seq out={0};
-  if(value <=0x7F) {
-    out->c[0]=value;
-    out->len=1;
-  }
-  else if(value <=0x7FF) {
-    out->c[0]=(value >> 6) | 0xC0;
-    out->c[1]=(value & 0x3F) | 0x80;
-    out->len=2;
-  }
-  else if(value <=0xFFFF) {
-    out->c[0]=(value >> 12) | 0xE0;
-    out->c[1]=((value >> 6) & 0x3F) | 0x80;
-    out->c[2]=(value & 0x3F) | 0x80;
-    out->len=3;
+/*
+ * return the first byte of [p, e) that does not start a valid UTF-8
+ * sequence, or e if the whole range is valid. ASCII is checked eight
+ * bytes at a time.
+ */
+static char * utf8_scan_scalar(char * p, char * e)
+{
+  while(p!=e) {
+    uint64_t w;
+    if(e-p >= 8) {
+      memcpy(&w, p, 8);
+      if(!(w & 0x8080808080808080ull)) {
+        p += 8;
+        continue;
+      }
+    }
+    char * q = p;
+    if(next(&p, e, false)==utf_illegal)
+      return q;
   }
-  else {
-    out->c[0]=(value >> 18) | 0xF0;
-    out->c[1]=((value >> 12) & 0x3F) | 0x80;
-    out->c[2]=((value >> 6) & 0x3F) | 0x80;
-    out->c[3]=(value & 0x3F) | 0x80;
-    out->len=4;
+  return e;
+}
+
+/*
+ * an error was found in the block at, the windows that end before it are
+ * valid. Find the error with the scalar scan, starting with the sequence
+ * of the last 3 bytes in front of the block, whose lead may be invalid.
+ */
+static char * utf8_rescan(char * begin, char * at, char * e)
+{
+  int back = 0;
+  at = at - begin > 3 ? at - 3 : begin;
+  while (at > begin && back < 3 && utf8_is_trail(at[0])) {
+    at--;
+    back++;
   }
+  return utf8_scan_scalar(at, e);
 }
-#endif 
-namespace cee {
-  namespace json {
-json::data * mk_true () {
-  static char b[CEE_SINGLETON_SIZE];
-  return (data *) singleton::init ((uintptr_t)type_is_boolean, b);
+
+#ifdef CEE_JSON_UTF8_SSSE3
+/*
+ * the lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". Three table lookups on the nibbles of
+ * each byte and its predecessor classify every error of a 2 byte window,
+ * the 3 and 4 byte sequences are checked by where the continuation bytes
+ * must be. The input is read in blocks of 64 bytes, a block of ASCII
+ * costs one test.
+ */
+#define UTF8_TOO_SHORT   (1<<0)
+#define UTF8_TOO_LONG    (1<<1)
+#define UTF8_OVERLONG_3  (1<<2)
+#define UTF8_TOO_LARGE   (1<<3)
+#define UTF8_SURROGATE   (1<<4)
+#define UTF8_OVERLONG_2  (1<<5)
+#define UTF8_TOO_LARGE_1000 (1<<6)
+#define UTF8_OVERLONG_4  (1<<6)
+#define UTF8_TWO_CONTS   (1<<7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i utf8_check_block(__m128i input, __m128i prev_input)
+{
+  const __m128i byte_1_high_table = _mm_setr_epi8(
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+  const __m128i byte_1_low_table = _mm_setr_epi8(
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+  const __m128i byte_2_high_table = _mm_setr_epi8(
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+      | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table,
+                          _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table,
+                          _mm_and_si128(prev1, nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table,
+                          _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                  byte_2_high);
+
+  /*
+   * the third and fourth bytes of a sequence must be continuations,
+   * a 2 byte window marks them as TWO_CONTS
+   */
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+  __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+  __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth),
+                                 _mm_set1_epi8((char)0x80));
+  return _mm_xor_si128(must23, special);
+}
+
+/*
+ * the bytes at the end of a block that start a sequence which does not
+ * fit into it
+ */
+__attribute__((target("ssse3")))
+static __m128i utf8_is_incomplete(__m128i input)
+{
+  const __m128i max_value = _mm_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+  return _mm_subs_epu8(input, max_value);
+}
+
+__attribute__((target("ssse3")))
+static char * utf8_scan_ssse3(char * p, char * e)
+{
+  char * begin = p;
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+  char tail[64];
+  while (p != e) {
+    __m128i in[4];
+    int i;
+    char * block = p;
+    if (e - p >= 64) {
+      for (i = 0; i < 4; i++)
+        in[i] = _mm_loadu_si128((__m128i *)(p + 16 * i));
+      p += 64;
+    }
+    else {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, e - p);
+      for (i = 0; i < 4; i++)
+        in[i] = _mm_loadu_si128((__m128i *)(tail + 16 * i));
+      p = e;
+    }
+    __m128i any = _mm_or_si128(_mm_or_si128(in[0], in[1]),
+                               _mm_or_si128(in[2], in[3]));
+    if (_mm_movemask_epi8(any) == 0) {
+      error = _mm_or_si128(error, prev_incomplete);
+    }
+    else {
+      error = _mm_or_si128(error, utf8_check_block(in[0], prev_input));
+      for (i = 1; i < 4; i++)
+        error = _mm_or_si128(error, utf8_check_block(in[i], in[i-1]));
+      prev_incomplete = utf8_is_incomplete(in[3]);
+      prev_input = in[3];
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) {
+      return utf8_rescan(begin, block, e);
+    }
+    if (_mm_movemask_epi8(any) == 0)
+      prev_incomplete = prev_input = _mm_setzero_si128();
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(prev_incomplete, _mm_setzero_si128())) != 0xFFFF)
+    return utf8_rescan(begin, e, e);
+  return e;
+}
+#endif
+
+/*
+ * return the first byte of [p, e) that does not start a valid UTF-8
+ * sequence, or e if the whole range is valid. Checking a whole input
+ * once makes the validation of each decoded string unnecessary.
+ */
+static char * utf8_scan(char * p, char * e)
+{
+#ifdef CEE_JSON_UTF8_SSSE3
+  if (__builtin_cpu_supports("ssse3"))
+    return utf8_scan_ssse3(p, e);
+#endif
+  return utf8_scan_scalar(p, e);
+}
+
+struct utf8_seq {
+  char c[4];
+  unsigned len;
+};
+
+static void utf8_encode(uint32_t value, struct utf8_seq *out) {
+  //struct utf8_seq out={0};
+  if(value <=0x7F) {
+    out->c[0]=value;
+    out->len=1;
+  }
+  else if(value <=0x7FF) {
+    out->c[0]=(value >> 6) | 0xC0;
+    out->c[1]=(value & 0x3F) | 0x80;
+    out->len=2;
+  }
+  else if(value <=0xFFFF) {
+    out->c[0]=(value >> 12) | 0xE0;
+    out->c[1]=((value >> 6) & 0x3F) | 0x80;
+    out->c[2]=(value & 0x3F) | 0x80;
+    out->len=3;
+  }
+  else {
+    out->c[0]=(value >> 18) | 0xF0;
+    out->c[1]=((value >> 12) & 0x3F) | 0x80;
+    out->c[2]=((value >> 6) & 0x3F) | 0x80;
+    out->c[3]=(value & 0x3F) | 0x80;
+    out->len=4;
+  }
+}
+#endif 
+namespace cee {
+  namespace json {
+json::data * mk_true (state::data *st) {
+  static char b[CEE_SINGLETON_SIZE];
+  return (data *) singleton::init (b, (uintptr_t)type_is_boolean, 1);
 }
-json::data * mk_false () {
+json::data * mk_false (state::data *st) {
   static char b[CEE_SINGLETON_SIZE];
-  return (data *) singleton::init ((uintptr_t)type_is_boolean, b);
+  return (data *) singleton::init (b, (uintptr_t)type_is_boolean, 0);
 }
-json::data * mk_bool(bool b) {
+json::data * mk_bool(state::data * st, bool b) {
   if (b)
-    return mk_true();
+    return mk_true(st);
   else
-    return mk_false();
+    return mk_false(st);
 }
-json::data * mk_undefined () {
+json::data * mk_undefined (state::data * st) {
   static char b[CEE_SINGLETON_SIZE];
-  return (data *) singleton::init ((uintptr_t)type_is_undefined, b);
+  return (data *) singleton::init (b, (uintptr_t)type_is_undefined, 0);
 }
-json::data * mk_null () {
+json::data * mk_null (state::data *st) {
   static char b[CEE_SINGLETON_SIZE];
-  return (data *) singleton::init ((uintptr_t)type_is_null, b);
+  return (data *) singleton::init (b, (uintptr_t)type_is_null, 0);
 }
 map::data * to_object (json::data * p) {
-  if (p->t == type_is_object) {
+  if (p->t == type_is_object)
     return p->value.object;
-  }
-  return NULL;
+  else
+    return NULL;
 }
-vect::data * to_array (json::data * p) {
-  if (p->t == type_is_array) {
+list::data * to_array (json::data * p) {
+  if (p->t == type_is_array)
     return p->value.array;
-  }
-  return NULL;
+  else
+    return NULL;
 }
 str::data * to_string (json::data * p) {
-  if (p->t == type_is_string) {
+  if (p->t == type_is_string)
     return p->value.string;
-  }
-  return NULL;
+  else
+    return NULL;
 }
 boxed::data * to_number (json::data * p) {
-  if (p->t == type_is_number) {
+  if (p->t == type_is_number)
     return p->value.number;
+  else
+    return NULL;
+}
+double to_double (json::data * p) {
+  boxed::data * x = to_number(p);
+  if (!x)
+    segfault();
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64: return x->_.f64;
+    case boxed::primitive_f32: return x->_.f32;
+    case boxed::primitive_u64: return x->_.u64;
+    case boxed::primitive_u32: return x->_.u32;
+    case boxed::primitive_u16: return x->_.u16;
+    case boxed::primitive_u8: return x->_.u8;
+    case boxed::primitive_i64: return x->_.i64;
+    case boxed::primitive_i32: return x->_.i32;
+    case boxed::primitive_i16: return x->_.i16;
+    case boxed::primitive_i8: return x->_.i8;
   }
-  return NULL;
+  segfault();
+  return 0;
 }
 bool to_bool (json::data * p) {
-  if (p == mk_true())
-    return true;
-  else if (p == mk_false())
-    return false;
+  switch(p->t) {
+    case type_is_null:
+    case type_is_undefined:
+      return false;
+    case type_is_boolean:
+      {
+        singleton::data * d = (singleton::data *)p;
+        if (d->val)
+          return true;
+        else
+          return false;
+      }
+    default:
+      segfault();
+      break;
+  }
   segfault();
   return false;
 }
-json::data * mk_number (double d) {
-  boxed::data *p = boxed::from_double (d);
-  tagged::data * t = tagged::mk (type_is_number, p);
+json::data * mk_number (state::data * st, double d) {
+  boxed::data *p = boxed::from_double (st, d);
+  tagged::data * t = tagged::mk (st, type_is_number, p);
   return (data *)t;
 }
-json::data * mk_string(str::data *s) {
-  tagged::data * t = tagged::mk(type_is_string, s);
+json::data * mk_string(state::data *st, str::data *s) {
+  tagged::data * t = tagged::mk(st, type_is_string, s);
   return (data *)t;
 }
-json::data * mk_array(int s) {
-  vect::data * v = vect::mk(s);
-  tagged::data * t = tagged::mk(type_is_array, v);
+json::data * mk_array(state::data * st, int s) {
+  list::data * v = list::mk(st, s);
+  tagged::data * t = tagged::mk(st, type_is_array, v);
   return (data *)t;
 }
-json::data * mk_object() {
-  map::data * m = map::mk ((cmp_fun)strcmp);
-  tagged::data * t = tagged::mk(type_is_object, m);
+json::data * mk_object(state::data * st) {
+  map::data * m = map::mk (st, (cmp_fun)strcmp);
+  tagged::data * t = tagged::mk(st, type_is_object, m);
   return (data *)t;
 }
-void object_set(json::data * j, char * key, json::data * v) {
+json::data * mk_stats (state::data * st, struct state::stats * s) {
+  json::data * j = mk_object(st), * types = mk_object(st);
+  unsigned i;
+  object_set_number(st, j, "live_bytes", s->live_bytes);
+  object_set_number(st, j, "peak_bytes", s->peak_bytes);
+  object_set_number(st, j, "allocs", s->n_allocs);
+  object_set_number(st, j, "live", s->n_live);
+  for (i = 0; i < state::max_types; i++)
+    if (state::type_name(i) && s->n_live_by_type[i])
+      object_set_number(st, types, (char *)state::type_name(i),
+                        s->n_live_by_type[i]);
+  object_set(st, j, "live_by_type", types);
+  return j;
+}
+static boxed::data * clone_number (state::data * st, boxed::data * x) {
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64: return boxed::from_double(st, x->_.f64);
+    case boxed::primitive_f32: return boxed::from_float(st, x->_.f32);
+    case boxed::primitive_u64: return boxed::from_u64(st, x->_.u64);
+    case boxed::primitive_u32: return boxed::from_u32(st, x->_.u32);
+    case boxed::primitive_u16: return boxed::from_u16(st, x->_.u16);
+    case boxed::primitive_u8: return boxed::from_u8(st, x->_.u8);
+    case boxed::primitive_i64: return boxed::from_i64(st, x->_.i64);
+    case boxed::primitive_i32: return boxed::from_i32(st, x->_.i32);
+    case boxed::primitive_i16: return boxed::from_i16(st, x->_.i16);
+    case boxed::primitive_i8: return boxed::from_i8(st, x->_.i8);
+  }
+  segfault();
+}
+struct clone_cxt {
+  state::data * st;
+  map::data * object;
+};
+static void clone_member (void * cxt, void * key, void * value) {
+  struct clone_cxt * c = (struct clone_cxt *)cxt;
+  map::add(c->object, str::mk(c->st, "%s", (char *)key),
+           clone(c->st, (json::data *)value));
+}
+json::data * clone (state::data * st, json::data * j) {
+  json::data * r;
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+    case type_is_boolean:
+      return j;
+    case type_is_number:
+      return (json::data *)tagged::mk(st, type_is_number,
+                                      clone_number(st, j->value.number));
+    case type_is_string:
+      return mk_string(st, str::mk(st, "%s", (char *)j->value.string));
+    case type_is_array:
+      n = list::size(j->value.array);
+      r = mk_array(st, n);
+      for (i = 0; i < n; i++)
+        list::append(&r->value.array,
+                     clone(st, (json::data *)j->value.array->_[i]));
+      return r;
+    case type_is_object:
+      {
+        struct clone_cxt c = { st, NULL };
+        r = mk_object(st);
+        c.object = r->value.object;
+        map::walk(j->value.object, &c, clone_member);
+        return r;
+      }
+  }
+  segfault();
+}
+static void share_member (void *, void * key, void * value) {
+  cee::share(key);
+  share((json::data *)value);
+}
+void share (json::data * j) {
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+    case type_is_boolean:
+      return;
+    case type_is_number:
+      cee::share(j->value.number);
+      break;
+    case type_is_string:
+      cee::share(j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      for (i = 0; i < n; i++)
+        share((json::data *)j->value.array->_[i]);
+      cee::share(j->value.array);
+      break;
+    case type_is_object:
+      map::walk(j->value.object, NULL, share_member);
+      cee::share(j->value.object);
+      break;
+  }
+  cee::share(j);
+}
+void object_set(state::data * st, json::data * j, char * key, json::data * v) {
   map::data * o = to_object(j);
   if (!o)
     segfault();
-  map::add(o, str::mk("%s", key), v);
+  map::add(o, str::mk(st, "%s", key), v);
 }
-void object_set_bool(json::data * j, char * key, bool b) {
+void object_set_bool(state::data * st, json::data * j, char * key, bool b) {
   map::data * o = to_object(j);
   if (!o)
     segfault();
-  map::add(o, str::mk("%s", key), mk_bool(b));
+  map::add(o, str::mk(st, "%s", key), mk_bool(st, b));
 }
-void object_set_string (json::data * j, char * key, char * str) {
+void object_set_string (state::data * st, json::data * j, char * key, char * str) {
   map::data * o = to_object(j);
   if (!o)
     segfault();
-  map::add(o, str::mk("%s", key), mk_string(str::mk("%s", str)));
+  map::add(o, str::mk(st, "%s", key), mk_string(st, str::mk(st, "%s", str)));
 }
-void object_set_number (json::data * j, char * key, double real) {
+void object_set_number (state::data * st, json::data * j, char * key, double real) {
   map::data * o = to_object(j);
   if (!o)
     segfault();
-  map::add(o, str::mk("%s", key), mk_number(real));
+  map::add(o, str::mk(st, "%s", key), mk_number(st, real));
 }
-void array_append (json::data * j, json::data *v) {
-  vect::data * o = to_array(j);
-  if (!o)
+/*
+ * append through the pointer held by j, the list moves when it grows
+ */
+void array_append (state::data *, json::data * j, json::data *v) {
+  if (!to_array(j))
     segfault();
-  vect::append(o, v);
+  list::append(&j->value.array, v);
 }
-void array_append_bool (json::data * j, bool b) {
-  vect::data * o = to_array(j);
-  if (!o)
-    segfault();
-  vect::append(o, mk_bool(b));
+void array_append_bool (state::data * st, json::data * j, bool b) {
+  array_append(st, j, mk_bool(st, b));
 }
-void array_append_string (json::data * j, char * x) {
-  vect::data * o = to_array(j);
-  if (!o)
-    segfault();
-  vect::append(o, mk_string(str::mk("%s", x)));
+void array_append_string (state::data * st, json::data * j, char * x) {
+  array_append(st, j, mk_string(st, str::mk(st, "%s", x)));
+}
+void array_append_number (state::data * st, json::data * j, double real) {
+  array_append(st, j, mk_number(st, real));
 }
 /*
  * this function assume the file pointer points to the begin of a file
  */
-json::data * load_from_file (FILE * f, bool force_eof, int * error_at_line) {
+json::data * load_from_file (state::data * st, FILE * f, bool force_eof,
+                             int * error_at_line) {
   int fd = fileno(f);
   struct stat buf;
   fstat(fd, &buf);
@@ -450,15 +1463,15 @@ json::data * load_from_file (FILE * f, bool force_eof, int * error_at_line) {
     segfault();
   int line = 0;
   json::data * j;
-  if (!parse(b, size, &j, true, &line)) {
+  if (!parse(st, b, size, &j, true, &line)) {
     // report error
   }
   return j;
 }
-bool save(json::data * j, FILE *f, enum format how) {
-  size_t s = json::snprint(NULL, 0, j, how);
+bool save(state::data * st, json::data * j, FILE *f, enum format how) {
+  size_t s = json::snprint(st, NULL, 0, j, how);
   char * p = (char *)malloc(s+1);
-  snprint(p, s+1, j, how);
+  snprint(st, p, s+1, j, how);
   if (fwrite(p, s+1, 1, f) != 1) {
     fprintf(stderr, "%s", strerror(errno));
     return false;
@@ -468,224 +1481,269 @@ bool save(json::data * j, FILE *f, enum format how) {
   }
 }
 /* JSON parser
-   C reimplementation of 
+   C reimplementation of
      Artyom Beilis (Tonkikh) <artyomtnk@yahoo.com>'s orca_json.cpp
 */
 namespace cee {
   namespace json {
-enum state_type {
-  st_init = 0,
-  st_object_or_array_or_value_expected = 0 ,
-  st_object_key_or_close_expected,
-  st_object_colon_expected,
-  st_object_value_expected,
-  st_object_close_or_comma_expected,
-  st_array_value_or_close_expected,
-  st_array_close_or_comma_expected,
-  st_error,
-  st_done
-} state_type;
-static const uintptr_t json_max_depth = 512;
-bool parse(char * buf, uintptr_t len, json::data **out, bool force_eof,
-           int *error_at_line)
-{
-  struct tokenizer tock = {0};
+/*
+ * the mask of a subtree that is built completely
+ */
+/*
+ * what the parser keeps for each open container of the builder
+ */
+struct frame {
+  uint64_t mask; // the projection paths that can still match inside
+  uintptr_t index; // the index of the next element of an array
+};
+static enum stats_token stats_token_of(int c)
+{
+  switch (c) {
+    case '{': return stats_open_object;
+    case '}': return stats_close_object;
+    case '[': return stats_open_array;
+    case ']': return stats_close_array;
+    case ':': return stats_colon;
+    case ',': return stats_comma;
+    case tock_str: return stats_string;
+    case tock_number: return stats_number;
+    case tock_true: return stats_true;
+    case tock_false: return stats_false;
+    case tock_null: return stats_null;
+    default: return stats_n_tokens;
+  }
+}
+static int get_token(state::data * st, struct tokenizer * t)
+{
+  uint64_t started = 0;
+  enum stats_token k;
+  JSON_STATS(t->stats, started = stats_clock());
+  int c = next_token(st, t);
+  JSON_STATS(t->stats, t->stats->tokenizer_ns += stats_clock() - started;
+                       if ((k = stats_token_of(c)) != stats_n_tokens)
+                         t->stats->n_tokens[k]++);
+  return c;
+}
+/*
+ * return the paths of mask that select the member named by the raw
+ * string [begin, end), or the element index if begin is NULL.
+ * MASK_ALL is returned if a path ends at the member.
+ */
+static uint64_t select_paths(projection::data * proj, uint64_t mask, int level,
+                             char * begin, char * end, uintptr_t index)
+{
+  uint64_t selected = 0;
+  uintptr_t i;
+  for (i = 0; i < proj->size; i++) {
+    if (!(mask & ((uint64_t)1 << i)))
+      continue;
+    struct projection::path * p = proj->_ + i;
+    struct projection::step * s = p->steps + level;
+    bool match;
+    if (begin)
+      match = s->key && string_equals(begin, end, s->key);
+    else
+      match = !s->key && (s->index < 0 || (uintptr_t)s->index == index);
+    if (match) {
+      if (p->size == (uintptr_t)level + 1)
+        return (~(uint64_t)0);
+      selected |= (uint64_t)1 << i;
+    }
+  }
+  return selected;
+}
+static uint64_t root_mask(projection::data * proj)
+{
+  uintptr_t i;
+  if (proj == NULL)
+    return (~(uint64_t)0);
+  for (i = 0; i < proj->size; i++)
+    if (proj->_[i].size == 0)
+      return (~(uint64_t)0);
+  return ((uint64_t)1 << proj->size) - 1;
+}
+bool parse(state::data * st, char * buf, uintptr_t len, json::data **out,
+           bool force_eof, int *error_at_line)
+{
+  return parse_e(st, buf, len, out, force_eof, error_at_line, NULL);
+}
+/*
+ * the states of the old table driven parser are kept as labels, each
+ * state jumps to its successor directly so the dispatch on a state
+ * variable is gone. The builder keeps the open containers in a fixed
+ * array on the C stack, nesting does not allocate any bookkeeping
+ * objects.
+ *
+ * With a projection every container carries the set of paths that can
+ * still match inside it. Members and elements no path selects are
+ * skipped with the scanning functions of the tokenizer, which neither
+ * decode nor allocate anything.
+ */
+bool parse_e(state::data * st, char * buf, uintptr_t len, json::data **out,
+             bool force_eof, int *error_at_line, struct parse_options * options)
+{
+  struct tokenizer tock = {};
   tock.buf = buf;
   tock.buf_end = buf + len;
   *out = NULL;
-  enum state_type state = st_init;
-  str::data * key = NULL;
-  stack::data * sp = stack::mk_e (dp_noop, json_max_depth);
-  tuple::data * top = NULL;
-  tuple::data * result = NULL;
-  static enum del_policy del_noops[2] = { dp_noop, dp_noop };
-  stack::push(sp, tuple::mk_e(del_noops, (void *)st_done, NULL));
-  while(!stack::empty(sp) && !stack::full(sp) &&
-        state != st_error && state != st_done) {
-    if (result) {
-      del(result);
-      result = NULL;
-    }
-    int c = next_token(&tock);
-    top = (tuple::data *)stack::top(sp, 0);
-    switch(state) {
-    case st_object_or_array_or_value_expected:
-      if(c=='[') {
-        top->_[1]= mk_array(10);
-        state=st_array_value_or_close_expected;
-      }
-      else if(c=='{') {
-        top->_[1]= mk_object();
-        state=st_object_key_or_close_expected;
-      }
-      else if(c==tock_str) {
-        top->_[1]= mk_string(tock.str);
-        tock.str = NULL;
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if(c==tock_true) {
-        top->_[1]= mk_true();
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if(c==tock_false) {
-        top->_[1] = mk_false();
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if(c==tock_null) {
-        top->_[1] = mk_null();
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if(c==tock_number) {
-        top->_[1] = mk_number (tock.real);
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else
-        state = st_error;
-      break;
-    case st_object_key_or_close_expected:
-      if(c=='}') {
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if (c==tock_str) {
-        key = tock.str;
-        tock.str = NULL;
-        state = st_object_colon_expected;
+  /*
+   * a complete input is checked as a whole, which is faster than
+   * validating every string after it is decoded
+   */
+  if (force_eof) {
+    char * bad = utf8_scan(buf, tock.buf_end);
+    if (bad != tock.buf_end) {
+      *error_at_line = count_lines(buf, bad);
+      return false;
+    }
+    tock.utf8_checked = true;
+  }
+  projection::data * proj = options ? options->projection : NULL;
+  struct stats_call call;
+  if (JSON_STATS_ON) {
+    stats_begin(st, &call);
+    tock.stats = &call.counted;
+  }
+  struct frame frames[MAX_JSON_DEPTH];
+  struct builder b;
+  json::data * v = NULL;
+  uint64_t mask = root_mask(proj);
+  char * begin, * end, * key_at;
+  int c;
+  builder_init(&b);
+st_object_or_array_or_value_expected:
+  if (mask != (~(uint64_t)0) && b.depth > 0) {
+    c = skip_space(&tock);
+    if (c != '[' && c != '{') {
+      /*
+       * a path goes on below this value but it is not a container
+       */
+      if (!skip_value(&tock))
+        goto st_error;
+      if (b.key) {
+        del(b.key);
+        b.key = NULL;
       }
-      else
-        state = st_error;
-      break;
-    case st_object_colon_expected:
-      if(c!=':')
-        state=st_error;
-      else
-        state=st_object_value_expected;
+      goto st_close_or_comma_expected;
+    }
+  }
+  c = get_token(st, &tock);
+st_value:
+  switch(c) {
+    case '[':
+    case '{':
+      if (b.depth == MAX_JSON_DEPTH)
+        goto st_error;
+      builder_open(&b, (c == '[') ? mk_array(st, 10) : mk_object(st));
+      JSON_STATS(tock.stats, if ((uintptr_t)b.depth > tock.stats->max_depth)
+                               tock.stats->max_depth = b.depth);
+      frames[b.depth-1].mask = mask;
+      frames[b.depth-1].index = 0;
+      if (c == '[')
+        goto st_array_value_or_close_expected;
+      goto st_object_key_or_close_expected;
+    case tock_str:
+      v = mk_string(st, tock.str);
+      tock.str = NULL;
       break;
-    case st_object_value_expected:
-      {
-        map::data * obj = json::to_object((json::data *)top->_[1]);
-        if(c==tock_str) {
-          map::add(obj, key, mk_string(tock.str));
-          tock.str = NULL;
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_true) {
-          map::add(obj, key, mk_true());
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_false) {
-          map::add(obj, key, mk_false());
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_null) {
-          map::add(obj, key, mk_null());
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c==tock_number) {
-          map::add(obj, key, mk_number(tock.real));
-          state=st_object_close_or_comma_expected;
-        }
-        else if(c=='[') {
-          json::data * a = mk_array(10);
-          map::add(obj, key, a);
-          state=st_array_value_or_close_expected;
-          stack::push(sp, tuple::mk_e(del_noops, (void *)st_object_close_or_comma_expected, a));
-        }
-        else if(c=='{') {
-          json::data * o = mk_object();
-          map::add(obj, key, o);
-          state=st_object_key_or_close_expected;
-          stack::push(sp, tuple::mk_e(del_noops, (void *)st_object_close_or_comma_expected, o));
-        }
-        else
-          state=st_error;
-      }
+    case tock_true:
+      v = mk_true(st);
       break;
-    case st_object_close_or_comma_expected:
-      if(c==',')
-        state=st_object_key_or_close_expected;
-      else if(c=='}') {
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else
-        state=st_error;
+    case tock_false:
+      v = mk_false(st);
       break;
-    case st_array_value_or_close_expected:
-      {
-        if(c==']') {
-          state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-          { result = (struct tuple::data *)stack::pop(sp); };
-          break;
-        }
-        struct vect::data * ar = json::to_array((json::data *)top->_[1]);
-        if(c==tock_str) {
-          vect::append(ar, mk_string(tock.str));
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c==tock_true) {
-          vect::append(ar, mk_true());
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c==tock_false) {
-          vect::append(ar, mk_false());
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c==tock_null) {
-          vect::append(ar, mk_null());
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c==tock_number) {
-          vect::append(ar, mk_number(tock.real));
-          state=st_array_close_or_comma_expected;
-        }
-        else if(c=='[') {
-          json::data * a = mk_array(10);
-          state=st_array_value_or_close_expected;
-          stack::push(sp, tuple::mk_e(del_noops, (void *)st_array_close_or_comma_expected, a));
-        }
-        else if(c=='{') {
-          json::data * o = mk_object();
-          state=st_object_key_or_close_expected;
-          stack::push(sp, tuple::mk_e(del_noops, (void *)st_array_close_or_comma_expected, o));
-        }
-        else
-          state=st_error;
-        break;
-      }
-    case st_array_close_or_comma_expected:
-      if(c==']') {
-        state=(static_cast<enum state_type>(reinterpret_cast<intptr_t>(top->_[0])));
-        { result = (struct tuple::data *)stack::pop(sp); };
-      }
-      else if(c==',')
-        state=st_array_value_or_close_expected;
-      else
-        state=st_error;
+    case tock_null:
+      v = mk_null(st);
       break;
-    case st_done:
-    case st_error:
+    case tock_number:
+      v = mk_number(st, tock.real);
       break;
-    };
+    default:
+      goto st_error;
   }
-  del(sp);
-  if(state==st_done) {
-    if(force_eof) {
-      if(next_token(&tock)!=tock_eof) {
-        *error_at_line=tock.line;
-        return false;
-      }
+  builder_add(&b, v);
+  goto st_close_or_comma_expected;
+st_object_key_or_close_expected:
+  mask = frames[b.depth-1].mask;
+  if (mask != (~(uint64_t)0)) {
+    c = skip_space(&tock);
+    if (c == '}') {
+      tock.buf++;
+      goto st_close;
     }
-    *out = (json::data *)(result->_[1]);
-    del(result);
-    return true;
+    key_at = tock.buf;
+    if (c != '"' || !scan_string(&tock, &begin, &end))
+      goto st_error;
+    mask = select_paths(proj, mask, b.depth - 1, begin, end, 0);
+    if (mask == 0) {
+      if (skip_space(&tock) != ':')
+        goto st_error;
+      tock.buf++;
+      if (!skip_value(&tock))
+        goto st_error;
+      goto st_close_or_comma_expected;
+    }
+    tock.buf = key_at;
+  }
+  c = get_token(st, &tock);
+  if (c == '}')
+    goto st_close;
+  if (c != tock_str)
+    goto st_error;
+  b.key = tock.str;
+  tock.str = NULL;
+  if (get_token(st, &tock) != ':')
+    goto st_error;
+  goto st_object_or_array_or_value_expected;
+st_array_value_or_close_expected:
+  mask = frames[b.depth-1].mask;
+  if (mask != (~(uint64_t)0)) {
+    c = skip_space(&tock);
+    if (c == ']') {
+      tock.buf++;
+      goto st_close;
+    }
+    mask = select_paths(proj, mask, b.depth - 1, NULL, NULL, frames[b.depth-1].index++);
+    if (mask == 0) {
+      if (!skip_value(&tock))
+        goto st_error;
+      goto st_close_or_comma_expected;
+    }
+    goto st_object_or_array_or_value_expected;
+  }
+  c = get_token(st, &tock);
+  if (c == ']')
+    goto st_close;
+  goto st_value;
+st_close:
+  builder_close(&b);
+st_close_or_comma_expected:
+  if (b.depth == 0)
+    goto st_done;
+  c = get_token(st, &tock);
+  if (builder_top(&b)->t == type_is_object) {
+    if (c == ',')
+      goto st_object_key_or_close_expected;
+    if (c == '}')
+      goto st_close;
+  }
+  else {
+    if (c == ',')
+      goto st_array_value_or_close_expected;
+    if (c == ']')
+      goto st_close;
   }
-  *error_at_line=tock.line;
+  goto st_error;
+st_done:
+  if (force_eof && get_token(st, &tock) != tock_eof)
+    goto st_error;
+  *out = b.root;
+  JSON_STATS(tock.stats, stats_end_parse(st, &call, options ? options->stats : NULL, true));
+  return true;
+st_error:
+  builder_abort(&b);
+  *error_at_line = tock.line;
+  JSON_STATS(tock.stats, stats_end_parse(st, &call, options ? options->stats : NULL, false));
   return false;
 }
   }
@@ -698,23 +1756,23 @@ namespace cee {
   namespace json {
 struct counter {
   uintptr_t next;
-  vect::data * array;
+  list::data * array;
   map::data * object;
-  char tabs;
+  uintptr_t tabs;
   char more_siblings;
 };
-static struct counter * push(uintptr_t tabs, bool more_siblings,
+static struct counter * push(state::data * st, uintptr_t tabs, bool more_siblings,
                              stack::data * sp, json::data * j) {
   struct counter * p = NULL;
   if (j == NULL) {
-    p = (struct counter *)block::mk(sizeof(struct counter));
+    p = (struct counter *)block::mk(st, sizeof(struct counter));
     p->tabs = 0;
   }
   else {
     switch(j->t) {
       case type_is_object:
         {
-          p = (struct counter *) block::mk(sizeof(struct counter));
+          p = (struct counter *) block::mk(st, sizeof(struct counter));
           map::data * mp = to_object(j);
           p->array = map::keys(mp);
           p->object = to_object(j);
@@ -725,7 +1783,7 @@ static struct counter * push(uintptr_t tabs, bool more_siblings,
         break;
       case type_is_array:
         {
-          p = (struct counter *)block::mk(sizeof(struct counter));
+          p = (struct counter *)block::mk(st, sizeof(struct counter));
           p->array = to_array(j);
           p->tabs = tabs;
           p->next = 0;
@@ -734,7 +1792,7 @@ static struct counter * push(uintptr_t tabs, bool more_siblings,
         break;
       default:
         {
-          p = (struct counter *)block::mk(sizeof(struct counter));
+          p = (struct counter *)block::mk(st, sizeof(struct counter));
           p->array = NULL;
           p->tabs = tabs;
           p->next = 0;
@@ -745,7 +1803,7 @@ static struct counter * push(uintptr_t tabs, bool more_siblings,
     p->more_siblings = more_siblings;
   }
   enum del_policy o[2] = { dp_del, dp_noop };
-  stack::push(sp, tuple::mk_e(o, p, j));
+  stack::push(sp, tuple::mk_e(st, o, p, j));
   return p;
 }
 static void pad (uintptr_t * offp, char * buf, struct counter * cnt, enum format f)
@@ -753,7 +1811,7 @@ static void pad (uintptr_t * offp, char * buf, struct counter * cnt, enum format
   if (!f) return;
   uintptr_t offset = *offp;
   if (buf) {
-    int i;
+    uintptr_t i;
     for (i = 0; i < cnt->tabs; i++)
       buf[offset + i] = '\t';
   }
@@ -857,13 +1915,20 @@ static void str_append(char * out, uintptr_t *offp, char *begin, unsigned len) {
 /*
  * compute how many bytes are needed to serialize orca_json as a string
  */
-size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
+size_t snprint (state::data * st, char * buf, size_t size, json::data * j, enum format f) {
   tuple::data * cur;
   json::data * cur_orca_json;
   struct counter * ccnt;
   uintptr_t incr = 0;
-  stack::data * sp = stack::mk_e(dp_noop, 500);
-  push (0, false, sp, j);
+  struct stats_call call;
+  if (JSON_STATS_ON)
+    stats_begin(st, &call);
+  /*
+   * the open containers, the value inside the innermost one and a slot
+   * to spare, printing stops once the stack is full
+   */
+  stack::data * sp = stack::mk_e(st, dp_noop, MAX_JSON_DEPTH + 2);
+  push (st, 0, false, sp, j);
   uintptr_t offset = 0;
   while (!stack::empty(sp) && !stack::full(sp)) {
     cur = (tuple::data *) stack::top(sp, 0);
@@ -921,7 +1986,7 @@ size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
           pad(&offset, buf, ccnt, f);
           incr = boxed::snprint(NULL, 0, to_number(cur_orca_json));
           if (buf) {
-            boxed::snprint(buf+offset, incr, to_number(cur_orca_json));
+            boxed::snprint(buf+offset, incr+1, to_number(cur_orca_json));
           }
           offset+=incr;
           if (ccnt->more_siblings)
@@ -934,13 +1999,14 @@ size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
           uintptr_t i = ccnt->next;
           if (i == 0)
             delimiter(&offset, buf, f, ccnt, '[');
-          uintptr_t n = vect::size(ccnt->array);
+          uintptr_t n = list::size(ccnt->array);
           if (i < n) {
             bool more_siblings = false;
             if (1 < n && i+1 < n)
               more_siblings = true;
             ccnt->next++;
-            push (ccnt->tabs + 1, more_siblings, sp, (json::data *)(ccnt->array->_[i]));
+            push (st, ccnt->tabs + 1, more_siblings, sp,
+                  (json::data *)(ccnt->array->_[i]));
           }
           else {
             delimiter(&offset, buf, f, ccnt, ']');
@@ -955,7 +2021,7 @@ size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
           uintptr_t i = ccnt->next;
           if (i == 0)
             delimiter(&offset, buf, f, ccnt, '{');
-          uintptr_t n = vect::size(ccnt->array);
+          uintptr_t n = list::size(ccnt->array);
           if (i < n) {
             bool more_siblings = false;
             if (1 < n && i+1 < n)
@@ -967,7 +2033,7 @@ size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
             pad(&offset, buf, ccnt, f);
             str_append(buf, &offset, key, klen);
             delimiter(&offset, buf, f, ccnt, ':');
-            push (ccnt->tabs + 1, more_siblings, sp, j1);
+            push (st, ccnt->tabs + 1, more_siblings, sp, j1);
           }
           else {
             delimiter(&offset, buf, f, ccnt, '}');
@@ -983,6 +2049,8 @@ size_t snprint (char * buf, size_t size, json::data * j, enum format f) {
   del (sp);
   if (buf)
     buf[offset] = '\0';
+  JSON_STATS(&call, call.counted.bytes_printed = offset;
+                    stats_end_print(st, &call));
   return offset;
 }
   }
@@ -1012,22 +2080,26 @@ static bool read_4_digits(struct tokenizer * t, uint16_t *x)
   else
     return false;
   int i;
+  unsigned v = 0;
   for(i=0; i<4; i++) {
     char c=buf[i];
-    if( ('0'<= c && c<='9') || ('A'<= c && c<='F') || ('a'<= c && c<='f') ) {
-      continue;
-    }
-    return false;
+    if('0'<= c && c<='9')
+      v = v * 16 + (c - '0');
+    else if('A'<= c && c<='F')
+      v = v * 16 + (c - 'A' + 10);
+    else if('a'<= c && c<='f')
+      v = v * 16 + (c - 'a' + 10);
+    else
+      return false;
   }
-  unsigned v;
-  sscanf(buf,"%x",&v);
   *x=v;
+  t->buf += 4;
   return true;
 }
-static bool parse_string(struct tokenizer * t) {
+static bool parse_string(state::data * st, struct tokenizer * t) {
   char c;
   // we should use a more efficient stretchy buffer here
-  t->str = str::mk_e(128, "");
+  t->str = str::mk_e(st, 128, "");
   if (t->buf == t->buf_end)
     return false;
   c=t->buf[0];
@@ -1035,6 +2107,7 @@ static bool parse_string(struct tokenizer * t) {
   if (c != '"') return false;
   bool second_surragate_expected=false;
   uint16_t first_surragate = 0;
+  bool escaped = false;
   for(;;) {
     if(t->buf == t->buf_end)
       return false;
@@ -1047,8 +2120,11 @@ static bool parse_string(struct tokenizer * t) {
     if(c=='"')
       break;
     if(c=='\\') {
+      escaped = true;
       if(t->buf == t->buf_end)
         return false;
+      c = t->buf[0];
+      t->buf ++;
       if(second_surragate_expected && c!='u')
         return false;
       switch(c) {
@@ -1066,11 +2142,12 @@ static bool parse_string(struct tokenizer * t) {
         {
           // don't support utf16
           uint16_t x;
-          if (!read_4_digits(t, &x))
+          if (!read_4_digits(t, &x) || !utf_valid(x))
             return false;
          struct utf8_seq s = { 0 };
           utf8_encode(x, &s);
-          t->str = str::ncat(t->str, s.c, s.len);
+          for (unsigned i = 0; i < s.len; i++)
+            t->str = str::add(t->str, s.c[i]);
         }
         break;
       default:
@@ -1081,16 +2158,38 @@ static bool parse_string(struct tokenizer * t) {
       t->str = str::add(t->str, c);
     }
   }
-  if(!utf8_validate(t->str->_, str::end(t->str)))
+  if(!t->utf8_checked && !utf8_validate(t->str->_, str::end(t->str)))
     return false;
+  JSON_STATS(t->stats, t->stats->n_strings++;
+                       t->stats->n_escaped_strings += escaped;
+                       t->stats->bytes_copied += str::end(t->str) - t->str->_);
   return true;
 }
+/*
+ * the number is scanned by the JSON grammar first and then copied out to
+ * be converted, the input is not required to be terminated by '\0'. A
+ * number too long for the buffer on the stack is copied to the heap.
+ */
 static bool parse_number(struct tokenizer *t) {
-  int x = sscanf(t->buf, "%lf", &t->real);
-  return x == 1;
+  char tmp[64], * copy = tmp, * end;
+  char * begin = t->buf;
+  if (!scan_number(t))
+    return false;
+  uintptr_t n = t->buf - begin;
+  if (n >= sizeof(tmp))
+    copy = (char *)malloc(n + 1);
+  memcpy(copy, begin, n);
+  copy[n] = '\0';
+  t->real = strtod(copy, &end);
+  bool ok = end == copy + n;
+  if (copy != tmp)
+    free(copy);
+  if (!ok)
+    t->buf = begin;
+  return ok;
 }
-enum token next_token(struct tokenizer * t) {
-  for (;;t->buf++) {
+enum token next_token(state::data * st, struct tokenizer * t) {
+  for (;;) {
     if (t->buf == t->buf_end)
       return tock_eof;
     char c = t->buf[0];
@@ -1112,7 +2211,7 @@ enum token next_token(struct tokenizer * t) {
         break;
       case '"':
         t->buf --;
-        if(parse_string(t))
+        if(parse_string(st, t))
           return tock_str;
         return tock_err;
       case 't':
@@ -1143,7 +2242,7 @@ enum token next_token(struct tokenizer * t) {
           return tock_number;
         return tock_err;
       case '/':
-        if(check(t->buf + 1, "/", &t->buf)) {
+        if(check(t->buf, "/", &t->buf)) {
           for (;t->buf < t->buf_end && (c = t->buf[0]) && c != '\n'; t->buf++);
           if(c=='\n')
             break;
@@ -1154,6 +2253,4123 @@ enum token next_token(struct tokenizer * t) {
         return tock_err;
     }
   }
+}
+int skip_space(struct tokenizer * t) {
+  for (;;) {
+    if (t->buf == t->buf_end)
+      return tock_eof;
+    char c = t->buf[0];
+    switch (c) {
+      case '\n':
+        t->line++;
+        t->buf++;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+        t->buf++;
+        break;
+      case '/':
+        if (t->buf + 1 < t->buf_end && t->buf[1] == '/') {
+          for (t->buf += 2; t->buf < t->buf_end && t->buf[0] != '\n'; t->buf++);
+          break;
+        }
+        return c;
+      default:
+        return (unsigned char)c;
+    }
+  }
+}
+static int hex_value(char c) {
+  if ('0' <= c && c <= '9')
+    return c - '0';
+  if ('A' <= c && c <= 'F')
+    return c - 'A' + 10;
+  if ('a' <= c && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+bool scan_string(struct tokenizer * t, char ** begin, char ** end) {
+  char * p = t->buf, * e = t->buf_end;
+  if (p == e || *p != '"')
+    return false;
+  *begin = ++p;
+  for (;;) {
+    if (p == e)
+      return false;
+    unsigned char c = *p;
+    if (c == '"')
+      break;
+    if (c < 0x20)
+      return false;
+    if (c == '\\') {
+      if (++p == e)
+        return false;
+      switch (*p) {
+        case '"': case '\\': case '/':
+        case 'b': case 'f': case 'n': case 'r': case 't':
+          break;
+        case 'u':
+          if (e - p < 5 || hex_value(p[1]) < 0 || hex_value(p[2]) < 0
+              || hex_value(p[3]) < 0 || hex_value(p[4]) < 0)
+            return false;
+          p += 4;
+          break;
+        default:
+          return false;
+      }
+    }
+    p++;
+  }
+  *end = p;
+  t->buf = p + 1;
+  return true;
+}
+int count_lines(char * begin, char * end) {
+  int n = 0;
+  for (; begin < end; begin++)
+    if (*begin == '\n')
+      n++;
+  return n;
+}
+static char * scan_digits(char * p, char * e) {
+  while (p < e && '0' <= *p && *p <= '9')
+    p++;
+  return p;
+}
+bool scan_number(struct tokenizer * t) {
+  char * p = t->buf, * e = t->buf_end, * q;
+  if (p < e && *p == '-')
+    p++;
+  if (p < e && *p == '0')
+    p++;
+  else if ((q = scan_digits(p, e)) != p)
+    p = q;
+  else
+    return false;
+  if (p < e && *p == '.') {
+    q = scan_digits(p + 1, e);
+    if (q == p + 1)
+      return false;
+    p = q;
+  }
+  if (p < e && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < e && (*p == '+' || *p == '-'))
+      p++;
+    q = scan_digits(p, e);
+    if (q == p)
+      return false;
+    p = q;
+  }
+  t->buf = p;
+  return true;
+}
+bool string_equals(char * begin, char * end, char * key) {
+  char * p = begin;
+  unsigned char * k = (unsigned char *)key;
+  while (p < end) {
+    char c = *p++;
+    if (c != '\\') {
+      if (*k++ != (unsigned char)c)
+        return false;
+      continue;
+    }
+    switch (c = *p++) {
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'u':
+        {
+          uint32_t x = (hex_value(p[0]) << 12) | (hex_value(p[1]) << 8)
+                     | (hex_value(p[2]) << 4) | hex_value(p[3]);
+          struct utf8_seq s = {};
+          unsigned i;
+          p += 4;
+          utf8_encode(x, &s);
+          for (i = 0; i < s.len; i++)
+            if (*k++ != (unsigned char)s.c[i])
+              return false;
+          continue;
+        }
+      default:
+        break;
+    }
+    if (*k++ != (unsigned char)c)
+      return false;
+  }
+  return *k == '\0';
+}
+/*
+ * move over true, false, null or a number, it has to end where a value
+ * can end
+ */
+static bool skip_literal(struct tokenizer * t) {
+  char * p = t->buf, * e = t->buf_end;
+  const char * word = NULL;
+  switch (*p) {
+    case 't': word = "true"; break;
+    case 'f': word = "false"; break;
+    case 'n': word = "null"; break;
+    default:
+      if (!scan_number(t))
+        return false;
+  }
+  if (word) {
+    size_t n = strlen(word);
+    if ((size_t)(e - p) < n || memcmp(p, word, n))
+      return false;
+    t->buf += n;
+  }
+  if (t->buf == e)
+    return true;
+  switch (t->buf[0]) {
+    case ',': case ']': case '}': case '/':
+    case ' ': case '\t': case '\r': case '\n':
+      return true;
+    default:
+      return false;
+  }
+}
+/*
+ * skip until the container opened by open and the ones nested in it
+ * have been closed, each by the bracket of its kind. Strings, literals
+ * and comments are checked, the placement of ',' and ':' is not.
+ */
+static bool skip_nested(struct tokenizer * t, char open) {
+  char frames[MAX_JSON_DEPTH]; // '[' or '{', the closing bracket is 2 above
+  int depth = 0;
+  char * begin, * end;
+  frames[depth++] = open;
+  while (depth) {
+    int c = skip_space(t);
+    switch (c) {
+      case tock_eof:
+        return false;
+      case '"':
+        if (!scan_string(t, &begin, &end))
+          return false;
+        break;
+      case '[':
+      case '{':
+        if (depth == MAX_JSON_DEPTH)
+          return false;
+        frames[depth++] = c;
+        t->buf++;
+        break;
+      case ']':
+      case '}':
+        if (c != frames[--depth] + 2)
+          return false;
+        t->buf++;
+        break;
+      case ',':
+      case ':':
+        t->buf++;
+        break;
+      default:
+        if (!skip_literal(t))
+          return false;
+    }
+  }
+  return true;
+}
+bool skip_container(struct tokenizer * t, char open) {
+  return skip_nested(t, open);
+}
+bool skip_value(struct tokenizer * t) {
+  char * begin, * end;
+  int c = skip_space(t);
+  switch (c) {
+    case '"':
+      return scan_string(t, &begin, &end);
+    case '[':
+    case '{':
+      t->buf++;
+      return skip_nested(t, c);
+    case tock_eof:
+      return false;
+    default:
+      return skip_literal(t);
+  }
+}
+  }
+}
+/* JSON Pointer (RFC 6901)
+ */
+namespace cee {
+  namespace json {
+    namespace pointer {
+/*
+ * the key under which the compiled pointers are cached in a state
+ */
+static char * cache_key = "cee.json.pointers";
+/*
+ * the cache drops the pointers nothing else holds when it has this
+ * many, so that a program looking up ever new paths does not keep them
+ * all
+ */
+enum { max_cached = 1024 };
+static void keep_held(void * cxt, void * key, void * value)
+{
+  if (get_rc(value) > 1)
+    map::add((map::data *)cxt, key, value);
+}
+/*
+ * "0" or a decimal number without leading zeros, -1 otherwise
+ */
+static intptr_t to_index(char * s)
+{
+  if (s[0] == '0')
+    return s[1] == '\0' ? 0 : -1;
+  intptr_t v = 0;
+  char * p;
+  for (p = s; *p; p++) {
+    if (*p < '0' || '9' < *p)
+      return -1;
+    int d = *p - '0';
+    if (v > (INTPTR_MAX - d) / 10)
+      return -1;
+    v = v * 10 + d;
+  }
+  return p == s ? -1 : v;
+}
+static pointer::data * mk(state::data * st, char * path)
+{
+  uintptr_t n = 0;
+  char * p;
+  if (path[0] != '\0' && path[0] != '/')
+    return NULL;
+  for (p = path; *p; p++)
+    if (*p == '/')
+      n++;
+  /*
+   * one block holds the tokens followed by their unescaped keys,
+   * unescaping never makes a key longer than it is in the path
+   */
+  size_t head = sizeof(pointer::data) + n * sizeof(struct token);
+  pointer::data * ptr = (pointer::data *)block::mk(st, head + strlen(path) + 1);
+  char * out = (char *)ptr + head;
+  ptr->size = n;
+  uintptr_t i = 0;
+  for (p = path; *p; ) {
+    struct token * tok = ptr->_ + i++;
+    tok->key = out;
+    for (p++; *p && *p != '/'; p++) {
+      if (*p == '~') {
+        p++;
+        if (*p == '0')
+          *out++ = '~';
+        else if (*p == '1')
+          *out++ = '/';
+        else {
+          del(ptr);
+          return NULL;
+        }
+      }
+      else
+        *out++ = *p;
+    }
+    *out++ = '\0';
+    tok->index = to_index(tok->key);
+  }
+  return ptr;
+}
+pointer::data * compile(state::data * st, char * path)
+{
+  map::data * cache = (map::data *)state::get_context(st, cache_key);
+  if (cache == NULL || (map::size(cache) >= max_cached && map::find(cache, path) == NULL)) {
+    map::data * held = map::mk(st, (cmp_fun)strcmp);
+    if (cache) {
+      map::walk(cache, held, keep_held);
+      state::remove_context(st, cache_key);
+    }
+    cache = held;
+    state::add_context(st, (char *)str::mk(st, "%s", cache_key), cache);
+  }
+  pointer::data * ptr = (pointer::data *)map::find(cache, path);
+  if (ptr)
+    return ptr;
+  ptr = mk(st, path);
+  if (ptr)
+    map::add(cache, str::mk(st, "%s", path), ptr);
+  return ptr;
+}
+json::data * eval(pointer::data * ptr, json::data * j)
+{
+  return eval_e(ptr, j, ptr->size);
+}
+json::data * eval_e(pointer::data * ptr, json::data * j, uintptr_t n)
+{
+  uintptr_t i;
+  for (i = 0; j && i < n; i++) {
+    struct token * tok = ptr->_ + i;
+    switch (j->t) {
+      case type_is_object:
+        j = (json::data *)map::find(j->value.object, tok->key);
+        break;
+      case type_is_array:
+        if (tok->index < 0 || (uintptr_t)tok->index >= list::size(j->value.array))
+          return NULL;
+        j = (json::data *)j->value.array->_[tok->index];
+        break;
+      default:
+        return NULL;
+    }
+  }
+  return j;
+}
+    }
+json::data * find(state::data * st, json::data * j, char * path)
+{
+  pointer::data * ptr = pointer::compile(st, path);
+  if (ptr == NULL)
+    return NULL;
+  return pointer::eval(ptr, j);
+}
+json::data * get(state::data * st, json::data * j, char * path, json::data * def)
+{
+  json::data * v = find(st, j, path);
+  return v ? v : def;
+}
+  }
+}
+/* On demand JSON access
+ */
+namespace cee {
+  namespace json {
+    namespace ondemand {
+static void load(struct document * d, struct tokenizer * t)
+{
+  t->buf = d->buf;
+  t->buf_end = d->buf_end;
+  t->line = d->line;
+  t->str = NULL;
+  t->utf8_checked = false;
+  t->stats = NULL;
+}
+static void store(struct tokenizer * t, struct document * d)
+{
+  d->buf = t->buf;
+  d->line = t->line;
+}
+static bool fail(struct document * d)
+{
+  d->error = true;
+  return false;
+}
+/*
+ * bring the document to the given container depth with no value pending,
+ * whatever is left of deeper containers is skipped
+ */
+static bool seek(struct document * d, int depth)
+{
+  struct tokenizer t;
+  load(d, &t);
+  while (!d->error && (d->depth > depth || (d->depth == depth && d->at_value))) {
+    if (d->at_value) {
+      if (!skip_value(&t))
+        d->error = true;
+      d->at_value = false;
+    }
+    else {
+      if (!skip_container(&t, d->open[d->depth - 1]))
+        d->error = true;
+      d->depth--;
+    }
+  }
+  store(&t, d);
+  return !d->error && d->depth == depth;
+}
+/*
+ * true if v is the value the document is positioned at
+ */
+static bool current(struct value v)
+{
+  struct document * d = v.doc;
+  return !d->error && d->at_value && d->depth == v.depth;
+}
+/*
+ * consume the current value as a single token, st is only used for
+ * strings
+ */
+static int scalar(state::data * st, struct value v, struct tokenizer * t)
+{
+  struct document * d = v.doc;
+  if (!current(v))
+    return tock_err;
+  load(d, t);
+  int c = next_token(st, t);
+  if (c == tock_err || c == tock_eof || c < tock_eof)
+    fail(d);
+  else {
+    store(t, d);
+    d->at_value = false;
+  }
+  return c;
+}
+struct value init(struct document * d, char * buf, uintptr_t len)
+{
+  d->buf = buf;
+  d->buf_end = buf + len;
+  d->line = 0;
+  d->depth = 0;
+  d->at_value = true;
+  d->error = false;
+  struct value v = { d, 0 };
+  return v;
+}
+enum type type_of(struct value v)
+{
+  struct tokenizer t;
+  if (!current(v))
+    return type_is_undefined;
+  load(v.doc, &t);
+  int c = skip_space(&t);
+  store(&t, v.doc);
+  switch (c) {
+    case '{':
+      return type_is_object;
+    case '[':
+      return type_is_array;
+    case '"':
+      return type_is_string;
+    case 't':
+    case 'f':
+      return type_is_boolean;
+    case 'n':
+      return type_is_null;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return type_is_number;
+    default:
+      return type_is_undefined;
+  }
+}
+static bool enter(struct value v, char open)
+{
+  struct tokenizer t;
+  struct document * d = v.doc;
+  if (!current(v))
+    return false;
+  load(d, &t);
+  if (skip_space(&t) != open || d->depth == MAX_JSON_DEPTH)
+    return fail(d);
+  t.buf++;
+  store(&t, d);
+  d->at_value = false;
+  d->open[d->depth++] = open;
+  return true;
+}
+bool get_object(struct value v, struct object * o)
+{
+  if (!enter(v, '{'))
+    return false;
+  o->doc = v.doc;
+  o->depth = v.doc->depth;
+  o->first = true;
+  return true;
+}
+bool get_array(struct value v, struct array * a)
+{
+  if (!enter(v, '['))
+    return false;
+  a->doc = v.doc;
+  a->depth = v.doc->depth;
+  a->first = true;
+  return true;
+}
+bool find_field(struct object * o, char * key, struct value * out)
+{
+  struct document * d = o->doc;
+  struct tokenizer t;
+  char * begin, * end;
+  if (!seek(d, o->depth))
+    return false;
+  load(d, &t);
+  for (;;) {
+    int c = skip_space(&t);
+    if (c == '}') {
+      t.buf++;
+      store(&t, d);
+      d->depth--;
+      return false;
+    }
+    if (!o->first) {
+      if (c != ',')
+        break;
+      t.buf++;
+      c = skip_space(&t);
+    }
+    o->first = false;
+    if (c != '"' || !scan_string(&t, &begin, &end) || skip_space(&t) != ':')
+      break;
+    t.buf++;
+    if (string_equals(begin, end, key)) {
+      store(&t, d);
+      d->at_value = true;
+      out->doc = d;
+      out->depth = o->depth;
+      return true;
+    }
+    if (!skip_value(&t))
+      break;
+  }
+  store(&t, d);
+  return fail(d);
+}
+bool next_element(struct array * a, struct value * out)
+{
+  struct document * d = a->doc;
+  struct tokenizer t;
+  if (!seek(d, a->depth))
+    return false;
+  load(d, &t);
+  int c = skip_space(&t);
+  if (c == ']') {
+    t.buf++;
+    store(&t, d);
+    d->depth--;
+    return false;
+  }
+  if (!a->first) {
+    if (c != ',') {
+      store(&t, d);
+      return fail(d);
+    }
+    t.buf++;
+  }
+  a->first = false;
+  store(&t, d);
+  d->at_value = true;
+  out->doc = d;
+  out->depth = a->depth;
+  return true;
+}
+bool get_string(state::data * st, struct value v, str::data ** s)
+{
+  struct tokenizer t;
+  t.str = NULL; // scalar does not load t for a value already consumed
+  int c = scalar(st, v, &t);
+  if (c != tock_str) {
+    if (t.str)
+      del(t.str);
+    return fail(v.doc);
+  }
+  *s = t.str;
+  return true;
+}
+bool get_number(struct value v, double * d)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_number || scalar(NULL, v, &t) != tock_number)
+    return fail(v.doc);
+  *d = t.real;
+  return true;
+}
+bool get_bool(struct value v, bool * b)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_boolean)
+    return fail(v.doc);
+  switch (scalar(NULL, v, &t)) {
+    case tock_true:
+      *b = true;
+      return true;
+    case tock_false:
+      *b = false;
+      return true;
+    default:
+      return fail(v.doc);
+  }
+}
+bool is_null(struct value v)
+{
+  struct tokenizer t;
+  if (type_of(v) != type_is_null)
+    return false;
+  return scalar(NULL, v, &t) == tock_null;
+}
+bool materialize(state::data * st, struct value v, json::data ** out)
+{
+  struct tokenizer t;
+  struct document * d = v.doc;
+  int line;
+  if (!current(v))
+    return false;
+  load(d, &t);
+  skip_space(&t);
+  char * begin = t.buf;
+  if (!skip_value(&t))
+    return fail(d);
+  if (!parse(st, begin, t.buf - begin, out, true, &line))
+    return fail(d);
+  store(&t, d);
+  d->at_value = false;
+  return true;
+}
+    }
+  }
+}
+/* Field masks for projection parsing
+ */
+namespace cee {
+  namespace json {
+    namespace projection {
+/*
+ * count the steps of a path, -1 if it is malformed
+ */
+static intptr_t count_steps(char * p)
+{
+  intptr_t n = 0;
+  if (*p == '\0')
+    return 0;
+  for (;;) {
+    if (*p == '[') {
+      if (n == 0)
+        return -1;
+      p++;
+      if (*p == '*')
+        p++;
+      else if ('0' <= *p && *p <= '9')
+        while ('0' <= *p && *p <= '9')
+          p++;
+      else
+        return -1;
+      if (*p++ != ']')
+        return -1;
+    }
+    else {
+      char * begin = p;
+      while (*p && *p != '.' && *p != '[')
+        p++;
+      if (p == begin)
+        return -1;
+    }
+    n++;
+    if (*p == '\0')
+      return n;
+    if (*p == '.') {
+      p++;
+      if (*p == '\0' || *p == '.' || *p == '[')
+        return -1;
+    }
+    else if (*p != '[')
+      return -1;
+  }
+}
+projection::data * mk(state::data * st, size_t n, char ** paths)
+{
+  size_t i, steps = 0, chars = 0;
+  if (n == 0 || n > MAX_JSON_PROJECTION)
+    return NULL;
+  for (i = 0; i < n; i++) {
+    intptr_t k = count_steps(paths[i]);
+    if (k < 0)
+      return NULL;
+    steps += k;
+    chars += strlen(paths[i]) + k;
+  }
+  /*
+   * one block holds the paths, their steps and the field names
+   */
+  size_t paths_size = sizeof(projection::data) + n * sizeof(struct path);
+  size_t steps_size = steps * sizeof(struct step);
+  projection::data * proj =
+    (projection::data *)block::mk(st, paths_size + steps_size + chars);
+  struct step * step = (struct step *)((char *)proj + paths_size);
+  char * out = (char *)proj + paths_size + steps_size;
+  proj->size = n;
+  for (i = 0; i < n; i++) {
+    char * p = paths[i];
+    proj->_[i].steps = step;
+    proj->_[i].size = count_steps(p);
+    while (*p) {
+      if (*p == '[') {
+        step->key = NULL;
+        if (p[1] == '*') {
+          step->index = -1;
+          p += 3;
+        }
+        else {
+          step->index = strtol(p + 1, &p, 10);
+          p++;
+        }
+      }
+      else {
+        step->key = out;
+        step->index = -1;
+        while (*p && *p != '.' && *p != '[')
+          *out++ = *p++;
+        *out++ = '\0';
+      }
+      step++;
+      if (*p == '.')
+        p++;
+    }
+  }
+  return proj;
+}
+    }
+  }
+}
+/* Validate-only mode
+ */
+namespace cee {
+  namespace json {
+/*
+ * scan a string, the input has been checked for UTF-8 already. Like
+ * parse_string, a \u escape of a surrogate is refused.
+ */
+static bool check_string(struct tokenizer * t)
+{
+  char * begin, * end, * p;
+  if (!scan_string(t, &begin, &end))
+    return false;
+  for (p = begin; p < end; p++) {
+    if (*p != '\\')
+      continue;
+    if (*++p != 'u')
+      continue;
+    unsigned x = 0;
+    int i;
+    for (i = 1; i < 5; i++)
+      x = x * 16 + (p[i] <= '9' ? p[i] - '0' : (p[i] | 0x20) - 'a' + 10);
+    if (0xD800 <= x && x <= 0xDFFF) {
+      t->buf = p - 1;
+      return false;
+    }
+    p += 4;
+  }
+  return true;
+}
+static bool check_literal(struct tokenizer * t, char * s, size_t n)
+{
+  if ((size_t)(t->buf_end - t->buf) < n || memcmp(t->buf, s, n))
+    return false;
+  t->buf += n;
+  return true;
+}
+/*
+ * the same states as parse_e, each one only moves over the input.
+ * The kind of each open container is kept in a byte array, nothing is
+ * decoded or allocated. Separators are stricter than in parse, a comma
+ * before a closing bracket is an error. UTF-8 is checked for the whole
+ * input before, the first error in the text is reported.
+ */
+bool validate(char * buf, uintptr_t len, uintptr_t * error_at, int * error_at_line)
+{
+  struct tokenizer tock = {};
+  tock.buf = buf;
+  tock.buf_end = buf + len;
+  char frames[MAX_JSON_DEPTH]; // '[' or '{', the closing bracket is 2 above
+  int depth = 0;
+  int c;
+  char * bad = utf8_scan(buf, tock.buf_end);
+st_value_expected:
+  switch (skip_space(&tock)) {
+    case '[':
+    case '{':
+      if (depth == MAX_JSON_DEPTH)
+        goto st_error;
+      c = *tock.buf++;
+      frames[depth++] = c;
+      if (skip_space(&tock) == c + 2) {
+        tock.buf++;
+        goto st_close;
+      }
+      if (c == '[')
+        goto st_value_expected;
+      goto st_key_expected;
+    case '"':
+      if (!check_string(&tock))
+        goto st_error;
+      break;
+    case 't':
+      if (!check_literal(&tock, "true", 4))
+        goto st_error;
+      break;
+    case 'f':
+      if (!check_literal(&tock, "false", 5))
+        goto st_error;
+      break;
+    case 'n':
+      if (!check_literal(&tock, "null", 4))
+        goto st_error;
+      break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      if (!scan_number(&tock))
+        goto st_error;
+      break;
+    default:
+      goto st_error;
+  }
+  goto st_close_or_comma_expected;
+st_key_expected:
+  if (skip_space(&tock) != '"' || !check_string(&tock))
+    goto st_error;
+  if (skip_space(&tock) != ':')
+    goto st_error;
+  tock.buf++;
+  goto st_value_expected;
+st_close:
+  depth--;
+st_close_or_comma_expected:
+  if (depth == 0)
+    goto st_done;
+  c = skip_space(&tock);
+  if (c == ',') {
+    tock.buf++;
+    if (frames[depth-1] == '{')
+      goto st_key_expected;
+    goto st_value_expected;
+  }
+  if (c == frames[depth-1] + 2) {
+    tock.buf++;
+    goto st_close;
+  }
+  goto st_error;
+st_done:
+  skip_space(&tock);
+  if (tock.buf != tock.buf_end)
+    goto st_error;
+  if (bad != tock.buf_end)
+    goto st_bad_utf8;
+  return true;
+st_error:
+  if (bad < tock.buf)
+    goto st_bad_utf8;
+  *error_at = tock.buf - buf;
+  *error_at_line = tock.line;
+  return false;
+st_bad_utf8:
+  *error_at = bad - buf;
+  *error_at_line = count_lines(buf, bad);
+  return false;
+}
+  }
+}
+/* JSONPath queries
+ */
+namespace cee {
+  namespace json {
+    namespace jsonpath {
+enum expr_op {
+  op_or,
+  op_and,
+  op_not,
+  op_eq,
+  op_ne,
+  op_lt,
+  op_le,
+  op_gt,
+  op_ge,
+  op_path, // a path from @ or $, true if it selects a value
+  op_literal
+};
+struct expr {
+  enum expr_op op;
+  struct expr * left;
+  struct expr * right;
+  /*
+   * op_path
+   */
+  bool absolute;
+  uintptr_t size;
+  struct pointer::token * path;
+  /*
+   * op_literal
+   */
+  enum type t;
+  double number;
+  char * string;
+};
+/*
+ * the parts of a plan are carved out of one block, a query never
+ * needs more of them than it has characters
+ */
+struct compiler {
+  char * p;
+  struct step * steps;
+  struct expr * exprs;
+  struct pointer::token * tokens;
+  char * chars;
+};
+static void skip_blank(struct compiler * c)
+{
+  while (*c->p == ' ' || *c->p == '\t')
+    c->p++;
+}
+static bool is_name_char(char ch)
+{
+  return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z')
+    || ('0' <= ch && ch <= '9') || ch == '_' || ch == '-'
+    || (unsigned char)ch >= 0x80;
+}
+static char * read_name(struct compiler * c)
+{
+  char * out = c->chars;
+  if (!is_name_char(*c->p))
+    return NULL;
+  while (is_name_char(*c->p))
+    *c->chars++ = *c->p++;
+  *c->chars++ = '\0';
+  return out;
+}
+/*
+ * a name in single or double quotes, \ escapes the next character
+ */
+static char * read_quoted(struct compiler * c)
+{
+  char quote = *c->p++;
+  char * out = c->chars;
+  while (*c->p != quote) {
+    if (*c->p == '\0')
+      return NULL;
+    if (*c->p == '\\' && c->p[1])
+      c->p++;
+    *c->chars++ = *c->p++;
+  }
+  c->p++;
+  *c->chars++ = '\0';
+  return out;
+}
+static bool read_int(struct compiler * c, intptr_t * v)
+{
+  char * end;
+  skip_blank(c);
+  if (!(*c->p == '-' || ('0' <= *c->p && *c->p <= '9')))
+    return false;
+  *v = strtol(c->p, &end, 10);
+  if (end == c->p || (*c->p == '-' && end == c->p + 1))
+    return false;
+  c->p = end;
+  skip_blank(c);
+  return true;
+}
+static struct expr * parse_or(struct compiler * c);
+/*
+ * the steps after @ or $ in a filter, only names and indices
+ */
+static struct expr * parse_path(struct compiler * c)
+{
+  struct expr * e = c->exprs++;
+  e->op = op_path;
+  e->absolute = (*c->p++ == '$');
+  e->path = c->tokens;
+  e->size = 0;
+  for (;;) {
+    struct pointer::token * tok = c->tokens;
+    if (*c->p == '.') {
+      c->p++;
+      if (!(tok->key = read_name(c)))
+        return NULL;
+      tok->index = -1;
+    }
+    else if (*c->p == '[') {
+      c->p++;
+      skip_blank(c);
+      if (*c->p == '\'' || *c->p == '"') {
+        if (!(tok->key = read_quoted(c)))
+          return NULL;
+        tok->index = -1;
+        skip_blank(c);
+      }
+      else {
+        tok->key = NULL;
+        if (!read_int(c, &tok->index))
+          return NULL;
+      }
+      if (*c->p++ != ']')
+        return NULL;
+    }
+    else
+      return e;
+    c->tokens++;
+    e->size++;
+  }
+}
+static struct expr * parse_operand(struct compiler * c)
+{
+  struct expr * e;
+  char * end;
+  skip_blank(c);
+  switch (*c->p) {
+    case '@':
+    case '$':
+      e = parse_path(c);
+      break;
+    case '\'':
+    case '"':
+      e = c->exprs++;
+      e->op = op_literal;
+      e->t = type_is_string;
+      if (!(e->string = read_quoted(c)))
+        return NULL;
+      break;
+    default:
+      e = c->exprs++;
+      e->op = op_literal;
+      if (!strncmp(c->p, "true", 4) || !strncmp(c->p, "false", 5)) {
+        e->t = type_is_boolean;
+        e->number = (*c->p == 't');
+        c->p += (*c->p == 't') ? 4 : 5;
+      }
+      else if (!strncmp(c->p, "null", 4)) {
+        e->t = type_is_null;
+        c->p += 4;
+      }
+      else {
+        e->t = type_is_number;
+        e->number = strtod(c->p, &end);
+        if (end == c->p)
+          return NULL;
+        c->p = end;
+      }
+      break;
+  }
+  skip_blank(c);
+  return e;
+}
+static struct expr * parse_comparison(struct compiler * c)
+{
+  struct expr * left = parse_operand(c), * e;
+  enum expr_op op;
+  if (left == NULL)
+    return NULL;
+  char * p = c->p;
+  if (p[0] == '=' && p[1] == '=')
+    op = op_eq;
+  else if (p[0] == '!' && p[1] == '=')
+    op = op_ne;
+  else if (p[0] == '<')
+    op = p[1] == '=' ? op_le : op_lt;
+  else if (p[0] == '>')
+    op = p[1] == '=' ? op_ge : op_gt;
+  else
+    return left;
+  c->p += (op == op_lt || op == op_gt) ? 1 : 2;
+  e = c->exprs++;
+  e->op = op;
+  e->left = left;
+  if (!(e->right = parse_operand(c)))
+    return NULL;
+  return e;
+}
+static struct expr * parse_unary(struct compiler * c)
+{
+  struct expr * e;
+  skip_blank(c);
+  if (*c->p == '!') {
+    c->p++;
+    e = c->exprs++;
+    e->op = op_not;
+    if (!(e->left = parse_unary(c)))
+      return NULL;
+    return e;
+  }
+  if (*c->p == '(') {
+    c->p++;
+    e = parse_or(c);
+    if (e == NULL || *c->p++ != ')')
+      return NULL;
+    skip_blank(c);
+    return e;
+  }
+  return parse_comparison(c);
+}
+static struct expr * parse_and(struct compiler * c)
+{
+  struct expr * left = parse_unary(c), * e;
+  while (left && c->p[0] == '&' && c->p[1] == '&') {
+    c->p += 2;
+    e = c->exprs++;
+    e->op = op_and;
+    e->left = left;
+    if (!(e->right = parse_unary(c)))
+      return NULL;
+    left = e;
+  }
+  return left;
+}
+static struct expr * parse_or(struct compiler * c)
+{
+  struct expr * left = parse_and(c), * e;
+  while (left && c->p[0] == '|' && c->p[1] == '|') {
+    c->p += 2;
+    e = c->exprs++;
+    e->op = op_or;
+    e->left = left;
+    if (!(e->right = parse_and(c)))
+      return NULL;
+    left = e;
+  }
+  return left;
+}
+/*
+ * the inside of [ ]: a quoted name, *, an index, a slice or a filter
+ */
+static bool parse_bracket(struct compiler * c, struct step * s)
+{
+  skip_blank(c);
+  if (*c->p == '\'' || *c->p == '"') {
+    s->kind = sel_name;
+    if (!(s->name = read_quoted(c)))
+      return false;
+  }
+  else if (*c->p == '*') {
+    s->kind = sel_wildcard;
+    c->p++;
+  }
+  else if (*c->p == '?') {
+    c->p++;
+    skip_blank(c);
+    if (*c->p++ != '(')
+      return false;
+    s->kind = sel_filter;
+    if (!(s->filter = parse_or(c)) || *c->p++ != ')')
+      return false;
+  }
+  else {
+    intptr_t * bounds[3] = { &s->start, &s->end, &s->step };
+    bool given[3] = { false, false, false };
+    int i;
+    for (i = 0; i < 3; i++) {
+      given[i] = read_int(c, bounds[i]);
+      if (*c->p != ':')
+        break;
+      c->p++;
+    }
+    if (i == 3)
+      return false;
+    if (i == 0) {
+      s->kind = sel_index;
+      if (!given[0])
+        return false;
+    }
+    else {
+      s->kind = sel_slice;
+      s->has_start = given[0];
+      s->has_end = given[1];
+      if (!given[2])
+        s->step = 1;
+    }
+  }
+  skip_blank(c);
+  return *c->p++ == ']';
+}
+jsonpath::data * compile(state::data * st, char * query)
+{
+  size_t n = strlen(query) + 1;
+  size_t head = sizeof(jsonpath::data);
+  size_t steps_size = n * sizeof(struct step);
+  size_t exprs_size = n * sizeof(struct expr);
+  size_t tokens_size = n * sizeof(struct pointer::token);
+  jsonpath::data * plan =
+    (jsonpath::data *)block::mk(st, head + steps_size + exprs_size
+                                     + tokens_size + 2 * n);
+  struct compiler c;
+  char * mem = (char *)plan;
+  memset(mem, 0, head + steps_size + exprs_size + tokens_size);
+  c.p = query;
+  c.steps = plan->steps = (struct step *)(mem + head);
+  c.exprs = (struct expr *)(mem + head + steps_size);
+  c.tokens = (struct pointer::token *)(mem + head + steps_size + exprs_size);
+  c.chars = mem + head + steps_size + exprs_size + tokens_size;
+  plan->size = 0;
+  skip_blank(&c);
+  if (*c.p++ != '$')
+    goto error;
+  for (;;) {
+    skip_blank(&c);
+    if (*c.p == '\0')
+      return plan;
+    struct step * s = c.steps++;
+    plan->size++;
+    if (c.p[0] == '.' && c.p[1] == '.') {
+      s->descendant = true;
+      c.p += 2;
+      if (*c.p == '[') {
+        c.p++;
+        if (!parse_bracket(&c, s))
+          goto error;
+        continue;
+      }
+    }
+    else if (*c.p == '.')
+      c.p++;
+    else if (*c.p == '[') {
+      c.p++;
+      if (!parse_bracket(&c, s))
+        goto error;
+      continue;
+    }
+    else
+      goto error;
+    if (*c.p == '*') {
+      s->kind = sel_wildcard;
+      c.p++;
+    }
+    else {
+      s->kind = sel_name;
+      if (!(s->name = read_name(&c)))
+        goto error;
+    }
+  }
+error:
+  del(plan);
+  return NULL;
+}
+/*
+ * the state of one evaluation, the plan itself is never written
+ */
+struct run {
+  jsonpath::data * plan;
+  json::data * root;
+  list::data * results;
+};
+struct visit {
+  struct run * r;
+  uintptr_t i;
+};
+static void apply(struct run * r, uintptr_t i, json::data * j);
+static void descend(struct run * r, uintptr_t i, json::data * j);
+static json::data * resolve(struct expr * e, json::data * root, json::data * j)
+{
+  uintptr_t i;
+  if (e->absolute)
+    j = root;
+  for (i = 0; j && i < e->size; i++) {
+    struct pointer::token * tok = e->path + i;
+    if (tok->key) {
+      if (j->t != type_is_object)
+        return NULL;
+      j = (json::data *)map::find(j->value.object, tok->key);
+    }
+    else {
+      intptr_t n, k = tok->index;
+      if (j->t != type_is_array)
+        return NULL;
+      n = list::size(j->value.array);
+      if (k < 0)
+        k += n;
+      if (k < 0 || k >= n)
+        return NULL;
+      j = (json::data *)j->value.array->_[k];
+    }
+  }
+  return j;
+}
+/*
+ * a scalar value of a comparison
+ */
+struct scalar {
+  enum type t;
+  double number;
+  char * string;
+};
+static bool operand(struct expr * e, json::data * root, json::data * j,
+                    struct scalar * v)
+{
+  if (e->op == op_literal) {
+    v->t = e->t;
+    v->number = e->number;
+    v->string = e->string;
+    return true;
+  }
+  j = resolve(e, root, j);
+  if (j == NULL)
+    return false;
+  v->t = j->t;
+  switch (j->t) {
+    case type_is_number:
+      v->number = to_double(j);
+      break;
+    case type_is_boolean:
+      v->number = to_bool(j);
+      break;
+    case type_is_string:
+      v->string = (char *)j->value.string;
+      break;
+    case type_is_null:
+      break;
+    default:
+      /*
+       * containers are compared by identity
+       */
+      v->string = (char *)j;
+      break;
+  }
+  return true;
+}
+static bool compare(struct expr * e, json::data * root, json::data * j)
+{
+  struct scalar a, b;
+  int c;
+  if (!operand(e->left, root, j, &a) || !operand(e->right, root, j, &b))
+    return e->op == op_ne;
+  if (a.t != b.t)
+    return e->op == op_ne;
+  switch (a.t) {
+    case type_is_number:
+    case type_is_boolean:
+      c = (a.number > b.number) - (a.number < b.number);
+      break;
+    case type_is_string:
+      c = strcmp(a.string, b.string);
+      break;
+    case type_is_null:
+      c = 0;
+      break;
+    default:
+      if (e->op != op_eq && e->op != op_ne)
+        return false;
+      c = (a.string != b.string);
+      break;
+  }
+  if (a.t == type_is_boolean || a.t == type_is_null)
+    if (e->op != op_eq && e->op != op_ne)
+      return false;
+  switch (e->op) {
+    case op_eq: return c == 0;
+    case op_ne: return c != 0;
+    case op_lt: return c < 0;
+    case op_le: return c <= 0;
+    case op_gt: return c > 0;
+    default: return c >= 0;
+  }
+}
+static bool matches(struct expr * e, json::data * root, json::data * j)
+{
+  switch (e->op) {
+    case op_or:
+      return matches(e->left, root, j) || matches(e->right, root, j);
+    case op_and:
+      return matches(e->left, root, j) && matches(e->right, root, j);
+    case op_not:
+      return !matches(e->left, root, j);
+    case op_path:
+      return resolve(e, root, j) != NULL;
+    case op_literal:
+      return e->t == type_is_boolean ? e->number != 0 : e->t != type_is_null;
+    default:
+      return compare(e, root, j);
+  }
+}
+/*
+ * member callbacks of map::walk
+ */
+static void apply_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  apply(v->r, v->i + 1, (json::data *)value);
+}
+static void filter_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  struct step * s = v->r->plan->steps + v->i;
+  if (matches(s->filter, v->r->root, (json::data *)value))
+    apply(v->r, v->i + 1, (json::data *)value);
+}
+static void descend_member(void * cxt, void *, void * value)
+{
+  struct visit * v = (struct visit *)cxt;
+  descend(v->r, v->i, (json::data *)value);
+}
+/*
+ * python like slice bounds
+ */
+static intptr_t clamp(intptr_t k, intptr_t n, intptr_t lo, intptr_t hi)
+{
+  if (k < 0)
+    k += n;
+  return k < lo ? lo : (k > hi ? hi : k);
+}
+/*
+ * apply the selector of step i to j and go on with the selected nodes
+ */
+static void select_step(struct run * r, uintptr_t i, json::data * j)
+{
+  struct step * s = r->plan->steps + i;
+  struct visit v = { r, i };
+  json::data * child;
+  intptr_t n, k, start, end;
+  if (j->t == type_is_object) {
+    switch (s->kind) {
+      case sel_name:
+        child = (json::data *)map::find(j->value.object, s->name);
+        if (child)
+          apply(r, i + 1, child);
+        break;
+      case sel_wildcard:
+        map::walk(j->value.object, &v, apply_member);
+        break;
+      case sel_filter:
+        map::walk(j->value.object, &v, filter_member);
+        break;
+      default:
+        break;
+    }
+    return;
+  }
+  if (j->t != type_is_array)
+    return;
+  n = list::size(j->value.array);
+  switch (s->kind) {
+    case sel_wildcard:
+      for (k = 0; k < n; k++)
+        apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      break;
+    case sel_filter:
+      for (k = 0; k < n; k++) {
+        child = (json::data *)j->value.array->_[k];
+        if (matches(s->filter, r->root, child))
+          apply(r, i + 1, child);
+      }
+      break;
+    case sel_index:
+      k = s->start < 0 ? s->start + n : s->start;
+      if (0 <= k && k < n)
+        apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      break;
+    case sel_slice:
+      if (s->step > 0) {
+        start = s->has_start ? clamp(s->start, n, 0, n) : 0;
+        end = s->has_end ? clamp(s->end, n, 0, n) : n;
+        for (k = start; k < end; k += s->step)
+          apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      }
+      else if (s->step < 0) {
+        start = s->has_start ? clamp(s->start, n, -1, n - 1) : n - 1;
+        end = s->has_end ? clamp(s->end, n, -1, n - 1) : -1;
+        for (k = start; k > end; k += s->step)
+          apply(r, i + 1, (json::data *)j->value.array->_[k]);
+      }
+      break;
+    default:
+      break;
+  }
+}
+/*
+ * apply the selector of step i to j and all of its descendants
+ */
+static void descend(struct run * r, uintptr_t i, json::data * j)
+{
+  struct visit v = { r, i };
+  intptr_t k, n;
+  select_step(r, i, j);
+  if (j->t == type_is_object)
+    map::walk(j->value.object, &v, descend_member);
+  else if (j->t == type_is_array) {
+    n = list::size(j->value.array);
+    for (k = 0; k < n; k++)
+      descend(r, i, (json::data *)j->value.array->_[k]);
+  }
+}
+static void apply(struct run * r, uintptr_t i, json::data * j)
+{
+  if (i == r->plan->size)
+    list::append(&r->results, j);
+  else if (r->plan->steps[i].descendant)
+    descend(r, i, j);
+  else
+    select_step(r, i, j);
+}
+list::data * eval(state::data * st, jsonpath::data * plan, json::data * j)
+{
+  struct run r = { plan, j, list::mk_e(st, dp_noop, 8) };
+  apply(&r, 0, j);
+  return r.results;
+}
+    }
+  }
+}
+/* A growable output buffer
+ */
+namespace cee {
+  namespace json {
+void buffer_init(struct buffer * b, state::data * st, uintptr_t capacity)
+{
+  b->st = st;
+  b->_ = (char *)block::mk(st, capacity);
+  b->size = 0;
+  b->capacity = capacity;
+}
+char * buffer_reserve(struct buffer * b, uintptr_t n)
+{
+  if (b->size + n > b->capacity) {
+    uintptr_t capacity = b->capacity * 2;
+    if (capacity < b->size + n)
+      capacity = b->size + n;
+    char * p = (char *)block::mk(b->st, capacity);
+    memcpy(p, b->_, b->size);
+    del(b->_);
+    b->_ = p;
+    b->capacity = capacity;
+  }
+  char * p = b->_ + b->size;
+  b->size += n;
+  return p;
+}
+void buffer_put(struct buffer * b, void * p, uintptr_t n)
+{
+  memcpy(buffer_reserve(b, n), p, n);
+}
+void buffer_put_byte(struct buffer * b, uint8_t c)
+{
+  if (b->size < b->capacity)
+    b->_[b->size++] = c;
+  else
+    *buffer_reserve(b, 1) = c;
+}
+void buffer_put_be(struct buffer * b, uint64_t v, int n)
+{
+  char * p = buffer_reserve(b, n);
+  int i;
+  for (i = n - 1; i >= 0; i--) {
+    p[i] = (char)v;
+    v >>= 8;
+  }
+}
+  }
+}
+/* MessagePack encoding
+ */
+namespace cee {
+  namespace json {
+    namespace msgpack {
+/*
+ * undefined has no MessagePack type, it is written as a fixext 1 of
+ * the application type 0
+ */
+static void encode_uint(struct buffer * b, uint64_t v)
+{
+  if (v < 0x80)
+    buffer_put_byte(b, v);
+  else if (v <= 0xFF) {
+    buffer_put_byte(b, 0xcc);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v <= 0xFFFF) {
+    buffer_put_byte(b, 0xcd);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v <= 0xFFFFFFFF) {
+    buffer_put_byte(b, 0xce);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, 0xcf);
+    buffer_put_be(b, v, 8);
+  }
+}
+static void encode_int(struct buffer * b, int64_t v)
+{
+  if (v >= 0)
+    encode_uint(b, v);
+  else if (v >= -32)
+    buffer_put_byte(b, (uint8_t)v);
+  else if (v >= INT8_MIN) {
+    buffer_put_byte(b, 0xd0);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v >= INT16_MIN) {
+    buffer_put_byte(b, 0xd1);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v >= INT32_MIN) {
+    buffer_put_byte(b, 0xd2);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, 0xd3);
+    buffer_put_be(b, v, 8);
+  }
+}
+static void encode_number(struct buffer * b, boxed::data * x)
+{
+  uint64_t u64;
+  uint32_t u32;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+      memcpy(&u64, &x->_.f64, 8);
+      buffer_put_byte(b, 0xcb);
+      buffer_put_be(b, u64, 8);
+      break;
+    case boxed::primitive_f32:
+      memcpy(&u32, &x->_.f32, 4);
+      buffer_put_byte(b, 0xca);
+      buffer_put_be(b, u32, 4);
+      break;
+    case boxed::primitive_u64: encode_uint(b, x->_.u64); break;
+    case boxed::primitive_u32: encode_uint(b, x->_.u32); break;
+    case boxed::primitive_u16: encode_uint(b, x->_.u16); break;
+    case boxed::primitive_u8: encode_uint(b, x->_.u8); break;
+    case boxed::primitive_i64: encode_int(b, x->_.i64); break;
+    case boxed::primitive_i32: encode_int(b, x->_.i32); break;
+    case boxed::primitive_i16: encode_int(b, x->_.i16); break;
+    case boxed::primitive_i8: encode_int(b, x->_.i8); break;
+  }
+}
+/*
+ * the header of a str, array or map: the fix form, then 8 (str only),
+ * 16 and 32 bit lengths
+ */
+static void encode_header(struct buffer * b, uint8_t fix, uintptr_t fix_max,
+                          uint8_t first, uintptr_t n)
+{
+  if (n <= fix_max)
+    buffer_put_byte(b, fix | n);
+  else if (first == 0xd9 && n <= 0xFF) {
+    buffer_put_byte(b, 0xd9);
+    buffer_put_be(b, n, 1);
+  }
+  else if (n <= 0xFFFF) {
+    buffer_put_byte(b, first == 0xd9 ? 0xda : first);
+    buffer_put_be(b, n, 2);
+  }
+  else {
+    buffer_put_byte(b, (first == 0xd9 ? 0xda : first) + 1);
+    buffer_put_be(b, n, 4);
+  }
+}
+static void encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  encode_header(b, 0xa0, 31, 0xd9, n);
+  buffer_put(b, s, n);
+}
+static void encode(struct buffer * b, json::data * j);
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct buffer * b = (struct buffer *)cxt;
+  encode_string(b, (char *)key);
+  encode(b, (json::data *)value);
+}
+static void encode(struct buffer * b, json::data * j)
+{
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+      buffer_put_byte(b, 0xd4);
+      buffer_put_byte(b, 0);
+      buffer_put_byte(b, 0);
+      break;
+    case type_is_null:
+      buffer_put_byte(b, 0xc0);
+      break;
+    case type_is_boolean:
+      buffer_put_byte(b, to_bool(j) ? 0xc3 : 0xc2);
+      break;
+    case type_is_number:
+      encode_number(b, j->value.number);
+      break;
+    case type_is_string:
+      encode_string(b, (char *)j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      encode_header(b, 0x90, 15, 0xdc, n);
+      for (i = 0; i < n; i++)
+        encode(b, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      encode_header(b, 0x80, 15, 0xde, map::size(j->value.object));
+      map::walk(j->value.object, b, encode_member);
+      break;
+  }
+}
+struct reader {
+  state::data * st;
+  unsigned char * p;
+  unsigned char * end;
+  int depth;
+};
+static bool read_be(struct reader * r, int n, uint64_t * v)
+{
+  int i;
+  if (r->end - r->p < n)
+    return false;
+  *v = 0;
+  for (i = 0; i < n; i++)
+    *v = (*v << 8) | *r->p++;
+  return true;
+}
+static json::data * mk_boxed(state::data * st, boxed::data * x)
+{
+  return (json::data *)tagged::mk(st, type_is_number, x);
+}
+static json::data * mk_int(state::data * st, int64_t v)
+{
+  return mk_boxed(st, boxed::from_i64(st, v));
+}
+/*
+ * a string is valid UTF-8 without '\0', which would cut it short
+ */
+static str::data * read_string(struct reader * r, uint64_t n)
+{
+  char * p = (char *)r->p;
+  if ((uint64_t)(r->end - r->p) < n || utf8_scan(p, p + n) != p + n || memchr(p, '\0', n))
+    return NULL;
+  str::data * s = str::mk_e(r->st, n + 1, NULL);
+  memcpy(s->_, r->p, n);
+  s->_[n] = '\0';
+  r->p += n;
+  return s;
+}
+static bool decode(struct reader * r, json::data ** out);
+static bool decode_array(struct reader * r, uint64_t n, json::data ** out)
+{
+  uint64_t i;
+  json::data * v;
+  /*
+   * every element takes at least a byte, a bogus count cannot make
+   * the list allocate more than the input is long
+   */
+  if (n > (uint64_t)(r->end - r->p) || r->depth == MAX_JSON_DEPTH)
+    return false;
+  json::data * a = mk_array(r->st, n);
+  r->depth++;
+  for (i = 0; i < n; i++) {
+    if (!decode(r, &v)) {
+      del(a);
+      return false;
+    }
+    list::append(&a->value.array, v);
+  }
+  r->depth--;
+  *out = a;
+  return true;
+}
+static bool decode_map(struct reader * r, uint64_t n, json::data ** out)
+{
+  uint64_t i, len;
+  json::data * v;
+  str::data * key;
+  if (n > (uint64_t)(r->end - r->p) / 2 || r->depth == MAX_JSON_DEPTH)
+    return false;
+  json::data * o = mk_object(r->st);
+  r->depth++;
+  for (i = 0; i < n; i++) {
+    unsigned char c = r->p < r->end ? *r->p++ : 0xc1;
+    if ((c & 0xe0) == 0xa0)
+      len = c & 0x1f;
+    else if (c < 0xd9 || c > 0xdb || !read_be(r, 1 << (c - 0xd9), &len)) {
+      del(o);
+      return false;
+    }
+    if (!(key = read_string(r, len))) {
+      del(o);
+      return false;
+    }
+    if (!decode(r, &v)) {
+      del(key);
+      del(o);
+      return false;
+    }
+    map::add(o->value.object, key, v);
+  }
+  r->depth--;
+  *out = o;
+  return true;
+}
+static bool decode(struct reader * r, json::data ** out)
+{
+  uint64_t v;
+  str::data * s;
+  if (r->p == r->end)
+    return false;
+  unsigned char c = *r->p++;
+  if (c < 0x80) {
+    *out = mk_int(r->st, c);
+    return true;
+  }
+  if (c >= 0xe0) {
+    *out = mk_int(r->st, (int8_t)c);
+    return true;
+  }
+  switch (c & 0xf0) {
+    case 0x80:
+      return decode_map(r, c & 0x0f, out);
+    case 0x90:
+      return decode_array(r, c & 0x0f, out);
+    case 0xa0:
+    case 0xb0:
+      if (!(s = read_string(r, c & 0x1f)))
+        return false;
+      *out = mk_string(r->st, s);
+      return true;
+  }
+  switch (c) {
+    case 0xc0:
+      *out = mk_null(r->st);
+      return true;
+    case 0xc2:
+      *out = mk_false(r->st);
+      return true;
+    case 0xc3:
+      *out = mk_true(r->st);
+      return true;
+    case 0xca:
+      {
+        uint32_t u32;
+        float f;
+        if (!read_be(r, 4, &v))
+          return false;
+        u32 = v;
+        memcpy(&f, &u32, 4);
+        *out = mk_boxed(r->st, boxed::from_float(r->st, f));
+        return true;
+      }
+    case 0xcb:
+      {
+        double d;
+        if (!read_be(r, 8, &v))
+          return false;
+        memcpy(&d, &v, 8);
+        *out = mk_boxed(r->st, boxed::from_double(r->st, d));
+        return true;
+      }
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+      if (!read_be(r, 1 << (c - 0xcc), &v))
+        return false;
+      if (v > INT64_MAX)
+        *out = mk_boxed(r->st, boxed::from_u64(r->st, v));
+      else
+        *out = mk_int(r->st, v);
+      return true;
+    case 0xd0:
+      if (!read_be(r, 1, &v))
+        return false;
+      *out = mk_int(r->st, (int8_t)v);
+      return true;
+    case 0xd1:
+      if (!read_be(r, 2, &v))
+        return false;
+      *out = mk_int(r->st, (int16_t)v);
+      return true;
+    case 0xd2:
+      if (!read_be(r, 4, &v))
+        return false;
+      *out = mk_int(r->st, (int32_t)v);
+      return true;
+    case 0xd3:
+      if (!read_be(r, 8, &v))
+        return false;
+      *out = mk_int(r->st, (int64_t)v);
+      return true;
+    case 0xd4:
+      if (r->end - r->p < 2 || r->p[0] != 0)
+        return false;
+      r->p += 2;
+      *out = mk_undefined(r->st);
+      return true;
+    case 0xd9: case 0xda: case 0xdb:
+      if (!read_be(r, 1 << (c - 0xd9), &v) || !(s = read_string(r, v)))
+        return false;
+      *out = mk_string(r->st, s);
+      return true;
+    case 0xdc: case 0xdd:
+      if (!read_be(r, c == 0xdc ? 2 : 4, &v))
+        return false;
+      return decode_array(r, v, out);
+    case 0xde: case 0xdf:
+      if (!read_be(r, c == 0xde ? 2 : 4, &v))
+        return false;
+      return decode_map(r, v, out);
+    default:
+      /*
+       * bin and the other ext types have no JSON counterpart
+       */
+      return false;
+  }
+}
+    }
+block::data * to_msgpack(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 256);
+  msgpack::encode(&b, j);
+  *size = b.size;
+  return (block::data *)b._;
+}
+bool from_msgpack(state::data * st, char * buf, uintptr_t len,
+                  json::data ** out, uintptr_t * error_at)
+{
+  struct msgpack::reader r;
+  r.st = st;
+  r.p = (unsigned char *)buf;
+  r.end = r.p + len;
+  r.depth = 0;
+  *out = NULL;
+  if (msgpack::decode(&r, out) && r.p == r.end)
+    return true;
+  if (*out) {
+    del(*out);
+    *out = NULL;
+  }
+  *error_at = (char *)r.p - buf;
+  return false;
+}
+  }
+}
+/* Tree construction shared by the decoders
+ */
+namespace cee {
+  namespace json {
+void builder_init(struct builder * b)
+{
+  b->root = NULL;
+  b->key = NULL;
+  b->depth = 0;
+}
+void builder_add(struct builder * b, json::data * v)
+{
+  if (b->depth == 0) {
+    b->root = v;
+    return;
+  }
+  json::data * top = b->containers[b->depth-1];
+  if (top->t == type_is_object) {
+    map::add(top->value.object, b->key, v);
+    b->key = NULL;
+  }
+  else
+    list::append(&top->value.array, v);
+}
+bool builder_open(struct builder * b, json::data * container)
+{
+  if (b->depth == MAX_JSON_DEPTH) {
+    del(container);
+    return false;
+  }
+  builder_add(b, container);
+  b->containers[b->depth++] = container;
+  return true;
+}
+void builder_abort(struct builder * b)
+{
+  if (b->key)
+    del(b->key);
+  if (b->root)
+    del(b->root);
+  builder_init(b);
+}
+  }
+}
+/* CBOR (RFC 8949) encoding
+ */
+namespace cee {
+  namespace json {
+    namespace cbor {
+enum cbor_major {
+  major_uint = 0,
+  major_negint,
+  major_bytes,
+  major_text,
+  major_array,
+  major_map,
+  major_tag,
+  major_simple
+};
+/*
+ * the tags of positive and negative bignums, the only tags that change
+ * how the tagged item is read
+ */
+static void encode_head(struct buffer * b, int major, uint64_t v)
+{
+  uint8_t m = major << 5;
+  if (v < 24)
+    buffer_put_byte(b, m | v);
+  else if (v <= 0xFF) {
+    buffer_put_byte(b, m | 24);
+    buffer_put_be(b, v, 1);
+  }
+  else if (v <= 0xFFFF) {
+    buffer_put_byte(b, m | 25);
+    buffer_put_be(b, v, 2);
+  }
+  else if (v <= 0xFFFFFFFF) {
+    buffer_put_byte(b, m | 26);
+    buffer_put_be(b, v, 4);
+  }
+  else {
+    buffer_put_byte(b, m | 27);
+    buffer_put_be(b, v, 8);
+  }
+}
+static void encode_int(struct buffer * b, int64_t v)
+{
+  if (v >= 0)
+    encode_head(b, major_uint, v);
+  else
+    encode_head(b, major_negint, (uint64_t)-(v + 1));
+}
+static void encode_number(struct buffer * b, boxed::data * x)
+{
+  uint64_t u64;
+  uint32_t u32;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+      memcpy(&u64, &x->_.f64, 8);
+      buffer_put_byte(b, 0xfb);
+      buffer_put_be(b, u64, 8);
+      break;
+    case boxed::primitive_f32:
+      memcpy(&u32, &x->_.f32, 4);
+      buffer_put_byte(b, 0xfa);
+      buffer_put_be(b, u32, 4);
+      break;
+    case boxed::primitive_u64: encode_head(b, major_uint, x->_.u64); break;
+    case boxed::primitive_u32: encode_head(b, major_uint, x->_.u32); break;
+    case boxed::primitive_u16: encode_head(b, major_uint, x->_.u16); break;
+    case boxed::primitive_u8: encode_head(b, major_uint, x->_.u8); break;
+    case boxed::primitive_i64: encode_int(b, x->_.i64); break;
+    case boxed::primitive_i32: encode_int(b, x->_.i32); break;
+    case boxed::primitive_i16: encode_int(b, x->_.i16); break;
+    case boxed::primitive_i8: encode_int(b, x->_.i8); break;
+  }
+}
+static void encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  encode_head(b, major_text, n);
+  buffer_put(b, s, n);
+}
+static void encode(struct buffer * b, json::data * j);
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct buffer * b = (struct buffer *)cxt;
+  encode_string(b, (char *)key);
+  encode(b, (json::data *)value);
+}
+static void encode(struct buffer * b, json::data * j)
+{
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+      buffer_put_byte(b, 0xf7);
+      break;
+    case type_is_null:
+      buffer_put_byte(b, 0xf6);
+      break;
+    case type_is_boolean:
+      buffer_put_byte(b, to_bool(j) ? 0xf5 : 0xf4);
+      break;
+    case type_is_number:
+      encode_number(b, j->value.number);
+      break;
+    case type_is_string:
+      encode_string(b, (char *)j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      encode_head(b, major_array, n);
+      for (i = 0; i < n; i++)
+        encode(b, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      encode_head(b, major_map, map::size(j->value.object));
+      map::walk(j->value.object, b, encode_member);
+      break;
+  }
+}
+struct decoder {
+  state::data * st;
+  struct builder b;
+  /*
+   * the items an open container still expects, the pairs of a map,
+   * -1 if it has an indefinite length
+   */
+  int64_t remaining[MAX_JSON_DEPTH];
+  struct buffer carry; // an item that is split between chunks
+  struct buffer text; // the chunks of an indefinite length string
+  int in_string; // the major type of that string, 0 if there is none
+  uint64_t tag;
+  bool done;
+  bool error;
+  uintptr_t offset; // of the next item in the stream
+};
+decoder * mk_decoder(state::data * st)
+{
+  decoder * d = (decoder *)block::mk(st, sizeof(decoder));
+  d->st = st;
+  builder_init(&d->b);
+  buffer_init(&d->carry, st, 64);
+  buffer_init(&d->text, st, 64);
+  d->in_string = 0;
+  d->tag = 0;
+  d->done = false;
+  d->error = false;
+  d->offset = 0;
+  return d;
+}
+static int argument_size(uint8_t ib)
+{
+  switch (ib & 31) {
+    case 24: return 1;
+    case 25: return 2;
+    case 26: return 4;
+    case 27: return 8;
+    case 28: case 29: case 30:
+      return -1;
+    default:
+      return 0;
+  }
+}
+static uint64_t argument(unsigned char * p)
+{
+  int i, n = argument_size(p[0]);
+  uint64_t v = 0;
+  if (n == 0)
+    return p[0] & 31;
+  for (i = 1; i <= n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+/*
+ * the number of bytes the item at p takes, as far as the n bytes there
+ * tell, the head and the content of a definite length string.
+ * -1 if it is malformed.
+ */
+static intptr_t item_size(unsigned char * p, uintptr_t n)
+{
+  if (n == 0)
+    return 1;
+  int a = argument_size(p[0]);
+  if (a < 0)
+    return -1;
+  if (n < (uintptr_t)a + 1)
+    return a + 1;
+  int major = p[0] >> 5;
+  if ((major == major_bytes || major == major_text) && (p[0] & 31) != 31) {
+    uint64_t len = argument(p);
+    if (len > (uint64_t)INTPTR_MAX - 9)
+      return -1;
+    return a + 1 + len;
+  }
+  return a + 1;
+}
+/*
+ * a value is complete, close the containers that it completes
+ */
+static void completed(decoder * d)
+{
+  while (d->b.depth) {
+    int64_t * r = d->remaining + d->b.depth - 1;
+    if (*r < 0 || --*r > 0)
+      return;
+    builder_close(&d->b);
+  }
+  d->done = true;
+}
+static bool expects_key(decoder * d)
+{
+  json::data * top = builder_top(&d->b);
+  return top && top->t == type_is_object && d->b.key == NULL;
+}
+static bool emit(decoder * d, json::data * v)
+{
+  if (expects_key(d)) {
+    del(v);
+    return false;
+  }
+  builder_add(&d->b, v);
+  completed(d);
+  return true;
+}
+static bool emit_key_or_string(decoder * d, str::data * s)
+{
+  if (expects_key(d)) {
+    d->b.key = s;
+    return true;
+  }
+  return emit(d, mk_string(d->st, s));
+}
+static bool emit_int(decoder * d, int64_t v)
+{
+  if (expects_key(d))
+    return emit_key_or_string(d, str::mk(d->st, "%lld", (long long)v));
+  return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                           boxed::from_i64(d->st, v)));
+}
+/*
+ * a text string is valid UTF-8 without '\0', which would cut it short
+ */
+static bool emit_text(decoder * d, char * p, uintptr_t n)
+{
+  if (utf8_scan(p, p + n) != p + n || memchr(p, '\0', n))
+    return false;
+  str::data * s = str::mk_e(d->st, n + 1, NULL);
+  memcpy(s->_, p, n);
+  s->_[n] = '\0';
+  return emit_key_or_string(d, s);
+}
+/*
+ * a byte string has no JSON type, it becomes its base64url form as
+ * RFC 8949 suggests, or a number if it is tagged as a bignum
+ */
+static bool emit_bytes(decoder * d, unsigned char * p, uintptr_t n)
+{
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uintptr_t i;
+  if (d->tag == 2 || d->tag == 3) {
+    double v = 0;
+    for (i = 0; i < n; i++)
+      v = v * 256 + p[i];
+    if (d->tag == 3)
+      v = -1 - v;
+    d->tag = 0;
+    return emit(d, mk_number(d->st, v));
+  }
+  str::data * s = str::mk_e(d->st, (n + 2) / 3 * 4 + 1, NULL);
+  char * out = s->_;
+  for (i = 0; i + 2 < n; i += 3) {
+    uint32_t v = (p[i] << 16) | (p[i+1] << 8) | p[i+2];
+    *out++ = digits[v >> 18];
+    *out++ = digits[(v >> 12) & 63];
+    *out++ = digits[(v >> 6) & 63];
+    *out++ = digits[v & 63];
+  }
+  if (i < n) {
+    uint32_t v = p[i] << 16 | (i + 1 < n ? p[i+1] << 8 : 0);
+    *out++ = digits[v >> 18];
+    *out++ = digits[(v >> 12) & 63];
+    if (i + 1 < n)
+      *out++ = digits[(v >> 6) & 63];
+  }
+  *out = '\0';
+  return emit_key_or_string(d, s);
+}
+static double half_to_double(uint16_t h)
+{
+  int e = (h >> 10) & 0x1f, m = h & 0x3ff;
+  double v;
+  if (e == 0)
+    v = ldexp(m, -24);
+  else if (e == 31)
+    v = m ? NAN : INFINITY;
+  else
+    v = ldexp(m + 1024, e - 25);
+  return (h & 0x8000) ? -v : v;
+}
+static bool open_container(decoder * d, json::data * c, unsigned char * p)
+{
+  uint64_t n = argument(p);
+  if (expects_key(d) || n > INT64_MAX) {
+    del(c);
+    return false;
+  }
+  if (!builder_open(&d->b, c))
+    return false;
+  int64_t * r = d->remaining + d->b.depth - 1;
+  *r = ((p[0] & 31) == 31) ? -1 : (int64_t)n;
+  if (*r == 0) {
+    builder_close(&d->b);
+    completed(d);
+  }
+  return true;
+}
+/*
+ * the end of an indefinite length container or string
+ */
+static bool brk(decoder * d)
+{
+  if (d->in_string) {
+    bool ok;
+    if (d->in_string == major_text)
+      ok = emit_text(d, d->text._, d->text.size);
+    else
+      ok = emit_bytes(d, (unsigned char *)d->text._, d->text.size);
+    d->in_string = 0;
+    d->text.size = 0;
+    return ok;
+  }
+  if (d->b.depth == 0 || d->remaining[d->b.depth-1] >= 0 || d->b.key)
+    return false;
+  builder_close(&d->b);
+  completed(d);
+  return true;
+}
+/*
+ * decode the complete item at p, item_size has checked its length
+ */
+static bool item(decoder * d, unsigned char * p)
+{
+  int major = p[0] >> 5, ai = p[0] & 31;
+  int a = argument_size(p[0]);
+  uint64_t v = argument(p);
+  uint64_t u64;
+  uint32_t u32;
+  double f;
+  if (d->done)
+    return false;
+  if (d->in_string) {
+    if (p[0] == 0xff)
+      return brk(d);
+    if (major != d->in_string || ai == 31)
+      return false;
+    buffer_put(&d->text, p + 1 + a, v);
+    return true;
+  }
+  // only strings, containers and the break have an indefinite length
+  if (ai == 31 && (major == major_uint || major == major_negint || major == major_tag))
+    return false;
+  if (d->tag && major != major_bytes && major != major_tag)
+    d->tag = 0;
+  switch (major) {
+    case major_uint:
+      if (v > INT64_MAX) {
+        if (expects_key(d))
+          return emit_key_or_string(d, str::mk(d->st, "%llu", (unsigned long long)v));
+        return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                                 boxed::from_u64(d->st, v)));
+      }
+      return emit_int(d, (int64_t)v);
+    case major_negint:
+      if (v > INT64_MAX)
+        return emit(d, mk_number(d->st, -1.0 - (double)v));
+      return emit_int(d, -1 - (int64_t)v);
+    case major_bytes:
+    case major_text:
+      if (ai == 31) {
+        d->in_string = major;
+        return true;
+      }
+      if (major == major_text)
+        return emit_text(d, (char *)p + 1 + a, v);
+      return emit_bytes(d, p + 1 + a, v);
+    case major_array:
+      return open_container(d, mk_array(d->st, ai == 31 || v > 1024 ? 8 : v), p);
+    case major_map:
+      return open_container(d, mk_object(d->st), p);
+    case major_tag:
+      /*
+       * other tags are dropped and the tagged item is read as it is
+       */
+      d->tag = v;
+      return true;
+    default:
+      switch (ai) {
+        case 20:
+          return emit(d, mk_false(d->st));
+        case 21:
+          return emit(d, mk_true(d->st));
+        case 22:
+          return emit(d, mk_null(d->st));
+        case 23:
+          return emit(d, mk_undefined(d->st));
+        case 25:
+          return emit(d, mk_number(d->st, half_to_double(v)));
+        case 26:
+          {
+            float f32;
+            u32 = v;
+            memcpy(&f32, &u32, 4);
+            return emit(d, (json::data *)tagged::mk(d->st, type_is_number,
+                                                     boxed::from_float(d->st, f32)));
+          }
+        case 27:
+          u64 = v;
+          memcpy(&f, &u64, 8);
+          return emit(d, mk_number(d->st, f));
+        case 31:
+          return brk(d);
+        default:
+          return false;
+      }
+  }
+}
+static bool fail(decoder * d)
+{
+  d->error = true;
+  return false;
+}
+bool feed(decoder * d, char * chunk, uintptr_t len)
+{
+  unsigned char * p = (unsigned char *)chunk;
+  intptr_t need;
+  if (d->error)
+    return false;
+  /*
+   * complete the item that the previous chunk ended in
+   */
+  while (d->carry.size && len) {
+    need = item_size((unsigned char *)d->carry._, d->carry.size);
+    if (need < 0)
+      return fail(d);
+    uintptr_t take = need - d->carry.size;
+    if (take > len)
+      take = len;
+    buffer_put(&d->carry, p, take);
+    p += take;
+    len -= take;
+    if (d->carry.size == (uintptr_t)need
+        && item_size((unsigned char *)d->carry._, d->carry.size) == need) {
+      if (!item(d, (unsigned char *)d->carry._))
+        return fail(d);
+      d->offset += need;
+      d->carry.size = 0;
+    }
+  }
+  while (len) {
+    need = item_size(p, len);
+    if (need < 0)
+      return fail(d);
+    if ((uintptr_t)need > len) {
+      buffer_put(&d->carry, p, len);
+      break;
+    }
+    if (!item(d, p))
+      return fail(d);
+    d->offset += need;
+    p += need;
+    len -= need;
+  }
+  return true;
+}
+bool finish(decoder * d, json::data ** out, uintptr_t * error_at)
+{
+  bool ok = !d->error && d->done && d->carry.size == 0;
+  *out = NULL;
+  if (ok)
+    *out = d->b.root;
+  else {
+    builder_abort(&d->b);
+    *error_at = d->offset;
+  }
+  del(d->carry._);
+  del(d->text._);
+  del(d);
+  return ok;
+}
+    }
+block::data * to_cbor(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 256);
+  cbor::encode(&b, j);
+  *size = b.size;
+  return (block::data *)b._;
+}
+bool from_cbor(state::data * st, char * buf, uintptr_t len,
+               json::data ** out, uintptr_t * error_at)
+{
+  cbor::decoder * d = cbor::mk_decoder(st);
+  cbor::feed(d, buf, len);
+  return cbor::finish(d, out, error_at);
+}
+  }
+}
+/* A random access binary document format
+ */
+namespace cee {
+  namespace json {
+    namespace binary {
+/*
+ * A document is a header followed by records, all of them start at a
+ * multiple of 8 and every number is stored little endian.
+ *
+ *   header:  "CEEJSONB" | root slot
+ *   string:  length | bytes | '\0' | padding
+ *   array:   count | count slots
+ *   object:  count | count offsets of key strings | count slots
+ *
+ * The keys of an object are sorted by strcmp. A slot is 8 bytes, its low
+ * 3 bits are the kind, the rest is an inline value or, as records are
+ * aligned, the slot with the kind bits cleared is the offset of a record.
+ */
+enum kind {
+  kind_simple = 0, // null, false, true and undefined
+  kind_int, // a signed 61 bit integer held in the slot
+  kind_double, // offset of 8 bytes
+  kind_i64, // offset of 8 bytes
+  kind_u64, // offset of 8 bytes
+  kind_string,
+  kind_array,
+  kind_object
+};
+enum simple {
+  simple_null = 0,
+  simple_false,
+  simple_true,
+  simple_undefined
+};
+static const char magic[8] = { 'C', 'E', 'E', 'J', 'S', 'O', 'N', 'B' };
+static uint64_t load(char * p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+static void store(char * p, uint64_t v)
+{
+  memcpy(p, &v, 8);
+}
+/*
+ * reserve an aligned record of n bytes and return its offset
+ */
+static uint64_t reserve(struct buffer * b, uintptr_t n)
+{
+  uint64_t offset = b->size;
+  memset(buffer_reserve(b, (n + 7) & ~(uintptr_t)7), 0, (n + 7) & ~(uintptr_t)7);
+  return offset;
+}
+static uint64_t encode_word(struct buffer * b, enum kind k, uint64_t v)
+{
+  uint64_t offset = reserve(b, 8);
+  store(b->_ + offset, v);
+  return offset | k;
+}
+static uint64_t encode_int(struct buffer * b, int64_t v)
+{
+  if ((-((int64_t)1 << 60)) <= v && v <= (((int64_t)1 << 60) - 1))
+    return ((uint64_t)v << 3) | kind_int;
+  return encode_word(b, kind_i64, v);
+}
+static uint64_t encode_number(struct buffer * b, boxed::data * x)
+{
+  double d;
+  uint64_t u64;
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64:
+    case boxed::primitive_f32:
+      d = boxed::type(x) == boxed::primitive_f64 ? x->_.f64 : x->_.f32;
+      memcpy(&u64, &d, 8);
+      return encode_word(b, kind_double, u64);
+    case boxed::primitive_u64:
+      if (x->_.u64 > (uint64_t)(((int64_t)1 << 60) - 1))
+        return encode_word(b, kind_u64, x->_.u64);
+      return encode_int(b, x->_.u64);
+    case boxed::primitive_u32: return encode_int(b, x->_.u32);
+    case boxed::primitive_u16: return encode_int(b, x->_.u16);
+    case boxed::primitive_u8: return encode_int(b, x->_.u8);
+    case boxed::primitive_i64: return encode_int(b, x->_.i64);
+    case boxed::primitive_i32: return encode_int(b, x->_.i32);
+    case boxed::primitive_i16: return encode_int(b, x->_.i16);
+    case boxed::primitive_i8: return encode_int(b, x->_.i8);
+  }
+  return kind_simple | (simple_undefined << 3);
+}
+static uint64_t encode_string(struct buffer * b, char * s)
+{
+  uintptr_t n = strlen(s);
+  uint64_t offset = reserve(b, 8 + n + 1);
+  store(b->_ + offset, n);
+  memcpy(b->_ + offset + 8, s, n);
+  return offset | kind_string;
+}
+static uint64_t encode(struct buffer * b, json::data * j);
+/*
+ * the state of writing the members of an object
+ */
+struct members {
+  struct buffer * b;
+  uint64_t offset;
+  uint64_t count;
+  uint64_t i;
+};
+static void encode_member(void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  uint64_t k = encode_string(m->b, (char *)key);
+  uint64_t v = encode(m->b, (json::data *)value);
+  store(m->b->_ + m->offset + 8 + 8 * m->i, k & ~(uint64_t)7);
+  store(m->b->_ + m->offset + 8 + 8 * (m->count + m->i), v);
+  m->i++;
+}
+static uint64_t encode(struct buffer * b, json::data * j)
+{
+  uint64_t i, n, offset;
+  switch (j->t) {
+    case type_is_null:
+      return kind_simple | (simple_null << 3);
+    case type_is_boolean:
+      return kind_simple | ((to_bool(j) ? simple_true : simple_false) << 3);
+    case type_is_number:
+      return encode_number(b, j->value.number);
+    case type_is_string:
+      return encode_string(b, (char *)j->value.string);
+    case type_is_array:
+      /*
+       * the record is reserved first and its slots are filled in as the
+       * elements are written after it, the buffer may move meanwhile
+       */
+      n = list::size(j->value.array);
+      offset = reserve(b, 8 + 8 * n);
+      store(b->_ + offset, n);
+      for (i = 0; i < n; i++) {
+        uint64_t v = encode(b, (json::data *)j->value.array->_[i]);
+        store(b->_ + offset + 8 + 8 * i, v);
+      }
+      return offset | kind_array;
+    case type_is_object:
+      {
+        struct members m;
+        m.b = b;
+        m.count = map::size(j->value.object);
+        m.offset = reserve(b, 8 + 16 * m.count);
+        m.i = 0;
+        store(b->_ + m.offset, m.count);
+        map::walk(j->value.object, &m, encode_member);
+        return m.offset | kind_object;
+      }
+    default:
+      return kind_simple | (simple_undefined << 3);
+  }
+}
+/*
+ * a record of n bytes at offset lies inside the document
+ */
+static bool inside(struct value v, uint64_t offset, uint64_t n)
+{
+  return offset <= v.len && n <= v.len - offset;
+}
+static uint64_t count(struct value v)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7;
+  if (!inside(v, offset, 8))
+    return 0;
+  uint64_t n = load(v.base + offset);
+  uint64_t per = (v.slot & 7) == kind_object ? 16 : 8;
+  if (n > v.len / per || !inside(v, offset + 8, n * per))
+    return 0;
+  return n;
+}
+static struct value child(struct value v, uint64_t offset)
+{
+  struct value c = { v.base, v.len, load(v.base + offset) };
+  return c;
+}
+bool open(char * buf, uintptr_t len, struct value * root)
+{
+  if (len < 16 || memcmp(buf, magic, 8))
+    return false;
+  root->base = buf;
+  root->len = len;
+  root->slot = load(buf + 8);
+  return true;
+}
+enum type type_of(struct value v)
+{
+  switch (v.slot & 7) {
+    case kind_simple:
+      switch (v.slot >> 3) {
+        case simple_null:
+          return type_is_null;
+        case simple_false:
+        case simple_true:
+          return type_is_boolean;
+        default:
+          return type_is_undefined;
+      }
+    case kind_int:
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      return type_is_number;
+    case kind_string:
+      return type_is_string;
+    case kind_array:
+      return type_is_array;
+    default:
+      return type_is_object;
+  }
+}
+bool get_bool(struct value v, bool * b)
+{
+  if ((v.slot & 7) != kind_simple
+      || ((v.slot >> 3) != simple_false && (v.slot >> 3) != simple_true))
+    return false;
+  *b = (v.slot >> 3) == simple_true;
+  return true;
+}
+bool get_number(struct value v, double * d)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7, u64;
+  switch (v.slot & 7) {
+    case kind_int:
+      *d = (double)((int64_t)v.slot >> 3);
+      return true;
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      if (!inside(v, offset, 8))
+        return false;
+      u64 = load(v.base + offset);
+      if ((v.slot & 7) == kind_double)
+        memcpy(d, &u64, 8);
+      else if ((v.slot & 7) == kind_i64)
+        *d = (double)(int64_t)u64;
+      else
+        *d = (double)u64;
+      return true;
+    default:
+      return false;
+  }
+}
+bool get_string(struct value v, char ** s, uintptr_t * len)
+{
+  uint64_t offset = v.slot & ~(uint64_t)7;
+  if ((v.slot & 7) != kind_string || !inside(v, offset, 8))
+    return false;
+  uint64_t n = load(v.base + offset);
+  if (n >= v.len || !inside(v, offset + 8, n + 1) || v.base[offset + 8 + n] != '\0')
+    return false;
+  *s = v.base + offset + 8;
+  if (len)
+    *len = n;
+  return true;
+}
+uintptr_t size(struct value v)
+{
+  if ((v.slot & 7) != kind_array && (v.slot & 7) != kind_object)
+    return 0;
+  return count(v);
+}
+bool at(struct value array, uintptr_t i, struct value * out)
+{
+  if ((array.slot & 7) != kind_array || i >= count(array))
+    return false;
+  *out = child(array, (array.slot & ~(uint64_t)7) + 8 + 8 * i);
+  return true;
+}
+bool member(struct value object, uintptr_t i, char ** key, struct value * out)
+{
+  uint64_t n, offset = object.slot & ~(uint64_t)7;
+  if ((object.slot & 7) != kind_object || i >= (n = count(object)))
+    return false;
+  struct value k = child(object, offset + 8 + 8 * i);
+  k.slot |= kind_string;
+  if (!get_string(k, key, NULL))
+    return false;
+  *out = child(object, offset + 8 + 8 * (n + i));
+  return true;
+}
+bool find(struct value object, char * key, struct value * out)
+{
+  uint64_t n, offset = object.slot & ~(uint64_t)7;
+  if ((object.slot & 7) != kind_object)
+    return false;
+  n = count(object);
+  uint64_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    char * k;
+    struct value kv = child(object, offset + 8 + 8 * mid);
+    kv.slot |= kind_string;
+    if (!get_string(kv, &k, NULL))
+      return false;
+    int c = strcmp(key, k);
+    if (c == 0) {
+      *out = child(object, offset + 8 + 8 * (n + mid));
+      return true;
+    }
+    if (c < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return false;
+}
+static json::data * mk_boxed(state::data * st, boxed::data * x)
+{
+  return (json::data *)tagged::mk(st, type_is_number, x);
+}
+static bool materialize(state::data * st, struct value v, json::data ** out,
+                        int depth)
+{
+  uint64_t i, n, u64;
+  char * s;
+  bool b;
+  json::data * j, * c;
+  if (depth > MAX_JSON_DEPTH)
+    return false;
+  switch (v.slot & 7) {
+    case kind_simple:
+      switch (v.slot >> 3) {
+        case simple_null:
+          *out = mk_null(st);
+          return true;
+        case simple_undefined:
+          *out = mk_undefined(st);
+          return true;
+        default:
+          get_bool(v, &b);
+          *out = mk_bool(st, b);
+          return true;
+      }
+    case kind_int:
+      *out = mk_boxed(st, boxed::from_i64(st, (int64_t)v.slot >> 3));
+      return true;
+    case kind_double:
+    case kind_i64:
+    case kind_u64:
+      if (!inside(v, v.slot & ~(uint64_t)7, 8))
+        return false;
+      u64 = load(v.base + (v.slot & ~(uint64_t)7));
+      if ((v.slot & 7) == kind_i64)
+        *out = mk_boxed(st, boxed::from_i64(st, (int64_t)u64));
+      else if ((v.slot & 7) == kind_u64)
+        *out = mk_boxed(st, boxed::from_u64(st, u64));
+      else {
+        double d;
+        memcpy(&d, &u64, 8);
+        *out = mk_number(st, d);
+      }
+      return true;
+    case kind_string:
+      if (!get_string(v, &s, &n))
+        return false;
+      {
+        str::data * str = str::mk_e(st, n + 1, NULL);
+        memcpy(str->_, s, n + 1);
+        *out = mk_string(st, str);
+      }
+      return true;
+    case kind_array:
+      n = count(v);
+      j = mk_array(st, n);
+      for (i = 0; i < n; i++) {
+        struct value e;
+        if (!at(v, i, &e) || !materialize(st, e, &c, depth + 1)) {
+          del(j);
+          return false;
+        }
+        list::append(&j->value.array, c);
+      }
+      *out = j;
+      return true;
+    default:
+      n = count(v);
+      j = mk_object(st);
+      for (i = 0; i < n; i++) {
+        struct value e;
+        if (!member(v, i, &s, &e) || !materialize(st, e, &c, depth + 1)) {
+          del(j);
+          return false;
+        }
+        map::add(j->value.object, str::mk(st, "%s", s), c);
+      }
+      *out = j;
+      return true;
+  }
+}
+bool to_json(state::data * st, struct value v, json::data ** out)
+{
+  return materialize(st, v, out, 0);
+}
+    }
+block::data * to_binary(state::data * st, json::data * j, uintptr_t * size)
+{
+  struct buffer b;
+  buffer_init(&b, st, 4096);
+  buffer_put(&b, (void *)binary::magic, 8);
+  buffer_reserve(&b, 8);
+  uint64_t root = binary::encode(&b, j);
+  binary::store(b._ + 8, root);
+  *size = b.size;
+  return (block::data *)b._;
+}
+  }
+}
+/* structural comparison and hashing
+ */
+namespace cee {
+  namespace json {
+    namespace structural {
+static uint64_t fmix (uint64_t v)
+{
+  v ^= v >> 33;
+  v *= 0xff51afd7ed558ccdULL;
+  v ^= v >> 33;
+  v *= 0xc4ceb9fe1a85ec53ULL;
+  v ^= v >> 33;
+  return v;
+}
+static uint64_t combine (uint64_t h, uint64_t v)
+{
+  h = (h << 5 | h >> 59) ^ fmix(v);
+  return h * 0x9e3779b97f4a7c15ULL;
+}
+static uint64_t hash_string (char * s)
+{
+  uintptr_t n = strlen(s), i;
+  uint64_t h = n, w;
+  for (i = 0; i + 8 <= n; i += 8) {
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  if (i < n) {
+    w = 0;
+    memcpy(&w, s + i, n - i);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  return fmix(h);
+}
+/*
+ * the hash of a container being computed
+ */
+struct hasher {
+  uint64_t h;
+  json::data * parent;
+  bool stable; // the containers in parent are linked under it
+};
+static uint64_t hash_e (json::data * j, bool * stable);
+/*
+ * a container in h->parent is linked under it, so that a change to the
+ * container drops the hash cached with the parent
+ */
+static void hash_child (struct hasher * h, json::data * c)
+{
+  bool stable = true;
+  h->h = combine(h->h, hash_e(c, &stable));
+  if ((c->t == type_is_array || c->t == type_is_object)
+      && !(stable && tagged::link((tagged::data *)c, (tagged::data *)h->parent)))
+    h->stable = false;
+}
+static void hash_member (void * cxt, void * key, void * value)
+{
+  struct hasher * h = (struct hasher *)cxt;
+  h->h = combine(h->h, hash_string((char *)key));
+  hash_child(h, (json::data *)value);
+}
+/*
+ * *stable is cleared if the hash of j cannot be cached because j, or a
+ * container in it, has other owners
+ */
+static uint64_t hash_e (json::data * j, bool * stable)
+{
+  struct hasher h = { 0, j, true };
+  uintptr_t i, n;
+  uint64_t v;
+  double d;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+      return fmix(j->t + 1);
+    case type_is_boolean:
+      return fmix((j->t << 1 | to_bool(j)) + 1);
+    case type_is_number:
+      d = to_double(j);
+      if (d == 0)
+        d = 0; // -0 and 0 are equal
+      memcpy(&v, &d, 8);
+      return combine(j->t, v);
+    case type_is_string:
+      return combine(j->t, hash_string((char *)j->value.string));
+    case type_is_array:
+      if (tagged::recall((tagged::data *)j, &v))
+        return v;
+      n = list::size(j->value.array);
+      h.h = combine(j->t, n);
+      for (i = 0; i < n; i++)
+        hash_child(&h, (json::data *)j->value.array->_[i]);
+      break;
+    case type_is_object:
+      if (tagged::recall((tagged::data *)j, &v))
+        return v;
+      h.h = combine(j->t, map::size(j->value.object));
+      map::walk(j->value.object, &h, hash_member);
+      break;
+  }
+  *stable = h.stable && tagged::memoize((tagged::data *)j, h.h);
+  return h.h;
+}
+/*
+ * the members of an object in the order of their keys, key and value
+ * interleaved
+ */
+struct members {
+  uintptr_t size;
+  void ** _;
+};
+static void collect_member (void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  m->_[m->size++] = key;
+  m->_[m->size++] = value;
+}
+struct merge {
+  struct members * a;
+  uintptr_t i;
+  int result;
+};
+static void merge_member (void * cxt, void * key, void * value)
+{
+  struct merge * m = (struct merge *)cxt;
+  if (m->result)
+    return;
+  m->result = strcmp((char *)m->a->_[m->i], (char *)key);
+  if (m->result == 0)
+    m->result = json::cmp((json::data *)m->a->_[m->i + 1],
+                          (json::data *)value);
+  m->i += 2;
+}
+static int cmp_objects (map::data * a, map::data * b, uintptr_t n)
+{
+  void * small[32];
+  struct members ma = { 0, small };
+  struct merge m = { &ma, 0, 0 };
+  if (2 * n > sizeof(small)/sizeof(small[0]))
+    ma._ = (void **)malloc(2 * n * sizeof(void *));
+  map::walk(a, &ma, collect_member);
+  map::walk(b, &m, merge_member);
+  if (ma._ != small)
+    free(ma._);
+  return m.result;
+}
+static int sign (int c)
+{
+  return c < 0 ? -1 : c > 0;
+}
+    }
+uint64_t hash (json::data * j)
+{
+  bool stable;
+  return structural::hash_e(j, &stable);
+}
+int cmp (json::data * a, json::data * b)
+{
+  uintptr_t i, n, m;
+  uint64_t ha, hb;
+  double x, y;
+  int c;
+  if (a == b)
+    return 0;
+  if (a->t != b->t)
+    return a->t < b->t ? -1 : 1;
+  switch (a->t) {
+    case type_is_undefined:
+    case type_is_null:
+      return 0;
+    case type_is_boolean:
+      return (int)to_bool(a) - (int)to_bool(b);
+    case type_is_number:
+      x = to_double(a);
+      y = to_double(b);
+      return x < y ? -1 : x > y;
+    case type_is_string:
+      return structural::sign(strcmp((char *)a->value.string,
+                                     (char *)b->value.string));
+    case type_is_array:
+    case type_is_object:
+      if (a->t == type_is_array) {
+        n = list::size(a->value.array);
+        m = list::size(b->value.array);
+      }
+      else {
+        n = map::size(a->value.object);
+        m = map::size(b->value.object);
+      }
+      if (n != m)
+        return n < m ? -1 : 1;
+      ha = hash(a);
+      hb = hash(b);
+      if (ha != hb)
+        return ha < hb ? -1 : 1;
+      if (a->t == type_is_object)
+        return structural::sign(structural::cmp_objects(a->value.object,
+                                                        b->value.object, n));
+      for (i = 0; i < n; i++) {
+        c = cmp((json::data *)a->value.array->_[i],
+                (json::data *)b->value.array->_[i]);
+        if (c)
+          return c;
+      }
+      return 0;
+  }
+  return 0;
+}
+  }
+}
+/* RFC 6902 JSON Patch from the difference of two documents
+ */
+namespace cee {
+  namespace json {
+    namespace differ {
+/*
+ * the dynamic programming table of an LCS of two array middles is
+ * limited to this many cells, larger middles are paired up by position
+ */
+struct context {
+  state::data * st;
+  struct buffer path; // the pointer of the values being compared
+  json::data * patch;
+};
+/*
+ * subtrees that are the same node, or that are equal scalars or
+ * containers with equal hashes are taken as unchanged
+ */
+static bool same (json::data * a, json::data * b)
+{
+  if (a == b)
+    return true;
+  if (a->t != b->t)
+    return false;
+  if (a->t == type_is_array || a->t == type_is_object)
+    return hash(a) == hash(b);
+  return cmp(a, b) == 0;
+}
+static void emit (struct context * d, char * op, json::data * value)
+{
+  json::data * o = mk_object(d->st);
+  object_set_string(d->st, o, "op", op);
+  buffer_put_byte(&d->path, 0);
+  object_set_string(d->st, o, "path", d->path._);
+  d->path.size--;
+  if (value)
+    object_set(d->st, o, "value", value);
+  list::append(&d->patch->value.array, o);
+}
+static void push_key (struct context * d, char * key)
+{
+  buffer_put_byte(&d->path, '/');
+  for (; *key; key++) {
+    if (*key == '~')
+      buffer_put(&d->path, (void *)"~0", 2);
+    else if (*key == '/')
+      buffer_put(&d->path, (void *)"~1", 2);
+    else
+      buffer_put_byte(&d->path, *key);
+  }
+}
+static void push_index (struct context * d, uintptr_t i)
+{
+  char s[24];
+  int n = snprintf(s, sizeof(s), "/%lu", (unsigned long)i);
+  buffer_put(&d->path, s, n);
+}
+static void diff (struct context * d, json::data * a, json::data * b);
+/*
+ * the members of an object in the order of their keys, key and value
+ * interleaved
+ */
+struct members {
+  uintptr_t size;
+  void ** _;
+};
+static void collect_member (void * cxt, void * key, void * value)
+{
+  struct members * m = (struct members *)cxt;
+  m->_[m->size++] = key;
+  m->_[m->size++] = value;
+}
+static void diff_objects (struct context * d, map::data * a, map::data * b)
+{
+  struct members ma, mb;
+  uintptr_t i = 0, j = 0, top = d->path.size;
+  int c;
+  ma.size = mb.size = 0;
+  ma._ = (void **)malloc((map::size(a) + map::size(b)) * 2 * sizeof(void *) + 1);
+  mb._ = ma._ + map::size(a) * 2;
+  map::walk(a, &ma, collect_member);
+  map::walk(b, &mb, collect_member);
+  while (i < ma.size || j < mb.size) {
+    if (i == ma.size)
+      c = 1;
+    else if (j == mb.size)
+      c = -1;
+    else
+      c = strcmp((char *)ma._[i], (char *)mb._[j]);
+    if (c < 0) {
+      push_key(d, (char *)ma._[i]);
+      emit(d, "remove", NULL);
+      i += 2;
+    }
+    else if (c > 0) {
+      push_key(d, (char *)mb._[j]);
+      emit(d, "add", (json::data *)mb._[j + 1]);
+      j += 2;
+    }
+    else {
+      push_key(d, (char *)ma._[i]);
+      diff(d, (json::data *)ma._[i + 1], (json::data *)mb._[j + 1]);
+      i += 2;
+      j += 2;
+    }
+    d->path.size = top;
+  }
+  free(ma._);
+}
+/*
+ * edit the middle a[0..n) into b[0..m), index is where a[0] is in the
+ * array being patched. A removal that is followed by an addition
+ * becomes a diff of the two elements.
+ */
+static void edit (struct context * d, uintptr_t index,
+                  json::data ** a, uintptr_t n, json::data ** b, uintptr_t m,
+                  char * dir)
+{
+  uintptr_t i = 0, j = 0, top = d->path.size;
+  while (i < n || j < m) {
+    if (i < n && j < m && dir[i * (m + 1) + j] == 0) {
+      i++;
+      j++;
+      index++;
+      continue;
+    }
+    push_index(d, index);
+    if (i < n && j < m && dir[i * (m + 1) + j] == 3) {
+      diff(d, a[i++], b[j++]);
+      index++;
+    }
+    else if (i < n && (j == m || dir[i * (m + 1) + j] == 1)) {
+      emit(d, "remove", NULL);
+      i++;
+    }
+    else {
+      emit(d, "add", b[j++]);
+      index++;
+    }
+    d->path.size = top;
+  }
+}
+static void diff_arrays (struct context * d, list::data * la, list::data * lb)
+{
+  json::data ** a = (json::data **)la->_, ** b = (json::data **)lb->_;
+  uintptr_t n = list::size(la), m = list::size(lb), p = 0, i, j;
+  while (p < n && p < m && same(a[p], b[p]))
+    p++;
+  while (n > p && m > p && same(a[n - 1], b[m - 1])) {
+    n--;
+    m--;
+  }
+  a += p;
+  b += p;
+  n -= p;
+  m -= p;
+  if (n == 0 && m == 0)
+    return;
+  if ((uint64_t)(n + 1) * (m + 1) > (1 << 22)) {
+    uintptr_t top = d->path.size;
+    for (i = 0; i < n && i < m; i++) {
+      push_index(d, p + i);
+      diff(d, a[i], b[i]);
+      d->path.size = top;
+    }
+    for (; i < m; i++) {
+      push_index(d, p + i);
+      emit(d, "add", b[i]);
+      d->path.size = top;
+    }
+    push_index(d, p + m);
+    for (; i < n; i++)
+      emit(d, "remove", NULL);
+    d->path.size = top;
+    return;
+  }
+  /*
+   * dir[i][j] is the first step of an edit of a[i..n) into b[j..m):
+   * 0 keeps both, 1 removes a[i], 2 adds b[j], 3 diffs a[i] with b[j]
+   */
+  char * dir = (char *)malloc((n + 1) * (m + 1));
+  uint32_t * len = (uint32_t *)malloc((m + 1) * 2 * sizeof(uint32_t));
+  uint32_t * next = len, * cur = len + m + 1, * t;
+  for (j = 0; j <= m; j++)
+    next[j] = 0;
+  for (i = n + 1; i-- > 0; ) {
+    for (j = m + 1; j-- > 0; ) {
+      char * s = &dir[i * (m + 1) + j];
+      if (i == n || j == m) {
+        *s = i == n ? 2 : 1;
+        cur[j] = 0;
+      }
+      else if (same(a[i], b[j])) {
+        *s = 0;
+        cur[j] = next[j + 1] + 1;
+      }
+      else if (next[j] >= cur[j + 1]) {
+        *s = 1;
+        cur[j] = next[j];
+      }
+      else {
+        *s = 2;
+        cur[j] = cur[j + 1];
+      }
+    }
+    t = next;
+    next = cur;
+    cur = t;
+  }
+  free(len);
+  /*
+   * a removal right before an addition is one element changed
+   */
+  for (i = 0, j = 0; i < n || j < m; ) {
+    char * s = &dir[i * (m + 1) + j];
+    if (i < n && j < m && *s == 1 && dir[(i + 1) * (m + 1) + j] == 2)
+      *s = 3;
+    if (*s == 0 || *s == 3) {
+      i++;
+      j++;
+    }
+    else if (*s == 1)
+      i++;
+    else
+      j++;
+  }
+  edit(d, p, a, n, b, m, dir);
+  free(dir);
+}
+static void diff (struct context * d, json::data * a, json::data * b)
+{
+  if (same(a, b))
+    return;
+  if (a->t == type_is_object && b->t == type_is_object)
+    diff_objects(d, a->value.object, b->value.object);
+  else if (a->t == type_is_array && b->t == type_is_array)
+    diff_arrays(d, a->value.array, b->value.array);
+  else
+    emit(d, "replace", b);
+}
+    }
+json::data * diff (state::data * st, json::data * a, json::data * b)
+{
+  struct differ::context d;
+  d.st = st;
+  d.patch = mk_array(st, 8);
+  buffer_init(&d.path, st, 256);
+  differ::diff(&d, a, b);
+  del(d.path._);
+  return d.patch;
+}
+  }
+}
+/* JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7386) applied in place
+ */
+namespace cee {
+  namespace json {
+    namespace patching {
+/*
+ * what has to be done to take back one change of the document, the
+ * undo log holds a reference to old so that it outlives the change
+ */
+enum undo_kind {
+  undo_root, // *doc was old
+  undo_member, // key of container was old, or absent if old is NULL
+  undo_insert, // an element was inserted at index
+  undo_remove, // old was removed from index
+  undo_element // the element at index was old
+};
+struct undo {
+  enum undo_kind kind;
+  json::data * container;
+  char * key;
+  uintptr_t index;
+  json::data * old;
+};
+struct patcher {
+  state::data * st;
+  json::data ** doc;
+  struct undo * log;
+  uintptr_t size;
+  uintptr_t capacity;
+  // the compiled paths the log refers to, kept from the cache emptying
+  list::data * paths;
+};
+static void record (struct patcher * p, enum undo_kind kind,
+                    json::data * container, char * key, uintptr_t index,
+                    json::data * old)
+{
+  if (p->size == p->capacity) {
+    p->capacity = p->capacity ? p->capacity * 2 : 16;
+    p->log = (struct undo *)realloc(p->log, p->capacity * sizeof(struct undo));
+  }
+  struct undo * u = p->log + p->size++;
+  u->kind = kind;
+  u->container = container;
+  u->key = key;
+  u->index = index;
+  u->old = old;
+  if (old)
+    incr_indegree(CEE_DEFAULT_DEL_POLICY, old);
+}
+/*
+ * the element at i is replaced by v without shifting the rest
+ */
+static void set_element (json::data * a, uintptr_t i, json::data * v)
+{
+  json::data * old = (json::data *)a->value.array->_[i];
+  incr_indegree(CEE_DEFAULT_DEL_POLICY, v);
+  write_barrier(a->value.array, v);
+  a->value.array->_[i] = v;
+  decr_indegree(CEE_DEFAULT_DEL_POLICY, old);
+}
+static void set_member (state::data * st, json::data * o, char * key,
+                        json::data * v)
+{
+  map::remove(o->value.object, key);
+  map::add(o->value.object, str::mk(st, "%s", key), v);
+}
+/*
+ * take back the changes in reverse order and drop the references of
+ * the log, or only drop them when the patch succeeded
+ */
+static void finish (struct patcher * p, bool rollback)
+{
+  uintptr_t i = p->size;
+  while (i-- > 0) {
+    struct undo * u = p->log + i;
+    if (rollback) {
+      switch (u->kind) {
+        case undo_root:
+          {
+            /*
+             * the reference of the log goes back to being the one of the
+             * root, the reference add took on the new root is dropped
+             */
+            json::data * v = *p->doc;
+            *p->doc = u->old;
+            decr_indegree(CEE_DEFAULT_DEL_POLICY, u->old);
+            del_e(CEE_DEFAULT_DEL_POLICY, v);
+            continue;
+          }
+        case undo_member:
+          if (u->old)
+            set_member(p->st, u->container, u->key, u->old);
+          else
+            map::remove(u->container->value.object, u->key);
+          break;
+        case undo_insert:
+          list::remove(u->container->value.array, u->index);
+          break;
+        case undo_remove:
+          list::insert(&u->container->value.array, u->index, u->old);
+          break;
+        case undo_element:
+          set_element(u->container, u->index, u->old);
+          break;
+      }
+    }
+    if (u->old)
+      del_e(CEE_DEFAULT_DEL_POLICY, u->old);
+  }
+  free(p->log);
+  if (p->paths)
+    del(p->paths);
+}
+static pointer::data * compile (struct patcher * p, char * path)
+{
+  pointer::data * ptr = pointer::compile(p->st, path);
+  if (ptr) {
+    if (p->paths == NULL)
+      p->paths = list::mk(p->st, 8);
+    list::append(&p->paths, ptr);
+  }
+  return ptr;
+}
+static json::data * member (json::data * o, char * key)
+{
+  return (json::data *)map::find(o->value.object, key);
+}
+static char * string_member (json::data * o, char * key)
+{
+  json::data * v = member(o, key);
+  return v && v->t == type_is_string ? (char *)v->value.string : NULL;
+}
+/*
+ * the index an array token refers to, size for "-" when it is allowed
+ */
+static bool element_index (json::data * a, struct pointer::token * tok,
+                           bool end_ok, uintptr_t * index)
+{
+  uintptr_t n = list::size(a->value.array);
+  if (end_ok && strcmp(tok->key, "-") == 0) {
+    *index = n;
+    return true;
+  }
+  if (tok->index < 0 || (uintptr_t)tok->index >= n + end_ok)
+    return false;
+  *index = tok->index;
+  return true;
+}
+static bool add (struct patcher * p, pointer::data * path, json::data * v)
+{
+  uintptr_t i;
+  if (path->size == 0) {
+    record(p, undo_root, NULL, NULL, 0, *p->doc);
+    /*
+     * the root is held as if it were in a container, a value moved to
+     * the root outlives the references of the log
+     */
+    incr_indegree(CEE_DEFAULT_DEL_POLICY, v);
+    *p->doc = v;
+    return true;
+  }
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      record(p, undo_member, parent, tok->key, 0, member(parent, tok->key));
+      set_member(p->st, parent, tok->key, v);
+      return true;
+    case type_is_array:
+      if (!element_index(parent, tok, true, &i))
+        return false;
+      record(p, undo_insert, parent, NULL, i, NULL);
+      list::insert(&parent->value.array, i, v);
+      return true;
+    default:
+      return false;
+  }
+}
+static bool remove (struct patcher * p, pointer::data * path)
+{
+  uintptr_t i;
+  if (path->size == 0)
+    return false;
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      {
+        json::data * old = member(parent, tok->key);
+        if (old == NULL)
+          return false;
+        record(p, undo_member, parent, tok->key, 0, old);
+        map::remove(parent->value.object, tok->key);
+        return true;
+      }
+    case type_is_array:
+      if (!element_index(parent, tok, false, &i))
+        return false;
+      record(p, undo_remove, parent, NULL, i,
+             (json::data *)parent->value.array->_[i]);
+      list::remove(parent->value.array, i);
+      return true;
+    default:
+      return false;
+  }
+}
+static bool replace (struct patcher * p, pointer::data * path, json::data * v)
+{
+  uintptr_t i;
+  if (path->size == 0)
+    return add(p, path, v);
+  json::data * parent = pointer::eval_e(path, *p->doc, path->size - 1);
+  struct pointer::token * tok = path->_ + path->size - 1;
+  if (parent == NULL)
+    return false;
+  switch (parent->t) {
+    case type_is_object:
+      if (member(parent, tok->key) == NULL)
+        return false;
+      return add(p, path, v);
+    case type_is_array:
+      if (!element_index(parent, tok, false, &i))
+        return false;
+      record(p, undo_element, parent, NULL, i,
+             (json::data *)parent->value.array->_[i]);
+      set_element(parent, i, v);
+      return true;
+    default:
+      return false;
+  }
+}
+/*
+ * a value cannot be moved into one of its own descendants
+ */
+static bool is_proper_prefix (pointer::data * from, pointer::data * path)
+{
+  uintptr_t i;
+  if (from->size >= path->size)
+    return false;
+  for (i = 0; i < from->size; i++)
+    if (strcmp(from->_[i].key, path->_[i].key))
+      return false;
+  return true;
+}
+/*
+ * op with a copy of v, the copy is dropped when op fails as it is then
+ * in no document
+ */
+static bool with_copy (bool (*op)(struct patcher *, pointer::data *, json::data *),
+                       struct patcher * p, pointer::data * path, json::data * v)
+{
+  json::data * copy = clone(p->st, v);
+  if (op(p, path, copy))
+    return true;
+  del(copy);
+  return false;
+}
+static bool apply (struct patcher * p, json::data * op)
+{
+  if (op->t != type_is_object)
+    return false;
+  char * name = string_member(op, "op"), * to, * s;
+  json::data * value = member(op, "value"), * v;
+  pointer::data * path, * from = NULL;
+  if (name == NULL || (to = string_member(op, "path")) == NULL
+      || (path = compile(p, to)) == NULL)
+    return false;
+  if (strcmp(name, "move") == 0 || strcmp(name, "copy") == 0) {
+    if ((s = string_member(op, "from")) == NULL
+        || (from = compile(p, s)) == NULL
+        || (v = pointer::eval(from, *p->doc)) == NULL)
+      return false;
+  }
+  if (strcmp(name, "add") == 0)
+    return value && with_copy(add, p, path, value);
+  if (strcmp(name, "remove") == 0)
+    return remove(p, path);
+  if (strcmp(name, "replace") == 0)
+    return value && with_copy(replace, p, path, value);
+  if (strcmp(name, "copy") == 0)
+    return with_copy(add, p, path, v);
+  if (strcmp(name, "move") == 0) {
+    if (strcmp(s, to) == 0)
+      return true;
+    if (is_proper_prefix(from, path))
+      return false;
+    /*
+     * the log keeps v alive between its removal and its addition
+     */
+    return remove(p, from) && add(p, path, v);
+  }
+  if (strcmp(name, "test") == 0)
+    return value && (v = pointer::eval(path, *p->doc)) && cmp(v, value) == 0;
+  return false;
+}
+static json::data * merge (state::data * st, json::data * target,
+                           json::data * patch);
+struct merger {
+  state::data * st;
+  json::data * target;
+};
+static void merge_member (void * cxt, void * key, void * value)
+{
+  struct merger * m = (struct merger *)cxt;
+  json::data * patch = (json::data *)value;
+  json::data * old = member(m->target, (char *)key);
+  if (patch->t == type_is_null) {
+    if (old)
+      map::remove(m->target->value.object, key);
+  }
+  else if (old && old->t == type_is_object && patch->t == type_is_object)
+    merge(m->st, old, patch);
+  else
+    set_member(m->st, m->target, (char *)key, merge(m->st, NULL, patch));
+}
+/*
+ * the result of merging patch into target, target is changed in place
+ * when both are objects
+ */
+static json::data * merge (state::data * st, json::data * target,
+                           json::data * patch)
+{
+  if (patch->t != type_is_object)
+    return clone(st, patch);
+  if (target == NULL || target->t != type_is_object)
+    target = mk_object(st);
+  struct merger m = { st, target };
+  map::walk(patch->value.object, &m, merge_member);
+  return target;
+}
+    }
+bool apply_patch (state::data * st, json::data ** doc, json::data * patch,
+                  uintptr_t * error_at)
+{
+  struct patching::patcher p = { st, doc, NULL, 0, 0, NULL };
+  uintptr_t i, n;
+  if (patch->t != type_is_array) {
+    *error_at = 0;
+    return false;
+  }
+  n = list::size(patch->value.array);
+  for (i = 0; i < n; i++) {
+    if (!patching::apply(&p, (json::data *)patch->value.array->_[i])) {
+      patching::finish(&p, true);
+      *error_at = i;
+      return false;
+    }
+  }
+  patching::finish(&p, false);
+  return true;
+}
+void merge_patch (state::data * st, json::data ** doc, json::data * patch)
+{
+  json::data * old = *doc;
+  *doc = patching::merge(st, old, patch);
+  if (old && *doc != old && get_rc(old) == 0)
+    del(old);
+}
+  }
+}
+/* Persistent documents, updates that leave the old version intact
+ */
+namespace cee {
+  namespace json {
+    namespace persistent {
+/*
+ * the copy of an object or array on the path, its other members are
+ * shared with the original and gain a reference each
+ */
+struct copier {
+  json::data * copy;
+  char * skip; // the member left out, it is about to be replaced
+};
+static void copy_member (void * cxt, void * key, void * value)
+{
+  struct copier * c = (struct copier *)cxt;
+  if (c->skip == NULL || strcmp((char *)key, c->skip))
+    map::add(c->copy->value.object, key, value);
+}
+static json::data * copy_object (state::data * st, json::data * o, char * skip)
+{
+  struct copier c = { mk_object(st), skip };
+  map::walk(o->value.object, &c, copy_member);
+  return c.copy;
+}
+static json::data * copy_array (state::data * st, json::data * a,
+                                uintptr_t skip, json::data * v)
+{
+  uintptr_t i, n = list::size(a->value.array);
+  json::data * c = mk_array(st, n + 1);
+  for (i = 0; i < n; i++) {
+    if (i != skip)
+      list::append(&c->value.array, a->value.array->_[i]);
+    else if (v)
+      list::append(&c->value.array, v);
+  }
+  if (skip == n && v)
+    list::append(&c->value.array, v);
+  return c;
+}
+/*
+ * the new version of node with the value at ptr from the token at depth
+ * on replaced by v, or removed if v is NULL. NULL if ptr does not
+ * resolve.
+ */
+static json::data * update (state::data * st, json::data * node,
+                            pointer::data * ptr, uintptr_t depth, json::data * v)
+{
+  struct pointer::token * tok = ptr->_ + depth;
+  bool last = depth + 1 == ptr->size;
+  json::data * child, * c;
+  uintptr_t n, i;
+  switch (node->t) {
+    case type_is_object:
+      child = (json::data *)map::find(node->value.object, tok->key);
+      if (!last) {
+        if (child == NULL || (v = update(st, child, ptr, depth + 1, v)) == NULL)
+          return NULL;
+      }
+      else if (v == NULL && child == NULL)
+        return NULL;
+      c = copy_object(st, node, tok->key);
+      if (v)
+        map::add(c->value.object, str::mk(st, "%s", tok->key), v);
+      return c;
+    case type_is_array:
+      n = list::size(node->value.array);
+      if (last && v && strcmp(tok->key, "-") == 0)
+        i = n;
+      else if (tok->index >= 0 && (uintptr_t)tok->index < n)
+        i = tok->index;
+      else
+        return NULL;
+      if (!last) {
+        child = (json::data *)node->value.array->_[i];
+        if ((v = update(st, child, ptr, depth + 1, v)) == NULL)
+          return NULL;
+      }
+      return copy_array(st, node, i, v);
+    default:
+      return NULL;
+  }
+}
+json::data * set (state::data * st, json::data * root, char * pointer,
+                  json::data * value)
+{
+  pointer::data * ptr = pointer::compile(st, pointer);
+  if (ptr == NULL)
+    return NULL;
+  if (ptr->size == 0)
+    return value;
+  return update(st, root, ptr, 0, value);
+}
+json::data * remove (state::data * st, json::data * root, char * pointer)
+{
+  pointer::data * ptr = pointer::compile(st, pointer);
+  if (ptr == NULL || ptr->size == 0)
+    return NULL;
+  return update(st, root, ptr, 0, NULL);
+}
+    }
+  }
+}
+/* Publication of document roots to concurrent readers with epoch based
+ * reclamation
+ */
+namespace cee {
+  namespace json {
+    namespace rcu {
+/*
+ * a reader slot takes a cache line of its own, readers only ever write
+ * to their own slot
+ */
+struct alignas(64) reader {
+  struct domain * domain;
+  uintptr_t epoch; // the epoch seen by read_lock, 0 outside of it
+  int in_use;
+};
+/*
+ * a root replaced at epoch, it can be freed once every reader has moved
+ * past that epoch
+ */
+struct retired {
+  json::data * root;
+  uintptr_t epoch;
+};
+/*
+ * the roots of a domain, the current one and the retired ones, are gc
+ * roots of its state until they are freed
+ */
+struct domain {
+  state::data * st;
+  json::data * root;
+  uintptr_t epoch;
+  int lock; // serializes writers
+  struct retired * retired;
+  uintptr_t size;
+  uintptr_t capacity;
+  uintptr_t max_readers;
+  struct reader readers[1];
+};
+static void lock (struct domain * d)
+{
+  while (__atomic_exchange_n(&d->lock, 1, 2))
+    ;
+}
+static void unlock (struct domain * d)
+{
+  __atomic_store_n(&d->lock, 0, 3);
+}
+/*
+ * the oldest epoch a reader may still be in, or the current epoch if no
+ * reader is inside read_lock
+ */
+static uintptr_t oldest_epoch (struct domain * d)
+{
+  uintptr_t i, e, min = __atomic_load_n(&d->epoch, 5);
+  for (i = 0; i < d->max_readers; i++) {
+    e = __atomic_load_n(&d->readers[i].epoch, 5);
+    if (e && e < min)
+      min = e;
+  }
+  return min;
+}
+static uintptr_t reclaim_locked (struct domain * d)
+{
+  uintptr_t i, n = 0, oldest = oldest_epoch(d);
+  for (i = 0; i < d->size; i++) {
+    if (d->retired[i].epoch < oldest) {
+      state::remove_gc_root(d->st, d->retired[i].root);
+      del(d->retired[i].root);
+    }
+    else
+      d->retired[n++] = d->retired[i];
+  }
+  d->size = n;
+  return n;
+}
+domain * mk_domain (state::data * st, json::data * root, uintptr_t max_readers)
+{
+  uintptr_t i, size = sizeof(domain) + max_readers * sizeof(struct reader);
+  // the readers are aligned as the domain is
+  domain * d = (domain *)aligned_alloc(alignof(domain), size);
+  d->st = st;
+  d->root = root;
+  d->epoch = 1;
+  d->lock = 0;
+  d->retired = NULL;
+  d->size = 0;
+  d->capacity = 0;
+  d->max_readers = max_readers;
+  for (i = 0; i < max_readers; i++) {
+    d->readers[i].domain = d;
+    d->readers[i].epoch = 0;
+    d->readers[i].in_use = 0;
+  }
+  if (root)
+    state::add_gc_root(st, root);
+  return d;
+}
+json::data * del_domain (domain * d)
+{
+  uintptr_t i;
+  json::data * root = d->root;
+  for (i = 0; i < d->size; i++) {
+    state::remove_gc_root(d->st, d->retired[i].root);
+    del(d->retired[i].root);
+  }
+  if (root)
+    state::remove_gc_root(d->st, root);
+  free(d->retired);
+  free(d);
+  return root;
+}
+reader * join (domain * d)
+{
+  uintptr_t i;
+  for (i = 0; i < d->max_readers; i++) {
+    int idle = 0;
+    if (__atomic_compare_exchange_n(&d->readers[i].in_use, &idle, 1, false,
+                                    2, 0))
+      return d->readers + i;
+  }
+  return NULL;
+}
+void leave (reader * r)
+{
+  __atomic_store_n(&r->epoch, 0, 3);
+  __atomic_store_n(&r->in_use, 0, 3);
+}
+json::data * read_lock (reader * r)
+{
+  domain * d = r->domain;
+  /*
+   * the epoch is announced before the root is loaded, a writer that
+   * swaps the root afterwards sees the announcement and keeps the
+   * root this reader may get
+   */
+  __atomic_store_n(&r->epoch, __atomic_load_n(&d->epoch, 5),
+                   5);
+  return __atomic_load_n(&d->root, 5);
+}
+void read_unlock (reader * r)
+{
+  __atomic_store_n(&r->epoch, 0, 3);
+}
+void publish (domain * d, json::data * root)
+{
+  lock(d);
+  if (root == d->root) {
+    unlock(d);
+    return;
+  }
+  if (root)
+    state::add_gc_root(d->st, root);
+  json::data * old = __atomic_exchange_n(&d->root, root, 5);
+  uintptr_t e = __atomic_fetch_add(&d->epoch, 1, 5);
+  if (old) {
+    if (d->size == d->capacity) {
+      d->capacity = d->capacity ? d->capacity * 2 : 8;
+      d->retired = (struct retired *)realloc(d->retired,
+                                             d->capacity * sizeof(struct retired));
+    }
+    d->retired[d->size].root = old;
+    d->retired[d->size].epoch = e;
+    d->size++;
+  }
+  reclaim_locked(d);
+  unlock(d);
+}
+uintptr_t reclaim (domain * d)
+{
+  lock(d);
+  uintptr_t n = reclaim_locked(d);
+  unlock(d);
+  return n;
+}
+    }
+  }
+}
+/* Counters of parse and snprint
+ */
+namespace cee {
+  namespace json {
+/*
+ * the key under which the counters are kept in a state
+ */
+static char * stats_key = "cee.json.stats";
+struct stats * get_stats (state::data * st)
+{
+  if (!JSON_STATS_ON)
+    return NULL;
+  struct stats * s = (struct stats *)state::get_context(st, stats_key);
+  if (s == NULL) {
+    s = (struct stats *)block::mk(st, sizeof(struct stats));
+    memset(s, 0, sizeof(struct stats));
+    state::add_context(st, (char *)str::mk(st, "%s", stats_key), s);
+  }
+  return s;
+}
+uint64_t stats_clock (void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+static void add (struct stats * to, struct stats * from)
+{
+  unsigned i;
+  to->n_parses += from->n_parses;
+  to->n_parse_failures += from->n_parse_failures;
+  for (i = 0; i < stats_n_tokens; i++)
+    to->n_tokens[i] += from->n_tokens[i];
+  to->n_strings += from->n_strings;
+  to->n_escaped_strings += from->n_escaped_strings;
+  to->bytes_copied += from->bytes_copied;
+  to->n_parse_allocs += from->n_parse_allocs;
+  for (i = 0; i < state::max_types; i++)
+    to->n_parse_allocs_by_type[i] += from->n_parse_allocs_by_type[i];
+  if (from->max_depth > to->max_depth)
+    to->max_depth = from->max_depth;
+  to->tokenizer_ns += from->tokenizer_ns;
+  to->build_ns += from->build_ns;
+  to->n_prints += from->n_prints;
+  to->bytes_printed += from->bytes_printed;
+  to->n_print_allocs += from->n_print_allocs;
+  to->print_ns += from->print_ns;
+}
+void stats_begin (state::data * st, struct stats_call * c)
+{
+  memset(&c->counted, 0, sizeof(c->counted));
+  state::stats(st, &c->before);
+  c->started = stats_clock();
+}
+void stats_end_parse (state::data * st, struct stats_call * c,
+                      struct stats * more, bool ok)
+{
+  uint64_t elapsed = stats_clock() - c->started;
+  struct state::stats after;
+  unsigned i;
+  state::stats(st, &after);
+  c->counted.n_parses = 1;
+  c->counted.n_parse_failures = !ok;
+  c->counted.build_ns = elapsed - c->counted.tokenizer_ns;
+  c->counted.n_parse_allocs = after.n_allocs - c->before.n_allocs;
+  // a parse frees objects only when it fails
+  for (i = 0; i < state::max_types; i++)
+    c->counted.n_parse_allocs_by_type[i] =
+      after.n_live_by_type[i] - c->before.n_live_by_type[i];
+  add(get_stats(st), &c->counted);
+  if (more)
+    add(more, &c->counted);
+}
+void stats_end_print (state::data * st, struct stats_call * c)
+{
+  uint64_t elapsed = stats_clock() - c->started;
+  struct state::stats after;
+  state::stats(st, &after);
+  c->counted.n_prints = 1;
+  c->counted.print_ns = elapsed;
+  c->counted.n_print_allocs = after.n_allocs - c->before.n_allocs;
+  add(get_stats(st), &c->counted);
 }
   }
 }
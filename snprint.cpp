@@ -4,6 +4,7 @@
 */
 #ifndef CEE_JSON_AMALGAMATION
 #include "json.hpp"
+#include "stats.hpp"
 #include <string.h>
 #endif
 
@@ -14,7 +15,7 @@ struct counter {
   uintptr_t next;
   list::data * array;
   map::data  * object;
-  char tabs;
+  uintptr_t tabs;
   char more_siblings;
 };
 
@@ -70,7 +71,7 @@ static void pad (uintptr_t * offp, char * buf, struct counter * cnt, enum format
   
   uintptr_t offset = *offp;
   if (buf) {
-    int i;
+    uintptr_t i;
     for (i = 0; i < cnt->tabs; i++)
       buf[offset + i] = '\t';
   }
@@ -187,8 +188,15 @@ size_t snprint (state::data * st, char * buf, size_t size, json::data * j, enum
   json::data * cur_orca_json;
   struct counter * ccnt;
   uintptr_t incr = 0;
+  struct stats_call call;
+  if (JSON_STATS_ON)
+    stats_begin(st, &call);
   
-  stack::data * sp = stack::mk_e(st, dp_noop, 500);
+  /*
+   * the open containers, the value inside the innermost one and a slot
+   * to spare, printing stops once the stack is full
+   */
+  stack::data * sp = stack::mk_e(st, dp_noop, MAX_JSON_DEPTH + 2);
   push (st, 0, false, sp, j);
   
   uintptr_t offset = 0;
@@ -249,7 +257,7 @@ size_t snprint (state::data * st, char * buf, size_t size, json::data * j, enum
           pad(&offset, buf, ccnt, f);
           incr = boxed::snprint(NULL, 0, to_number(cur_orca_json));
           if (buf) {
-            boxed::snprint(buf+offset, incr, to_number(cur_orca_json));
+            boxed::snprint(buf+offset, incr+1, to_number(cur_orca_json));
           }
           offset+=incr;
           if (ccnt->more_siblings)
@@ -315,6 +323,8 @@ size_t snprint (state::data * st, char * buf, size_t size, json::data * j, enum
   del (sp);
   if (buf)
     buf[offset] = '\0';
+  JSON_STATS(&call, call.counted.bytes_printed = offset;
+                    stats_end_print(st, &call));
   return offset;
 }
     
@@ -0,0 +1,101 @@
+/* Counters of parse and snprint
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "stats.hpp"
+#include <string.h>
+#include <time.h>
+#endif
+
+namespace cee {
+  namespace json {
+
+/*
+ * the key under which the counters are kept in a state
+ */
+static char * stats_key = "cee.json.stats";
+
+struct stats * get_stats (state::data * st)
+{
+  if (!JSON_STATS_ON)
+    return NULL;
+  struct stats * s = (struct stats *)state::get_context(st, stats_key);
+  if (s == NULL) {
+    s = (struct stats *)block::mk(st, sizeof(struct stats));
+    memset(s, 0, sizeof(struct stats));
+    state::add_context(st, (char *)str::mk(st, "%s", stats_key), s);
+  }
+  return s;
+}
+
+uint64_t stats_clock (void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void add (struct stats * to, struct stats * from)
+{
+  unsigned i;
+  to->n_parses += from->n_parses;
+  to->n_parse_failures += from->n_parse_failures;
+  for (i = 0; i < stats_n_tokens; i++)
+    to->n_tokens[i] += from->n_tokens[i];
+  to->n_strings += from->n_strings;
+  to->n_escaped_strings += from->n_escaped_strings;
+  to->bytes_copied += from->bytes_copied;
+  to->n_parse_allocs += from->n_parse_allocs;
+  for (i = 0; i < state::max_types; i++)
+    to->n_parse_allocs_by_type[i] += from->n_parse_allocs_by_type[i];
+  if (from->max_depth > to->max_depth)
+    to->max_depth = from->max_depth;
+  to->tokenizer_ns += from->tokenizer_ns;
+  to->build_ns += from->build_ns;
+  to->n_prints += from->n_prints;
+  to->bytes_printed += from->bytes_printed;
+  to->n_print_allocs += from->n_print_allocs;
+  to->print_ns += from->print_ns;
+}
+
+void stats_begin (state::data * st, struct stats_call * c)
+{
+  memset(&c->counted, 0, sizeof(c->counted));
+  state::stats(st, &c->before);
+  c->started = stats_clock();
+}
+
+void stats_end_parse (state::data * st, struct stats_call * c,
+                      struct stats * more, bool ok)
+{
+  uint64_t elapsed = stats_clock() - c->started;
+  struct state::stats after;
+  unsigned i;
+  state::stats(st, &after);
+  c->counted.n_parses = 1;
+  c->counted.n_parse_failures = !ok;
+  c->counted.build_ns = elapsed - c->counted.tokenizer_ns;
+  c->counted.n_parse_allocs = after.n_allocs - c->before.n_allocs;
+  // a parse frees objects only when it fails
+  for (i = 0; i < state::max_types; i++)
+    c->counted.n_parse_allocs_by_type[i] =
+      after.n_live_by_type[i] - c->before.n_live_by_type[i];
+  add(get_stats(st), &c->counted);
+  if (more)
+    add(more, &c->counted);
+}
+
+void stats_end_print (state::data * st, struct stats_call * c)
+{
+  uint64_t elapsed = stats_clock() - c->started;
+  struct state::stats after;
+  state::stats(st, &after);
+  c->counted.n_prints = 1;
+  c->counted.print_ns = elapsed;
+  c->counted.n_print_allocs = after.n_allocs - c->before.n_allocs;
+  add(get_stats(st), &c->counted);
+}
+
+  }
+}
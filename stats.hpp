@@ -0,0 +1,40 @@
+#ifndef CEE_JSON_STATS_H
+#define CEE_JSON_STATS_H
+#include "cee.hpp"
+#include "json.hpp"
+
+namespace cee {
+  namespace json {
+
+/*
+ * the counting of parse and snprint is compiled in with CEE_JSON_STATS.
+ * JSON_STATS(s, x) runs x if it is and s is not NULL, the compiler drops
+ * x otherwise.
+ */
+#ifdef CEE_JSON_STATS
+#define JSON_STATS_ON 1
+#else
+#define JSON_STATS_ON 0
+#endif
+#define JSON_STATS(s, x) do { if (JSON_STATS_ON && (s)) { x; } } while (0)
+
+/*
+ * a call counts into a struct stats of its own, stats_end_parse and
+ * stats_end_print add it to the stats of the state, and stats_end_parse
+ * to more as well if that is not NULL
+ */
+struct stats_call {
+  struct stats counted;
+  struct state::stats before;
+  uint64_t started;
+};
+
+extern uint64_t stats_clock(void);
+extern void stats_begin(state::data *, struct stats_call *);
+extern void stats_end_parse(state::data *, struct stats_call *,
+                            struct stats * more, bool ok);
+extern void stats_end_print(state::data *, struct stats_call *);
+
+  }
+}
+#endif // CEE_JSON_STATS_H
@@ -0,0 +1,69 @@
+/* Structural comparison and the hashes cached with containers
+ */
+#include "test.hpp"
+
+static bool cached (json::data * j)
+{
+  uint64_t h;
+  return tagged::recall((tagged::data *)j, &h);
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  const char * text = "{\"x\":{\"y\":[1,2,{\"z\":true}]},\"s\":\"str\"}";
+  json::data * a = parse_text(st, text);
+  json::data * b = parse_text(st, text);
+  json::data * y = json::find(st, a, (char *)"/x/y");
+  json::data * z = json::find(st, a, (char *)"/x/y/2");
+
+  check(json::cmp(a, b) == 0 && json::hash(a) == json::hash(b));
+  check(cached(a) && cached(y) && cached(z));
+  check(json::cmp(parse_text(st, "[1,2]"), parse_text(st, "[1,3]")) != 0);
+  check(json::cmp(parse_text(st, "{\"a\":0}"), parse_text(st, "{\"a\":-0}")) == 0);
+
+  // a change in another document leaves the hashes alone
+  json::data * other = parse_text(st, "{\"o\":[]}");
+  json::object_set_number(st, other, (char *)"n", 1);
+  json::array_append_number(st, json::find(st, other, (char *)"/o"), 1);
+  check(cached(a) && cached(y));
+
+  // a change deep in a drops the hashes on its path, and only those
+  json::object_set_bool(st, z, (char *)"w", false);
+  check(!cached(z) && !cached(y) && !cached(a) && cached(b));
+  check(json::cmp(a, b) != 0);
+  json::data * changed = parse_text(st, "{\"x\":{\"y\":[1,2,{\"z\":true,\"w\":false}]},\"s\":\"str\"}");
+  check(json::cmp(a, changed) == 0 && json::hash(a) == json::hash(changed));
+
+  // an element written in place by a patch
+  json::data * doc = parse_text(st, "[[1],[2]]");
+  json::hash(doc);
+  uintptr_t error_at;
+  check(json::apply_patch(st, &doc, parse_text(st,
+        "[{\"op\":\"replace\",\"path\":\"/1/0\",\"value\":3}]"), &error_at));
+  check(json::cmp(doc, parse_text(st, "[[1],[3]]")) == 0);
+
+  // a container in two documents is not linked under either of them
+  json::data * shared = parse_text(st, "[1]");
+  json::data * d1 = parse_text(st, "[]");
+  json::data * d2 = parse_text(st, "{}");
+  json::array_append(st, d1, shared);
+  json::object_set(st, d2, (char *)"k", shared);
+  check(json::hash(d1) == json::hash(parse_text(st, "[[1]]")));
+  check(!cached(d1) && cached(shared));
+  json::array_append_number(st, shared, 2);
+  check(json::cmp(d1, parse_text(st, "[[1,2]]")) == 0);
+  check(json::cmp(d2, parse_text(st, "{\"k\":[1,2]}")) == 0);
+
+  // versions of a persistent document share what did not change
+  json::data * v1 = parse_text(st, text);
+  json::hash(v1);
+  json::data * v2 = json::persistent::set(st, v1, (char *)"/x/y/0", json::mk_number(st, 5));
+  // what is shared keeps its hash, the containers above it do not
+  check(cached(json::find(st, v1, (char *)"/x/y/2")) && !cached(v1));
+  check(json::cmp(v1, b) == 0);
+  check(json::cmp(v2, parse_text(st, "{\"x\":{\"y\":[5,2,{\"z\":true}]},\"s\":\"str\"}")) == 0);
+
+  del(st);
+  return report("test-cmp");
+}
@@ -0,0 +1,129 @@
+/* MessagePack, CBOR and the binary form
+ */
+#include "test.hpp"
+
+static const char * texts[] = {
+  "null", "true", "false", "0", "-1", "1.5", "-1e300", "4294967296",
+  "\"\"", "\"caf\xc3\xa9 \\u65e5\"", "[]", "{}",
+  "[1,[2,[3,[4]]],{\"a\":[]}]",
+  "{\"k\":{\"nested\":{\"deeper\":[true,false,null,\"s\"]}},\"n\":-0.25}",
+};
+
+/*
+ * encoding and decoding again gives the same document, and a cut off
+ * encoding does not decode
+ */
+static void round_trip (state::data * st, json::data * j, const char * text)
+{
+  uintptr_t size, at, i;
+  json::data * out;
+
+  block::data * b = json::to_msgpack(st, j, &size);
+  out = NULL;
+  check(json::from_msgpack(st, (char *)b, size, &out, &at) && json::cmp(j, out) == 0);
+  for (i = 0; i < size; i++)
+    check(!json::from_msgpack(st, (char *)b, i, &out, &at));
+
+  b = json::to_cbor(st, j, &size);
+  out = NULL;
+  check(json::from_cbor(st, (char *)b, size, &out, &at) && json::cmp(j, out) == 0);
+  for (i = 0; i < size; i++)
+    check(!json::from_cbor(st, (char *)b, i, &out, &at));
+
+  // the streaming decoder given one byte at a time
+  json::cbor::decoder * d = json::cbor::mk_decoder(st);
+  bool fed = true;
+  for (i = 0; i < size; i++)
+    fed = json::cbor::feed(d, (char *)b + i, 1) && fed;
+  out = NULL;
+  check(fed && json::cbor::finish(d, &out, &at) && json::cmp(j, out) == 0);
+
+  b = json::to_binary(st, j, &size);
+  struct json::binary::value v;
+  out = NULL;
+  check(json::binary::open((char *)b, size, &v) && json::binary::to_json(st, v, &out)
+        && json::cmp(j, out) == 0);
+  /*
+   * a cut off document is read within its bounds, but a record that is
+   * cut off reads as empty, so it need not fail
+   */
+  for (i = 0; i < size; i++) {
+    if (json::binary::open((char *)b, i, &v))
+      json::binary::to_json(st, v, &out);
+    else
+      check(i < 16);
+  }
+  if (failures)
+    printf("  %s\n", text);
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  uintptr_t i, size, at;
+  for (i = 0; i < sizeof(texts)/sizeof(texts[0]); i++) {
+    json::data * j = parse_text(st, texts[i]);
+    check(j != NULL);
+    if (j)
+      round_trip(st, j, texts[i]);
+  }
+
+  // a wide and a deep document
+  json::data * wide = json::mk_object(st);
+  char key[32];
+  for (i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key%d", (int)i);
+    json::object_set_number(st, wide, key, i * 0.5);
+  }
+  round_trip(st, wide, "1000 members");
+  json::data * deep = json::mk_array(st, 1);
+  for (i = 0; i < 200; i++) {
+    json::data * a = json::mk_array(st, 1);
+    json::array_append(st, a, deep);
+    deep = a;
+  }
+  round_trip(st, deep, "200 arrays deep");
+
+  // binary access in place
+  json::data * j = parse_text(st, "{\"b\":[10,\"x\"],\"a\":true}");
+  block::data * b = json::to_binary(st, j, &size);
+  struct json::binary::value root, v, e;
+  char * s, * k;
+  uintptr_t len;
+  double d;
+  bool t;
+  check(json::binary::open((char *)b, size, &root));
+  check(json::binary::type_of(root) == json::type_is_object && json::binary::size(root) == 2);
+  check(json::binary::member(root, 0, &k, &v) && strcmp(k, "a") == 0);
+  check(json::binary::get_bool(v, &t) && t);
+  check(json::binary::find(root, (char *)"b", &v) && json::binary::size(v) == 2);
+  check(json::binary::at(v, 0, &e) && json::binary::get_number(e, &d) && d == 10);
+  check(json::binary::at(v, 1, &e) && json::binary::get_string(e, &s, &len)
+        && len == 1 && strcmp(s, "x") == 0);
+  check(!json::binary::at(v, 2, &e));
+  check(!json::binary::find(root, (char *)"c", &v));
+  // a string that is not terminated inside the document is rejected
+  s[1] = 'y';
+  check(!json::binary::get_string(e, &s, &len));
+  k[1] = 'z';
+  check(!json::binary::member(root, 0, &k, &v));
+  check(!json::binary::find(root, (char *)"a", &v));
+
+  // malformed input
+  char junk[] = "\xc1\xff\x1f";
+  json::data * out = NULL;
+  check(!json::from_msgpack(st, junk, 1, &out, &at));
+  check(!json::from_cbor(st, junk + 1, 1, &out, &at));
+  check(!json::from_cbor(st, junk + 2, 1, &out, &at));
+  check(!json::binary::open(junk, 3, &root));
+  // strings that are not UTF-8 or have a '\0' in them
+  char bad[] = "\xa2\xc3\x28";
+  check(!json::from_msgpack(st, bad, 3, &out, &at));
+  char nul[] = "\xa2x\0";
+  check(!json::from_msgpack(st, nul, 3, &out, &at));
+  char text_nul[] = "\x62x\0";
+  check(!json::from_cbor(st, text_nul, 3, &out, &at));
+
+  del(st);
+  return report("test-codec");
+}
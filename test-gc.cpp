@@ -0,0 +1,178 @@
+/* Collections with live roots
+ */
+#include "test.hpp"
+#include <malloc.h>
+
+static uintptr_t live (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_live;
+}
+
+static const char * text =
+  "{\"a\":[1,2,{\"b\":\"str\"}],\"c\":{\"d\":[true,null,\"x\"]},\"e\":\"long string\"}";
+
+/*
+ * garbage of n parsed documents that nothing refers to
+ */
+static void litter (state::data * st, int n)
+{
+  for (int i = 0; i < n; i++)
+    parse_text(st, text);
+}
+
+/*
+ * a member of the root, without the pointer cache that would stay live
+ */
+static json::data * member (json::data * root, const char * key)
+{
+  return (json::data *)map::find(root->value.object, (void *)key);
+}
+
+/*
+ * the rooted document still prints as it did
+ */
+static void intact (state::data * st, json::data * root, const char * expect)
+{
+  char * s = print_text(st, root, json::compact);
+  check(strcmp(s, expect) == 0);
+  free(s);
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  json::data * root = parse_text(st, text);
+  state::add_gc_root(st, root);
+  char * expect = print_text(st, root, json::compact);
+  uintptr_t n;
+
+  // a full collection keeps the root and frees the rest
+  state::gc(st);
+  n = live(st);
+  litter(st, 100);
+  check(live(st) > n);
+  state::gc(st);
+  check(live(st) == n);
+  intact(st, root, expect);
+
+  /*
+   * an incremental collection with the mutator running between steps,
+   * values stored into the root while marking survive
+   */
+  litter(st, 100);
+  int steps = 0;
+  while (!state::gc_step(st, 10)) {
+    if (steps == 3)
+      json::object_set(st, root, (char *)"new", parse_text(st, "[1,{\"k\":\"v\"}]"));
+    if (steps == 5)
+      litter(st, 10);
+    steps++;
+  }
+  check(steps > 5);
+  state::gc(st);
+  check(json::cmp(member(root, "new"), parse_text(st, "[1,{\"k\":\"v\"}]")) == 0);
+  map::remove(root->value.object, (void *)"new");
+  state::gc(st);
+  check(live(st) == n);
+  intact(st, root, expect);
+
+  // a minor collection keeps a young value stored into an old container
+  litter(st, 100);
+  json::data * young = parse_text(st, "{\"young\":[1,2,3]}");
+  json::object_set(st, root, (char *)"y", young);
+  state::gc_minor(st);
+  check(json::cmp(member(root, "y"), parse_text(st, "{\"young\":[1,2,3]}")) == 0);
+  map::remove(root->value.object, (void *)"y");
+  state::gc(st);
+  check(live(st) == n);
+  intact(st, root, expect);
+
+  // young garbage alone is collected by a minor collection
+  litter(st, 100);
+  state::gc_minor(st);
+  check(live(st) == n);
+
+  // a parallel collection
+  for (unsigned threads = 1; threads <= 4; threads++) {
+    litter(st, 200);
+    json::object_set(st, root, (char *)"p", parse_text(st, "[[[\"deep\"]]]"));
+    state::gc_parallel(st, threads);
+    check(json::cmp(member(root, "p"), parse_text(st, "[[[\"deep\"]]]")) == 0);
+    map::remove(root->value.object, (void *)"p");
+    state::gc_parallel(st, threads);
+    check(live(st) == n);
+    intact(st, root, expect);
+  }
+
+  /*
+   * objects freed while they are on the grey list or in the remembered
+   * set are taken off it
+   */
+  json::data * big = json::mk_array(st, 2000);
+  for (int i = 0; i < 2000; i++)
+    json::array_append(st, big, parse_text(st, "{\"k\":[1]}"));
+  json::object_set(st, root, (char *)"big", big);
+  state::gc(st);
+  for (int i = 0; i < 2000; i++)
+    json::object_set(st, (json::data *)big->value.array->_[i], (char *)"young",
+                     parse_text(st, "[2]"));
+  check(!state::gc_step(st, 1000));
+  map::remove(root->value.object, (void *)"big");
+  while (!state::gc_step(st, 100))
+    ;
+  state::gc(st);
+  check(live(st) == n);
+  intact(st, root, expect);
+
+  /*
+   * the same for a minor collection, with new objects that may take the
+   * addresses of the freed ones and are remembered again
+   */
+  big = json::mk_array(st, 2000);
+  for (int i = 0; i < 2000; i++)
+    json::array_append(st, big, parse_text(st, "{\"k\":[1]}"));
+  json::object_set(st, root, (char *)"big", big);
+  state::gc(st);
+  for (int i = 0; i < 2000; i++)
+    json::object_set(st, (json::data *)big->value.array->_[i], (char *)"young",
+                     parse_text(st, "[2]"));
+  map::remove(root->value.object, (void *)"big");
+  state::gc(st);
+  big = json::mk_array(st, 2000);
+  for (int i = 0; i < 2000; i++)
+    json::array_append(st, big, parse_text(st, "{\"k\":[1]}"));
+  json::object_set(st, root, (char *)"big", big);
+  state::gc_minor(st);
+  for (int i = 0; i < 2000; i++)
+    json::object_set(st, (json::data *)big->value.array->_[i], (char *)"young",
+                     parse_text(st, "[2]"));
+  state::gc_minor(st);
+  for (int i = 0; i < 2000; i++)
+    check(json::cmp((json::data *)big->value.array->_[i],
+                    parse_text(st, "{\"k\":[1],\"young\":[2]}")) == 0);
+  map::remove(root->value.object, (void *)"big");
+  state::gc(st);
+  check(live(st) == n);
+  intact(st, root, expect);
+
+  // the memory of what is collected goes back to malloc
+  state::gc(st);
+  size_t before = mallinfo2().uordblks;
+  litter(st, 5000);
+  check(mallinfo2().uordblks > before + 1024 * 1024);
+  state::gc(st);
+  // each size class may keep its current 64K slab, which need not be
+  // the one it had before
+  check(mallinfo2().uordblks < before + 4 * 64 * 1024);
+
+  // a root that is removed is collected
+  state::remove_gc_root(st, root);
+  state::gc(st);
+  check(live(st) < n);
+
+  free(expect);
+  del(st);
+  return report("test-gc");
+}
@@ -0,0 +1,93 @@
+/* On demand access
+ */
+#include "test.hpp"
+
+/*
+ * true if field z of the object in text is reached, the fields before it
+ * are skipped
+ */
+static bool reaches_z(const char * text)
+{
+  char buf[256];
+  struct json::ondemand::document doc;
+  struct json::ondemand::object o;
+  struct json::ondemand::value v;
+  strcpy(buf, text);
+  struct json::ondemand::value root = json::ondemand::init(&doc, buf, strlen(buf));
+  double d;
+  return json::ondemand::get_object(root, &o)
+    && json::ondemand::find_field(&o, (char *)"z", &v)
+    && json::ondemand::get_number(v, &d) && d == 1;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  char text[] = "{\"a\":\"x\",\"b\":[1,true,null],\"c\":{\"d\":2.5}}";
+  struct json::ondemand::document doc;
+  struct json::ondemand::value root = json::ondemand::init(&doc, text, strlen(text));
+  struct json::ondemand::object o;
+  struct json::ondemand::value v;
+  str::data * s = NULL;
+
+  check(json::ondemand::get_object(root, &o));
+  check(json::ondemand::find_field(&o, (char *)"a", &v));
+  check(json::ondemand::type_of(v) == json::type_is_string);
+  check(json::ondemand::get_string(st, v, &s) && strcmp(s->_, "x") == 0);
+
+  // a value read once is consumed, reading it again fails
+  check(json::ondemand::type_of(v) == json::type_is_undefined);
+  check(!json::ondemand::get_string(st, v, &s));
+  check(!json::ondemand::get_string(st, v, &s));
+
+  // the error sticks to the document
+  check(!json::ondemand::find_field(&o, (char *)"c", &v));
+
+  char again[] = "{\"a\":\"x\",\"b\":[1,true,null],\"c\":{\"d\":2.5}}";
+  root = json::ondemand::init(&doc, again, strlen(again));
+  struct json::ondemand::array a;
+  double d;
+  bool b;
+  check(json::ondemand::get_object(root, &o));
+  check(json::ondemand::find_field(&o, (char *)"b", &v));
+  check(json::ondemand::get_array(v, &a));
+  check(json::ondemand::next_element(&a, &v) && json::ondemand::get_number(v, &d) && d == 1);
+  check(!json::ondemand::get_number(v, &d));
+
+  root = json::ondemand::init(&doc, again, strlen(again));
+  check(json::ondemand::get_object(root, &o));
+  check(json::ondemand::find_field(&o, (char *)"b", &v));
+  check(json::ondemand::get_array(v, &a));
+  check(json::ondemand::next_element(&a, &v));
+  check(json::ondemand::next_element(&a, &v) && json::ondemand::get_bool(v, &b) && b);
+  check(json::ondemand::next_element(&a, &v) && json::ondemand::is_null(v));
+  check(!json::ondemand::next_element(&a, &v));
+  // the fields after the skipped array can still be reached
+  check(json::ondemand::find_field(&o, (char *)"c", &v));
+  json::data * j = NULL;
+  check(json::ondemand::materialize(st, v, &j) && j);
+  if (j)
+    check(json::to_double(json::find(st, j, (char *)"/d")) == 2.5);
+
+  // skipping matches brackets by kind and checks literals and comments
+  check(reaches_z("{\"a\":{\"b\":[true,false,null,-1.5e3]},\"z\":1}"));
+  check(reaches_z("{\"a\":[1, // ] } \" [\n 2],\"z\":1}"));
+  check(!reaches_z("{\"a\":[1,2},\"z\":1}"));
+  check(!reaches_z("{\"a\":{\"b\":1],\"z\":1}"));
+  check(!reaches_z("{\"a\":xyz,\"z\":1}"));
+  check(!reaches_z("{\"a\":[truex],\"z\":1}"));
+  check(!reaches_z("{\"a\":[01],\"z\":1}"));
+  check(!reaches_z("{\"a\":[1 / 2],\"z\":1}"));
+
+  // the rest of an entered container is skipped up to its own bracket
+  char mismatched[] = "{\"a\":[1,2},\"z\":1}";
+  root = json::ondemand::init(&doc, mismatched, strlen(mismatched));
+  check(json::ondemand::get_object(root, &o));
+  check(json::ondemand::find_field(&o, (char *)"a", &v));
+  check(json::ondemand::get_array(v, &a));
+  check(json::ondemand::next_element(&a, &v));
+  check(!json::ondemand::find_field(&o, (char *)"z", &v));
+
+  del(st);
+  return report("test-ondemand");
+}
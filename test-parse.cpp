@@ -0,0 +1,137 @@
+/* Parsing and printing
+ */
+#include "test.hpp"
+
+/*
+ * printing the parsed text and parsing the print again gives the same
+ * document and the same print
+ */
+static void round_trip (state::data * st, const char * text)
+{
+  json::data * j = parse_text(st, text);
+  check(j != NULL);
+  if (j == NULL) {
+    printf("  does not parse: %s\n", text);
+    return;
+  }
+  enum json::format how[2] = { json::compact, json::readable };
+  for (int i = 0; i < 2; i++) {
+    char * once = print_text(st, j, how[i]);
+    json::data * k = parse_text(st, once);
+    check(k != NULL);
+    if (k == NULL)
+      printf("  does not parse again: %s\n", once);
+    if (k) {
+      char * twice = print_text(st, k, how[i]);
+      check(strcmp(once, twice) == 0);
+      check(json::cmp(parse_text(st, once), k) == 0);
+      free(twice);
+    }
+    free(once);
+  }
+}
+
+/*
+ * a number inside depth arrays, "[[1]]" for depth 2
+ */
+static char * nested (int depth)
+{
+  char * s = (char *)malloc(2 * depth + 2);
+  int i;
+  for (i = 0; i < depth; i++) {
+    s[i] = '[';
+    s[depth + 1 + i] = ']';
+  }
+  s[depth] = '1';
+  s[2 * depth + 1] = '\0';
+  return s;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+
+  const char * texts[] = {
+    "{}", "[]", "0", "-0", "1.5", "-12e3", "true", "false", "null", "\"\"",
+    "\"tab\\tnew\\nline \\\"quoted\\\" \\\\ \\/ \\u00e9 \\u65e5 caf\xc3\xa9\"",
+    "[1,2,3,[4,[5,[6]]],{\"a\":{\"b\":{\"c\":[]}}}]",
+    "{\"b\":true,\"a1\":[\"false\",\"true\"],\"s1\":\"xxx\\n\",\"y1\":{\"s2\":\"yyy\"}}",
+    "[\"\\u0001\\u001f\", {\"\": \"empty key\"}, -1.25e-10, 1E+2]",
+    " \n\t[ 1 , { \"k\" : null } ]\r\n",
+    "// a comment\n[1, // another\n 2]",
+  };
+  for (unsigned i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+    round_trip(st, texts[i]);
+
+  const char * bad[] = {
+    "", "[", "]", "{", "[,]", "{\"a\"}", "{\"a\":}", "{1:2}", "[1 2]",
+    "tru", "nul", "\"unterminated", "\"bad \\x escape\"", "[1]]", "{}{}",
+    "-", "1.", ".5", "1e", "--1", "\"\x01\"", "\"\xff\"",
+  };
+  for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    check(parse_text(st, bad[i]) == NULL);
+    if (parse_text(st, bad[i]))
+      printf("  parses: %s\n", bad[i]);
+  }
+
+  // a trailing comma has always been let through
+  check(parse_text(st, "[1,]") != NULL);
+  check(parse_text(st, "{\"a\":1,}") != NULL);
+
+  // MAX_JSON_DEPTH containers may be open at once, one more may not
+  char * s = nested(MAX_JSON_DEPTH);
+  check(parse_text(st, s) != NULL);
+  round_trip(st, s);
+  free(s);
+  s = nested(MAX_JSON_DEPTH + 1);
+  check(parse_text(st, s) == NULL);
+  free(s);
+
+  // numbers are never cut short, however many digits they have
+  char big[256] = "[0.";
+  memset(big + 3, '1', 80);
+  strcpy(big + 83, "]");
+  json::data * j = parse_text(st, big);
+  check(j != NULL);
+  if (j) {
+    double d = json::to_double((json::data *)j->value.array->_[0]);
+    check(d > 0.1111111 && d < 0.1111112);
+  }
+  char digits[256] = "[";
+  memset(digits + 1, '9', 100);
+  strcpy(digits + 101, ",-1.");
+  memset(digits + 105, '5', 100);
+  strcpy(digits + 205, "e-3]");
+  j = parse_text(st, digits);
+  check(j != NULL && list::size(j->value.array) == 2);
+  if (j) {
+    check(json::to_double((json::data *)j->value.array->_[0]) > 9.9e99);
+    check(json::to_double((json::data *)j->value.array->_[1]) < -0.00155);
+  }
+  check(parse_text(st, "[1.5e]") == NULL);
+  check(parse_text(st, "[01]") == NULL);
+
+  // the blocks a long string outgrows while it is read are not kept
+  state::data * fresh = state::mk(10);
+  size_t n = 100000;
+  char * text = (char *)malloc(n + 5);
+  strcpy(text, "[\"");
+  memset(text + 2, 'x', n);
+  strcpy(text + 2 + n, "\"]");
+  j = parse_text(fresh, text);
+  check(j != NULL);
+  struct state::stats usage;
+  state::stats(fresh, &usage);
+  check(usage.live_bytes < 2 * n && usage.peak_bytes < 4 * n);
+  free(text);
+  del(fresh);
+
+  // the parse of a prefix with force_eof false
+  int line;
+  j = NULL;
+  check(json::parse(st, (char *)"[1] trailing", 12, &j, false, &line) && j);
+  check(!json::parse(st, (char *)"[1] trailing", 12, &j, true, &line));
+
+  del(st);
+  return report("test-parse");
+}
@@ -0,0 +1,184 @@
+/* JSON Patch and JSON Merge Patch
+ */
+#include "test.hpp"
+
+/*
+ * apply patch to doc and compare the result with expect, or check that
+ * the patch fails at error_at and leaves doc as it was when expect is NULL
+ */
+static void patched (state::data * st, const char * doc, const char * patch,
+                     const char * expect, uintptr_t error_at = 0)
+{
+  json::data * d = parse_text(st, doc), * p = parse_text(st, patch);
+  uintptr_t at = (uintptr_t)-1;
+  check(d != NULL && p != NULL);
+  if (d == NULL || p == NULL)
+    return;
+  bool ok = json::apply_patch(st, &d, p, &at);
+  if (expect) {
+    check(ok);
+    check(json::cmp(d, parse_text(st, expect)) == 0);
+  }
+  else {
+    check(!ok);
+    check(at == error_at);
+    check(json::cmp(d, parse_text(st, doc)) == 0);
+  }
+  if (ok != (expect != NULL))
+    printf("  %s with %s\n", doc, patch);
+}
+
+static uintptr_t live (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_live;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+
+  // the examples of RFC 6902 appendix A
+  patched(st, "{\"foo\":\"bar\"}",
+          "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]",
+          "{\"baz\":\"qux\",\"foo\":\"bar\"}");
+  patched(st, "{\"foo\":[\"bar\",\"baz\"]}",
+          "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]",
+          "{\"foo\":[\"bar\",\"qux\",\"baz\"]}");
+  patched(st, "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+          "[{\"op\":\"remove\",\"path\":\"/baz\"}]",
+          "{\"foo\":\"bar\"}");
+  patched(st, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+          "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]",
+          "{\"foo\":[\"bar\",\"baz\"]}");
+  patched(st, "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+          "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]",
+          "{\"baz\":\"boo\",\"foo\":\"bar\"}");
+  patched(st, "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+          "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]",
+          "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}");
+  patched(st, "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+          "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]",
+          "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}");
+  patched(st, "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+          "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},"
+          "{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]",
+          "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}");
+  patched(st, "{\"baz\":\"qux\"}",
+          "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", NULL);
+  patched(st, "{\"foo\":\"bar\"}",
+          "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]",
+          "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}");
+  patched(st, "{\"foo\":\"bar\"}",
+          "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\",\"xyz\":123}]",
+          "{\"foo\":\"bar\",\"baz\":\"qux\"}");
+  patched(st, "{\"foo\":\"bar\"}",
+          "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", NULL);
+  patched(st, "{\"/\":9,\"~1\":10}",
+          "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]",
+          "{\"/\":9,\"~1\":10}");
+  patched(st, "{\"/\":9,\"~1\":10}",
+          "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":\"10\"}]", NULL);
+  patched(st, "{\"foo\":[\"bar\"]}",
+          "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]",
+          "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}");
+
+  // the whole document, copies and moves into a descendant
+  patched(st, "{\"a\":1}",
+          "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1,2]}]", "[1,2]");
+  patched(st, "{\"a\":{\"b\":1}}",
+          "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"}]",
+          "{\"a\":{\"b\":1},\"c\":{\"b\":1}}");
+  patched(st, "{\"a\":{\"b\":1}}",
+          "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b/c\"}]", NULL);
+  patched(st, "{\"a\":[1]}",
+          "[{\"op\":\"remove\",\"path\":\"/a/1\"}]", NULL);
+  patched(st, "{\"a\":[1]}",
+          "[{\"op\":\"replace\",\"path\":\"/b\",\"value\":1}]", NULL);
+  patched(st, "{}", "[{\"op\":\"frob\",\"path\":\"\"}]", NULL);
+  patched(st, "{}", "{\"op\":\"add\",\"path\":\"\",\"value\":1}", NULL);
+
+  // every change made before the failing operation is taken back
+  patched(st, "{\"a\":[1,2,3],\"b\":{\"c\":{\"d\":4}}}",
+          "[{\"op\":\"add\",\"path\":\"/a/0\",\"value\":0},"
+          "{\"op\":\"remove\",\"path\":\"/a/3\"},"
+          "{\"op\":\"replace\",\"path\":\"/b/c/d\",\"value\":5},"
+          "{\"op\":\"move\",\"from\":\"/b/c\",\"path\":\"/e\"},"
+          "{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/a/-\"},"
+          "{\"op\":\"remove\",\"path\":\"/b\"},"
+          "{\"op\":\"test\",\"path\":\"/e/d\",\"value\":4}]", NULL, 6);
+  patched(st, "{\"a\":{\"b\":[1]}}",
+          "[{\"op\":\"replace\",\"path\":\"\",\"value\":{\"x\":1}},"
+          "{\"op\":\"move\",\"from\":\"/x\",\"path\":\"\"},"
+          "{\"op\":\"add\",\"path\":\"/y\",\"value\":1}]", NULL, 2);
+  patched(st, "{\"a\":{\"b\":[1]}}",
+          "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"\"},"
+          "{\"op\":\"add\",\"path\":\"/b/-\",\"value\":2},"
+          "{\"op\":\"test\",\"path\":\"/b/1\",\"value\":3}]", NULL, 2);
+
+  // failed patches and merges release what they made
+  json::data * d = parse_text(st, "{\"a\":{\"b\":[1]}}");
+  json::data * p = parse_text(st,
+    "[{\"op\":\"replace\",\"path\":\"\",\"value\":{\"x\":[1,2,3]}},"
+    "{\"op\":\"add\",\"path\":\"/x/9\",\"value\":{\"y\":[4,5]}}]");
+  json::data * m = parse_text(st, "[1,{\"z\":2}]");
+  uintptr_t at, n, i;
+  check(!json::apply_patch(st, &d, p, &at));
+  n = live(st);
+  for (i = 0; i < 1000; i++)
+    json::apply_patch(st, &d, p, &at);
+  check(live(st) == n);
+  check(json::cmp(d, parse_text(st, "{\"a\":{\"b\":[1]}}")) == 0);
+
+  json::merge_patch(st, &d, m);
+  n = live(st);
+  for (i = 0; i < 1000; i++)
+    json::merge_patch(st, &d, m);
+  check(live(st) == n);
+  check(json::cmp(d, m) == 0);
+
+  // RFC 7386 merges
+  d = parse_text(st, "{\"a\":\"b\",\"c\":{\"d\":\"e\",\"f\":\"g\"}}");
+  json::merge_patch(st, &d, parse_text(st, "{\"a\":\"z\",\"c\":{\"f\":null}}"));
+  check(json::cmp(d, parse_text(st, "{\"a\":\"z\",\"c\":{\"d\":\"e\"}}")) == 0);
+  d = parse_text(st, "[1]");
+  json::merge_patch(st, &d, parse_text(st, "{\"a\":{\"b\":null},\"c\":[]}"));
+  check(json::cmp(d, parse_text(st, "{\"a\":{},\"c\":[]}")) == 0);
+
+  // a diff applied to a copy of a gives b
+  const char * pairs[][2] = {
+    { "{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"e\"}}",
+      "{\"a\":2,\"b\":[1,3,4],\"c\":{\"d\":\"e\",\"f\":null}}" },
+    { "[1,2,3,4,5]", "[0,1,3,5,6]" },
+    { "{\"a\":[{\"x\":1}]}", "[\"a\"]" },
+    { "{\"a/b\":{\"~\":1}}", "{\"a/b\":{\"~\":2}}" },
+  };
+  for (i = 0; i < sizeof(pairs)/sizeof(pairs[0]); i++) {
+    json::data * a = parse_text(st, pairs[i][0]), * b = parse_text(st, pairs[i][1]);
+    d = json::clone(st, a);
+    check(json::apply_patch(st, &d, json::diff(st, a, b), &at));
+    check(json::cmp(d, b) == 0);
+    check(list::size(json::diff(st, b, json::clone(st, b))->value.array) == 0);
+  }
+
+  // the diff leaves the hashes cached in the unchanged parts alone
+  json::data * a = parse_text(st, "[]"), * b;
+  for (i = 0; i < 100; i++)
+    json::array_append(st, a, parse_text(st, "{\"k\":[1,2,{\"l\":3}]}"));
+  b = json::clone(st, a);
+  json::object_set_number(st, json::find(st, b, (char *)"/50/k/2"), (char *)"m", 4);
+  json::hash(a);
+  json::hash(b);
+  check(list::size(json::diff(st, a, b)->value.array) == 1);
+  uint64_t h;
+  for (i = 0; i < 100; i++) {
+    char path[16];
+    snprintf(path, sizeof(path), "/%u", (unsigned)i);
+    check(i == 50 || tagged::recall((tagged::data *)json::find(st, a, path), &h));
+    check(i == 50 || tagged::recall((tagged::data *)json::find(st, b, path), &h));
+  }
+
+  del(st);
+  return report("test-patch");
+}
@@ -0,0 +1,76 @@
+/* JSON Pointer
+ */
+#include "test.hpp"
+
+static uintptr_t live (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_live;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+
+  // the examples of RFC 6901 section 5
+  json::data * j = parse_text(st,
+    "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"c%d\":2,\"e^f\":3,"
+    "\"g|h\":4,\"i\\\\j\":5,\"k\\\"l\":6,\" \":7,\"m~n\":8}");
+  check(j != NULL);
+  check(json::find(st, j, (char *)"") == j);
+  check(json::cmp(json::find(st, j, (char *)"/foo"), parse_text(st, "[\"bar\",\"baz\"]")) == 0);
+  check(strcmp(json::to_string(json::find(st, j, (char *)"/foo/0"))->_, "bar") == 0);
+  const char * paths[] = { "/", "/a~1b", "/c%d", "/e^f", "/g|h", "/i\\j", "/k\"l", "/ ", "/m~0n" };
+  for (int i = 0; i < 9; i++)
+    check(json::to_double(json::find(st, j, (char *)paths[i])) == i);
+  check(json::find(st, j, (char *)"/foo/2") == NULL);
+  check(json::find(st, j, (char *)"/foo/01") == NULL);
+  check(json::find(st, j, (char *)"/foo/-") == NULL);
+  check(json::find(st, j, (char *)"/x~2") == NULL);
+  check(json::find(st, j, (char *)"foo") == NULL);
+  check(json::get(st, j, (char *)"/nope", j) == j);
+  check(json::find(st, j, (char *)"/foo/9223372036854775807") == NULL);
+  check(json::find(st, j, (char *)"/foo/99999999999999999999") == NULL);
+
+  // the state does not keep every path it has seen
+  char path[32];
+  uintptr_t n = 0, i;
+  for (i = 0; i < 10000; i++) {
+    snprintf(path, sizeof(path), "/foo/%d", (int)i);
+    json::find(st, j, path);
+    if (i == 2000)
+      n = live(st);
+  }
+  check(live(st) <= n);
+
+  // a pointer that is held stays in the cache
+  json::pointer::data * held = json::pointer::compile(st, (char *)"/foo/1");
+  incr_indegree(dp_del_rc, held);
+  for (i = 0; i < 2000; i++) {
+    snprintf(path, sizeof(path), "/x%d", (int)i);
+    json::pointer::compile(st, path);
+  }
+  check(json::pointer::compile(st, (char *)"/foo/1") == held);
+  check(strcmp(json::to_string(json::pointer::eval(held, j))->_, "baz") == 0);
+  del_ref(held);
+
+  // a patch uses more paths than the cache holds and is taken back
+  json::data * d = parse_text(st, "{\"a\":{}}");
+  json::data * p = json::mk_array(st, 3000);
+  for (i = 0; i < 3000; i++) {
+    snprintf(path, sizeof(path), "/a/k%d", (int)i);
+    json::data * op = json::mk_object(st);
+    json::object_set_string(st, op, (char *)"op", (char *)"add");
+    json::object_set_string(st, op, (char *)"path", path);
+    json::object_set_number(st, op, (char *)"value", i);
+    json::array_append(st, p, op);
+  }
+  json::array_append(st, p, parse_text(st, "{\"op\":\"remove\",\"path\":\"/b\"}"));
+  uintptr_t at;
+  check(!json::apply_patch(st, &d, p, &at) && at == 3000);
+  check(json::cmp(d, parse_text(st, "{\"a\":{}}")) == 0);
+
+  del(st);
+  return report("test-pointer");
+}
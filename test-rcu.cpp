@@ -0,0 +1,100 @@
+/* Publication of roots to concurrent readers
+ */
+#include "test.hpp"
+#include <pthread.h>
+
+static uintptr_t live (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_live;
+}
+
+static json::data * version (state::data * st, json::data * root, int n)
+{
+  return json::persistent::set(st, root, (char *)"/n", json::mk_number(st, n));
+}
+
+static int number (json::data * root)
+{
+  return (int)json::to_double((json::data *)map::find(root->value.object, (void *)"n"));
+}
+
+static int done = 0;
+
+/*
+ * the versions a reader sees only go forward
+ */
+static void * reading (void * cxt)
+{
+  json::rcu::domain * d = (json::rcu::domain *)cxt;
+  json::rcu::reader * r = json::rcu::join(d);
+  int last = 0, bad = 0;
+  while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+    int n = number(json::rcu::read_lock(r));
+    json::rcu::read_unlock(r);
+    if (n < last)
+      bad++;
+    last = n;
+  }
+  json::rcu::leave(r);
+  return (void *)(intptr_t)bad;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  json::data * v = parse_text(st, "{\"n\":0,\"doc\":{\"a\":[1,2,3]}}");
+  json::rcu::domain * d = json::rcu::mk_domain(st, v, 4);
+  state::gc(st);
+  uintptr_t n = live(st);
+  check(number(v) == 0);
+
+  // a reader slot takes a cache line
+  json::rcu::reader * r = json::rcu::join(d), * r2 = json::rcu::join(d);
+  check(r && r2 && (uintptr_t)r % 64 == 0 && (uintptr_t)r2 - (uintptr_t)r == 64);
+  json::rcu::leave(r2);
+
+  // the current root and the retired ones a reader may see are kept by gc
+  check(json::rcu::read_lock(r) == v);
+  json::data * v1 = version(st, v, 1);
+  json::rcu::publish(d, v1);
+  check(json::rcu::reclaim(d) == 1);
+  state::gc(st);
+  check(number(v) == 0 && number(v1) == 1);
+  json::rcu::read_unlock(r);
+  check(json::rcu::reclaim(d) == 0);
+  check(json::rcu::read_lock(r) == v1);
+  json::rcu::read_unlock(r);
+  json::rcu::publish(d, v1);
+  check(json::rcu::reclaim(d) == 0 && number(v1) == 1);
+  json::rcu::leave(r);
+
+  // readers in threads while versions are published and collected
+  pthread_t t[3];
+  int i;
+  for (i = 0; i < 3; i++)
+    pthread_create(t + i, NULL, reading, d);
+  json::data * cur = v1;
+  for (i = 2; i < 2000; i++) {
+    cur = version(st, cur, i);
+    json::rcu::publish(d, cur);
+  }
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < 3; i++) {
+    void * bad;
+    pthread_join(t[i], &bad);
+    check(bad == NULL);
+  }
+  check(json::rcu::reclaim(d) == 0);
+
+  // the domain gives back its current root
+  check(json::rcu::del_domain(d) == cur);
+  check(number(cur) == 1999);
+  del(cur);
+  state::gc(st);
+  check(live(st) < n);
+
+  del(st);
+  return report("test-rcu");
+}
@@ -0,0 +1,105 @@
+/* Documents shared between threads
+ */
+#include "test.hpp"
+#include <pthread.h>
+
+static uintptr_t live (state::data * st)
+{
+  struct state::stats s;
+  state::stats(st, &s);
+  return s.n_live;
+}
+
+/*
+ * read the document a few times and drop the reference of the thread
+ */
+static void * reading (void * cxt)
+{
+  json::data * j = (json::data *)cxt;
+  int i, bad = 0;
+  for (i = 0; i < 100; i++) {
+    json::data * a = (json::data *)map::find(j->value.object, (void *)"a");
+    if (a == NULL || list::size(a->value.array) != 3)
+      bad++;
+  }
+  del_ref(j);
+  return (void *)(intptr_t)bad;
+}
+
+/*
+ * take and drop references to the document, it holds one of its own
+ */
+static void * referencing (void * cxt)
+{
+  json::data * j = (json::data *)cxt;
+  int i;
+  for (i = 0; i < 1000; i++) {
+    incr_indegree(dp_del_rc, j);
+    del_ref(j);
+  }
+  return NULL;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  const char * text = "{\"a\":[1,\"two\",{\"three\":3}],\"b\":\"bee\"}";
+  uintptr_t n = live(st);
+  int round, i;
+
+  json::data * j = parse_text(st, text);
+  json::share(j);
+  check(get_rc(j) == 0);
+  incr_indegree(dp_del_rc, j);
+  incr_indegree(dp_del_rc, j);
+  check(get_rc(j) == 2);
+  del_ref(j);
+  check(get_rc(j) == 1 && json::cmp(j, parse_text(st, text)) == 0);
+  del_ref(j);
+
+  /*
+   * the last reference is dropped by one of the threads while this one
+   * allocates and frees
+   */
+  for (round = 0; round < 200; round++) {
+    pthread_t t[4];
+    j = parse_text(st, text);
+    json::share(j);
+    for (i = 0; i < 4; i++)
+      incr_indegree(dp_del_rc, j);
+    for (i = 0; i < 4; i++)
+      pthread_create(t + i, NULL, reading, j);
+    for (i = 0; i < 20; i++)
+      del(parse_text(st, text));
+    for (i = 0; i < 4; i++) {
+      void * bad;
+      pthread_join(t[i], &bad);
+      check(bad == NULL);
+    }
+  }
+  state::gc(st);
+  check(live(st) == n);
+
+  // references are taken while this thread collects incrementally
+  j = parse_text(st, text);
+  json::share(j);
+  incr_indegree(dp_del_rc, j);
+  state::add_gc_root(st, j);
+  for (round = 0; round < 20; round++) {
+    pthread_t t[4];
+    for (i = 0; i < 4; i++)
+      pthread_create(t + i, NULL, referencing, j);
+    while (!state::gc_step(st, 1))
+      ;
+    for (i = 0; i < 4; i++)
+      pthread_join(t[i], NULL);
+  }
+  check(get_rc(j) == 1 && json::cmp(j, parse_text(st, text)) == 0);
+  state::remove_gc_root(st, j);
+  del_ref(j);
+  state::gc(st);
+  check(live(st) == n);
+
+  del(st);
+  return report("test-share");
+}
@@ -0,0 +1,86 @@
+/* validate accepts nothing parse rejects
+ */
+#include "test.hpp"
+
+static int cross_check (state::data * st, const char * text, size_t len)
+{
+  uintptr_t at;
+  int line;
+  json::data * j = NULL;
+  bool valid = json::validate((char *)text, len, &at, &line);
+  bool parsed = json::parse(st, (char *)text, len, &j, true, &line);
+  check(!valid || parsed);
+  if (valid && !parsed)
+    printf("  validates but does not parse: %.*s\n", (int)len, text);
+  return valid;
+}
+
+static uint64_t seed = 88172645463325252ULL;
+
+static uint64_t rnd (void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+int main ()
+{
+  state::data * st = state::mk(10);
+  const char * texts[] = {
+    "[0.11111111111111111111111111111111111111111111111111111111111111111111111111111111]",
+    "-123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890e-5",
+    "{\"a\":[1,2,{\"b\":null}],\"c\":\"\\u00e9\\n\",\"d\":-0.5e+3}",
+    "[]", "{}", "\"\"", "0", "true", "[true,false,null]",
+    "[1,]", "[01]", "[1.]", "[\"\\x\"]", "{\"a\" 1}", "[1]x", "\"\xc3\"",
+    "[\"\xf0\x9f\x98\x80\"]", "[\"\xed\xa0\x80\"]",
+  };
+  unsigned i, k;
+  for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+    cross_check(st, texts[i], strlen(texts[i]));
+
+  // the depth limits agree
+  char deep[2 * MAX_JSON_DEPTH + 8];
+  for (k = MAX_JSON_DEPTH; k <= MAX_JSON_DEPTH + 1; k++) {
+    memset(deep, '[', k);
+    memset(deep + k, ']', k);
+    check(cross_check(st, deep, 2 * k) == (k == MAX_JSON_DEPTH));
+  }
+
+  /*
+   * mutations of valid texts, a byte replaced, dropped or repeated
+   */
+  const char alphabet[] = "{}[]:,\"\\ 0123456789.eE+-tfnulrsa\x01\xc3\xa9";
+  unsigned n_valid = 0;
+  for (i = 0; i < 20000; i++) {
+    const char * base = texts[rnd() % 9];
+    char buf[256];
+    size_t len = strlen(base);
+    memcpy(buf, base, len);
+    for (k = rnd() % 3 + 1; k > 0 && len > 0; k--) {
+      size_t at = rnd() % len;
+      switch (rnd() % 3) {
+        case 0:
+          buf[at] = alphabet[rnd() % (sizeof(alphabet) - 1)];
+          break;
+        case 1:
+          memmove(buf + at, buf + at + 1, len - at - 1);
+          len--;
+          break;
+        default:
+          if (len < sizeof(buf) - 1) {
+            memmove(buf + at + 1, buf + at, len - at);
+            len++;
+          }
+          break;
+      }
+    }
+    n_valid += cross_check(st, buf, len);
+    if (i % 1000 == 0)
+      state::gc(st);
+  }
+  check(n_valid > 0);
+  del(st);
+  return report("test-validate");
+}
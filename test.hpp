@@ -0,0 +1,54 @@
+/* What the test programs share, each test-*.cpp is a program of its own
+ * that make test runs
+ */
+#ifndef CEE_JSON_TEST_H
+#define CEE_JSON_TEST_H
+#include "json.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace cee;
+
+static int failures = 0;
+
+#define check(c) do { \
+  if (!(c)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+    failures++; \
+  } \
+} while (0)
+
+/*
+ * parse a '\0' terminated text as a whole, NULL if it does not parse
+ */
+static json::data * parse_text (state::data * st, const char * text)
+{
+  json::data * j = NULL;
+  int line;
+  if (!json::parse(st, (char *)text, strlen(text), &j, true, &line))
+    return NULL;
+  return j;
+}
+
+/*
+ * the text of j in a malloc'ed buffer
+ */
+static char * print_text (state::data * st, json::data * j, enum json::format how)
+{
+  size_t n = json::snprint(st, NULL, 0, j, how);
+  char * buf = (char *)malloc(n + 1);
+  json::snprint(st, buf, n + 1, j, how);
+  return buf;
+}
+
+static int report (const char * name)
+{
+  if (failures)
+    printf("%s: %d checks failed\n", name, failures);
+  else
+    printf("%s: ok\n", name);
+  return failures != 0;
+}
+
+#endif // CEE_JSON_TEST_H
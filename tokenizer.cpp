@@ -3,7 +3,9 @@
 #include "json.hpp"
 #include "utf8.h"
 #include <stdlib.h>
+#include <string.h>
 #include "tokenizer.hpp"
+#include "stats.hpp"
 #endif
 
 namespace cee {
@@ -34,16 +36,20 @@ static bool read_4_digits(struct tokenizer * t, uint16_t *x)
   else
     return false;
   int i;
+  unsigned v = 0;
   for(i=0; i<4; i++) {
     char c=buf[i];
-    if(	('0'<= c && c<='9') || ('A'<= c && c<='F') || ('a'<= c && c<='f') ) {
-      continue;
-    }
-    return false;
+    if('0'<= c && c<='9')
+      v = v * 16 + (c - '0');
+    else if('A'<= c && c<='F')
+      v = v * 16 + (c - 'A' + 10);
+    else if('a'<= c && c<='f')
+      v = v * 16 + (c - 'a' + 10);
+    else
+      return false;
   }
-  unsigned v;
-  sscanf(buf,"%x",&v);
   *x=v;
+  t->buf += 4;
   return true;
 }
 
@@ -60,6 +66,7 @@ static bool parse_string(state::data * st, struct tokenizer * t) {
   if (c != '"') return false;
   bool second_surragate_expected=false;
   uint16_t first_surragate = 0;
+  bool escaped = false;
   
   for(;;) {
     if(t->buf == t->buf_end)
@@ -74,8 +81,11 @@ static bool parse_string(state::data * st, struct tokenizer * t) {
     if(c=='"')
       break;
     if(c=='\\') {
+      escaped = true;
       if(t->buf == t->buf_end)
         return false;
+      c = t->buf[0];
+      t->buf ++;
       if(second_surragate_expected && c!='u')
         return false;
       switch(c) {
@@ -93,11 +103,12 @@ static bool parse_string(state::data * st, struct tokenizer * t) {
         {
           // don't support utf16
           uint16_t x;
-          if (!read_4_digits(t, &x)) 
+          if (!read_4_digits(t, &x) || !utf_valid(x))
             return false;
         	struct utf8_seq s = { 0 };
           utf8_encode(x, &s);
-          t->str = str::ncat(t->str, s.c, s.len);
+          for (unsigned i = 0; i < s.len; i++)
+            t->str = str::add(t->str, s.c[i]);
         }
         break;
       default:
@@ -108,19 +119,41 @@ static bool parse_string(state::data * st, struct tokenizer * t) {
       t->str = str::add(t->str, c);
     }
   }
-  if(!utf8_validate(t->str->_, str::end(t->str)))
+  if(!t->utf8_checked && !utf8_validate(t->str->_, str::end(t->str)))
     return false;
+  JSON_STATS(t->stats, t->stats->n_strings++;
+                       t->stats->n_escaped_strings += escaped;
+                       t->stats->bytes_copied += str::end(t->str) - t->str->_);
   return true;
 }
 
 
+/*
+ * the number is scanned by the JSON grammar first and then copied out to
+ * be converted, the input is not required to be terminated by '\0'. A
+ * number too long for the buffer on the stack is copied to the heap.
+ */
 static bool parse_number(struct tokenizer *t) {
-  int x = sscanf(t->buf, "%lf", &t->real);
-  return x == 1;
+  char tmp[64], * copy = tmp, * end;
+  char * begin = t->buf;
+  if (!scan_number(t))
+    return false;
+  uintptr_t n = t->buf - begin;
+  if (n >= sizeof(tmp))
+    copy = (char *)malloc(n + 1);
+  memcpy(copy, begin, n);
+  copy[n] = '\0';
+  t->real = strtod(copy, &end);
+  bool ok = end == copy + n;
+  if (copy != tmp)
+    free(copy);
+  if (!ok)
+    t->buf = begin;
+  return ok;
 }
 
 enum token next_token(state::data * st, struct tokenizer * t) {
-  for (;;t->buf++) {
+  for (;;) {
     if (t->buf == t->buf_end)
       return tock_eof;
     char c = t->buf[0];
@@ -173,7 +206,7 @@ enum token next_token(state::data * st, struct tokenizer * t) {
           return tock_number;
         return tock_err;
       case '/':
-        if(check(t->buf + 1, "/", &t->buf)) {
+        if(check(t->buf, "/", &t->buf)) {
           for (;t->buf < t->buf_end && (c = t->buf[0]) && c != '\n'; t->buf++);
 
           if(c=='\n')
@@ -186,5 +219,257 @@ enum token next_token(state::data * st, struct tokenizer * t) {
     }
   }
 }
+
+int skip_space(struct tokenizer * t) {
+  for (;;) {
+    if (t->buf == t->buf_end)
+      return tock_eof;
+    char c = t->buf[0];
+    switch (c) {
+      case '\n':
+        t->line++;
+        t->buf++;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+        t->buf++;
+        break;
+      case '/':
+        if (t->buf + 1 < t->buf_end && t->buf[1] == '/') {
+          for (t->buf += 2; t->buf < t->buf_end && t->buf[0] != '\n'; t->buf++);
+          break;
+        }
+        return c;
+      default:
+        return (unsigned char)c;
+    }
+  }
+}
+
+static int hex_value(char c) {
+  if ('0' <= c && c <= '9')
+    return c - '0';
+  if ('A' <= c && c <= 'F')
+    return c - 'A' + 10;
+  if ('a' <= c && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+bool scan_string(struct tokenizer * t, char ** begin, char ** end) {
+  char * p = t->buf, * e = t->buf_end;
+  if (p == e || *p != '"')
+    return false;
+  *begin = ++p;
+  for (;;) {
+    if (p == e)
+      return false;
+    unsigned char c = *p;
+    if (c == '"')
+      break;
+    if (c < 0x20)
+      return false;
+    if (c == '\\') {
+      if (++p == e)
+        return false;
+      switch (*p) {
+        case '"': case '\\': case '/':
+        case 'b': case 'f': case 'n': case 'r': case 't':
+          break;
+        case 'u':
+          if (e - p < 5 || hex_value(p[1]) < 0 || hex_value(p[2]) < 0
+              || hex_value(p[3]) < 0 || hex_value(p[4]) < 0)
+            return false;
+          p += 4;
+          break;
+        default:
+          return false;
+      }
+    }
+    p++;
+  }
+  *end = p;
+  t->buf = p + 1;
+  return true;
+}
+
+int count_lines(char * begin, char * end) {
+  int n = 0;
+  for (; begin < end; begin++)
+    if (*begin == '\n')
+      n++;
+  return n;
+}
+
+static char * scan_digits(char * p, char * e) {
+  while (p < e && '0' <= *p && *p <= '9')
+    p++;
+  return p;
+}
+
+bool scan_number(struct tokenizer * t) {
+  char * p = t->buf, * e = t->buf_end, * q;
+  if (p < e && *p == '-')
+    p++;
+  if (p < e && *p == '0')
+    p++;
+  else if ((q = scan_digits(p, e)) != p)
+    p = q;
+  else
+    return false;
+  if (p < e && *p == '.') {
+    q = scan_digits(p + 1, e);
+    if (q == p + 1)
+      return false;
+    p = q;
+  }
+  if (p < e && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < e && (*p == '+' || *p == '-'))
+      p++;
+    q = scan_digits(p, e);
+    if (q == p)
+      return false;
+    p = q;
+  }
+  t->buf = p;
+  return true;
+}
+
+bool string_equals(char * begin, char * end, char * key) {
+  char * p = begin;
+  unsigned char * k = (unsigned char *)key;
+  while (p < end) {
+    char c = *p++;
+    if (c != '\\') {
+      if (*k++ != (unsigned char)c)
+        return false;
+      continue;
+    }
+    switch (c = *p++) {
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'u':
+        {
+          uint32_t x = (hex_value(p[0]) << 12) | (hex_value(p[1]) << 8)
+                     | (hex_value(p[2]) << 4) | hex_value(p[3]);
+          struct utf8_seq s = {};
+          unsigned i;
+          p += 4;
+          utf8_encode(x, &s);
+          for (i = 0; i < s.len; i++)
+            if (*k++ != (unsigned char)s.c[i])
+              return false;
+          continue;
+        }
+      default:
+        break;
+    }
+    if (*k++ != (unsigned char)c)
+      return false;
+  }
+  return *k == '\0';
+}
+
+/*
+ * move over true, false, null or a number, it has to end where a value
+ * can end
+ */
+static bool skip_literal(struct tokenizer * t) {
+  char * p = t->buf, * e = t->buf_end;
+  const char * word = NULL;
+  switch (*p) {
+    case 't': word = "true"; break;
+    case 'f': word = "false"; break;
+    case 'n': word = "null"; break;
+    default:
+      if (!scan_number(t))
+        return false;
+  }
+  if (word) {
+    size_t n = strlen(word);
+    if ((size_t)(e - p) < n || memcmp(p, word, n))
+      return false;
+    t->buf += n;
+  }
+  if (t->buf == e)
+    return true;
+  switch (t->buf[0]) {
+    case ',': case ']': case '}': case '/':
+    case ' ': case '\t': case '\r': case '\n':
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * skip until the container opened by open and the ones nested in it
+ * have been closed, each by the bracket of its kind. Strings, literals
+ * and comments are checked, the placement of ',' and ':' is not.
+ */
+static bool skip_nested(struct tokenizer * t, char open) {
+  char frames[MAX_JSON_DEPTH];   // '[' or '{', the closing bracket is 2 above
+  int depth = 0;
+  char * begin, * end;
+  frames[depth++] = open;
+  while (depth) {
+    int c = skip_space(t);
+    switch (c) {
+      case tock_eof:
+        return false;
+      case '"':
+        if (!scan_string(t, &begin, &end))
+          return false;
+        break;
+      case '[':
+      case '{':
+        if (depth == MAX_JSON_DEPTH)
+          return false;
+        frames[depth++] = c;
+        t->buf++;
+        break;
+      case ']':
+      case '}':
+        if (c != frames[--depth] + 2)
+          return false;
+        t->buf++;
+        break;
+      case ',':
+      case ':':
+        t->buf++;
+        break;
+      default:
+        if (!skip_literal(t))
+          return false;
+    }
+  }
+  return true;
+}
+
+bool skip_container(struct tokenizer * t, char open) {
+  return skip_nested(t, open);
+}
+
+bool skip_value(struct tokenizer * t) {
+  char * begin, * end;
+  int c = skip_space(t);
+  switch (c) {
+    case '"':
+      return scan_string(t, &begin, &end);
+    case '[':
+    case '{':
+      t->buf++;
+      return skip_nested(t, c);
+    case tock_eof:
+      return false;
+    default:
+      return skip_literal(t);
+  }
+}
   }
 }
\ No newline at end of file
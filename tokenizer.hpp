@@ -21,9 +21,58 @@ struct tokenizer {
   char * buf_end;
   str::data * str;
   double real;
+  bool utf8_checked;  // the whole input is known to be valid UTF-8
+  struct stats * stats; // the counters of parse, see stats.hpp
 };
 
 extern enum token next_token(state::data *, struct tokenizer * t);
+
+/*
+ * the scanning functions below move t->buf over the input without
+ * allocating anything, they keep t->line up to date
+ */
+
+/*
+ * skip whitespace and comments, return the next character without
+ * consuming it, or tock_eof at the end of the input
+ */
+extern int skip_space(struct tokenizer * t);
+
+/*
+ * t->buf points to the opening quote of a string, on success *begin and
+ * *end delimit its raw (still escaped) content and t->buf is moved past
+ * the closing quote. Escape sequences and control characters are
+ * checked, UTF-8 is not.
+ */
+extern bool scan_string(struct tokenizer * t, char ** begin, char ** end);
+
+/*
+ * the line number of end, counted from begin
+ */
+extern int count_lines(char * begin, char * end);
+
+/*
+ * move over a number that follows the JSON number grammar
+ */
+extern bool scan_number(struct tokenizer * t);
+
+/*
+ * compare the raw content of a string with a '\0' terminated key,
+ * escape sequences in the raw content are decoded on the fly
+ */
+extern bool string_equals(char * begin, char * end, char * key);
+
+/*
+ * skip one value, containers are skipped by matching brackets of the
+ * same kind, the literals in them are checked
+ */
+extern bool skip_value(struct tokenizer * t);
+
+/*
+ * skip the rest of the innermost open container, which was opened by
+ * open ('[' or '{'), up to and including its closing bracket
+ */
+extern bool skip_container(struct tokenizer * t, char open);
     
   }
 }
@@ -11,6 +11,13 @@
 #ifndef CEE_JSON_AMALGAMATION
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CEE_JSON_UTF8_SSSE3
+#ifndef CEE_JSON_AMALGAMATION
+#include <tmmintrin.h>
+#endif
 #endif
 
 static const uint32_t utf_illegal = 0xFFFFFFFFu;
@@ -154,6 +161,204 @@ static bool utf8_validate(char * p, char * e)
   return true;
 }
 
+/*
+ * return the first byte of [p, e) that does not start a valid UTF-8
+ * sequence, or e if the whole range is valid. ASCII is checked eight
+ * bytes at a time.
+ */
+static char * utf8_scan_scalar(char * p, char * e)
+{
+  while(p!=e) {
+    uint64_t w;
+    if(e-p >= 8) {
+      memcpy(&w, p, 8);
+      if(!(w & 0x8080808080808080ull)) {
+        p += 8;
+        continue;
+      }
+    }
+    char * q = p;
+    if(next(&p, e, false)==utf_illegal)
+      return q;
+  }
+  return e;
+}
+
+/*
+ * an error was found in the block at, the windows that end before it are
+ * valid. Find the error with the scalar scan, starting with the sequence
+ * of the last 3 bytes in front of the block, whose lead may be invalid.
+ */
+static char * utf8_rescan(char * begin, char * at, char * e)
+{
+  int back = 0;
+  at = at - begin > 3 ? at - 3 : begin;
+  while (at > begin && back < 3 && utf8_is_trail(at[0])) {
+    at--;
+    back++;
+  }
+  return utf8_scan_scalar(at, e);
+}
+
+#ifdef CEE_JSON_UTF8_SSSE3
+/*
+ * the lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". Three table lookups on the nibbles of
+ * each byte and its predecessor classify every error of a 2 byte window,
+ * the 3 and 4 byte sequences are checked by where the continuation bytes
+ * must be. The input is read in blocks of 64 bytes, a block of ASCII
+ * costs one test.
+ */
+#define UTF8_TOO_SHORT   (1<<0)
+#define UTF8_TOO_LONG    (1<<1)
+#define UTF8_OVERLONG_3  (1<<2)
+#define UTF8_TOO_LARGE   (1<<3)
+#define UTF8_SURROGATE   (1<<4)
+#define UTF8_OVERLONG_2  (1<<5)
+#define UTF8_TOO_LARGE_1000 (1<<6)
+#define UTF8_OVERLONG_4  (1<<6)
+#define UTF8_TWO_CONTS   (1<<7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i utf8_check_block(__m128i input, __m128i prev_input)
+{
+  const __m128i byte_1_high_table = _mm_setr_epi8(
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+  const __m128i byte_1_low_table = _mm_setr_epi8(
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+  const __m128i byte_2_high_table = _mm_setr_epi8(
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+      | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+      | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table,
+                          _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table,
+                          _mm_and_si128(prev1, nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table,
+                          _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                  byte_2_high);
+
+  /*
+   * the third and fourth bytes of a sequence must be continuations,
+   * a 2 byte window marks them as TWO_CONTS
+   */
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+  __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+  __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth),
+                                 _mm_set1_epi8((char)0x80));
+  return _mm_xor_si128(must23, special);
+}
+
+/*
+ * the bytes at the end of a block that start a sequence which does not
+ * fit into it
+ */
+__attribute__((target("ssse3")))
+static __m128i utf8_is_incomplete(__m128i input)
+{
+  const __m128i max_value = _mm_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+  return _mm_subs_epu8(input, max_value);
+}
+
+__attribute__((target("ssse3")))
+static char * utf8_scan_ssse3(char * p, char * e)
+{
+  char * begin = p;
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+  char tail[64];
+  while (p != e) {
+    __m128i in[4];
+    int i;
+    char * block = p;
+    if (e - p >= 64) {
+      for (i = 0; i < 4; i++)
+        in[i] = _mm_loadu_si128((__m128i *)(p + 16 * i));
+      p += 64;
+    }
+    else {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, e - p);
+      for (i = 0; i < 4; i++)
+        in[i] = _mm_loadu_si128((__m128i *)(tail + 16 * i));
+      p = e;
+    }
+    __m128i any = _mm_or_si128(_mm_or_si128(in[0], in[1]),
+                               _mm_or_si128(in[2], in[3]));
+    if (_mm_movemask_epi8(any) == 0) {
+      error = _mm_or_si128(error, prev_incomplete);
+    }
+    else {
+      error = _mm_or_si128(error, utf8_check_block(in[0], prev_input));
+      for (i = 1; i < 4; i++)
+        error = _mm_or_si128(error, utf8_check_block(in[i], in[i-1]));
+      prev_incomplete = utf8_is_incomplete(in[3]);
+      prev_input = in[3];
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) {
+      return utf8_rescan(begin, block, e);
+    }
+    if (_mm_movemask_epi8(any) == 0)
+      prev_incomplete = prev_input = _mm_setzero_si128();
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(prev_incomplete, _mm_setzero_si128())) != 0xFFFF)
+    return utf8_rescan(begin, e, e);
+  return e;
+}
+#endif
+
+/*
+ * return the first byte of [p, e) that does not start a valid UTF-8
+ * sequence, or e if the whole range is valid. Checking a whole input
+ * once makes the validation of each decoded string unnecessary.
+ */
+static char * utf8_scan(char * p, char * e)
+{
+#ifdef CEE_JSON_UTF8_SSSE3
+  if (__builtin_cpu_supports("ssse3"))
+    return utf8_scan_ssse3(p, e);
+#endif
+  return utf8_scan_scalar(p, e);
+}
 
 struct utf8_seq {
   char c[4];
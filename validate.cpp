@@ -0,0 +1,158 @@
+/* Validate-only mode
+ */
+#ifndef CEE_JSON_AMALGAMATION
+#include "json.hpp"
+#include "cee.hpp"
+#include "tokenizer.hpp"
+#include "utf8.h"
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace cee {
+  namespace json {
+
+/*
+ * scan a string, the input has been checked for UTF-8 already. Like
+ * parse_string, a \u escape of a surrogate is refused.
+ */
+static bool check_string(struct tokenizer * t)
+{
+  char * begin, * end, * p;
+  if (!scan_string(t, &begin, &end))
+    return false;
+  for (p = begin; p < end; p++) {
+    if (*p != '\\')
+      continue;
+    if (*++p != 'u')
+      continue;
+    unsigned x = 0;
+    int i;
+    for (i = 1; i < 5; i++)
+      x = x * 16 + (p[i] <= '9' ? p[i] - '0' : (p[i] | 0x20) - 'a' + 10);
+    if (0xD800 <= x && x <= 0xDFFF) {
+      t->buf = p - 1;
+      return false;
+    }
+    p += 4;
+  }
+  return true;
+}
+
+static bool check_literal(struct tokenizer * t, char * s, size_t n)
+{
+  if ((size_t)(t->buf_end - t->buf) < n || memcmp(t->buf, s, n))
+    return false;
+  t->buf += n;
+  return true;
+}
+
+/*
+ * the same states as parse_e, each one only moves over the input.
+ * The kind of each open container is kept in a byte array, nothing is
+ * decoded or allocated. Separators are stricter than in parse, a comma
+ * before a closing bracket is an error. UTF-8 is checked for the whole
+ * input before, the first error in the text is reported.
+ */
+bool validate(char * buf, uintptr_t len, uintptr_t * error_at, int * error_at_line)
+{
+  struct tokenizer tock = {};
+  tock.buf = buf;
+  tock.buf_end = buf + len;
+
+  char frames[MAX_JSON_DEPTH];   // '[' or '{', the closing bracket is 2 above
+  int depth = 0;
+  int c;
+  char * bad = utf8_scan(buf, tock.buf_end);
+
+st_value_expected:
+  switch (skip_space(&tock)) {
+    case '[':
+    case '{':
+      if (depth == MAX_JSON_DEPTH)
+        goto st_error;
+      c = *tock.buf++;
+      frames[depth++] = c;
+      if (skip_space(&tock) == c + 2) {
+        tock.buf++;
+        goto st_close;
+      }
+      if (c == '[')
+        goto st_value_expected;
+      goto st_key_expected;
+    case '"':
+      if (!check_string(&tock))
+        goto st_error;
+      break;
+    case 't':
+      if (!check_literal(&tock, "true", 4))
+        goto st_error;
+      break;
+    case 'f':
+      if (!check_literal(&tock, "false", 5))
+        goto st_error;
+      break;
+    case 'n':
+      if (!check_literal(&tock, "null", 4))
+        goto st_error;
+      break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      if (!scan_number(&tock))
+        goto st_error;
+      break;
+    default:
+      goto st_error;
+  }
+  goto st_close_or_comma_expected;
+
+st_key_expected:
+  if (skip_space(&tock) != '"' || !check_string(&tock))
+    goto st_error;
+  if (skip_space(&tock) != ':')
+    goto st_error;
+  tock.buf++;
+  goto st_value_expected;
+
+st_close:
+  depth--;
+st_close_or_comma_expected:
+  if (depth == 0)
+    goto st_done;
+  c = skip_space(&tock);
+  if (c == ',') {
+    tock.buf++;
+    if (frames[depth-1] == '{')
+      goto st_key_expected;
+    goto st_value_expected;
+  }
+  if (c == frames[depth-1] + 2) {
+    tock.buf++;
+    goto st_close;
+  }
+  goto st_error;
+
+st_done:
+  skip_space(&tock);
+  if (tock.buf != tock.buf_end)
+    goto st_error;
+  if (bad != tock.buf_end)
+    goto st_bad_utf8;
+  return true;
+
+st_error:
+  if (bad < tock.buf)
+    goto st_bad_utf8;
+  *error_at = tock.buf - buf;
+  *error_at_line = tock.line;
+  return false;
+
+st_bad_utf8:
+  *error_at = bad - buf;
+  *error_at_line = count_lines(buf, bad);
+  return false;
+}
+
+  }
+}
@@ -67,6 +67,26 @@ boxed::data * to_number (json::data * p) {
     return NULL;
 }
 
+double to_double (json::data * p) {
+  boxed::data * x = to_number(p);
+  if (!x)
+    segfault();
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64: return x->_.f64;
+    case boxed::primitive_f32: return x->_.f32;
+    case boxed::primitive_u64: return x->_.u64;
+    case boxed::primitive_u32: return x->_.u32;
+    case boxed::primitive_u16: return x->_.u16;
+    case boxed::primitive_u8:  return x->_.u8;
+    case boxed::primitive_i64: return x->_.i64;
+    case boxed::primitive_i32: return x->_.i32;
+    case boxed::primitive_i16: return x->_.i16;
+    case boxed::primitive_i8:  return x->_.i8;
+  }
+  segfault();
+  return 0;
+}
+
 bool to_bool (json::data * p) {
   switch(p->t) {
     case type_is_null:
@@ -111,6 +131,112 @@ json::data * mk_object(state::data * st) {
   return (data *)t;
 }
 
+json::data * mk_stats (state::data * st, struct state::stats * s) {
+  json::data * j = mk_object(st), * types = mk_object(st);
+  unsigned i;
+  object_set_number(st, j, "live_bytes", s->live_bytes);
+  object_set_number(st, j, "peak_bytes", s->peak_bytes);
+  object_set_number(st, j, "allocs", s->n_allocs);
+  object_set_number(st, j, "live", s->n_live);
+  for (i = 0; i < state::max_types; i++)
+    if (state::type_name(i) && s->n_live_by_type[i])
+      object_set_number(st, types, (char *)state::type_name(i),
+                        s->n_live_by_type[i]);
+  object_set(st, j, "live_by_type", types);
+  return j;
+}
+
+static boxed::data * clone_number (state::data * st, boxed::data * x) {
+  switch (boxed::type(x)) {
+    case boxed::primitive_f64: return boxed::from_double(st, x->_.f64);
+    case boxed::primitive_f32: return boxed::from_float(st, x->_.f32);
+    case boxed::primitive_u64: return boxed::from_u64(st, x->_.u64);
+    case boxed::primitive_u32: return boxed::from_u32(st, x->_.u32);
+    case boxed::primitive_u16: return boxed::from_u16(st, x->_.u16);
+    case boxed::primitive_u8:  return boxed::from_u8(st, x->_.u8);
+    case boxed::primitive_i64: return boxed::from_i64(st, x->_.i64);
+    case boxed::primitive_i32: return boxed::from_i32(st, x->_.i32);
+    case boxed::primitive_i16: return boxed::from_i16(st, x->_.i16);
+    case boxed::primitive_i8:  return boxed::from_i8(st, x->_.i8);
+  }
+  segfault();
+}
+
+struct clone_cxt {
+  state::data * st;
+  map::data * object;
+};
+
+static void clone_member (void * cxt, void * key, void * value) {
+  struct clone_cxt * c = (struct clone_cxt *)cxt;
+  map::add(c->object, str::mk(c->st, "%s", (char *)key),
+           clone(c->st, (json::data *)value));
+}
+
+json::data * clone (state::data * st, json::data * j) {
+  json::data * r;
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+    case type_is_boolean:
+      return j;
+    case type_is_number:
+      return (json::data *)tagged::mk(st, type_is_number,
+                                      clone_number(st, j->value.number));
+    case type_is_string:
+      return mk_string(st, str::mk(st, "%s", (char *)j->value.string));
+    case type_is_array:
+      n = list::size(j->value.array);
+      r = mk_array(st, n);
+      for (i = 0; i < n; i++)
+        list::append(&r->value.array,
+                     clone(st, (json::data *)j->value.array->_[i]));
+      return r;
+    case type_is_object:
+      {
+        struct clone_cxt c = { st, NULL };
+        r = mk_object(st);
+        c.object = r->value.object;
+        map::walk(j->value.object, &c, clone_member);
+        return r;
+      }
+  }
+  segfault();
+}
+
+static void share_member (void *, void * key, void * value) {
+  cee::share(key);
+  share((json::data *)value);
+}
+
+void share (json::data * j) {
+  uintptr_t i, n;
+  switch (j->t) {
+    case type_is_undefined:
+    case type_is_null:
+    case type_is_boolean:
+      return;
+    case type_is_number:
+      cee::share(j->value.number);
+      break;
+    case type_is_string:
+      cee::share(j->value.string);
+      break;
+    case type_is_array:
+      n = list::size(j->value.array);
+      for (i = 0; i < n; i++)
+        share((json::data *)j->value.array->_[i]);
+      cee::share(j->value.array);
+      break;
+    case type_is_object:
+      map::walk(j->value.object, NULL, share_member);
+      cee::share(j->value.object);
+      break;
+  }
+  cee::share(j);
+}
+
 void object_set(state::data * st, json::data * j, char * key, json::data * v) {
   map::data * o = to_object(j);
   if (!o) 
@@ -139,25 +265,25 @@ void object_set_number (state::data * st, json::data * j, char * key, double rea
   map::add(o, str::mk(st, "%s", key), mk_number(st, real));
 }
 
-void array_append (json::data * j, json::data *v) {
-  list::data * o = to_array(j);
-  if (!o) 
+/*
+ * append through the pointer held by j, the list moves when it grows
+ */
+void array_append (state::data *, json::data * j, json::data *v) {
+  if (!to_array(j))
     segfault();
-  list::append(&o, v);
+  list::append(&j->value.array, v);
 }
 
 void array_append_bool (state::data * st, json::data * j, bool b) {
-  list::data * o = to_array(j);
-  if (!o) 
-    segfault();
-  list::append(&o, mk_bool(st, b));
+  array_append(st, j, mk_bool(st, b));
 }
 
 void array_append_string (state::data * st, json::data * j, char * x) {
-  list::data * o = to_array(j);
-  if (!o) 
-    segfault();
-  list::append(&o, mk_string(st, str::mk(st, "%s", x)));
+  array_append(st, j, mk_string(st, str::mk(st, "%s", x)));
+}
+
+void array_append_number (state::data * st, json::data * j, double real) {
+  array_append(st, j, mk_number(st, real));
 }
 
 /*